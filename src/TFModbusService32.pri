@@ -0,0 +1,77 @@
+# 服务的源文件，主程序和tests下的测试共用
+QT += serialport serialbus network
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+        $$PWD/modbusservice.cpp \
+        $$PWD/protocoljson.cpp \
+        $$PWD/pollplanner.cpp \
+        $$PWD/signalcodec.cpp \
+        $$PWD/requestscheduler.cpp \
+        $$PWD/rtutiming.cpp \
+        $$PWD/rttestimator.cpp \
+        $$PWD/busmanager.cpp \
+        $$PWD/modbusengine.cpp \
+        $$PWD/modbustcpengine.cpp \
+        $$PWD/modbusrtuengine.cpp \
+        $$PWD/modbusproxyserver.cpp \
+        $$PWD/signalapiserver.cpp \
+        $$PWD/asynclogger.cpp \
+        $$PWD/metricsexporter.cpp \
+        $$PWD/realtimemode.cpp \
+        $$PWD/cycletimer.cpp \
+        $$PWD/scripthost.cpp \
+        $$PWD/derivedsignalengine.cpp \
+        $$PWD/alarmengine.cpp \
+        $$PWD/signalaggregator.cpp \
+        $$PWD/burstsampler.cpp
+
+# qmake CONFIG+=alloc_counter: 按线程统计堆分配次数，验证实时模式稳态周期零分配，仅glibc
+alloc_counter {
+    DEFINES += MODBUS_ALLOC_COUNTER
+}
+
+# qmake CONFIG+=coroutines: 协程采集脚本，需支持C++20协程的编译器，脚本按链路节Scripts启用
+coroutines {
+    CONFIG -= c++11
+    CONFIG += c++2a
+    SOURCES += $$PWD/heartbeatscript.cpp
+    HEADERS += $$PWD/scripttask.h
+}
+
+# 采集器模式使用epoll/timerfd，仅Linux
+linux {
+    SOURCES += \
+        $$PWD/collector.cpp \
+        $$PWD/collectorworker.cpp
+    HEADERS += \
+        $$PWD/collector.h \
+        $$PWD/collectorworker.h
+}
+
+HEADERS += \
+    $$PWD/commondefine.h \
+    $$PWD/modbusservice.h \
+    $$PWD/protocoljson.h \
+    $$PWD/pollplanner.h \
+    $$PWD/signalcodec.h \
+    $$PWD/requestscheduler.h \
+    $$PWD/rtutiming.h \
+    $$PWD/rttestimator.h \
+    $$PWD/busmanager.h \
+    $$PWD/modbusengine.h \
+    $$PWD/modbustcpengine.h \
+    $$PWD/modbusrtuengine.h \
+    $$PWD/modbusproxyserver.h \
+    $$PWD/signalapiserver.h \
+    $$PWD/asynclogger.h \
+    $$PWD/metricsexporter.h \
+    $$PWD/realtimemode.h \
+    $$PWD/cycletimer.h \
+    $$PWD/scripthost.h \
+    $$PWD/derivedsignalengine.h \
+    $$PWD/alarmengine.h \
+    $$PWD/signalaggregator.h \
+    $$PWD/burstsampler.h \
+    $$PWD/modbusframe.h
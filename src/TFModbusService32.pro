@@ -1,5 +1,4 @@
 QT -= gui
-QT += serialport serialbus
 
 CONFIG += c++11 console
 CONFIG -= app_bundle
@@ -16,17 +15,12 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(TFModbusService32.pri)
+
 SOURCES += \
-        modbusservice.cpp \
-        protocoljson.cpp \
         main.cpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
-
-HEADERS += \
-    commondefine.h \
-    modbusservice.h \
-    protocoljson.h
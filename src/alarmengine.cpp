@@ -0,0 +1,214 @@
+﻿#include "alarmengine.h"
+#include <math.h>
+
+AlarmEngine::AlarmEngine()
+{
+
+}
+
+void AlarmEngine::clear()
+{
+    m_alarmList.clear();
+    m_edgeStart.clear();
+    m_edgeList.clear();
+    m_pendingList.clear();
+    m_eventList.clear();
+}
+
+void AlarmEngine::addAlarm(const AlarmDef &alarmDef, int iSignalIndex)
+{
+    AlarmState state;
+    state.alarmDef = alarmDef;
+    state.iSignalIndex = iSignalIndex;
+    state.bActive = false;
+    state.bPending = false;
+    state.iConditionNs = 0;
+    state.dConditionValue = 0;
+    resetSignalRate(state.rate);
+    m_alarmList.append(state);
+}
+
+void AlarmEngine::finalize(int iSignalCount)
+{
+    m_edgeStart.fill(0, iSignalCount + 1);
+    for(int i=0; i<m_alarmList.size(); i++)
+        m_edgeStart[m_alarmList.at(i).iSignalIndex + 1]++;
+    for(int i=0; i<iSignalCount; i++)
+        m_edgeStart[i + 1] += m_edgeStart.at(i);
+
+    m_edgeList.resize(m_alarmList.size());
+    QVector<int> fillList = m_edgeStart;
+    for(int i=0; i<m_alarmList.size(); i++)
+        m_edgeList[fillList[m_alarmList.at(i).iSignalIndex]++] = i;
+
+    //每个告警一次计算最多产生一个事件
+    m_pendingList.reserve(m_alarmList.size());
+    m_eventList.reserve(m_alarmList.size() * 2);
+}
+
+int AlarmEngine::getAlarmCount() const
+{
+    return m_alarmList.size();
+}
+
+const AlarmDef &AlarmEngine::getAlarmDef(int iAlarm) const
+{
+    return m_alarmList.at(iAlarm).alarmDef;
+}
+
+int AlarmEngine::getSignalIndex(int iAlarm) const
+{
+    return m_alarmList.at(iAlarm).iSignalIndex;
+}
+
+bool AlarmEngine::isActive(int iAlarm) const
+{
+    return m_alarmList.at(iAlarm).bActive;
+}
+
+void AlarmEngine::markInput(int iSignalIndex, bool bChanged)
+{
+    int iEnd = m_edgeStart.at(iSignalIndex + 1);
+    for(int i=m_edgeStart.at(iSignalIndex); i<iEnd; i++)
+    {
+        AlarmState &state = m_alarmList[m_edgeList.at(i)];
+        if(state.bPending || (!bChanged && state.alarmDef.iKind != Alarm_Rate))
+            continue;
+        state.bPending = true;
+        m_pendingList.append(m_edgeList.at(i));
+    }
+}
+
+bool AlarmEngine::hasPending() const
+{
+    return !m_pendingList.isEmpty();
+}
+
+void AlarmEngine::evaluate(const QVector<SignalParameter> &signalList)
+{
+    for(int i=0; i<m_pendingList.size(); i++)
+    {
+        int iAlarm = m_pendingList.at(i);
+        m_alarmList[iAlarm].bPending = false;
+        evaluateAlarm(iAlarm, signalList.at(m_alarmList.at(iAlarm).iSignalIndex));
+    }
+    m_pendingList.resize(0);
+}
+
+void AlarmEngine::evaluateAlarm(int iAlarm, const SignalParameter &signalParam)
+{
+    AlarmState &state = m_alarmList[iAlarm];
+    const AlarmDef &alarmDef = state.alarmDef;
+    if(signalParam.uQuality != Quality_Good)
+    {
+        state.iConditionNs = 0;
+        return;
+    }
+
+    double dValue = signalParam.dValue;
+    if(alarmDef.iKind == Alarm_Rate)
+        dValue = updateSignalRate(state.rate, signalParam);
+
+    //bRaise: 产生条件 bHold: 已告警时保持的条件，含回差
+    bool bRaise = false;
+    bool bHold = false;
+    switch(alarmDef.iKind)
+    {
+    case Alarm_High:
+        bRaise = dValue > alarmDef.dLimit;
+        bHold = dValue > alarmDef.dLimit - alarmDef.dDeadband;
+        break;
+    case Alarm_Low:
+        bRaise = dValue < alarmDef.dLimit;
+        bHold = dValue < alarmDef.dLimit + alarmDef.dDeadband;
+        break;
+    case Alarm_Rate:
+        bRaise = fabs(dValue) > alarmDef.dLimit;
+        bHold = fabs(dValue) > alarmDef.dLimit - alarmDef.dDeadband;
+        break;
+    case Alarm_Equal:
+        bRaise = bHold = dValue == alarmDef.dLimit;
+        break;
+    default:
+        bRaise = bHold = dValue != alarmDef.dLimit;
+        break;
+    }
+
+    if(state.bActive)
+    {
+        if(!bHold)
+        {
+            state.bActive = false;
+            appendEvent(iAlarm, false, dValue, signalParam.iAcqTimeMs);
+        }
+        return;
+    }
+    if(!bRaise)
+    {
+        state.iConditionNs = 0;
+        return;
+    }
+    if(state.iConditionNs == 0)
+        state.iConditionNs = signalParam.iAcqMonoNs;
+    state.dConditionValue = dValue;
+    if(signalParam.iAcqMonoNs - state.iConditionNs >= alarmDef.iDelayMs * 1000000LL)
+    {
+        state.bActive = true;
+        state.iConditionNs = 0;
+        appendEvent(iAlarm, true, dValue, signalParam.iAcqTimeMs);
+    }
+}
+
+void AlarmEngine::checkDelays(const QVector<SignalParameter> &signalList, qint64 iNowNs, qint64 iWallOffsetMs)
+{
+    for(int i=0; i<m_alarmList.size(); i++)
+    {
+        AlarmState &state = m_alarmList[i];
+        if(state.bActive || state.iConditionNs == 0)
+            continue;
+        qint64 iDeadlineNs = state.iConditionNs + state.alarmDef.iDelayMs * 1000000LL;
+        if(iDeadlineNs > iNowNs)
+            continue;
+        //延时期间质量变坏的不告警
+        state.iConditionNs = 0;
+        if(signalList.at(state.iSignalIndex).uQuality != Quality_Good)
+            continue;
+        state.bActive = true;
+        appendEvent(i, true, state.dConditionValue, iDeadlineNs / 1000000 + iWallOffsetMs);
+    }
+}
+
+qint64 AlarmEngine::nextDeadlineNs() const
+{
+    qint64 iNextNs = 0;
+    for(int i=0; i<m_alarmList.size(); i++)
+    {
+        const AlarmState &state = m_alarmList.at(i);
+        if(state.bActive || state.iConditionNs == 0)
+            continue;
+        qint64 iDeadlineNs = state.iConditionNs + state.alarmDef.iDelayMs * 1000000LL;
+        if(iNextNs == 0 || iDeadlineNs < iNextNs)
+            iNextNs = iDeadlineNs;
+    }
+    return iNextNs;
+}
+
+const QVector<AlarmEvent> &AlarmEngine::getEventList() const
+{
+    return m_eventList;
+}
+
+void AlarmEngine::clearEvents()
+{
+    m_eventList.resize(0);
+}
+
+void AlarmEngine::appendEvent(int iAlarm, bool bActive, double dValue, qint64 iTimeMs)
+{
+    AlarmEvent alarmEvent;
+    alarmEvent.iAlarm = iAlarm;
+    alarmEvent.bActive = bActive;
+    alarmEvent.dValue = dValue;
+    alarmEvent.iTimeMs = iTimeMs;
+    m_eventList.append(alarmEvent);
+}
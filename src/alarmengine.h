@@ -0,0 +1,77 @@
+﻿#ifndef ALARMENGINE_H
+#define ALARMENGINE_H
+
+#include <QVector>
+#include "commondefine.h"
+
+//告警产生或恢复
+struct AlarmEvent
+{
+    int iAlarm;                     //告警序号，即加入的顺序
+    bool bActive;                   //true产生 false恢复
+    double dValue;                  //触发时信号的工程值，Rate为每秒变化量
+    qint64 iTimeMs;                 //触发时间，自1970年起的ms
+};
+
+/* 信号告警，只在所监视的信号读回后计算，事件累积到取走为止
+ * 产生条件持续iDelayMs后告警，期间没有新读回时由定时检查补上；恢复不延时
+ * 信号质量不是GOOD时不计算，告警保持原状态，未到时的延时作废
+*/
+class AlarmEngine
+{
+public:
+    AlarmEngine();
+
+    void clear();
+    //iSignalIndex: 监视的信号在信号表中的下标
+    void addAlarm(const AlarmDef &alarmDef, int iSignalIndex);
+    //全部添加后按信号下标生成索引
+    void finalize(int iSignalCount);
+    int getAlarmCount() const;
+    const AlarmDef &getAlarmDef(int iAlarm) const;
+    int getSignalIndex(int iAlarm) const;
+    bool isActive(int iAlarm) const;
+
+    //信号是否有告警
+    inline bool hasAlarms(int iSignalIndex) const
+    {
+        return iSignalIndex < m_edgeStart.size() - 1 && m_edgeStart.at(iSignalIndex) != m_edgeStart.at(iSignalIndex + 1);
+    }
+    /* 信号读回后调用，监视它的告警置为待计算
+     * bChanged: 值改变；未改变时只有Rate告警需要重算
+    */
+    void markInput(int iSignalIndex, bool bChanged);
+    bool hasPending() const;
+    void evaluate(const QVector<SignalParameter> &signalList);
+    //延时到期的告警，iWallOffsetMs为系统时间减单调时钟ms
+    void checkDelays(const QVector<SignalParameter> &signalList, qint64 iNowNs, qint64 iWallOffsetMs);
+    //最近的延时到期时间，单调时钟ns，没有时为0
+    qint64 nextDeadlineNs() const;
+
+    const QVector<AlarmEvent> &getEventList() const;
+    void clearEvents();
+
+private:
+    struct AlarmState
+    {
+        AlarmDef alarmDef;
+        int iSignalIndex;
+        bool bActive;
+        bool bPending;
+        qint64 iConditionNs;        //产生条件开始成立的读回时间，未成立为0
+        double dConditionValue;     //条件成立时的值
+        SignalRate rate;            //Rate: 每秒变化量
+    };
+
+    void evaluateAlarm(int iAlarm, const SignalParameter &signalParam);
+    void appendEvent(int iAlarm, bool bActive, double dValue, qint64 iTimeMs);
+
+private:
+    QVector<AlarmState> m_alarmList;
+    QVector<int> m_edgeStart;           //按信号下标的告警起点，长度为信号数+1
+    QVector<int> m_edgeList;            //告警序号
+    QVector<int> m_pendingList;         //容量在finalize时预留
+    QVector<AlarmEvent> m_eventList;
+};
+
+#endif // ALARMENGINE_H
@@ -0,0 +1,246 @@
+﻿#include "asynclogger.h"
+#include "commondefine.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <stdio.h>
+#include <string.h>
+
+AsyncLogger *AsyncLogger::instance()
+{
+    static AsyncLogger logger;
+    return &logger;
+}
+
+AsyncLogger::AsyncLogger() : QThread(nullptr),
+    m_enqueuePos(0),
+    m_dequeuePos(0),
+    m_droppedCount(0),
+    m_maxLinesPerSec(2000),
+    m_windowStartMs(0),
+    m_windowLines(0),
+    m_suppressedLines(0),
+    m_reportedDropped(0)
+{
+    //槽位序号等于下标表示可写，等于下标+1表示可读
+    for(int i=0; i<Capacity; i++)
+        m_cells[i].uSequence.storeRelease(i);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    //退出前写出队列中剩余的记录
+    requestInterruption();
+    wait();
+}
+
+void AsyncLogger::setMaxLinesPerSec(int iMaxLinesPerSec)
+{
+    m_maxLinesPerSec.storeRelease(iMaxLinesPerSec > 0 ? iMaxLinesPerSec : 0);
+}
+
+int AsyncLogger::registerSource(const QString &strName, const QVector<LogRowFormat> &signalRows, const QVector<LogRowFormat> &registerRows,
+                                const QVector<LogRowFormat> &alarmRows, const QVector<LogRowFormat> &edgeRows)
+{
+    int iSource = 0;
+    {
+        QMutexLocker locker(&m_sourceMutex);
+        LogSource source;
+        source.name = strName.toUtf8();
+        source.signalRows = signalRows;
+        source.registerRows = registerRows;
+        source.alarmRows = alarmRows;
+        source.edgeRows = edgeRows;
+        m_sourceList.append(source);
+        iSource = m_sourceList.size() - 1;
+    }
+    if(!isRunning())
+        start(QThread::LowPriority);
+    return iSource;
+}
+
+bool AsyncLogger::push(const LogRecord &record)
+{
+    quint32 uPos = m_enqueuePos.loadAcquire();
+    while(true)
+    {
+        LogCell &cell = m_cells[uPos & (Capacity - 1)];
+        qint32 iDiff = (qint32)(cell.uSequence.loadAcquire() - uPos);
+        if(iDiff == 0)
+        {
+            //抢到槽位后写入记录，再发布序号
+            if(m_enqueuePos.testAndSetRelaxed(uPos, uPos + 1))
+            {
+                cell.record = record;
+                cell.uSequence.storeRelease(uPos + 1);
+                return true;
+            }
+            uPos = m_enqueuePos.loadAcquire();
+        }
+        else if(iDiff < 0)
+        {
+            //写线程未跟上，丢弃
+            m_droppedCount.fetchAndAddRelaxed(1);
+            return false;
+        }
+        else
+        {
+            uPos = m_enqueuePos.loadAcquire();
+        }
+    }
+}
+
+bool AsyncLogger::pop(LogRecord &record)
+{
+    LogCell &cell = m_cells[m_dequeuePos & (Capacity - 1)];
+    if((qint32)(cell.uSequence.loadAcquire() - (m_dequeuePos + 1)) < 0)
+        return false;
+    record = cell.record;
+    cell.uSequence.storeRelease(m_dequeuePos + Capacity);
+    m_dequeuePos++;
+    return true;
+}
+
+void AsyncLogger::run()
+{
+    while(!isInterruptionRequested())
+    {
+        if(drain() == 0)
+            msleep(20);
+    }
+    drain();
+}
+
+int AsyncLogger::drain()
+{
+    qint64 iNowMs = QDateTime::currentMSecsSinceEpoch();
+    flushSuppressed(iNowMs);
+
+    int iMaxLines = m_maxLinesPerSec.loadAcquire();
+    char outBuffer[16384];
+    int iOutLength = 0;
+    char line[1024];
+    int iLines = 0;
+    LogRecord record;
+
+    QMutexLocker locker(&m_sourceMutex);
+    while(pop(record))
+    {
+        if(iMaxLines > 0 && m_windowLines >= iMaxLines)
+        {
+            m_suppressedLines++;
+            continue;
+        }
+
+        int iLength = formatRecord(record, line, sizeof(line));
+        if(iLength <= 0)
+            continue;
+        if(iOutLength + iLength > (int)sizeof(outBuffer))
+        {
+            fwrite(outBuffer, 1, iOutLength, stderr);
+            iOutLength = 0;
+        }
+        memcpy(outBuffer + iOutLength, line, iLength);
+        iOutLength += iLength;
+        m_windowLines++;
+        iLines++;
+    }
+    locker.unlock();
+
+    if(iOutLength > 0)
+    {
+        fwrite(outBuffer, 1, iOutLength, stderr);
+        fflush(stderr);
+    }
+    return iLines;
+}
+
+int AsyncLogger::formatRecord(const LogRecord &record, char *pLine, int iSize)
+{
+    if(record.iSource < 0 || record.iSource >= m_sourceList.size())
+        return 0;
+    const LogSource &source = m_sourceList.at(record.iSource);
+
+    int iLength = 0;
+    switch(record.iType)
+    {
+    case LogRecord_Separator:
+    {
+        const QByteArray strTime = QDateTime::fromMSecsSinceEpoch(record.iTimeMs).toString("hh:mm:ss.zzz").toLatin1();
+        iLength = snprintf(pLine, iSize, "========== [%s] %s ==========\n", source.name.constData(), strTime.constData());
+        break;
+    }
+    case LogRecord_Signal:
+    {
+        if(record.iRow < 0 || record.iRow >= source.signalRows.size())
+            return 0;
+        const LogRowFormat &row = source.signalRows.at(record.iRow);
+        if(record.uQuality == Quality_Good)
+            iLength = snprintf(pLine, iSize, "%s%10.10g%s\n", row.prefix.constData(), record.dValue, row.suffix.constData());
+        else if(record.uQuality == Quality_Exception)
+            iLength = snprintf(pLine, iSize, "%s%10.10g%s [EXCEPTION 0x%02x]\n", row.prefix.constData(), record.dValue, row.suffix.constData(), record.uExceptionCode);
+        else
+            iLength = snprintf(pLine, iSize, "%s%10.10g%s [%s]\n", row.prefix.constData(), record.dValue, row.suffix.constData(), signalQualityName(record.uQuality));
+        break;
+    }
+    case LogRecord_Register:
+    {
+        if(record.iRow < 0 || record.iRow >= source.registerRows.size())
+            return 0;
+        const LogRowFormat &row = source.registerRows.at(record.iRow);
+        iLength = snprintf(pLine, iSize, "%s%10llx%s\n", row.prefix.constData(), (unsigned long long)record.uValue, row.suffix.constData());
+        break;
+    }
+    case LogRecord_BusTime:
+        iLength = snprintf(pLine, iSize, "[%s] RTU bus time %llu us in %d ms cycle (%.1f%%)\n",
+                           source.name.constData(), (unsigned long long)record.uValue, record.iRow, record.dValue);
+        break;
+    case LogRecord_Overrun:
+        iLength = snprintf(pLine, iSize, "[%s] Poll cycle overrun, queue depth %d, total %llu\n",
+                           source.name.constData(), record.iRow, (unsigned long long)record.uValue);
+        break;
+    case LogRecord_Alarm:
+    {
+        if(record.iRow < 0 || record.iRow >= source.alarmRows.size())
+            return 0;
+        const LogRowFormat &row = source.alarmRows.at(record.iRow);
+        iLength = snprintf(pLine, iSize, "[%s] Alarm %s %s: %s=%g\n", source.name.constData(), row.prefix.constData(),
+                           record.uValue ? "raised" : "cleared", row.suffix.constData(), record.dValue);
+        break;
+    }
+    case LogRecord_Edge:
+    {
+        if(record.iRow < 0 || record.iRow >= source.edgeRows.size())
+            return 0;
+        const QByteArray strTime = QDateTime::fromMSecsSinceEpoch(record.iTimeMs).toString("hh:mm:ss.zzz").toLatin1();
+        iLength = snprintf(pLine, iSize, "[%s] Edge %s -> %g at %s\n", source.name.constData(),
+                           source.edgeRows.at(record.iRow).prefix.constData(), record.dValue, strTime.constData());
+        break;
+    }
+    case LogRecord_BurstEnd:
+        iLength = snprintf(pLine, iSize, "[%s] Burst: %llu reads in %d ms\n",
+                           source.name.constData(), (unsigned long long)record.uValue, record.iRow);
+        break;
+    default:
+        return 0;
+    }
+    //超长的行截断
+    return iLength < iSize ? iLength : iSize - 1;
+}
+
+void AsyncLogger::flushSuppressed(qint64 iNowMs)
+{
+    if(iNowMs - m_windowStartMs < 1000)
+        return;
+
+    quint32 uDropped = m_droppedCount.loadAcquire();
+    if(m_suppressedLines > 0 || uDropped != m_reportedDropped)
+    {
+        fprintf(stderr, "Log: %d lines suppressed by rate limit, %u records dropped on full queue\n",
+                m_suppressedLines, uDropped - m_reportedDropped);
+        fflush(stderr);
+    }
+    m_reportedDropped = uDropped;
+    m_windowStartMs = iNowMs;
+    m_windowLines = 0;
+    m_suppressedLines = 0;
+}
@@ -0,0 +1,116 @@
+﻿#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <QThread>
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QAtomicInt>
+
+//日志记录类型
+enum LogRecordType
+{
+    LogRecord_Separator = 0,        //一个周期的分隔行
+    LogRecord_Signal,               //信号行，值为工程值
+    LogRecord_Register,             //寄存器行，值为寄存器原始值
+    LogRecord_BusTime,              //串口一周期的总线时间，uValue为us，iRow为轮询周期ms，dValue为占比%
+    LogRecord_Overrun,              //轮询周期跳过，uValue为累计次数，iRow为队列深度
+    LogRecord_Alarm,                //告警产生或恢复，iRow为告警序号，uValue为1产生、0恢复，dValue为信号工程值
+    LogRecord_Edge,                 //监视信号跳变，iRow为信号下标，dValue为跳变后的工程值，iTimeMs为读回时间
+    LogRecord_BurstEnd              //突发采样结束，uValue为读次数，iRow为窗口ms
+};
+
+//定长二进制日志记录，热路径只拷贝数值，文字在写线程中格式化
+struct LogRecord
+{
+    qint64 iTimeMs;                 //记录时间，自1970年起的ms
+    int iType;                      //LogRecordType
+    int iSource;                    //数据源编号
+    int iRow;                       //行号，对应登记时的行格式
+    quint64 uValue;
+    double dValue;
+    quint8 uQuality;                //信号行的SignalQuality，非GOOD时行尾输出质量
+    quint8 uExceptionCode;
+};
+
+//一行的固定部分，登记时一次格式化，值写在前后缀之间
+struct LogRowFormat
+{
+    QByteArray prefix;
+    QByteArray suffix;
+};
+
+/* 异步日志
+ * 各链路线程把定长记录写入无锁环形队列（多生产者、单消费者），不阻塞、不分配内存，队列满时丢弃并计数
+ * 后台线程批量取出记录，按登记的行格式拼成文本写到stderr，终端慢只拖慢写线程
+ * 写线程按每秒行数限流，超出的行丢弃，每秒汇总一次丢弃数
+*/
+class AsyncLogger : public QThread
+{
+public:
+    enum
+    {
+        Capacity = 8192             //队列记录数，必须为2的幂
+    };
+
+    static AsyncLogger *instance();
+    ~AsyncLogger();
+
+    //iMaxLinesPerSec: 每秒最多输出的行数，0为不限
+    void setMaxLinesPerSec(int iMaxLinesPerSec);
+
+    /* 加载时登记一个数据源的行格式，首次登记时启动写线程
+     * 返回值: 数据源编号，写入LogRecord::iSource
+    */
+    int registerSource(const QString &strName, const QVector<LogRowFormat> &signalRows, const QVector<LogRowFormat> &registerRows,
+                       const QVector<LogRowFormat> &alarmRows, const QVector<LogRowFormat> &edgeRows);
+
+    //热路径调用，队列满时返回false
+    bool push(const LogRecord &record);
+
+protected:
+    void run() override;
+
+private:
+    AsyncLogger();
+
+    struct LogCell
+    {
+        QAtomicInteger<quint32> uSequence;
+        LogRecord record;
+    };
+
+    struct LogSource
+    {
+        QByteArray name;
+        QVector<LogRowFormat> signalRows;
+        QVector<LogRowFormat> registerRows;
+        QVector<LogRowFormat> alarmRows;    //前缀为告警Key，后缀为信号Key
+        QVector<LogRowFormat> edgeRows;     //按信号下标，前缀为信号Key
+    };
+
+    bool pop(LogRecord &record);
+    //取出队列中的全部记录并写出，返回写出的行数
+    int drain();
+    int formatRecord(const LogRecord &record, char *pLine, int iSize);
+    void flushSuppressed(qint64 iNowMs);
+
+private:
+    LogCell m_cells[Capacity];
+    QAtomicInteger<quint32> m_enqueuePos;
+    quint32 m_dequeuePos;               //只有写线程访问
+    QAtomicInteger<quint32> m_droppedCount;     //队列满丢弃的记录数
+    QAtomicInt m_maxLinesPerSec;
+
+    QMutex m_sourceMutex;
+    QVector<LogSource> m_sourceList;
+
+    //写线程的限流状态
+    qint64 m_windowStartMs;
+    int m_windowLines;
+    int m_suppressedLines;
+    quint32 m_reportedDropped;
+};
+
+#endif // ASYNCLOGGER_H
@@ -0,0 +1,209 @@
+﻿#include "burstsampler.h"
+#include "modbusservice.h"
+#include "cycletimer.h"
+#include "asynclogger.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDebug>
+#include <QDateTime>
+
+BurstSampler::BurstSampler(ModBusService *pService, const QString &strLinkGroup, QObject *parent) : QObject(parent),
+    m_pService(pService),
+    m_strLinkGroup(strLinkGroup),
+    m_iTriggerIndex(-1),
+    m_bTriggerHeld(false),
+    m_iWindowMs(1000),
+    m_iBurstEndNs(0),
+    m_iNextBlock(0),
+    m_bInFlight(false),
+    m_iBurstReads(0),
+    m_logSource(-1),
+    m_issueTimer(nullptr)
+{
+    m_issueTimer = new QTimer(this);
+    m_issueTimer->setSingleShot(true);
+    m_issueTimer->setInterval(0);
+    connect(m_issueTimer, &QTimer::timeout, this, &BurstSampler::slot_issueNext);
+}
+
+int BurstSampler::init(const QVector<SignalParameter> &signalList, const QHash<QString, int> &signalIndexHash,
+                       const QList<PollBlock> &pollBlockList, const QMap<quint32, RegisterInterval> &intervalMap)
+{
+    QSettings settings(qApp->applicationDirPath() + "/config/Config.ini", QSettings::IniFormat);
+    QStringList keyList = settings.value(m_strLinkGroup + "/BurstSignals").toStringList();
+    QString strTrigger = settings.value(m_strLinkGroup + "/BurstTrigger").toString().trimmed();
+    m_iWindowMs = qMax(1, settings.value(m_strLinkGroup + "/BurstWindowMs", 1000).toInt());
+
+    m_watchList.fill(-1, signalList.size());
+    m_stateList.clear();
+    m_blockList.clear();
+    QVector<bool> blockUsedList(pollBlockList.size(), false);
+    int iEdgeCount = 0;
+    for(int i=0; i<keyList.size(); i++)
+    {
+        QString strKey = keyList.at(i).trimmed();
+        int iSignalIndex = signalIndexHash.value(strKey, -1);
+        if(iSignalIndex < 0)
+        {
+            qDebug()<<QString("[%1] Burst: unknown signal %2").arg(m_strLinkGroup).arg(strKey);
+            continue;
+        }
+        if(m_watchList.at(iSignalIndex) >= 0)
+            continue;
+
+        //派生信号没有寄存器，只记录跳变
+        const SignalParameter &signalParam = signalList.at(iSignalIndex);
+        quint32 uRegKey = makeRegKey(signalParam.uServerAddr, signalParam.eRegTable, signalParam.uRegisterAddr);
+        QMap<quint32, RegisterInterval>::const_iterator itr = intervalMap.constFind(uRegKey);
+        if(itr != intervalMap.constEnd())
+        {
+            for(int j=0; j<pollBlockList.size(); j++)
+            {
+                const PollBlock &block = pollBlockList.at(j);
+                quint32 uBlockKey = makeRegKey(block.uServerAddr, block.eRegTable, block.uStartAddr);
+                if(uRegKey >= uBlockKey && uRegKey + itr.value().uRegCount <= uBlockKey + block.uRegCount)
+                    blockUsedList[j] = true;
+            }
+        }
+
+        WatchState state;
+        state.bEdge = true;
+        state.bHasValue = false;
+        state.dLastValue = 0;
+        m_watchList[iSignalIndex] = m_stateList.size();
+        m_stateList.append(state);
+        iEdgeCount++;
+    }
+    for(int i=0; i<pollBlockList.size(); i++)
+    {
+        if(blockUsedList.at(i))
+            m_blockList.append(pollBlockList.at(i));
+    }
+
+    m_iTriggerIndex = strTrigger.isEmpty() ? -1 : signalIndexHash.value(strTrigger, -1);
+    if(!strTrigger.isEmpty() && m_iTriggerIndex < 0)
+        qDebug()<<QString("[%1] Burst: unknown trigger signal %2").arg(m_strLinkGroup).arg(strTrigger);
+    if(m_iTriggerIndex >= 0 && m_watchList.at(m_iTriggerIndex) < 0)
+    {
+        WatchState state;
+        state.bEdge = false;
+        state.bHasValue = false;
+        state.dLastValue = 0;
+        m_watchList[m_iTriggerIndex] = m_stateList.size();
+        m_stateList.append(state);
+    }
+
+    //每个监视信号一周期内通常最多跳变几次
+    m_edgeList.reserve(qMax(16, iEdgeCount * 4));
+    if(iEdgeCount > 0)
+        qDebug()<<QString("[%1] Burst: %2 signals in %3 blocks, trigger %4, window %5 ms")
+                        .arg(m_strLinkGroup)
+                        .arg(iEdgeCount)
+                        .arg(m_blockList.size())
+                        .arg(m_iTriggerIndex >= 0 ? strTrigger : QString("none"))
+                        .arg(m_iWindowMs);
+    return iEdgeCount;
+}
+
+void BurstSampler::signalUpdated(int iSignalIndex, const SignalParameter &signalParam)
+{
+    WatchState &state = m_stateList[m_watchList.at(iSignalIndex)];
+    bool bGood = signalParam.uQuality == Quality_Good;
+    if(state.bEdge && bGood)
+    {
+        //首次读回和质量恢复后的第一个值不算跳变
+        if(state.bHasValue && signalParam.dValue != state.dLastValue)
+        {
+            SignalEdge edge;
+            edge.iSignalIndex = iSignalIndex;
+            edge.dValue = signalParam.dValue;
+            edge.iTimeMs = signalParam.iAcqTimeMs;
+            edge.iMonoNs = signalParam.iAcqMonoNs;
+            m_edgeList.append(edge);
+        }
+        state.dLastValue = signalParam.dValue;
+    }
+    state.bHasValue = bGood;
+
+    if(iSignalIndex != m_iTriggerIndex)
+        return;
+    bool bHeld = bGood && signalParam.dValue != 0;
+    if(bHeld && !m_bTriggerHeld && !m_blockList.isEmpty())
+    {
+        m_iBurstEndNs = CycleTimer::monotonicNs() + m_iWindowMs * 1000000LL;
+        m_iBurstReads = 0;
+        if(!m_bInFlight)
+            m_issueTimer->start();
+    }
+    m_bTriggerHeld = bHeld;
+}
+
+void BurstSampler::readFinished(bool bSuccess)
+{
+    m_bInFlight = false;
+    if(!bSuccess)
+        m_iBurstEndNs = 0;
+    if(m_iBurstEndNs != 0)
+        m_issueTimer->start();
+}
+
+void BurstSampler::stop()
+{
+    m_iBurstEndNs = 0;
+    m_bTriggerHeld = false;
+    m_bInFlight = false;
+    m_issueTimer->stop();
+    for(int i=0; i<m_stateList.size(); i++)
+        m_stateList[i].bHasValue = false;
+}
+
+void BurstSampler::slot_issueNext()
+{
+    if(m_iBurstEndNs == 0 || m_bInFlight)
+        return;
+    if(CycleTimer::monotonicNs() >= m_iBurstEndNs)
+    {
+        m_iBurstEndNs = 0;
+        if(m_logSource >= 0)
+        {
+            LogRecord record;
+            record.iTimeMs = QDateTime::currentMSecsSinceEpoch();
+            record.iType = LogRecord_BurstEnd;
+            record.iSource = m_logSource;
+            record.iRow = m_iWindowMs;
+            record.uValue = m_iBurstReads;
+            record.dValue = 0;
+            record.uQuality = Quality_Good;
+            record.uExceptionCode = 0;
+            AsyncLogger::instance()->push(record);
+        }
+        return;
+    }
+
+    //命令入队失败时可能已同步通知完成
+    const PollBlock &block = m_blockList.at(m_iNextBlock);
+    m_iNextBlock = (m_iNextBlock + 1) % m_blockList.size();
+    m_bInFlight = true;
+    if(m_pService->enqueueReadCommand(block.uServerAddr, block.eRegTable, block.uStartAddr, block.uRegCount, CommandTag) < 0)
+    {
+        m_bInFlight = false;
+        m_iBurstEndNs = 0;
+        return;
+    }
+    m_iBurstReads++;
+}
+
+void BurstSampler::setLogSource(int iLogSource)
+{
+    m_logSource = iLogSource;
+}
+
+const QVector<SignalEdge> &BurstSampler::getEdgeList() const
+{
+    return m_edgeList;
+}
+
+void BurstSampler::clearEdges()
+{
+    m_edgeList.resize(0);
+}
@@ -0,0 +1,90 @@
+﻿#ifndef BURSTSAMPLER_H
+#define BURSTSAMPLER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <climits>
+#include "commondefine.h"
+
+class ModBusService;
+
+//监视信号的一次跳变
+struct SignalEdge
+{
+    int iSignalIndex;
+    double dValue;                  //跳变后的工程值
+    qint64 iTimeMs;                 //读回时间，自1970年起的ms
+    qint64 iMonoNs;                 //读回时间，单调时钟ns
+};
+
+/* 突发采样，链路节BurstSignals、BurstTrigger、BurstWindowMs
+ * 触发信号由0变为非0时，监视信号所在的读请求块经命令通道逐块连续读BurstWindowMs，之后恢复普通轮询
+ * 突发读在上一个完成后的下一轮事件循环再发，排队中的轮询请求先发出，普通轮询不会停顿
+ * 监视信号每次读回值改变都记为跳变，普通轮询和突发读都记录
+*/
+class BurstSampler : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        CommandTag = INT_MIN + 1    //突发读命令的标签，与脚本读命令区分
+    };
+
+    BurstSampler(ModBusService *pService, const QString &strLinkGroup, QObject *parent = nullptr);
+
+    /* 按配置找出触发信号和监视信号所在的读请求块
+     * 返回值: 监视信号个数，0时不需要突发采样
+    */
+    int init(const QVector<SignalParameter> &signalList, const QHash<QString, int> &signalIndexHash,
+             const QList<PollBlock> &pollBlockList, const QMap<quint32, RegisterInterval> &intervalMap);
+
+    inline bool isWatched(int iSignalIndex) const
+    {
+        return iSignalIndex < m_watchList.size() && m_watchList.at(iSignalIndex) >= 0;
+    }
+    //监视信号或触发信号读回、质量改变后调用
+    void signalUpdated(int iSignalIndex, const SignalParameter &signalParam);
+    //突发读命令完成，失败时结束本次突发，由普通轮询处理通讯错误
+    void readFinished(bool bSuccess);
+    //链路断开时停止，之前未完成的命令不再续发
+    void stop();
+    //异步日志的数据源编号，-1不输出突发结束
+    void setLogSource(int iLogSource);
+
+    const QVector<SignalEdge> &getEdgeList() const;
+    void clearEdges();
+
+private slots:
+    void slot_issueNext();
+
+private:
+    struct WatchState
+    {
+        bool bEdge;                 //记录跳变
+        bool bHasValue;
+        double dLastValue;
+    };
+
+private:
+    ModBusService *m_pService;
+    QString m_strLinkGroup;
+    QVector<int> m_watchList;           //按信号下标，不监视为-1，否则为m_stateList中的位置
+    QVector<WatchState> m_stateList;
+    QVector<PollBlock> m_blockList;     //监视信号所在的读请求块
+    int m_iTriggerIndex;                //触发信号下标，未配置为-1
+    bool m_bTriggerHeld;
+    int m_iWindowMs;
+    qint64 m_iBurstEndNs;               //突发结束时间，单调时钟ns，不在突发中为0
+    int m_iNextBlock;
+    bool m_bInFlight;
+    int m_iBurstReads;                  //本次突发的读次数
+    int m_logSource;                    //异步日志数据源编号，未启用调试输出为-1
+    QTimer *m_issueTimer;
+    QVector<SignalEdge> m_edgeList;
+};
+
+#endif // BURSTSAMPLER_H
@@ -0,0 +1,102 @@
+﻿#include "busmanager.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDebug>
+#include "metricsexporter.h"
+#include "realtimemode.h"
+#ifdef Q_OS_LINUX
+#include "collector.h"
+#endif
+
+BusManager::BusManager(QObject *parent) : QObject(parent),
+    m_singleService(nullptr),
+    m_collector(nullptr),
+    m_metricsExporter(nullptr)
+{
+
+}
+
+BusManager::~BusManager()
+{
+    for(int i=0; i<m_threadList.size(); i++)
+    {
+        m_threadList.at(i)->quit();
+        m_threadList.at(i)->wait();
+    }
+}
+
+void BusManager::start()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+
+    //先锁定内存，之后创建的线程栈、缓冲区都在锁定范围内
+    if(settings.value("Realtime/Enable",0).toInt() == 1)
+    {
+        int heapReserveKB = settings.value("Realtime/HeapReserveKB",16384).toInt();
+        if(RealtimeMode::lockMemory(heapReserveKB))
+            qDebug()<<QString("Realtime: memory locked, %1 KB heap reserved").arg(heapReserveKB);
+    }
+
+#ifdef Q_OS_LINUX
+    if(settings.value("Collector/Enable",0).toInt() == 1)
+    {
+        m_collector = new Collector(this);
+        if(m_collector->start())
+            return;
+        delete m_collector;
+        m_collector = nullptr;
+    }
+#endif
+
+    startMetrics();
+
+    QStringList groupList = settings.value("Bus/Groups").toStringList();
+    groupList.removeAll(QString());
+
+    if(groupList.isEmpty())
+    {
+        m_singleService = new ModBusService(QString(), this);
+        return;
+    }
+
+    for(int i=0; i<groupList.size(); i++)
+    {
+        QString strGroup = groupList.at(i).trimmed();
+        QThread *pThread = new QThread(this);
+        pThread->setObjectName(strGroup);
+
+        //服务在串口线程内创建，其串口、定时器、请求队列都属于该线程，线程结束时在线程内析构
+        connect(pThread, &QThread::started, [strGroup, pThread]() {
+            ModBusService *pService = new ModBusService(strGroup);
+            QObject::connect(pThread, &QThread::finished, [pService]() {
+                delete pService;
+            });
+        });
+        m_threadList.append(pThread);
+        pThread->start();
+    }
+    qDebug()<<QString("Started %1 serial buses: %2").arg(groupList.size()).arg(groupList.join(","));
+}
+
+void BusManager::startMetrics()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    int metricsPort = settings.value("Metrics/Port",0).toInt();
+    QString metricsBind = settings.value("Metrics/Bind","127.0.0.1").toString();
+    QString textFile = settings.value("Metrics/TextFile").toString();
+    int textFilePeriod = settings.value("Metrics/TextFilePeriod",5).toInt();
+    if(metricsPort <= 0 && textFile.isEmpty())
+        return;
+
+    m_metricsExporter = new MetricsExporter(this);
+    if(metricsPort > 0)
+    {
+        if(m_metricsExporter->listen(metricsBind, metricsPort))
+            qDebug()<<QString("Metrics listening on %1:%2").arg(metricsBind).arg(metricsPort);
+        else
+            qDebug()<<QString("Metrics listen on %1:%2 failed: ").arg(metricsBind).arg(metricsPort) + m_metricsExporter->errorString();
+    }
+    m_metricsExporter->setTextFile(textFile, textFilePeriod * 1000);
+}
@@ -0,0 +1,36 @@
+﻿#ifndef BUSMANAGER_H
+#define BUSMANAGER_H
+
+#include <QObject>
+#include <QList>
+#include <QThread>
+#include "modbusservice.h"
+
+class Collector;
+class MetricsExporter;
+
+class BusManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BusManager(QObject *parent = nullptr);
+    ~BusManager();
+
+    /* 按Config.ini启动，Collector/Enable=1时为采集器模式（仅Linux），否则按Bus/Groups启动链路
+     * 未配置时在主线程创建单个ModBusService，按ConnectType连接
+     * 配置多个串口时每个串口一个线程，线程内创建该串口的ModBusService，各串口请求队列互不等待
+    */
+    void start();
+
+private:
+    //Metrics节配置了端口或文本文件时启动指标输出，需在创建链路服务之前
+    void startMetrics();
+
+private:
+    ModBusService *m_singleService;     //单链路服务，多串口时为空
+    Collector *m_collector;             //采集器模式
+    QList<QThread*> m_threadList;       //多串口时每个串口一个线程
+    MetricsExporter *m_metricsExporter; //Metrics节启用时创建，各链路共用
+};
+
+#endif // BUSMANAGER_H
@@ -0,0 +1,324 @@
+﻿#include "collector.h"
+#include "protocoljson.h"
+#include "pollplanner.h"
+#include "modbusframe.h"
+#include "realtimemode.h"
+#include "asynclogger.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QFile>
+#include <QUrl>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QDebug>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <string.h>
+
+Collector::Collector(QObject *parent) : QObject(parent),
+    m_statsTimer(nullptr),
+    m_deviceCount(0),
+    m_pollMaxGap(0),
+    m_pollMaxRegCount(125),
+    m_pollMaxBitGap(0),
+    m_pollMaxBitCount(2000),
+    m_lastCycleCount(0),
+    m_lastTransactionCount(0),
+    m_lastSignalCount(0),
+    m_lastCpuTimeNs(0),
+    m_lastCycleStartCount(0),
+    m_lastJitterSumNs(0)
+{
+    m_statsTimer = new QTimer(this);
+    connect(m_statsTimer, &QTimer::timeout, this, &Collector::slot_printStats);
+}
+
+Collector::~Collector()
+{
+    //先停工作线程，再释放其引用的协议
+    qDeleteAll(m_workerList);
+    m_workerList.clear();
+    qDeleteAll(m_profileHash);
+    m_profileHash.clear();
+}
+
+bool Collector::start()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    int workerCount = settings.value("Collector/Workers",4).toInt();
+    int periodMs = settings.value("Collector/Period",100).toInt();
+    int timeOut = settings.value("Collector/Timeout",1000).toInt();
+    int statsPeriod = settings.value("Collector/StatsPeriod",10).toInt();
+    int debugType = settings.value("Debug",0).toInt();
+    QString deviceFile = settings.value("Collector/DeviceFile","Devices.json").toString();
+    m_pollMaxGap = settings.value("Poll/MaxGap",0).toInt();
+    m_pollMaxRegCount = settings.value("Poll/MaxRegCount",125).toInt();
+    m_pollMaxBitGap = settings.value("Poll/MaxBitGap",0).toInt();
+    m_pollMaxBitCount = settings.value("Poll/MaxBitCount",2000).toInt();
+
+    QVector<CollectorDevice> deviceList;
+    if(!loadDevices(qApp->applicationDirPath() + "/config/" + deviceFile, deviceList) || deviceList.isEmpty())
+    {
+        qDebug()<<"Collector: no device in " + deviceFile;
+        return false;
+    }
+
+    //Debug非0时每台设备登记一个日志数据源，工作线程输出变化的信号值
+    if(debugType != 0)
+    {
+        AsyncLogger::instance()->setMaxLinesPerSec(settings.value("Log/MaxLinesPerSec",2000).toInt());
+        for(int i=0; i<deviceList.size(); i++)
+        {
+            CollectorDevice &device = deviceList[i];
+            QVector<LogRowFormat> signalRows;
+            for(int j=0; j<device.signalList.size(); j++)
+            {
+                const SignalParameter &signalParam = device.signalList.at(j);
+                LogRowFormat row;
+                row.prefix = QString("%1 %2 %3 ")
+                                 .arg(j+1,3)
+                                 .arg(signalParam.strKey,26)
+                                 .arg(signalParam.uRegisterAddr + REGADDR_OFFSET,10).toUtf8();
+                row.suffix = QString(" %1").arg(signalParam.strParamName,20).toUtf8();
+                signalRows.append(row);
+            }
+            device.iLogSource = AsyncLogger::instance()->registerSource(device.strName, signalRows, QVector<LogRowFormat>(),
+                                                                        QVector<LogRowFormat>(), QVector<LogRowFormat>());
+        }
+    }
+
+    //实时模式下工作线程按CollectorCpus依次绑定CPU，未列出的不绑定
+    bool realtime = settings.value("Realtime/Enable",0).toInt() == 1;
+    int rtPriority = settings.value("Realtime/Priority",0).toInt();
+    QStringList rtCpuList = settings.value("Realtime/CollectorCpus").toStringList();
+
+    workerCount = qBound(1, workerCount, deviceList.size());
+    for(int i=0; i<workerCount; i++)
+    {
+        CollectorWorker *pWorker = new CollectorWorker(periodMs, timeOut);
+        if(realtime)
+            pWorker->setRealtime(rtPriority, i < rtCpuList.size() ? rtCpuList.at(i).trimmed().toInt() : -1);
+        m_workerList.append(pWorker);
+    }
+    int iSignalCount = 0;
+    for(int i=0; i<deviceList.size(); i++)
+    {
+        m_workerList.at(i % workerCount)->addDevice(deviceList.at(i));
+        iSignalCount += deviceList.at(i).signalList.size();
+    }
+    m_deviceCount = deviceList.size();
+
+    qDebug()<<QString("Collector: %1 devices, %2 signals, %3 protocols, %4 workers, %5 ms period")
+                    .arg(m_deviceCount)
+                    .arg(iSignalCount)
+                    .arg(m_profileHash.size())
+                    .arg(workerCount)
+                    .arg(periodMs);
+
+    for(int i=0; i<m_workerList.size(); i++)
+        m_workerList.at(i)->start();
+    m_statsElapsed.start();
+    m_statsTimer->start((statsPeriod > 0 ? statsPeriod : 10) * 1000);
+    return true;
+}
+
+int Collector::getWorkerCount() const
+{
+    return m_workerList.size();
+}
+
+const CollectorWorker *Collector::getWorker(int iIndex) const
+{
+    return m_workerList.at(iIndex);
+}
+
+void Collector::slot_printStats()
+{
+    qint64 iCycleCount = 0;
+    qint64 iTransactionCount = 0;
+    qint64 iSignalCount = 0;
+    qint64 iErrorCount = 0;
+    qint64 iOverrunCount = 0;
+    qint64 iCpuTimeNs = 0;
+    qint64 iAllocCount = 0;
+    qint64 iCycleStartCount = 0;
+    qint64 iJitterSumNs = 0;
+    qint64 iJitterMaxNs = 0;
+    int iConnectedCount = 0;
+    for(int i=0; i<m_workerList.size(); i++)
+    {
+        const CollectorWorker *pWorker = m_workerList.at(i);
+        iCycleCount += pWorker->getCycleCount();
+        iTransactionCount += pWorker->getTransactionCount();
+        iSignalCount += pWorker->getSignalCount();
+        iErrorCount += pWorker->getErrorCount();
+        iOverrunCount += pWorker->getOverrunCount();
+        iCpuTimeNs += pWorker->getCpuTimeNs();
+        iAllocCount += pWorker->getAllocCount();
+        iConnectedCount += pWorker->getConnectedCount();
+        iCycleStartCount += pWorker->getCycleStartCount();
+        iJitterSumNs += pWorker->getStartJitterSumNs();
+        iJitterMaxNs = qMax(iJitterMaxNs, m_workerList.at(i)->takeStartJitterMaxNs());
+    }
+
+    double dSeconds = m_statsElapsed.restart() / 1000.0;
+    if(dSeconds <= 0)
+        return;
+    double dSignalRate = (iSignalCount - m_lastSignalCount) / dSeconds;
+    double dCores = (iCpuTimeNs - m_lastCpuTimeNs) / 1e9 / dSeconds;
+    qDebug()<<QString("Collector: %1/%2 devices connected, %3 cycles/s, %4 requests/s, %5 signals/s, %6 errors, %7 overruns, CPU %8 cores, %9 signals/s per core")
+                    .arg(iConnectedCount)
+                    .arg(m_deviceCount)
+                    .arg((iCycleCount - m_lastCycleCount) / dSeconds, 0, 'f', 0)
+                    .arg((iTransactionCount - m_lastTransactionCount) / dSeconds, 0, 'f', 0)
+                    .arg(dSignalRate, 0, 'f', 0)
+                    .arg(iErrorCount)
+                    .arg(iOverrunCount)
+                    .arg(dCores, 0, 'f', 2)
+                    .arg(dCores > 0 ? dSignalRate / dCores : 0, 0, 'f', 0);
+
+    qint64 iStarts = iCycleStartCount - m_lastCycleStartCount;
+    qDebug()<<QString("Collector: cycle start jitter mean %1 us, max %2 us")
+                    .arg(iStarts > 0 ? (iJitterSumNs - m_lastJitterSumNs) / 1000.0 / iStarts : 0, 0, 'f', 1)
+                    .arg(iJitterMaxNs / 1000.0, 0, 'f', 1);
+
+    //压测时验证稳态零分配
+    if(RealtimeMode::isAllocCounterEnabled())
+        qDebug()<<QString("Collector: %1 heap allocations in worker threads after warm-up%2")
+                        .arg(iAllocCount)
+                        .arg(iAllocCount == 0 ? "" : ", steady state is NOT allocation-free");
+
+    m_lastCycleCount = iCycleCount;
+    m_lastTransactionCount = iTransactionCount;
+    m_lastSignalCount = iSignalCount;
+    m_lastCpuTimeNs = iCpuTimeNs;
+    m_lastCycleStartCount = iCycleStartCount;
+    m_lastJitterSumNs = iJitterSumNs;
+}
+
+const CollectorProfile *Collector::loadProfile(const QString &strFileName)
+{
+    CollectorProfile *pProfile = m_profileHash.value(strFileName, nullptr);
+    if(pProfile)
+        return pProfile;
+
+    ProtocolJson jsonFile;
+    jsonFile.loadJson(qApp->applicationDirPath() + "/config/" + strFileName);
+    PollPlanner pollPlanner;
+    pollPlanner.analyse(jsonFile.getDataStructMap());
+
+    pProfile = new CollectorProfile;
+    pProfile->strFileName = strFileName;
+    pProfile->signalList = pollPlanner.getSignalList();
+    pProfile->signalCodec.setByteSwap(jsonFile.getByteSwap());
+    pProfile->signalCodec.setWordSwap(jsonFile.getWordSwap());
+
+    //每个读请求块预先列出块内区间，应答到达时按偏移直接解码
+    QMap<quint32, RegisterInterval> intervalMap = pollPlanner.getIntervalMap();
+    QList<PollBlock> blockList = pollPlanner.planBlocks(m_pollMaxGap, m_pollMaxRegCount, m_pollMaxBitGap, m_pollMaxBitCount);
+    quint8 pduBuffer[8];
+    for(int i=0; i<blockList.size(); i++)
+    {
+        const PollBlock &block = blockList.at(i);
+        if(buildReadPdu(pduBuffer, block.eRegTable, block.uStartAddr, block.uRegCount) < 0)
+        {
+            qDebug()<<QString("Collector: %1 read request at %2 count %3 exceeds the function code limit, skipped")
+                            .arg(strFileName)
+                            .arg(block.uStartAddr)
+                            .arg(block.uRegCount);
+            continue;
+        }
+
+        CollectorBlock collectorBlock;
+        collectorBlock.eRegTable = block.eRegTable;
+        collectorBlock.uStartAddr = block.uStartAddr;
+        collectorBlock.uRegCount = block.uRegCount;
+        collectorBlock.iFirstInterval = pProfile->intervalList.size();
+        quint32 uStartKey = makeRegKey(block.eRegTable, block.uStartAddr);
+        quint32 uEndKey = uStartKey + block.uRegCount;
+        QMap<quint32, RegisterInterval>::const_iterator itr = intervalMap.lowerBound(uStartKey);
+        while(itr != intervalMap.constEnd() && itr.key() + itr.value().uRegCount <= uEndKey)
+        {
+            CollectorInterval collectorInterval;
+            collectorInterval.uOffset = itr.key() - uStartKey;
+            collectorInterval.uRegCount = itr.value().uRegCount;
+            collectorInterval.iFirstSignal = itr.value().iFirstSignal;
+            collectorInterval.iSignalCount = itr.value().iSignalCount;
+            pProfile->intervalList.append(collectorInterval);
+            itr++;
+        }
+        collectorBlock.iIntervalCount = pProfile->intervalList.size() - collectorBlock.iFirstInterval;
+        pProfile->blockList.append(collectorBlock);
+    }
+
+    m_profileHash.insert(strFileName, pProfile);
+    qDebug()<<QString("Collector: %1 compiled, %2 signals, %3 read requests per cycle")
+                    .arg(strFileName)
+                    .arg(pProfile->signalList.size())
+                    .arg(pProfile->blockList.size());
+    return pProfile;
+}
+
+bool Collector::loadDevices(const QString &strFilePath, QVector<CollectorDevice> &deviceList)
+{
+    QFile file(strFilePath);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug()<<"Collector: device file open error " + strFilePath;
+        return false;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if(parseError.error != QJsonParseError::NoError || !doc.isObject())
+    {
+        qDebug()<<"Collector: device file parse error " + strFilePath;
+        return false;
+    }
+
+    QJsonArray deviceArray = doc.object().value("DeviceArray").toArray();
+    for(int i=0; i<deviceArray.size(); i++)
+    {
+        QJsonObject obj = deviceArray.at(i).toObject();
+        QString strName = obj.value("Name").toString();                 //设备名称
+        QString strIPPort = obj.value("IPPort").toString();             //IP端口
+        uint uServerAddr = obj.value("ServerAddress").toString().toUInt();  //从站地址
+        QString strProtocol = obj.value("Protocol").toString();         //协议文件，默认Protocol.json
+        if(strProtocol.isEmpty())
+            strProtocol = "Protocol.json";
+        if(uServerAddr > 255)
+        {
+            qDebug()<<"Collector: invalid ServerAddress for " + strName + ", device skipped";
+            continue;
+        }
+
+        //启动时一次解析地址，工作线程只用sockaddr
+        const QUrl url = QUrl::fromUserInput(strIPPort);
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *pResult = nullptr;
+        if(getaddrinfo(url.host().toLatin1().constData(), nullptr, &hints, &pResult) != 0 || pResult == nullptr)
+        {
+            qDebug()<<"Collector: cannot resolve " + strIPPort + ", device skipped";
+            continue;
+        }
+
+        CollectorDevice device;
+        memcpy(&device.serverAddr, pResult->ai_addr, sizeof(device.serverAddr));
+        freeaddrinfo(pResult);
+        device.serverAddr.sin_port = htons(url.port(502));
+        device.strName = strName;
+        device.uServerAddr = uServerAddr;
+        device.pProfile = loadProfile(strProtocol);
+        device.signalList = device.pProfile->signalList;
+        device.iLogSource = -1;
+        deviceList.append(device);
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+﻿#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QHash>
+#include <QList>
+#include <QElapsedTimer>
+#include "collectorworker.h"
+
+/* 采集器模式，一台主机轮询数百台Modbus TCP设备
+ * 设备表见Collector/DeviceFile，协议文件经ProtocolJson、PollPlanner编译后由同协议的设备共用
+ * 设备平均分配到固定数量的工作线程，每个线程一个epoll，不使用Qt事件循环
+ * 按统计周期输出吞吐和每核每秒解码的信号数，用作容量基准
+*/
+class Collector : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Collector(QObject *parent = nullptr);
+    ~Collector();
+
+    //读取Collector节和设备表并启动工作线程，没有可用设备时返回false
+    bool start();
+
+    //工作线程，基准测试按线程读取统计量
+    int getWorkerCount() const;
+    const CollectorWorker *getWorker(int iIndex) const;
+
+private slots:
+    void slot_printStats();
+
+private:
+    //编译协议文件，同一文件只编译一次
+    const CollectorProfile *loadProfile(const QString &strFileName);
+    bool loadDevices(const QString &strFilePath, QVector<CollectorDevice> &deviceList);
+
+private:
+    QTimer *m_statsTimer;
+    QElapsedTimer m_statsElapsed;
+    QList<CollectorWorker*> m_workerList;
+    QHash<QString, CollectorProfile*> m_profileHash;    //Key:协议文件名
+    int m_deviceCount;
+    int m_pollMaxGap;
+    int m_pollMaxRegCount;
+    int m_pollMaxBitGap;
+    int m_pollMaxBitCount;
+
+    //上一统计周期的累计值
+    qint64 m_lastCycleCount;
+    qint64 m_lastTransactionCount;
+    qint64 m_lastSignalCount;
+    qint64 m_lastCpuTimeNs;
+    qint64 m_lastCycleStartCount;
+    qint64 m_lastJitterSumNs;
+};
+
+#endif // COLLECTOR_H
@@ -0,0 +1,525 @@
+﻿#include "collectorworker.h"
+#include "realtimemode.h"
+#include "modbusframe.h"
+#include "asynclogger.h"
+#include <QDebug>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static const int TickMs = 5;                            //状态机节拍
+static const qint64 ReconnectDelayNs = 1000000000LL;    //连接断开后1s重连
+static const qint64 AllocWarmupNs = 2000000000LL;       //启动后2s内不统计堆分配
+
+static qint64 monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static qint64 realtimeMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+CollectorWorker::CollectorWorker(int iPeriodMs, int iTimeoutMs, QObject *parent) : QThread(parent),
+    m_periodMs(iPeriodMs > 0 ? iPeriodMs : 100),
+    m_timeoutMs(iTimeoutMs > 0 ? iTimeoutMs : 1000),
+    m_epollFd(-1),
+    m_wallOffsetMs(0),
+    m_rtPriority(0),
+    m_rtCpu(-1),
+    m_allocStartNs(0),
+    m_allocBase(0),
+    m_timerFd(-1),
+    m_cycleCount(0),
+    m_transactionCount(0),
+    m_signalCount(0),
+    m_errorCount(0),
+    m_overrunCount(0),
+    m_cpuTimeNs(0),
+    m_allocCount(0),
+    m_cycleStartCount(0),
+    m_jitterSumNs(0),
+    m_jitterMaxNs(0),
+    m_connectedCount(0)
+{
+
+}
+
+CollectorWorker::~CollectorWorker()
+{
+    requestInterruption();
+    wait();
+}
+
+void CollectorWorker::addDevice(const CollectorDevice &device)
+{
+    m_deviceList.append(device);
+    CollectorDevice &newDevice = m_deviceList.last();
+    newDevice.iSocket = -1;
+    newDevice.iState = DeviceState_Disconnected;
+    newDevice.iBlock = 0;
+    newDevice.uTransactionId = 0;
+    newDevice.iRxLength = 0;
+}
+
+int CollectorWorker::getDeviceCount() const
+{
+    return m_deviceList.size();
+}
+
+qint64 CollectorWorker::getCycleCount() const
+{
+    return m_cycleCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getTransactionCount() const
+{
+    return m_transactionCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getSignalCount() const
+{
+    return m_signalCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getErrorCount() const
+{
+    return m_errorCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getOverrunCount() const
+{
+    return m_overrunCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getCpuTimeNs() const
+{
+    return m_cpuTimeNs.loadAcquire();
+}
+
+qint64 CollectorWorker::getAllocCount() const
+{
+    return m_allocCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getCycleStartCount() const
+{
+    return m_cycleStartCount.loadAcquire();
+}
+
+qint64 CollectorWorker::getStartJitterSumNs() const
+{
+    return m_jitterSumNs.loadAcquire();
+}
+
+qint64 CollectorWorker::takeStartJitterMaxNs()
+{
+    return m_jitterMaxNs.fetchAndStoreRelaxed(0);
+}
+
+void CollectorWorker::setRealtime(int iPriority, int iCpu)
+{
+    m_rtPriority = iPriority;
+    m_rtCpu = iCpu;
+}
+
+int CollectorWorker::getConnectedCount() const
+{
+    return m_connectedCount.loadAcquire();
+}
+
+void CollectorWorker::run()
+{
+    if(m_rtPriority > 0 || m_rtCpu >= 0)
+        RealtimeMode::setCurrentThread(m_rtPriority, m_rtCpu);
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_epollFd < 0 || m_timerFd < 0)
+    {
+        qDebug()<<"Collector: epoll/timerfd create failed: " + QString(strerror(errno));
+        return;
+    }
+
+    //节拍对齐到TickMs的整数倍，按绝对时间触发，处理慢了不会把后面的节拍推后
+    qint64 iNowNs = monotonicNs();
+    qint64 iTickNs = TickMs * 1000000LL;
+    qint64 iFirstTickNs = (iNowNs / iTickNs + 1) * iTickNs;
+    itimerspec timerSpec;
+    timerSpec.it_interval.tv_sec = 0;
+    timerSpec.it_interval.tv_nsec = iTickNs;
+    timerSpec.it_value.tv_sec = iFirstTickNs / 1000000000LL;
+    timerSpec.it_value.tv_nsec = iFirstTickNs % 1000000000LL;
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &timerSpec, nullptr);
+
+    //data.ptr为空表示节拍定时器，否则为设备
+    epoll_event timerEvent;
+    timerEvent.events = EPOLLIN;
+    timerEvent.data.ptr = nullptr;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &timerEvent);
+
+    //设备周期起点对齐到周期边界，在一个周期内按整数个节拍均匀错开，信号表在此一次分离，之后解码不再分配
+    qint64 iPeriodNs = m_periodMs * 1000000LL;
+    qint64 iBaseNs = (iNowNs / iPeriodNs + 1) * iPeriodNs;
+    m_wallOffsetMs = realtimeMs() - iNowNs / 1000000;
+    m_allocStartNs = iNowNs + AllocWarmupNs;
+    CollectorDevice *pDevice = m_deviceList.data();
+    for(int i=0; i<m_deviceList.size(); i++)
+    {
+        pDevice[i].signalList.data();
+        pDevice[i].iDeadlineNs = iNowNs;
+        pDevice[i].iNextCycleNs = iBaseNs + iPeriodNs * i / m_deviceList.size() / iTickNs * iTickNs;
+    }
+
+    epoll_event eventList[64];
+    while(!isInterruptionRequested())
+    {
+        int iCount = epoll_wait(m_epollFd, eventList, 64, 100);
+        if(iCount < 0 && errno != EINTR)
+        {
+            qDebug()<<"Collector: epoll_wait failed: " + QString(strerror(errno));
+            break;
+        }
+
+        iNowNs = monotonicNs();
+        for(int i=0; i<iCount; i++)
+        {
+            if(eventList[i].data.ptr == nullptr)
+            {
+                quint64 uExpirations = 0;
+                if(read(m_timerFd, &uExpirations, sizeof(uExpirations)) > 0)
+                    onTick(iNowNs);
+                continue;
+            }
+            onDeviceEvent(*static_cast<CollectorDevice*>(eventList[i].data.ptr), eventList[i].events, iNowNs);
+        }
+    }
+
+    for(int i=0; i<m_deviceList.size(); i++)
+        closeDevice(pDevice[i], iNowNs);
+    close(m_timerFd);
+    close(m_epollFd);
+    m_timerFd = -1;
+    m_epollFd = -1;
+}
+
+void CollectorWorker::onTick(qint64 iNowNs)
+{
+    qint64 iPeriodNs = m_periodMs * 1000000LL;
+    //系统时间可能被校时，每个节拍重新取一次差值
+    m_wallOffsetMs = realtimeMs() - iNowNs / 1000000;
+    CollectorDevice *pDevice = m_deviceList.data();
+    for(int i=0; i<m_deviceList.size(); i++)
+    {
+        CollectorDevice &device = pDevice[i];
+        switch(device.iState)
+        {
+        case DeviceState_Disconnected:
+            if(iNowNs >= device.iDeadlineNs)
+                startConnect(device, iNowNs);
+            break;
+        case DeviceState_Connecting:
+            if(iNowNs >= device.iDeadlineNs)
+            {
+                m_errorCount.fetchAndAddRelaxed(1);
+                closeDevice(device, iNowNs);
+            }
+            break;
+        case DeviceState_Waiting:
+            if(iNowNs >= device.iDeadlineNs)
+            {
+                //应答超时，本周期剩余的块跳过，迟到的应答按事务号丢弃
+                m_errorCount.fetchAndAddRelaxed(1);
+                markBlockQuality(device, device.pProfile->blockList.at(device.iBlock), Quality_CommError, 0, iNowNs);
+                device.iState = DeviceState_Idle;
+            }
+            else if(iNowNs >= device.iNextCycleNs)
+            {
+                m_overrunCount.fetchAndAddRelaxed(1);
+                device.iNextCycleNs += iPeriodNs;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if(device.iState == DeviceState_Idle && iNowNs >= device.iNextCycleNs)
+        {
+            //晚于一个周期的是重连或超限后补的周期，不计入抖动
+            qint64 iJitterNs = iNowNs - device.iNextCycleNs;
+            if(iJitterNs < iPeriodNs)
+            {
+                m_cycleStartCount.fetchAndAddRelaxed(1);
+                m_jitterSumNs.fetchAndAddRelaxed(iJitterNs);
+                if(iJitterNs > m_jitterMaxNs.loadAcquire())
+                    m_jitterMaxNs.storeRelease(iJitterNs);
+            }
+            while(device.iNextCycleNs <= iNowNs)
+                device.iNextCycleNs += iPeriodNs;
+            device.iBlock = 0;
+            sendBlock(device, iNowNs);
+        }
+    }
+
+    timespec cpuTime;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+    m_cpuTimeNs.storeRelease(cpuTime.tv_sec * 1000000000LL + cpuTime.tv_nsec);
+
+    //预热结束时取基准，之后的分配都计入
+    if(iNowNs < m_allocStartNs)
+        m_allocBase = RealtimeMode::getThreadAllocCount();
+    else
+        m_allocCount.storeRelease(RealtimeMode::getThreadAllocCount() - m_allocBase);
+}
+
+void CollectorWorker::onDeviceEvent(CollectorDevice &device, quint32 uEvents, qint64 iNowNs)
+{
+    if(device.iSocket < 0)
+        return;
+
+    if(device.iState == DeviceState_Connecting)
+    {
+        int iError = 0;
+        socklen_t iErrorLength = sizeof(iError);
+        getsockopt(device.iSocket, SOL_SOCKET, SO_ERROR, &iError, &iErrorLength);
+        if(iError != 0 || (uEvents & (EPOLLERR | EPOLLHUP)))
+        {
+            m_errorCount.fetchAndAddRelaxed(1);
+            closeDevice(device, iNowNs);
+            return;
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &device;
+        epoll_ctl(m_epollFd, EPOLL_CTL_MOD, device.iSocket, &event);
+        device.iState = DeviceState_Idle;
+        m_connectedCount.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    if(uEvents & EPOLLIN)
+        readDevice(device, iNowNs);
+    if(device.iSocket >= 0 && (uEvents & (EPOLLERR | EPOLLHUP)))
+    {
+        m_errorCount.fetchAndAddRelaxed(1);
+        closeDevice(device, iNowNs);
+    }
+}
+
+void CollectorWorker::startConnect(CollectorDevice &device, qint64 iNowNs)
+{
+    device.iDeadlineNs = iNowNs + ReconnectDelayNs;
+    int iSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(iSocket < 0)
+    {
+        m_errorCount.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    int iNoDelay = 1;
+    setsockopt(iSocket, IPPROTO_TCP, TCP_NODELAY, &iNoDelay, sizeof(iNoDelay));
+    if(::connect(iSocket, reinterpret_cast<const sockaddr*>(&device.serverAddr), sizeof(device.serverAddr)) < 0 && errno != EINPROGRESS)
+    {
+        m_errorCount.fetchAndAddRelaxed(1);
+        close(iSocket);
+        return;
+    }
+
+    //连接完成时可写
+    epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.ptr = &device;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, iSocket, &event);
+    device.iSocket = iSocket;
+    device.iRxLength = 0;
+    device.iState = DeviceState_Connecting;
+    device.iDeadlineNs = iNowNs + m_timeoutMs * 1000000LL;
+}
+
+void CollectorWorker::closeDevice(CollectorDevice &device, qint64 iNowNs)
+{
+    if(device.iSocket < 0)
+        return;
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, device.iSocket, nullptr);
+    close(device.iSocket);
+    const CollectorProfile *pProfile = device.pProfile;
+    for(int i=0; i<pProfile->blockList.size(); i++)
+        markBlockQuality(device, pProfile->blockList.at(i), Quality_CommError, 0, iNowNs);
+    if(device.iState == DeviceState_Idle || device.iState == DeviceState_Waiting)
+        m_connectedCount.fetchAndAddRelaxed(-1);
+    device.iSocket = -1;
+    device.iState = DeviceState_Disconnected;
+    device.iDeadlineNs = iNowNs + ReconnectDelayNs;
+}
+
+bool CollectorWorker::sendBlock(CollectorDevice &device, qint64 iNowNs)
+{
+    const CollectorProfile *pProfile = device.pProfile;
+    if(device.iBlock >= pProfile->blockList.size())
+    {
+        device.iState = DeviceState_Idle;
+        m_cycleCount.fetchAndAddRelaxed(1);
+        return true;
+    }
+
+    //一个设备同一时刻只有一个事务在途，不依赖设备支持流水
+    const CollectorBlock &block = pProfile->blockList.at(device.iBlock);
+    device.uTransactionId++;
+    int iPduLength = buildReadPdu(device.txFrame + 7, block.eRegTable, block.uStartAddr, block.uRegCount);
+    buildMbapHeader(device.txFrame, device.uTransactionId, device.uServerAddr, iPduLength);
+    if(send(device.iSocket, device.txFrame, 7 + iPduLength, MSG_NOSIGNAL) != 7 + iPduLength)
+    {
+        m_errorCount.fetchAndAddRelaxed(1);
+        closeDevice(device, iNowNs);
+        return false;
+    }
+    device.iState = DeviceState_Waiting;
+    device.iDeadlineNs = iNowNs + m_timeoutMs * 1000000LL;
+    return true;
+}
+
+void CollectorWorker::readDevice(CollectorDevice &device, qint64 iNowNs)
+{
+    while(true)
+    {
+        ssize_t iRead = recv(device.iSocket, device.rxBuffer + device.iRxLength, sizeof(device.rxBuffer) - device.iRxLength, 0);
+        if(iRead < 0 && errno == EINTR)
+            continue;
+        if(iRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if(iRead <= 0)
+        {
+            //对端关闭或连接错误
+            m_errorCount.fetchAndAddRelaxed(1);
+            closeDevice(device, iNowNs);
+            return;
+        }
+        device.iRxLength += iRead;
+
+        int iPos = 0;
+        while(device.iRxLength - iPos >= 7)
+        {
+            const quint8 *pFrame = device.rxBuffer + iPos;
+            int iLength = getUInt16(pFrame + 4);
+            if(getUInt16(pFrame + 2) != 0 || iLength < 2 || iLength > 254)
+            {
+                m_errorCount.fetchAndAddRelaxed(1);
+                closeDevice(device, iNowNs);
+                return;
+            }
+            if(device.iRxLength - iPos < 6 + iLength)
+                break;
+            iPos += 6 + iLength;
+
+            //超时后迟到的应答事务号不符，丢弃
+            if(device.iState != DeviceState_Waiting || getUInt16(pFrame) != device.uTransactionId || pFrame[6] != device.uServerAddr)
+                continue;
+
+            const CollectorBlock &block = device.pProfile->blockList.at(device.iBlock);
+            if(parseReadPdu(pFrame + 7, iLength - 1, block.eRegTable, block.uRegCount, m_regBuffer))
+            {
+                decodeBlock(device, block, m_regBuffer, iNowNs);
+                m_transactionCount.fetchAndAddRelaxed(1);
+            }
+            else
+            {
+                //异常应答功能码最高位置1，后跟异常码
+                bool bException = iLength == 3 && (pFrame[7] & 0x80);
+                markBlockQuality(device, block, bException ? Quality_Exception : Quality_CommError, bException ? pFrame[8] : 0, iNowNs);
+                m_errorCount.fetchAndAddRelaxed(1);
+            }
+            device.iBlock++;
+            if(!sendBlock(device, iNowNs))
+                return;
+        }
+
+        //一帧最长260字节，缓冲区剩余空间总能放下下一帧
+        if(iPos > 0)
+        {
+            memmove(device.rxBuffer, device.rxBuffer + iPos, device.iRxLength - iPos);
+            device.iRxLength -= iPos;
+        }
+    }
+}
+
+void CollectorWorker::decodeBlock(CollectorDevice &device, const CollectorBlock &block, const quint16 *pRegValue, qint64 iNowNs)
+{
+    qint64 iAcqTimeMs = iNowNs / 1000000 + m_wallOffsetMs;
+    const CollectorProfile *pProfile = device.pProfile;
+    const SignalCodec &signalCodec = pProfile->signalCodec;
+    bool bIsBit = isBitTable(block.eRegTable);
+    SignalParameter *pSignal = device.signalList.data();
+    int iSignalCount = 0;
+    for(int i=0; i<block.iIntervalCount; i++)
+    {
+        const CollectorInterval &interval = pProfile->intervalList.at(block.iFirstInterval + i);
+        const quint16 *pIntervalValue = pRegValue + interval.uOffset;
+        quint64 qRegValue = bIsBit ? *pIntervalValue : signalCodec.combineRegisters(pIntervalValue, interval.uRegCount);
+        for(int j=0; j<interval.iSignalCount; j++)
+        {
+            SignalParameter &signalParam = pSignal[interval.iFirstSignal + j];
+            quint64 uOldValue = signalParam.uValue;
+            bool bChanged = signalParam.uQuality != Quality_Good;
+            signalCodec.decode(signalParam, qRegValue);
+            signalParam.uQuality = Quality_Good;
+            signalParam.uExceptionCode = 0;
+            signalParam.iAcqMonoNs = iNowNs;
+            signalParam.iAcqTimeMs = iAcqTimeMs;
+            //只输出变化的值，与服务的Debug=3相同
+            if(device.iLogSource >= 0 && (bChanged || signalParam.uValue != uOldValue))
+                pushLogSignal(device, interval.iFirstSignal + j, iAcqTimeMs);
+        }
+        iSignalCount += interval.iSignalCount;
+    }
+    m_signalCount.fetchAndAddRelaxed(iSignalCount);
+}
+
+void CollectorWorker::markBlockQuality(CollectorDevice &device, const CollectorBlock &block, int iQuality, int iExceptionCode, qint64 iNowNs)
+{
+    qint64 iTimeMs = iNowNs / 1000000 + m_wallOffsetMs;
+    const CollectorProfile *pProfile = device.pProfile;
+    SignalParameter *pSignal = device.signalList.data();
+    for(int i=0; i<block.iIntervalCount; i++)
+    {
+        const CollectorInterval &interval = pProfile->intervalList.at(block.iFirstInterval + i);
+        for(int j=0; j<interval.iSignalCount; j++)
+        {
+            SignalParameter &signalParam = pSignal[interval.iFirstSignal + j];
+            //尚未读回的信号保持无值
+            if(signalParam.uQuality == Quality_NoValue)
+                continue;
+            bool bChanged = signalParam.uQuality != iQuality || signalParam.uExceptionCode != iExceptionCode;
+            signalParam.uQuality = iQuality;
+            signalParam.uExceptionCode = iExceptionCode;
+            if(device.iLogSource >= 0 && bChanged)
+                pushLogSignal(device, interval.iFirstSignal + j, iTimeMs);
+        }
+    }
+}
+
+void CollectorWorker::pushLogSignal(const CollectorDevice &device, int iSignalIndex, qint64 iTimeMs)
+{
+    const SignalParameter &signalParam = device.signalList.at(iSignalIndex);
+    LogRecord record;
+    record.iTimeMs = iTimeMs;
+    record.iType = LogRecord_Signal;
+    record.iSource = device.iLogSource;
+    record.iRow = iSignalIndex;
+    record.uValue = signalParam.uValue;
+    record.dValue = signalParam.dValue;
+    record.uQuality = signalParam.uQuality;
+    record.uExceptionCode = signalParam.uExceptionCode;
+    AsyncLogger::instance()->push(record);
+}
@@ -0,0 +1,146 @@
+﻿#ifndef COLLECTORWORKER_H
+#define COLLECTORWORKER_H
+
+#include <QThread>
+#include <QVector>
+#include <QAtomicInteger>
+#include <netinet/in.h>
+#include "commondefine.h"
+#include "signalcodec.h"
+
+//采集器轮询块内的一个区间，uOffset为相对块起始地址的偏移
+struct CollectorInterval
+{
+    quint16 uOffset;
+    quint16 uRegCount;
+    int iFirstSignal;
+    int iSignalCount;
+};
+
+//采集器读请求块，区间在CollectorProfile::intervalList中连续存放
+struct CollectorBlock
+{
+    QModbusDataUnit::RegisterType eRegTable;
+    quint16 uStartAddr;
+    quint16 uRegCount;
+    int iFirstInterval;
+    int iIntervalCount;
+};
+
+//一个协议文件编译后的轮询计划，使用同一协议文件的设备共用
+struct CollectorProfile
+{
+    QString strFileName;
+    QVector<SignalParameter> signalList;    //信号表模板
+    QVector<CollectorBlock> blockList;
+    QVector<CollectorInterval> intervalList;
+    SignalCodec signalCodec;
+};
+
+//设备状态机
+enum CollectorDeviceState
+{
+    DeviceState_Disconnected = 0,   //等待重连时间
+    DeviceState_Connecting,         //非阻塞连接中
+    DeviceState_Idle,               //已连接，等待下一周期
+    DeviceState_Waiting             //已发送请求，等待应答
+};
+
+struct CollectorDevice
+{
+    QString strName;
+    sockaddr_in serverAddr;
+    quint8 uServerAddr;             //从站地址
+    const CollectorProfile *pProfile;
+    QVector<SignalParameter> signalList;    //本设备的信号值
+    int iLogSource;                 //异步日志的数据源编号，不输出为-1
+
+    int iSocket;
+    int iState;                     //CollectorDeviceState
+    int iBlock;                     //本周期当前请求块
+    quint16 uTransactionId;
+    qint64 iDeadlineNs;             //应答超时、连接超时或重连时间
+    qint64 iNextCycleNs;            //下一周期开始时间
+    quint8 txFrame[260];
+    quint8 rxBuffer[520];
+    int iRxLength;
+};
+
+/* 采集器工作线程，不使用Qt事件循环和信号槽
+ * 每个线程一个epoll，管理分配给它的设备连接，timerfd按单调时钟的绝对节拍驱动各设备状态机
+ * 解码后的信号值留在设备的signalList中，改变的值经AsyncLogger输出
+ * 设备周期起点对齐到周期边界，再按设备序号错开整数个节拍，避免所有请求集中在同一时刻
+ * 节拍是绝对时间，处理耗时不累积到后面的周期
+*/
+class CollectorWorker : public QThread
+{
+public:
+    CollectorWorker(int iPeriodMs, int iTimeoutMs, QObject *parent = nullptr);
+    ~CollectorWorker();
+
+    //启动前调用
+    void addDevice(const CollectorDevice &device);
+    //实时模式，参数同RealtimeMode::setCurrentThread，线程启动时设置
+    void setRealtime(int iPriority, int iCpu);
+    int getDeviceCount() const;
+
+    //统计量，其它线程读取
+    qint64 getCycleCount() const;
+    qint64 getTransactionCount() const;
+    qint64 getSignalCount() const;
+    qint64 getErrorCount() const;
+    qint64 getOverrunCount() const;
+    qint64 getCpuTimeNs() const;
+    //启动预热后本线程的堆分配次数，编译时启用分配统计才有值
+    qint64 getAllocCount() const;
+    //周期起点抖动，实际开始时间减计划开始时间
+    qint64 getCycleStartCount() const;
+    qint64 getStartJitterSumNs() const;
+    //取出上次调用以来的最大抖动
+    qint64 takeStartJitterMaxNs();
+    int getConnectedCount() const;
+
+protected:
+    void run() override;
+
+private:
+    void onTick(qint64 iNowNs);
+    void onDeviceEvent(CollectorDevice &device, quint32 uEvents, qint64 iNowNs);
+    void startConnect(CollectorDevice &device, qint64 iNowNs);
+    void closeDevice(CollectorDevice &device, qint64 iNowNs);
+    bool sendBlock(CollectorDevice &device, qint64 iNowNs);
+    void readDevice(CollectorDevice &device, qint64 iNowNs);
+    //iNowNs: 收到应答时的单调时间，作为块内信号的读回时间
+    void decodeBlock(CollectorDevice &device, const CollectorBlock &block, const quint16 *pRegValue, qint64 iNowNs);
+    //读失败或连接断开，块内已读回的信号置为iQuality，值保留
+    void markBlockQuality(CollectorDevice &device, const CollectorBlock &block, int iQuality, int iExceptionCode, qint64 iNowNs);
+    //设备登记了日志数据源时，把值或质量改变的信号写入异步日志
+    void pushLogSignal(const CollectorDevice &device, int iSignalIndex, qint64 iTimeMs);
+
+private:
+    int m_periodMs;
+    int m_timeoutMs;
+    int m_epollFd;
+    qint64 m_wallOffsetMs;          //系统时间减单调时钟ms，每个节拍更新
+    int m_rtPriority;
+    int m_rtCpu;
+    qint64 m_allocStartNs;          //此后开始统计堆分配，连接建立、首个周期的分配不计
+    quint64 m_allocBase;            //开始统计时本线程的分配次数
+    int m_timerFd;
+    QVector<CollectorDevice> m_deviceList;
+    quint16 m_regBuffer[2000];
+
+    QAtomicInteger<qint64> m_cycleCount;        //完成的设备周期数
+    QAtomicInteger<qint64> m_transactionCount;  //成功的读事务数
+    QAtomicInteger<qint64> m_signalCount;       //解码的信号数
+    QAtomicInteger<qint64> m_errorCount;        //超时、异常应答、连接错误
+    QAtomicInteger<qint64> m_overrunCount;      //周期开始时上一周期未完成
+    QAtomicInteger<qint64> m_cpuTimeNs;         //线程CPU时间
+    QAtomicInteger<qint64> m_allocCount;        //预热后的堆分配次数
+    QAtomicInteger<qint64> m_cycleStartCount;   //按计划开始的设备周期数，晚于一个周期的不计
+    QAtomicInteger<qint64> m_jitterSumNs;
+    QAtomicInteger<qint64> m_jitterMaxNs;
+    QAtomicInt m_connectedCount;
+};
+
+#endif // COLLECTORWORKER_H
@@ -1,11 +1,33 @@
 ﻿#ifndef COMMONDEFINE_H
 #define COMMONDEFINE_H
 #include <QString>
+#include <QModbusDataUnit>
+#include <string.h>
 
 //软件寄存器地址比设备低1，设备400地址，软件要读399
 //#define REGADDR_OFFSET 1
 #define REGADDR_OFFSET 0
 
+//信号数据类型，加载时由DataType字段解析
+enum SignalDataType
+{
+    DataType_UInt = 0,                   //无符号整数，默认
+    DataType_Int,                        //有符号整数，按Length位做符号扩展
+    DataType_Float32,                    //IEEE754单精度，Length必须为32
+    DataType_Float64,                    //IEEE754双精度，Length必须为64
+    DataType_BCD                         //BCD码，每4位一个十进制数字
+};
+
+//信号质量，随值一起输出
+enum SignalQuality
+{
+    Quality_NoValue = 0,                 //尚未读回
+    Quality_Good,                        //最近一次轮询读回
+    Quality_Stale,                       //超过时效未读回，值为最后一次读回的值
+    Quality_CommError,                   //超时、帧错误或链路断开
+    Quality_Exception                    //从站异常应答，异常码见uExceptionCode
+};
+
 //通讯协议参数
 struct  SignalProtocolParam
 {
@@ -26,14 +48,174 @@ struct SignalParameter
     quint16  uRegisterAddr;              //寄存器地址
     quint16  uBitPos;                    //BIT位偏移
     quint16  uLength;                    //数据BIT位长度
-    quint64  uValue;                     //参数数值
+    quint64  uValue;                     //参数原始数值（寄存器中的位）
+    QModbusDataUnit::RegisterType eRegTable; //寄存器类型 线圈、离散输入、输入寄存器、保持寄存器
+    quint8   uServerAddr;                //从站地址，同一链路多个从站时区分信号所属设备
+    int      iDataType;                  //数据类型 SignalDataType
+    double   dScale;                     //线性缩放系数 工程值=原始值*dScale+dOffset
+    double   dOffset;                    //线性偏移
+    double   dValue;                     //工程值，解码时计算
+    quint64  uVersion;                   //值或质量最近一次改变时的数据版本，0为尚未读回
+    quint8   uQuality;                   //SignalQuality
+    quint8   uExceptionCode;             //uQuality为Quality_Exception时的从站异常码
+    qint64   iAcqMonoNs;                 //最近一次读回的时间，单调时钟ns，同一应答内的信号相同
+    qint64   iAcqTimeMs;                 //最近一次读回的时间，自1970年起的ms
+    int      iAggregateMs;               //聚合窗口ms，0不聚合
 };
 
+inline const char *signalQualityName(int iQuality)
+{
+    switch(iQuality)
+    {
+    case Quality_Good: return "GOOD";
+    case Quality_Stale: return "STALE";
+    case Quality_CommError: return "COMM";
+    case Quality_Exception: return "EXCEPTION";
+    default: return "NOVALUE";
+    }
+}
+
+//信号的每秒变化量，Rate告警和派生信号rate()共用
+struct SignalRate
+{
+    qint64 iLastNs;                 //上次读回时间，0为尚无样本
+    double dLastValue;              //上次读回的值
+    double dRate;                   //最近的每秒变化量
+};
+
+inline void resetSignalRate(SignalRate &rate)
+{
+    rate.iLastNs = 0;
+    rate.dLastValue = 0;
+    rate.dRate = 0;
+}
+
+//按读回时间更新并返回每秒变化量，同一次读回重复计算时保持上次结果
+inline double updateSignalRate(SignalRate &rate, const SignalParameter &signalParam)
+{
+    if(rate.iLastNs != 0 && signalParam.iAcqMonoNs > rate.iLastNs)
+        rate.dRate = (signalParam.dValue - rate.dLastValue) * 1e9 / (signalParam.iAcqMonoNs - rate.iLastNs);
+    if(signalParam.iAcqMonoNs != rate.iLastNs)
+    {
+        rate.iLastNs = signalParam.iAcqMonoNs;
+        rate.dLastValue = signalParam.dValue;
+    }
+    return rate.dRate;
+}
+
 struct SignalSturct
 {
-    int iRegBitLengh;               //寄存器占用长度 1位、16位为16，32位为32，64位为64
+    int iRegBitLengh;               //寄存器占用长度 1位、16位为16，32位为32，64位为64，线圈、离散输入为1
     bool bIsReadReg;                //读寄存器还是写寄存器
     QList<SignalParameter> spList;
 };
 
+//派生信号，值由其它信号的表达式计算，不占寄存器
+struct DerivedSignalDef
+{
+    SignalParameter signalParam;    //寄存器字段不用
+    QString strExpr;                //表达式，见DerivedSignalEngine
+};
+
+//告警类型
+enum AlarmKind
+{
+    Alarm_High = 0,                 //高于限值
+    Alarm_Low,                      //低于限值
+    Alarm_Rate,                     //每秒变化量的绝对值高于限值
+    Alarm_Equal,                    //等于限值，用于状态
+    Alarm_NotEqual                  //不等于限值
+};
+
+//信号告警定义，协议文件AlarmArray
+struct AlarmDef
+{
+    QString strKey;                 //告警Key
+    QString strSignalKey;           //监视的信号Key
+    QString strDesc;                //告警描述
+    int iKind;                      //AlarmKind
+    double dLimit;                  //限值，工程值
+    double dDeadband;               //回差，高限告警低于限值-回差才恢复，低限相反；Equal、NotEqual不用
+    int iDelayMs;                   //条件持续该时间后才告警，0立即告警
+    int iSeverity;                  //告警等级 0-255
+};
+
+//寄存器Map的Key 19-26位:从站地址 16-18位:寄存器类型 低16位:寄存器地址，按Key排序即按从站、类型、地址排序
+inline quint32 makeRegKey(QModbusDataUnit::RegisterType eRegTable, quint16 uRegAddr)
+{
+    return (static_cast<quint32>(eRegTable) << 16) | uRegAddr;
+}
+
+inline quint32 makeRegKey(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uRegAddr)
+{
+    return (static_cast<quint32>(uServerAddr) << 19) | makeRegKey(eRegTable, uRegAddr);
+}
+
+inline quint16 regKeyAddr(quint32 uRegKey)
+{
+    return static_cast<quint16>(uRegKey);
+}
+
+inline QModbusDataUnit::RegisterType regKeyTable(quint32 uRegKey)
+{
+    return static_cast<QModbusDataUnit::RegisterType>((uRegKey >> 16) & 0x7);
+}
+
+inline quint8 regKeyServer(quint32 uRegKey)
+{
+    return static_cast<quint8>(uRegKey >> 19);
+}
+
+//线圈、离散输入按位寻址，一个地址一个点
+inline bool isBitTable(QModbusDataUnit::RegisterType eRegTable)
+{
+    return eRegTable == QModbusDataUnit::Coils || eRegTable == QModbusDataUnit::DiscreteInputs;
+}
+
+//寄存器地址区间，协议分析后生成，区间之间互不重叠
+struct RegisterInterval
+{
+    quint8 uServerAddr;             //从站地址
+    QModbusDataUnit::RegisterType eRegTable; //寄存器类型
+    quint16 uStartAddr;             //起始寄存器地址
+    quint16 uRegCount;              //占用寄存器个数 16位为1，32位为2，64位为4，线圈、离散输入为1
+    bool bIsReadReg;                //读寄存器还是写寄存器
+    int iFirstSignal;               //区间内第一个信号在信号表中的下标
+    int iSignalCount;               //区间内信号个数，信号在信号表中连续存放
+};
+
+//轮询块，一次读请求覆盖的连续寄存器或线圈
+struct PollBlock
+{
+    quint8 uServerAddr;             //从站地址
+    QModbusDataUnit::RegisterType eRegTable; //寄存器类型
+    quint16 uStartAddr;             //起始寄存器地址
+    quint16 uRegCount;              //寄存器个数，线圈、离散输入为点数
+};
+
+//链路收发计数，只由链路线程累加，按周期复制给指标输出
+struct LinkCounters
+{
+    quint64 uTransactions;          //完成的事务数，含失败
+    quint64 uFailures;              //失败的事务数，含超时、异常应答、帧错误
+    quint64 uTimeouts;              //超时的事务数
+    quint64 uFrameErrors;           //CRC错误、帧定界错误、应答不匹配
+    quint64 exceptionCount[16];     //按Modbus异常码统计的异常应答数，下标为异常码
+    quint64 uBytesOut;              //发出的ADU字节数
+    quint64 uBytesIn;               //收到的字节数
+
+    LinkCounters() { memset(this, 0, sizeof(LinkCounters)); }
+
+    //iExceptionCode为0时只记为失败
+    void addResult(bool bSuccess, int iExceptionCode)
+    {
+        uTransactions++;
+        if(bSuccess)
+            return;
+        uFailures++;
+        if(iExceptionCode > 0 && iExceptionCode < 16)
+            exceptionCount[iExceptionCode]++;
+    }
+};
+
 #endif // COMMONDEFINE_H
@@ -0,0 +1,148 @@
+﻿#include "cycletimer.h"
+#include <QDeadlineTimer>
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+CycleTimer::CycleTimer(QObject *parent) : QObject(parent),
+    m_periodMs(100),
+    m_phaseMs(0),
+    m_bActive(false),
+    m_nextDeadlineNs(0),
+    m_timerFd(-1),
+    m_notifier(nullptr),
+    m_fallbackTimer(nullptr)
+{
+#ifdef Q_OS_LINUX
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerFd >= 0)
+    {
+        m_notifier = new QSocketNotifier(m_timerFd, QSocketNotifier::Read, this);
+        m_notifier->setEnabled(false);
+        connect(m_notifier, &QSocketNotifier::activated, this, &CycleTimer::slot_expired);
+        return;
+    }
+    qDebug()<<"CycleTimer: timerfd_create failed: " + QString(strerror(errno)) + ", using QTimer";
+#endif
+    m_fallbackTimer = new QTimer(this);
+    m_fallbackTimer->setSingleShot(true);
+    m_fallbackTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_fallbackTimer, &QTimer::timeout, this, &CycleTimer::slot_expired);
+}
+
+CycleTimer::~CycleTimer()
+{
+#ifdef Q_OS_LINUX
+    if(m_timerFd >= 0)
+        close(m_timerFd);
+#endif
+}
+
+void CycleTimer::setInterval(int iPeriodMs)
+{
+    m_periodMs = iPeriodMs > 0 ? iPeriodMs : 100;
+}
+
+void CycleTimer::setPhase(int iPhaseMs)
+{
+    m_phaseMs = iPhaseMs;
+}
+
+int CycleTimer::interval() const
+{
+    return m_periodMs;
+}
+
+bool CycleTimer::isActive() const
+{
+    return m_bActive;
+}
+
+const JitterStats &CycleTimer::getJitterStats() const
+{
+    return m_jitterStats;
+}
+
+qint64 CycleTimer::monotonicNs()
+{
+    return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+}
+
+qint64 CycleTimer::alignDeadline(qint64 iNowNs) const
+{
+    qint64 iPeriodNs = m_periodMs * 1000000LL;
+    qint64 iPhaseNs = ((m_phaseMs * 1000000LL) % iPeriodNs + iPeriodNs) % iPeriodNs;
+    return ((iNowNs - iPhaseNs) / iPeriodNs + 1) * iPeriodNs + iPhaseNs;
+}
+
+void CycleTimer::start()
+{
+    m_nextDeadlineNs = alignDeadline(monotonicNs());
+    m_bActive = true;
+#ifdef Q_OS_LINUX
+    if(m_timerFd >= 0)
+    {
+        itimerspec timerSpec;
+        timerSpec.it_interval.tv_sec = m_periodMs / 1000;
+        timerSpec.it_interval.tv_nsec = (m_periodMs % 1000) * 1000000L;
+        timerSpec.it_value.tv_sec = m_nextDeadlineNs / 1000000000LL;
+        timerSpec.it_value.tv_nsec = m_nextDeadlineNs % 1000000000LL;
+        timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &timerSpec, nullptr);
+        m_notifier->setEnabled(true);
+        return;
+    }
+#endif
+    //向上取整到ms，不早于起点唤醒
+    m_fallbackTimer->start((int)qMax<qint64>(0, (m_nextDeadlineNs - monotonicNs() + 999999) / 1000000));
+}
+
+void CycleTimer::stop()
+{
+    m_bActive = false;
+#ifdef Q_OS_LINUX
+    if(m_timerFd >= 0)
+    {
+        itimerspec timerSpec;
+        memset(&timerSpec, 0, sizeof(timerSpec));
+        timerfd_settime(m_timerFd, 0, &timerSpec, nullptr);
+        m_notifier->setEnabled(false);
+        return;
+    }
+#endif
+    m_fallbackTimer->stop();
+}
+
+void CycleTimer::slot_expired()
+{
+    qint64 iNowNs = monotonicNs();
+    qint64 iPeriodNs = m_periodMs * 1000000LL;
+    qint64 iExpirations = 1;
+#ifdef Q_OS_LINUX
+    if(m_timerFd >= 0)
+    {
+        quint64 uExpirations = 0;
+        if(read(m_timerFd, &uExpirations, sizeof(uExpirations)) != sizeof(uExpirations) || uExpirations == 0)
+            return;
+        iExpirations = (qint64)uExpirations;
+    }
+#endif
+    if(!m_bActive)
+        return;
+
+    //QTimer没有到期次数，按时间推算错过的周期
+    if(m_timerFd < 0 && iNowNs >= m_nextDeadlineNs + iPeriodNs)
+        iExpirations = (iNowNs - m_nextDeadlineNs) / iPeriodNs + 1;
+
+    //本次唤醒对应最近一个已到的起点，之前的周期跳过
+    qint64 iDeadlineNs = m_nextDeadlineNs + (iExpirations - 1) * iPeriodNs;
+    m_jitterStats.uMissed += iExpirations - 1;
+    m_jitterStats.add(qMax<qint64>(0, iNowNs - iDeadlineNs) / 1000);
+    m_nextDeadlineNs = iDeadlineNs + iPeriodNs;
+
+    if(m_fallbackTimer)
+        m_fallbackTimer->start((int)qMax<qint64>(0, (m_nextDeadlineNs - monotonicNs() + 999999) / 1000000));
+    emit sig_cycle(iDeadlineNs);
+}
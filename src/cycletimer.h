@@ -0,0 +1,90 @@
+﻿#ifndef CYCLETIMER_H
+#define CYCLETIMER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QSocketNotifier>
+#include <string.h>
+
+//周期起点抖动统计，抖动为实际唤醒时间减计划时间，桶上限us，最后一个桶为+Inf
+struct JitterStats
+{
+    enum
+    {
+        BucketCount = 10
+    };
+
+    quint64 bucketCount[BucketCount];   //各桶的周期数，不累加
+    quint64 uCount;
+    quint64 uMissed;                    //唤醒太迟而整个跳过的周期数
+    double dSumUs;
+    qint64 iMaxUs;
+
+    JitterStats() { memset(this, 0, sizeof(JitterStats)); }
+
+    static double getBucketBoundUs(int iBucket)
+    {
+        static const double boundUs[BucketCount - 1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000};
+        return boundUs[iBucket];
+    }
+
+    void add(qint64 iJitterUs)
+    {
+        int iBucket = 0;
+        while(iBucket < BucketCount - 1 && iJitterUs > getBucketBoundUs(iBucket))
+            iBucket++;
+        bucketCount[iBucket]++;
+        uCount++;
+        dSumUs += iJitterUs;
+        if(iJitterUs > iMaxUs)
+            iMaxUs = iJitterUs;
+    }
+};
+
+/* 周期执行定时器，按CLOCK_MONOTONIC的绝对时间触发
+ * 周期起点为 k*周期+相位，不随事件循环负载累积漂移；周期相同的链路起点对齐，不同周期的链路在公倍数处对齐
+ * Linux使用timerfd绝对定时，其它平台用精确QTimer按下一个绝对起点重新定时
+ * 唤醒迟于一个周期时跳过错过的周期，不补发
+*/
+class CycleTimer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CycleTimer(QObject *parent = nullptr);
+    ~CycleTimer();
+
+    void setInterval(int iPeriodMs);
+    //iPhaseMs: 周期起点相对周期边界的偏移
+    void setPhase(int iPhaseMs);
+    int interval() const;
+    void start();
+    void stop();
+    bool isActive() const;
+    const JitterStats &getJitterStats() const;
+
+    //单调时钟ns，与QDeadlineTimer、timerfd同一时钟
+    static qint64 monotonicNs();
+
+signals:
+    //iDeadlineNs: 本周期计划的起点
+    void sig_cycle(qint64 iDeadlineNs);
+
+private slots:
+    void slot_expired();
+
+private:
+    //下一个不早于iNowNs的周期起点
+    qint64 alignDeadline(qint64 iNowNs) const;
+
+private:
+    int m_periodMs;
+    int m_phaseMs;
+    bool m_bActive;
+    qint64 m_nextDeadlineNs;
+    int m_timerFd;                  //Linux timerfd，创建失败时为-1，改用m_fallbackTimer
+    QSocketNotifier *m_notifier;
+    QTimer *m_fallbackTimer;
+    JitterStats m_jitterStats;
+};
+
+#endif // CYCLETIMER_H
@@ -0,0 +1,724 @@
+﻿#include "derivedsignalengine.h"
+#include <math.h>
+
+//质量从好到差的次序，派生信号取输入中最差的
+static int qualityRank(int iQuality)
+{
+    switch(iQuality)
+    {
+    case Quality_Good: return 0;
+    case Quality_Stale: return 1;
+    case Quality_Exception: return 2;
+    case Quality_CommError: return 3;
+    default: return 4;
+    }
+}
+
+//位运算的整数，超出64位范围的按0
+static qint64 toInteger(double dValue)
+{
+    if(!(dValue > -9.2e18 && dValue < 9.2e18))
+        return 0;
+    return (qint64)dValue;
+}
+
+class DerivedSignalEngine::Compiler
+{
+public:
+    Compiler(DerivedSignalEngine *pEngine, DerivedSignal &derived, const QString &strExpr,
+             const QString &strKeyPrefix, const QHash<QString, int> &signalIndexHash) :
+        m_pEngine(pEngine), m_derived(derived), m_strExpr(strExpr), m_strKeyPrefix(strKeyPrefix),
+        m_signalIndexHash(signalIndexHash), m_iPos(0), m_iTokenPos(0), m_iTokenType(Token_End), m_dNumber(0), m_iDepth(0), m_iMaxDepth(0)
+    {
+    }
+
+    bool compile(QString &strError)
+    {
+        next();
+        bool bOk = parseTernary();
+        if(bOk && m_iTokenType != Token_End)
+            bOk = fail(QString("unexpected '%1'").arg(m_strToken));
+        if(bOk && m_iMaxDepth > MaxStackDepth)
+            bOk = fail("expression too deep");
+        strError = m_strError;
+        return bOk;
+    }
+
+private:
+    enum TokenType
+    {
+        Token_End = 0,
+        Token_Number,
+        Token_Ident,
+        Token_Op                    //运算符、括号、逗号，文字在m_strToken
+    };
+
+    bool fail(const QString &strError)
+    {
+        if(m_strError.isEmpty())
+            m_strError = QString("%1 at column %2").arg(strError).arg(m_iTokenPos + 1);
+        return false;
+    }
+
+    bool isOp(const char *pOp) const
+    {
+        return m_iTokenType == Token_Op && m_strToken == QLatin1String(pOp);
+    }
+
+    void next()
+    {
+        while(m_iPos < m_strExpr.size() && m_strExpr.at(m_iPos).isSpace())
+            m_iPos++;
+        m_iTokenPos = m_iPos;
+        if(m_iPos >= m_strExpr.size())
+        {
+            m_iTokenType = Token_End;
+            m_strToken.clear();
+            return;
+        }
+
+        QChar ch = m_strExpr.at(m_iPos);
+        if(ch.isDigit() || (ch == '.' && m_iPos + 1 < m_strExpr.size() && m_strExpr.at(m_iPos + 1).isDigit()))
+        {
+            int iStart = m_iPos;
+            bool bOk = false;
+            if(m_strExpr.mid(m_iPos, 2).toLower() == "0x")
+            {
+                m_iPos += 2;
+                while(m_iPos < m_strExpr.size() && isxdigit(m_strExpr.at(m_iPos).toLatin1()))
+                    m_iPos++;
+                m_dNumber = (double)m_strExpr.mid(iStart + 2, m_iPos - iStart - 2).toULongLong(&bOk, 16);
+            }
+            else
+            {
+                while(m_iPos < m_strExpr.size())
+                {
+                    QChar digit = m_strExpr.at(m_iPos);
+                    if(digit == 'e' || digit == 'E')
+                    {
+                        m_iPos++;
+                        if(m_iPos < m_strExpr.size() && (m_strExpr.at(m_iPos) == '+' || m_strExpr.at(m_iPos) == '-'))
+                            m_iPos++;
+                    }
+                    else if(digit.isDigit() || digit == '.')
+                        m_iPos++;
+                    else
+                        break;
+                }
+                m_dNumber = m_strExpr.mid(iStart, m_iPos - iStart).toDouble(&bOk);
+            }
+            m_strToken = m_strExpr.mid(iStart, m_iPos - iStart);
+            m_iTokenType = bOk ? Token_Number : Token_Op;
+            return;
+        }
+
+        if(ch.isLetter() || ch == '_')
+        {
+            int iStart = m_iPos;
+            while(m_iPos < m_strExpr.size() && (m_strExpr.at(m_iPos).isLetterOrNumber() || m_strExpr.at(m_iPos) == '_' || m_strExpr.at(m_iPos) == '.'))
+                m_iPos++;
+            m_strToken = m_strExpr.mid(iStart, m_iPos - iStart);
+            m_iTokenType = Token_Ident;
+            return;
+        }
+
+        static const char *twoCharOps[] = {"||", "&&", "==", "!=", "<=", ">=", "<<", ">>"};
+        for(unsigned i=0; i<sizeof(twoCharOps)/sizeof(twoCharOps[0]); i++)
+        {
+            if(m_strExpr.mid(m_iPos, 2) == QLatin1String(twoCharOps[i]))
+            {
+                m_strToken = QLatin1String(twoCharOps[i]);
+                m_iTokenType = Token_Op;
+                m_iPos += 2;
+                return;
+            }
+        }
+        m_strToken = QString(ch);
+        m_iTokenType = Token_Op;
+        m_iPos++;
+    }
+
+    //iEffect: 对栈深度的影响
+    void append(int iCode, int iEffect, int iOperand = 0, double dConst = 0)
+    {
+        DerivedOp op;
+        op.iCode = iCode;
+        op.iOperand = iOperand;
+        op.iState = -1;
+        op.dConst = dConst;
+        if(iCode == Op_Rate)
+        {
+            SignalRate rate;
+            resetSignalRate(rate);
+            op.iState = m_pEngine->m_rateList.size();
+            m_pEngine->m_rateList.append(rate);
+        }
+        m_pEngine->m_codeList.append(op);
+        m_iDepth += iEffect;
+        m_iMaxDepth = qMax(m_iMaxDepth, m_iDepth);
+    }
+
+    //跳转目标在后面的代码生成后由patchJump填入，返回跳转指令的位置
+    int appendJump(int iCode, int iEffect)
+    {
+        append(iCode, iEffect);
+        return m_pEngine->m_codeList.size() - 1;
+    }
+
+    void patchJump(int iJump)
+    {
+        m_pEngine->m_codeList[iJump].iOperand = m_pEngine->m_codeList.size();
+    }
+
+    bool parseTernary()
+    {
+        if(!parseBinary(0))
+            return false;
+        if(!isOp("?"))
+            return true;
+        next();
+        //条件为0跳到冒号后的分支，两个分支各自压入一个结果
+        int iElseJump = appendJump(Op_JumpIfZero, -1);
+        if(!parseTernary())
+            return false;
+        if(!isOp(":"))
+            return fail("expected ':'");
+        next();
+        int iEndJump = appendJump(Op_Jump, -1);
+        patchJump(iElseJump);
+        if(!parseTernary())
+            return false;
+        patchJump(iEndJump);
+        return true;
+    }
+
+    //iLevel越大优先级越高，同C
+    bool parseBinary(int iLevel)
+    {
+        static const struct { int iLevel; const char *pOp; int iCode; } binaryOps[] =
+        {
+            {0, "||", Op_OrJump}, {1, "&&", Op_AndJump}, {2, "|", Op_BitOr}, {3, "^", Op_BitXor}, {4, "&", Op_BitAnd},
+            {5, "==", Op_Eq}, {5, "!=", Op_Ne},
+            {6, "<", Op_Lt}, {6, "<=", Op_Le}, {6, ">", Op_Gt}, {6, ">=", Op_Ge},
+            {7, "<<", Op_Shl}, {7, ">>", Op_Shr},
+            {8, "+", Op_Add}, {8, "-", Op_Sub},
+            {9, "*", Op_Mul}, {9, "/", Op_Div}, {9, "%", Op_Mod}
+        };
+        if(iLevel > 9)
+            return parseUnary();
+        if(!parseBinary(iLevel + 1))
+            return false;
+        while(true)
+        {
+            int iCode = -1;
+            for(unsigned i=0; i<sizeof(binaryOps)/sizeof(binaryOps[0]); i++)
+            {
+                if(binaryOps[i].iLevel == iLevel && isOp(binaryOps[i].pOp))
+                    iCode = binaryOps[i].iCode;
+            }
+            if(iCode < 0)
+                return true;
+            next();
+            //&& ||左边已定结果时跳过右边
+            if(iCode == Op_AndJump || iCode == Op_OrJump)
+            {
+                int iJump = appendJump(iCode, -1);
+                if(!parseBinary(iLevel + 1))
+                    return false;
+                append(Op_Bool, 0);
+                patchJump(iJump);
+                continue;
+            }
+            if(!parseBinary(iLevel + 1))
+                return false;
+            append(iCode, -1);
+        }
+    }
+
+    bool parseUnary()
+    {
+        int iCode = -1;
+        if(isOp("-"))
+            iCode = Op_Neg;
+        else if(isOp("!"))
+            iCode = Op_Not;
+        else if(isOp("~"))
+            iCode = Op_BitNot;
+        else if(isOp("+"))
+        {
+            next();
+            return parseUnary();
+        }
+        if(iCode < 0)
+            return parsePrimary();
+        next();
+        if(!parseUnary())
+            return false;
+        append(iCode, 0);
+        return true;
+    }
+
+    bool parsePrimary()
+    {
+        if(m_iTokenType == Token_Number)
+        {
+            append(Op_Const, 1, 0, m_dNumber);
+            next();
+            return true;
+        }
+        if(isOp("("))
+        {
+            next();
+            if(!parseTernary())
+                return false;
+            if(!isOp(")"))
+                return fail("expected ')'");
+            next();
+            return true;
+        }
+        if(m_iTokenType != Token_Ident)
+            return fail(m_iTokenType == Token_End ? QString("unexpected end") : QString("unexpected '%1'").arg(m_strToken));
+
+        QString strName = m_strToken;
+        next();
+        if(isOp("("))
+            return parseCall(strName);
+
+        int iSignalIndex = findSignal(strName);
+        if(iSignalIndex < 0)
+            return fail(QString("unknown signal %1").arg(strName));
+        if(!m_derived.inputList.contains(iSignalIndex))
+            m_derived.inputList.append(iSignalIndex);
+        append(Op_Signal, 1, iSignalIndex);
+        return true;
+    }
+
+    bool parseCall(const QString &strName)
+    {
+        next();
+        //rate的参数只能是信号
+        if(strName == "rate")
+        {
+            if(m_iTokenType != Token_Ident)
+                return fail("rate() takes a signal key");
+            int iSignalIndex = findSignal(m_strToken);
+            if(iSignalIndex < 0)
+                return fail(QString("unknown signal %1").arg(m_strToken));
+            next();
+            if(!isOp(")"))
+                return fail("expected ')'");
+            next();
+            if(!m_derived.rateInputList.contains(iSignalIndex))
+                m_derived.rateInputList.append(iSignalIndex);
+            append(Op_Rate, 1, iSignalIndex);
+            return true;
+        }
+
+        int iArgCount = 0;
+        if(!isOp(")"))
+        {
+            while(true)
+            {
+                if(!parseTernary())
+                    return false;
+                iArgCount++;
+                if(isOp(")"))
+                    break;
+                if(!isOp(","))
+                    return fail("expected ',' or ')'");
+                next();
+            }
+        }
+        next();
+
+        static const struct { const char *pName; int iCode; int iMinArgs; int iMaxArgs; } functions[] =
+        {
+            {"abs", Op_Abs, 1, 1}, {"sqrt", Op_Sqrt, 1, 1}, {"floor", Op_Floor, 1, 1}, {"ceil", Op_Ceil, 1, 1},
+            {"round", Op_Round, 1, 1}, {"bit", Op_Bit, 2, 2}, {"min", Op_Min, 2, MaxArgs}, {"max", Op_Max, 2, MaxArgs}
+        };
+        for(unsigned i=0; i<sizeof(functions)/sizeof(functions[0]); i++)
+        {
+            if(strName != QLatin1String(functions[i].pName))
+                continue;
+            if(iArgCount < functions[i].iMinArgs || iArgCount > functions[i].iMaxArgs)
+                return fail(QString("wrong number of arguments to %1()").arg(strName));
+            append(functions[i].iCode, 1 - iArgCount, iArgCount);
+            return true;
+        }
+        return fail(QString("unknown function %1()").arg(strName));
+    }
+
+    int findSignal(const QString &strName) const
+    {
+        int iSignalIndex = m_signalIndexHash.value(m_strKeyPrefix + strName, -1);
+        if(iSignalIndex < 0 && !m_strKeyPrefix.isEmpty())
+            iSignalIndex = m_signalIndexHash.value(strName, -1);
+        return iSignalIndex;
+    }
+
+private:
+    DerivedSignalEngine *m_pEngine;
+    DerivedSignal &m_derived;
+    const QString &m_strExpr;
+    const QString &m_strKeyPrefix;
+    const QHash<QString, int> &m_signalIndexHash;
+    int m_iPos;
+    int m_iTokenPos;
+    int m_iTokenType;
+    QString m_strToken;
+    double m_dNumber;
+    int m_iDepth;
+    int m_iMaxDepth;
+    QString m_strError;
+};
+
+DerivedSignalEngine::DerivedSignalEngine() :
+    m_firstPending(0)
+{
+
+}
+
+void DerivedSignalEngine::clear()
+{
+    m_codeList.clear();
+    m_rateList.clear();
+    m_derivedList.clear();
+    m_derivedIndexHash.clear();
+    m_edgeStart.clear();
+    m_edgeList.clear();
+    m_updatedList.clear();
+    m_firstPending = 0;
+}
+
+bool DerivedSignalEngine::addSignal(int iSignalIndex, const QString &strExpr, const QString &strKeyPrefix, const QHash<QString, int> &signalIndexHash, QString &strError)
+{
+    DerivedSignal derived;
+    derived.iSignalIndex = iSignalIndex;
+    derived.iCodeStart = m_codeList.size();
+    derived.bValid = false;
+    derived.bPending = false;
+
+    int iRateCount = m_rateList.size();
+    Compiler compiler(this, derived, strExpr, strKeyPrefix, signalIndexHash);
+    if(!compiler.compile(strError))
+    {
+        m_codeList.resize(derived.iCodeStart);
+        m_rateList.resize(iRateCount);
+        return false;
+    }
+    derived.iCodeCount = m_codeList.size() - derived.iCodeStart;
+    m_derivedIndexHash.insert(iSignalIndex, m_derivedList.size());
+    m_derivedList.append(derived);
+    return true;
+}
+
+bool DerivedSignalEngine::finalize(const QVector<SignalParameter> &signalList, QString &strError)
+{
+    //派生信号之间按输入关系拓扑排序，排在前面的先算
+    int iCount = m_derivedList.size();
+    QVector<int> inDegreeList(iCount, 0);
+    QVector<QVector<int> > dependentList(iCount);
+    for(int i=0; i<iCount; i++)
+    {
+        const DerivedSignal &derived = m_derivedList.at(i);
+        for(int k=0; k<2; k++)
+        {
+            const QVector<int> &inputList = k == 0 ? derived.inputList : derived.rateInputList;
+            for(int j=0; j<inputList.size(); j++)
+            {
+                int iInput = m_derivedIndexHash.value(inputList.at(j), -1);
+                if(iInput < 0 || dependentList.at(iInput).contains(i))
+                    continue;
+                dependentList[iInput].append(i);
+                inDegreeList[i]++;
+            }
+        }
+    }
+
+    QVector<int> orderList;
+    for(int i=0; i<iCount; i++)
+    {
+        if(inDegreeList.at(i) == 0)
+            orderList.append(i);
+    }
+    for(int i=0; i<orderList.size(); i++)
+    {
+        const QVector<int> &nextList = dependentList.at(orderList.at(i));
+        for(int j=0; j<nextList.size(); j++)
+        {
+            if(--inDegreeList[nextList.at(j)] == 0)
+                orderList.append(nextList.at(j));
+        }
+    }
+
+    //环上和依赖环的派生信号排在最后，不计算
+    QStringList cycleList;
+    for(int i=0; i<iCount; i++)
+    {
+        if(inDegreeList.at(i) > 0)
+        {
+            orderList.append(i);
+            cycleList.append(signalList.at(m_derivedList.at(i).iSignalIndex).strKey);
+        }
+    }
+
+    QVector<DerivedSignal> sortedList;
+    m_derivedIndexHash.clear();
+    for(int i=0; i<orderList.size(); i++)
+    {
+        DerivedSignal derived = m_derivedList.at(orderList.at(i));
+        derived.bValid = inDegreeList.at(orderList.at(i)) == 0;
+        derived.bPending = false;
+        m_derivedIndexHash.insert(derived.iSignalIndex, sortedList.size());
+        sortedList.append(derived);
+    }
+    m_derivedList = sortedList;
+
+    //按输入信号下标排列的依赖边
+    int iSignalCount = signalList.size();
+    m_edgeStart.fill(0, iSignalCount + 1);
+    for(int i=0; i<m_derivedList.size(); i++)
+    {
+        const DerivedSignal &derived = m_derivedList.at(i);
+        if(!derived.bValid)
+            continue;
+        for(int j=0; j<derived.inputList.size(); j++)
+            m_edgeStart[derived.inputList.at(j) + 1]++;
+        for(int j=0; j<derived.rateInputList.size(); j++)
+            m_edgeStart[derived.rateInputList.at(j) + 1]++;
+    }
+    for(int i=0; i<iSignalCount; i++)
+        m_edgeStart[i + 1] += m_edgeStart.at(i);
+
+    m_edgeList.resize(m_edgeStart.at(iSignalCount));
+    QVector<int> fillList = m_edgeStart;
+    for(int i=0; i<m_derivedList.size(); i++)
+    {
+        const DerivedSignal &derived = m_derivedList.at(i);
+        if(!derived.bValid)
+            continue;
+        for(int j=0; j<derived.inputList.size(); j++)
+        {
+            DependentEdge &edge = m_edgeList[fillList[derived.inputList.at(j)]++];
+            edge.iDerived = i;
+            edge.bOnSample = false;
+        }
+        for(int j=0; j<derived.rateInputList.size(); j++)
+        {
+            DependentEdge &edge = m_edgeList[fillList[derived.rateInputList.at(j)]++];
+            edge.iDerived = i;
+            edge.bOnSample = true;
+        }
+    }
+    m_firstPending = m_derivedList.size();
+    m_updatedList.reserve(m_derivedList.size());
+
+    if(cycleList.isEmpty())
+        return true;
+    strError = QString("circular reference among %1").arg(cycleList.join(","));
+    return false;
+}
+
+int DerivedSignalEngine::getSignalCount() const
+{
+    return m_derivedList.size();
+}
+
+bool DerivedSignalEngine::isDerived(int iSignalIndex) const
+{
+    return m_derivedIndexHash.contains(iSignalIndex);
+}
+
+void DerivedSignalEngine::markInput(int iSignalIndex, bool bChanged)
+{
+    int iEnd = m_edgeStart.at(iSignalIndex + 1);
+    for(int i=m_edgeStart.at(iSignalIndex); i<iEnd; i++)
+    {
+        const DependentEdge &edge = m_edgeList.at(i);
+        if(!bChanged && !edge.bOnSample)
+            continue;
+        DerivedSignal &derived = m_derivedList[edge.iDerived];
+        if(derived.bPending)
+            continue;
+        derived.bPending = true;
+        if(edge.iDerived < m_firstPending)
+            m_firstPending = edge.iDerived;
+    }
+}
+
+bool DerivedSignalEngine::hasPending() const
+{
+    return m_firstPending < m_derivedList.size();
+}
+
+bool DerivedSignalEngine::evaluate(QVector<SignalParameter> &signalList, quint64 uVersion)
+{
+    bool bAnyChanged = false;
+    m_updatedList.resize(0);
+    //依赖的派生信号排在后面，同一轮内算到
+    for(int i=m_firstPending; i<m_derivedList.size(); i++)
+    {
+        DerivedSignal &derived = m_derivedList[i];
+        if(!derived.bPending)
+            continue;
+        derived.bPending = false;
+
+        //时间取最近的读回，质量取最差的输入
+        int iWorstRank = 0;
+        int iQuality = Quality_Good;
+        int iExceptionCode = 0;
+        qint64 iAcqMonoNs = 0;
+        qint64 iAcqTimeMs = 0;
+        for(int k=0; k<2; k++)
+        {
+            const QVector<int> &inputList = k == 0 ? derived.inputList : derived.rateInputList;
+            for(int j=0; j<inputList.size(); j++)
+            {
+                const SignalParameter &input = signalList.at(inputList.at(j));
+                int iRank = qualityRank(input.uQuality);
+                if(iRank > iWorstRank)
+                {
+                    iWorstRank = iRank;
+                    iQuality = input.uQuality;
+                    iExceptionCode = input.uExceptionCode;
+                }
+                if(input.iAcqMonoNs > iAcqMonoNs)
+                {
+                    iAcqMonoNs = input.iAcqMonoNs;
+                    iAcqTimeMs = input.iAcqTimeMs;
+                }
+            }
+        }
+
+        SignalParameter &signalParam = signalList[derived.iSignalIndex];
+        double dValue = signalParam.dValue;
+        //输入尚未全部读回时不计算
+        if(iQuality != Quality_NoValue)
+            dValue = run(derived, signalList);
+
+        bool bValueChanged = dValue != signalParam.dValue && !(dValue != dValue && signalParam.dValue != signalParam.dValue);
+        bool bChanged = bValueChanged || signalParam.uQuality != iQuality || signalParam.uExceptionCode != iExceptionCode;
+        bool bSampled = signalParam.iAcqMonoNs != iAcqMonoNs;
+        signalParam.dValue = dValue;
+        signalParam.uValue = (quint64)toInteger(dValue);
+        signalParam.uQuality = iQuality;
+        signalParam.uExceptionCode = iExceptionCode;
+        signalParam.iAcqMonoNs = iAcqMonoNs;
+        signalParam.iAcqTimeMs = iAcqTimeMs;
+        if(bChanged)
+        {
+            signalParam.uVersion = uVersion;
+            bAnyChanged = true;
+        }
+        if(bChanged || bSampled)
+        {
+            markInput(derived.iSignalIndex, bChanged);
+            m_updatedList.append(derived.iSignalIndex);
+        }
+    }
+    m_firstPending = m_derivedList.size();
+    return bAnyChanged;
+}
+
+const QVector<int> &DerivedSignalEngine::getUpdatedList() const
+{
+    return m_updatedList;
+}
+
+double DerivedSignalEngine::run(const DerivedSignal &derived, const QVector<SignalParameter> &signalList)
+{
+    double stack[MaxStackDepth];
+    int iTop = 0;
+    const DerivedOp *pCode = m_codeList.constData();
+    const DerivedOp *pOp = pCode + derived.iCodeStart;
+    const DerivedOp *pEnd = pOp + derived.iCodeCount;
+    while(pOp < pEnd)
+    {
+        const DerivedOp &op = *pOp++;
+        switch(op.iCode)
+        {
+        case Op_Const:
+            stack[iTop++] = op.dConst;
+            break;
+        case Op_Signal:
+            stack[iTop++] = signalList.at(op.iOperand).dValue;
+            break;
+        case Op_Rate:
+            stack[iTop++] = updateSignalRate(m_rateList[op.iState], signalList.at(op.iOperand));
+            break;
+        case Op_Jump:
+            pOp = pCode + op.iOperand;
+            break;
+        case Op_JumpIfZero:
+            if(stack[--iTop] == 0)
+                pOp = pCode + op.iOperand;
+            break;
+        case Op_AndJump:
+            if(stack[iTop - 1] == 0)
+                pOp = pCode + op.iOperand;
+            else
+                iTop--;
+            break;
+        case Op_OrJump:
+            if(stack[iTop - 1] != 0)
+            {
+                stack[iTop - 1] = 1;
+                pOp = pCode + op.iOperand;
+            }
+            else
+                iTop--;
+            break;
+        case Op_Bool: stack[iTop - 1] = stack[iTop - 1] != 0 ? 1 : 0; break;
+        case Op_Neg: stack[iTop - 1] = -stack[iTop - 1]; break;
+        case Op_Not: stack[iTop - 1] = stack[iTop - 1] == 0 ? 1 : 0; break;
+        case Op_BitNot: stack[iTop - 1] = (double)~toInteger(stack[iTop - 1]); break;
+        case Op_Abs: stack[iTop - 1] = fabs(stack[iTop - 1]); break;
+        case Op_Sqrt: stack[iTop - 1] = sqrt(stack[iTop - 1]); break;
+        case Op_Floor: stack[iTop - 1] = floor(stack[iTop - 1]); break;
+        case Op_Ceil: stack[iTop - 1] = ceil(stack[iTop - 1]); break;
+        case Op_Round: stack[iTop - 1] = round(stack[iTop - 1]); break;
+        case Op_Min:
+        case Op_Max:
+        {
+            iTop -= op.iOperand;
+            double dResult = stack[iTop];
+            for(int i=1; i<op.iOperand; i++)
+                dResult = op.iCode == Op_Min ? qMin(dResult, stack[iTop + i]) : qMax(dResult, stack[iTop + i]);
+            stack[iTop++] = dResult;
+            break;
+        }
+        default:
+        {
+            //二元运算
+            iTop--;
+            double dLeft = stack[iTop - 1];
+            double dRight = stack[iTop];
+            double &dResult = stack[iTop - 1];
+            switch(op.iCode)
+            {
+            case Op_Add: dResult = dLeft + dRight; break;
+            case Op_Sub: dResult = dLeft - dRight; break;
+            case Op_Mul: dResult = dLeft * dRight; break;
+            case Op_Div: dResult = dLeft / dRight; break;
+            case Op_Mod: dResult = fmod(dLeft, dRight); break;
+            case Op_Lt: dResult = dLeft < dRight; break;
+            case Op_Le: dResult = dLeft <= dRight; break;
+            case Op_Gt: dResult = dLeft > dRight; break;
+            case Op_Ge: dResult = dLeft >= dRight; break;
+            case Op_Eq: dResult = dLeft == dRight; break;
+            case Op_Ne: dResult = dLeft != dRight; break;
+            case Op_BitAnd: dResult = (double)(toInteger(dLeft) & toInteger(dRight)); break;
+            case Op_BitOr: dResult = (double)(toInteger(dLeft) | toInteger(dRight)); break;
+            case Op_BitXor: dResult = (double)(toInteger(dLeft) ^ toInteger(dRight)); break;
+            //左移负数在C++中未定义，按64位无符号移位
+            case Op_Shl: dResult = (double)(qint64)((quint64)toInteger(dLeft) << (toInteger(dRight) & 63)); break;
+            case Op_Shr: dResult = (double)(toInteger(dLeft) >> (toInteger(dRight) & 63)); break;
+            case Op_Bit: dResult = (double)((toInteger(dLeft) >> (toInteger(dRight) & 63)) & 1); break;
+            default: break;
+            }
+            break;
+        }
+        }
+    }
+    return iTop > 0 ? stack[iTop - 1] : 0;
+}
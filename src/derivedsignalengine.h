@@ -0,0 +1,139 @@
+﻿#ifndef DERIVEDSIGNALENGINE_H
+#define DERIVEDSIGNALENGINE_H
+
+#include <QVector>
+#include <QHash>
+#include <QString>
+#include "commondefine.h"
+
+/* 派生信号，表达式在加载时编译为后缀字节码，按依赖图增量计算
+ * 表达式: 数字（含0x十六进制）、信号Key、括号，运算符同C: ?: || && | ^ & == != < <= > >= << >> + - * / % 单目- ! ~
+ * 函数: abs min max sqrt floor ceil round bit(x,n) rate(信号Key)
+ * ?: && ||同C只计算取到的分支，未取到的rate不更新样本
+ * 位运算按64位整数计算；rate为信号每秒的变化量，按两次读回的单调时间计算，同一次读回内保持上次结果
+ * 结果的时间取输入中最近的读回时间，质量取输入中最差的质量
+*/
+class DerivedSignalEngine
+{
+public:
+    enum
+    {
+        MaxStackDepth = 32,         //表达式求值栈深度
+        MaxArgs = 8                 //函数最大参数个数
+    };
+
+    DerivedSignalEngine();
+
+    void clear();
+    /* 编译一个派生信号，信号已追加在信号表末尾
+     * iSignalIndex: 派生信号在信号表中的下标
+     * strKeyPrefix: 表达式中的Key先按加前缀查找，找不到再按原样查找
+     * 返回值: 编译失败时返回false，strError为原因
+    */
+    bool addSignal(int iSignalIndex, const QString &strExpr, const QString &strKeyPrefix, const QHash<QString, int> &signalIndexHash, QString &strError);
+    //全部添加后生成依赖图，按拓扑顺序排列；有环的派生信号不计算，返回false，strError为环上的信号
+    bool finalize(const QVector<SignalParameter> &signalList, QString &strError);
+    int getSignalCount() const;
+    bool isDerived(int iSignalIndex) const;
+
+    //信号是否是某个派生信号的输入
+    inline bool hasDependents(int iSignalIndex) const
+    {
+        return iSignalIndex < m_edgeStart.size() - 1 && m_edgeStart.at(iSignalIndex) != m_edgeStart.at(iSignalIndex + 1);
+    }
+    /* 输入信号读回后调用，依赖它的派生信号置为待计算
+     * bChanged: 值或质量改变；未改变时只有rate依赖的派生信号需要重算
+    */
+    void markInput(int iSignalIndex, bool bChanged);
+    bool hasPending() const;
+    /* 按拓扑顺序计算待计算的派生信号，值或质量改变的记为uVersion
+     * 返回值: 是否有派生信号改变
+    */
+    bool evaluate(QVector<SignalParameter> &signalList, quint64 uVersion);
+    //上次evaluate中有新读回或改变的派生信号下标
+    const QVector<int> &getUpdatedList() const;
+
+private:
+    enum OpCode
+    {
+        Op_Const = 0,
+        Op_Signal,
+        Op_Rate,
+        Op_Neg,
+        Op_Not,
+        Op_BitNot,
+        Op_Add,
+        Op_Sub,
+        Op_Mul,
+        Op_Div,
+        Op_Mod,
+        Op_Lt,
+        Op_Le,
+        Op_Gt,
+        Op_Ge,
+        Op_Eq,
+        Op_Ne,
+        Op_BitAnd,
+        Op_BitOr,
+        Op_BitXor,
+        Op_Shl,
+        Op_Shr,
+        Op_Jump,                    //跳到iOperand
+        Op_JumpIfZero,              //弹出条件，为0时跳到iOperand
+        Op_AndJump,                 //&&: 栈顶为0时置0并跳到iOperand，否则弹出
+        Op_OrJump,                  //||: 栈顶非0时置1并跳到iOperand，否则弹出
+        Op_Bool,                    //栈顶换算为0或1
+        Op_Abs,
+        Op_Min,
+        Op_Max,
+        Op_Sqrt,
+        Op_Floor,
+        Op_Ceil,
+        Op_Round,
+        Op_Bit
+    };
+
+    struct DerivedOp
+    {
+        int iCode;                  //OpCode
+        int iOperand;               //Op_Signal、Op_Rate: 信号下标 Op_Min、Op_Max: 参数个数 跳转: m_codeList中的目标位置
+        int iState;                 //Op_Rate: rate状态下标
+        double dConst;
+    };
+
+    struct DerivedSignal
+    {
+        int iSignalIndex;
+        int iCodeStart;
+        int iCodeCount;
+        QVector<int> inputList;     //值输入，去重
+        QVector<int> rateInputList; //rate输入，去重
+        bool bValid;                //依赖图中无环
+        bool bPending;
+    };
+
+    //依赖边，输入信号到派生信号在m_derivedList中的位置
+    struct DependentEdge
+    {
+        int iDerived;
+        bool bOnSample;             //rate输入，每次读回都重算
+    };
+
+    //递归下降编译，出错时设置m_strError
+    class Compiler;
+    friend class Compiler;
+
+    double run(const DerivedSignal &derived, const QVector<SignalParameter> &signalList);
+
+private:
+    QVector<DerivedOp> m_codeList;
+    QVector<SignalRate> m_rateList;
+    QVector<DerivedSignal> m_derivedList;       //finalize后按拓扑顺序
+    QHash<int, int> m_derivedIndexHash;         //Key:信号下标 Value:m_derivedList中的位置
+    QVector<int> m_edgeStart;                   //按信号下标的依赖边起点，长度为信号数+1
+    QVector<DependentEdge> m_edgeList;
+    int m_firstPending;                         //最前的待计算位置，没有时为m_derivedList.size()
+    QVector<int> m_updatedList;                 //容量在finalize时预留
+};
+
+#endif // DERIVEDSIGNALENGINE_H
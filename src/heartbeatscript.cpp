@@ -0,0 +1,64 @@
+﻿#include "scripttask.h"
+#include <QElapsedTimer>
+#include <QDebug>
+
+/* 心跳握手脚本，Scripts=heartbeat
+ * 每周期把计数写到HeartbeatWrite信号，PLC把计数回写到HeartbeatAck信号，超时未回写即告警
+ * 参数在链路节中: HeartbeatWrite、HeartbeatAck、HeartbeatPeriodMs、HeartbeatTimeoutMs
+*/
+static ScriptTask heartbeat(ScriptDevice device)
+{
+    ScriptHost *pHost = device.host();
+    QString strWriteKey = pHost->setting("HeartbeatWrite").toString();
+    QString strAckKey = pHost->setting("HeartbeatAck").toString();
+    int iPeriodMs = qMax(10, pHost->setting("HeartbeatPeriodMs", 1000).toInt());
+    int iTimeoutMs = qMax(10, pHost->setting("HeartbeatTimeoutMs", 3000).toInt());
+    //循环中按下标读写，不再查找Key
+    int iWriteId = device.signalId(strWriteKey);
+    int iAckId = device.signalId(strAckKey);
+    if(iWriteId < 0 || iAckId < 0)
+    {
+        qDebug()<<QString("[%1] Heartbeat: unknown signal %2 or %3").arg(pHost->linkGroup()).arg(strWriteKey).arg(strAckKey);
+        co_return;
+    }
+
+    //回读间隔为超时的1/10，不少于10ms
+    int iAckPollMs = qMax(10, iTimeoutMs / 10);
+    int iCounter = 0;
+    bool bAlarm = false;
+    QElapsedTimer ackTimer;
+    while(true)
+    {
+        iCounter = (iCounter + 1) & 0x7FFF;
+        ScriptResult result = co_await device.write(iWriteId, iCounter, iTimeoutMs);
+        bool bAcked = false;
+        if(result.isOk())
+        {
+            ackTimer.start();
+            while(!ackTimer.hasExpired(iTimeoutMs))
+            {
+                result = co_await device.readSignal(iAckId, iTimeoutMs);
+                if(result.isOk() && (int)device.value(iAckId) == iCounter)
+                {
+                    bAcked = true;
+                    break;
+                }
+                co_await device.sleep(iAckPollMs);
+            }
+        }
+
+        if(bAcked == bAlarm)
+        {
+            bAlarm = !bAcked;
+            if(bAlarm)
+                qDebug()<<QString("[%1] Heartbeat: %2 not acknowledged within %3 ms").arg(pHost->linkGroup()).arg(iCounter).arg(iTimeoutMs);
+            else
+                qDebug()<<QString("[%1] Heartbeat: acknowledged again").arg(pHost->linkGroup());
+        }
+        co_await device.sleep(iPeriodMs);
+    }
+}
+
+static const bool s_heartbeatRegistered = ScriptHost::registerScript("heartbeat", [](ScriptHost *pHost){
+    heartbeat(ScriptDevice(pHost));
+});
@@ -1,9 +1,10 @@
 ﻿#include <QCoreApplication>
-#include "modbusservice.h"
+#include "busmanager.h"
 
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
-    ModBusService obj;
+    BusManager obj;
+    obj.start();
     return a.exec();
 }
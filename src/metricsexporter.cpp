@@ -0,0 +1,308 @@
+﻿#include "metricsexporter.h"
+#include "realtimemode.h"
+#include <QMutexLocker>
+#include <QHostAddress>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QDebug>
+
+MetricsExporter *MetricsExporter::s_instance = nullptr;
+
+MetricsExporter::MetricsExporter(QObject *parent) : QObject(parent),
+    m_tcpServer(nullptr),
+    m_textFileTimer(nullptr)
+{
+    s_instance = this;
+
+    m_tcpServer = new QTcpServer(this);
+    connect(m_tcpServer, &QTcpServer::newConnection, this, &MetricsExporter::slot_newConnection);
+
+    m_textFileTimer = new QTimer(this);
+    connect(m_textFileTimer, &QTimer::timeout, this, &MetricsExporter::slot_writeTextFile);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    if(s_instance == this)
+        s_instance = nullptr;
+}
+
+MetricsExporter *MetricsExporter::instance()
+{
+    return s_instance;
+}
+
+bool MetricsExporter::listen(const QString &strBindAddr, quint16 uPort)
+{
+    //默认只监听本机，由同机的Prometheus或node_exporter采集
+    QHostAddress bindAddr(strBindAddr.isEmpty() ? QString("127.0.0.1") : strBindAddr);
+    return m_tcpServer->listen(bindAddr, uPort);
+}
+
+QString MetricsExporter::errorString() const
+{
+    return m_tcpServer->errorString();
+}
+
+void MetricsExporter::setTextFile(const QString &strTextFile, int iPeriodMs)
+{
+    m_strTextFile = strTextFile;
+    if(m_strTextFile.isEmpty())
+    {
+        m_textFileTimer->stop();
+        return;
+    }
+    m_textFileTimer->start(iPeriodMs > 0 ? iPeriodMs : 5000);
+}
+
+int MetricsExporter::registerLink(const QString &strName, const QList<quint8> &deviceList)
+{
+    QMutexLocker locker(&m_linkMutex);
+    LinkEntry entry;
+    entry.name = strName.toUtf8();
+    entry.deviceList = deviceList;
+    m_linkList.append(entry);
+    return m_linkList.size() - 1;
+}
+
+void MetricsExporter::publish(int iLink, const LinkMetrics &metrics)
+{
+    QMutexLocker locker(&m_linkMutex);
+    if(iLink < 0 || iLink >= m_linkList.size())
+        return;
+    m_linkList[iLink].metrics = metrics;
+}
+
+void MetricsExporter::slot_newConnection()
+{
+    while(QTcpSocket *pSocket = m_tcpServer->nextPendingConnection())
+    {
+        m_requestHash.insert(pSocket, QByteArray());
+        connect(pSocket, &QTcpSocket::readyRead, this, &MetricsExporter::slot_readyRead);
+        connect(pSocket, &QTcpSocket::disconnected, this, &MetricsExporter::slot_disconnected);
+    }
+}
+
+void MetricsExporter::slot_disconnected()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    m_requestHash.remove(pSocket);
+    pSocket->deleteLater();
+}
+
+void MetricsExporter::slot_readyRead()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    QHash<QTcpSocket*, QByteArray>::iterator itr = m_requestHash.find(pSocket);
+    if(itr == m_requestHash.end())
+        return;
+
+    QByteArray &request = itr.value();
+    request.append(pSocket->readAll());
+    if(!request.contains("\r\n\r\n"))
+    {
+        if(request.size() > MaxRequestSize)
+            pSocket->abort();
+        return;
+    }
+
+    //只处理请求行，其余请求头忽略
+    QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray strPath = requestLine.size() >= 2 ? requestLine.at(1) : QByteArray();
+    int iQueryPos = strPath.indexOf('?');
+    if(iQueryPos >= 0)
+        strPath.truncate(iQueryPos);
+    m_requestHash.remove(pSocket);
+    disconnect(pSocket, &QTcpSocket::readyRead, this, &MetricsExporter::slot_readyRead);
+
+    QByteArray response;
+    if(requestLine.at(0) != "GET" && requestLine.at(0) != "HEAD")
+    {
+        response = "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else if(strPath != "/metrics" && strPath != "/")
+    {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    else
+    {
+        QByteArray body = render();
+        response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: "
+                   + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n";
+        if(requestLine.at(0) == "GET")
+            response.append(body);
+    }
+    pSocket->write(response);
+    pSocket->disconnectFromHost();
+}
+
+void MetricsExporter::slot_writeTextFile()
+{
+    //先写临时文件再改名，textfile collector不会读到写了一半的文件
+    QSaveFile file(m_strTextFile);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        qDebug()<<"Metrics: open " + m_strTextFile + " failed: " + file.errorString();
+        return;
+    }
+    file.write(render());
+    if(!file.commit())
+        qDebug()<<"Metrics: write " + m_strTextFile + " failed: " + file.errorString();
+}
+
+void MetricsExporter::appendHeader(QByteArray &text, const char *pName, const char *pType, const char *pHelp)
+{
+    text.append("# HELP ").append(pName).append(' ').append(pHelp).append('\n');
+    text.append("# TYPE ").append(pName).append(' ').append(pType).append('\n');
+}
+
+QByteArray MetricsExporter::render()
+{
+    //先逐项复制快照，格式化时不持有锁；不共享m_linkList，链路线程发布时不会因分离而分配内存
+    QList<LinkEntry> linkList;
+    {
+        QMutexLocker locker(&m_linkMutex);
+        linkList.reserve(m_linkList.size());
+        for(int i=0; i<m_linkList.size(); i++)
+            linkList.append(m_linkList.at(i));
+    }
+    qint64 iNowMs = QDateTime::currentMSecsSinceEpoch();
+
+    struct CounterMetric
+    {
+        const char *pName;
+        const char *pType;
+        const char *pHelp;
+    };
+    static const CounterMetric linkMetricList[] =
+    {
+        {"modbus_link_up", "gauge", "1 if the link is connected."},
+        {"modbus_reconnects_total", "counter", "Times the link was re-established after a disconnect."},
+        {"modbus_transactions_total", "counter", "Completed Modbus transactions, including failures."},
+        {"modbus_transaction_failures_total", "counter", "Failed Modbus transactions: timeouts, exception responses and frame errors."},
+        {"modbus_timeouts_total", "counter", "Transactions that received no response within the timeout."},
+        {"modbus_frame_errors_total", "counter", "Responses dropped for CRC, framing or request mismatch."},
+        {"modbus_bytes_out_total", "counter", "ADU bytes sent on the link."},
+        {"modbus_bytes_in_total", "counter", "Bytes received on the link."},
+        {"modbus_queue_depth", "gauge", "Poll requests of the current cycle not yet completed."},
+        {"modbus_poll_overruns_total", "counter", "Poll cycles skipped because the previous cycle had not finished."}
+    };
+    const int iLinkMetricCount = sizeof(linkMetricList) / sizeof(linkMetricList[0]);
+
+    QByteArray text;
+    text.reserve(4096 + linkList.size() * 4096);
+    for(int m=0; m<iLinkMetricCount; m++)
+    {
+        appendHeader(text, linkMetricList[m].pName, linkMetricList[m].pType, linkMetricList[m].pHelp);
+        for(int i=0; i<linkList.size(); i++)
+        {
+            const LinkMetrics &metrics = linkList.at(i).metrics;
+            const LinkCounters &counters = metrics.counters;
+            quint64 uValue = 0;
+            switch(m)
+            {
+            case 0: uValue = metrics.bConnected ? 1 : 0; break;
+            case 1: uValue = metrics.uReconnects; break;
+            case 2: uValue = counters.uTransactions; break;
+            case 3: uValue = counters.uFailures; break;
+            case 4: uValue = counters.uTimeouts; break;
+            case 5: uValue = counters.uFrameErrors; break;
+            case 6: uValue = counters.uBytesOut; break;
+            case 7: uValue = counters.uBytesIn; break;
+            case 8: uValue = metrics.iQueueDepth; break;
+            default: uValue = metrics.uPollOverruns; break;
+            }
+            text.append(linkMetricList[m].pName).append("{link=\"").append(linkList.at(i).name).append("\"} ");
+            text.append(QByteArray::number(uValue)).append('\n');
+        }
+    }
+
+    //标准异常码1-11始终输出，其余有计数时输出
+    appendHeader(text, "modbus_exceptions_total", "counter", "Exception responses by Modbus exception code.");
+    for(int i=0; i<linkList.size(); i++)
+    {
+        const LinkCounters &counters = linkList.at(i).metrics.counters;
+        for(int iCode=1; iCode<16; iCode++)
+        {
+            if(iCode > 11 && counters.exceptionCount[iCode] == 0)
+                continue;
+            text.append("modbus_exceptions_total{link=\"").append(linkList.at(i).name)
+                .append("\",code=\"").append(QByteArray::number(iCode)).append("\"} ")
+                .append(QByteArray::number(counters.exceptionCount[iCode])).append('\n');
+        }
+    }
+
+    appendHeader(text, "modbus_poll_cycle_seconds", "histogram", "Time from the start of a poll cycle until its last request completed.");
+    for(int i=0; i<linkList.size(); i++)
+    {
+        const CycleHistogram &histogram = linkList.at(i).metrics.cycleHistogram;
+        const QByteArray &name = linkList.at(i).name;
+        quint64 uCumulative = 0;
+        for(int iBucket=0; iBucket<CycleHistogram::BucketCount; iBucket++)
+        {
+            uCumulative += histogram.bucketCount[iBucket];
+            QByteArray strBound = iBucket < CycleHistogram::BucketCount - 1
+                    ? QByteArray::number(CycleHistogram::getBucketBoundMs(iBucket) / 1000.0) : QByteArray("+Inf");
+            text.append("modbus_poll_cycle_seconds_bucket{link=\"").append(name).append("\",le=\"").append(strBound).append("\"} ")
+                .append(QByteArray::number(uCumulative)).append('\n');
+        }
+        text.append("modbus_poll_cycle_seconds_sum{link=\"").append(name).append("\"} ")
+            .append(QByteArray::number(histogram.dSumMs / 1000.0, 'g', 12)).append('\n');
+        text.append("modbus_poll_cycle_seconds_count{link=\"").append(name).append("\"} ")
+            .append(QByteArray::number(histogram.uCount)).append('\n');
+    }
+
+    appendHeader(text, "modbus_cycle_start_jitter_seconds", "histogram", "Delay between the scheduled and the actual start of a poll cycle.");
+    for(int i=0; i<linkList.size(); i++)
+    {
+        const JitterStats &jitter = linkList.at(i).metrics.cycleJitter;
+        const QByteArray &name = linkList.at(i).name;
+        quint64 uCumulative = 0;
+        for(int iBucket=0; iBucket<JitterStats::BucketCount; iBucket++)
+        {
+            uCumulative += jitter.bucketCount[iBucket];
+            QByteArray strBound = iBucket < JitterStats::BucketCount - 1
+                    ? QByteArray::number(JitterStats::getBucketBoundUs(iBucket) / 1000000.0) : QByteArray("+Inf");
+            text.append("modbus_cycle_start_jitter_seconds_bucket{link=\"").append(name).append("\",le=\"").append(strBound).append("\"} ")
+                .append(QByteArray::number(uCumulative)).append('\n');
+        }
+        text.append("modbus_cycle_start_jitter_seconds_sum{link=\"").append(name).append("\"} ")
+            .append(QByteArray::number(jitter.dSumUs / 1000000.0, 'g', 12)).append('\n');
+        text.append("modbus_cycle_start_jitter_seconds_count{link=\"").append(name).append("\"} ")
+            .append(QByteArray::number(jitter.uCount)).append('\n');
+    }
+
+    appendHeader(text, "modbus_cycles_missed_total", "counter", "Poll cycle starts skipped because the link thread woke up more than a period late.");
+    for(int i=0; i<linkList.size(); i++)
+    {
+        text.append("modbus_cycles_missed_total{link=\"").append(linkList.at(i).name).append("\"} ")
+            .append(QByteArray::number(linkList.at(i).metrics.cycleJitter.uMissed)).append('\n');
+    }
+
+    if(RealtimeMode::isAllocCounterEnabled())
+    {
+        appendHeader(text, "modbus_steady_state_allocations_total", "counter", "Heap allocations in the link thread during steady-state poll cycles.");
+        for(int i=0; i<linkList.size(); i++)
+        {
+            text.append("modbus_steady_state_allocations_total{link=\"").append(linkList.at(i).name).append("\"} ")
+                .append(QByteArray::number(linkList.at(i).metrics.uSteadyAllocations)).append('\n');
+        }
+    }
+
+    //从未读成功的从站时间为+Inf，告警规则无需另外判断缺失
+    appendHeader(text, "modbus_device_last_success_age_seconds", "gauge", "Seconds since the last successful poll read from the device.");
+    for(int i=0; i<linkList.size(); i++)
+    {
+        const LinkEntry &entry = linkList.at(i);
+        for(int j=0; j<entry.deviceList.size(); j++)
+        {
+            quint8 uServerAddr = entry.deviceList.at(j);
+            qint64 iLastMs = entry.metrics.lastSuccessMs[uServerAddr];
+            QByteArray strAge = iLastMs > 0 ? QByteArray::number(qMax<qint64>(0, iNowMs - iLastMs) / 1000.0) : QByteArray("+Inf");
+            text.append("modbus_device_last_success_age_seconds{link=\"").append(entry.name)
+                .append("\",server=\"").append(QByteArray::number(uServerAddr)).append("\"} ")
+                .append(strAge).append('\n');
+        }
+    }
+    return text;
+}
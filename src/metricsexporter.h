@@ -0,0 +1,124 @@
+﻿#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+#include <QByteArray>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include "commondefine.h"
+#include "cycletimer.h"
+
+//轮询周期耗时直方图，桶上限ms，最后一个桶为+Inf
+struct CycleHistogram
+{
+    enum
+    {
+        BucketCount = 11
+    };
+
+    quint64 bucketCount[BucketCount];   //各桶的周期数，不累加
+    quint64 uCount;
+    double dSumMs;
+
+    CycleHistogram() { memset(this, 0, sizeof(CycleHistogram)); }
+
+    static double getBucketBoundMs(int iBucket)
+    {
+        static const double boundMs[BucketCount - 1] = {5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+        return boundMs[iBucket];
+    }
+
+    void add(double dCycleMs)
+    {
+        int iBucket = 0;
+        while(iBucket < BucketCount - 1 && dCycleMs > getBucketBoundMs(iBucket))
+            iBucket++;
+        bucketCount[iBucket]++;
+        uCount++;
+        dSumMs += dCycleMs;
+    }
+};
+
+//一个链路的指标，链路线程累加，按周期整体复制给MetricsExporter
+struct LinkMetrics
+{
+    LinkCounters counters;
+    bool bConnected;
+    quint64 uReconnects;            //断开后重新连上的次数
+    quint64 uPollOverruns;          //轮询未在周期内完成而跳过的次数
+    int iQueueDepth;                //未完成的轮询请求数
+    CycleHistogram cycleHistogram;
+    JitterStats cycleJitter;        //轮询周期起点抖动
+    qint64 lastSuccessMs[256];      //各从站最近一次读成功的时间，自1970年起的ms，0为尚未读成功
+    quint64 uSteadyAllocations;     //稳态轮询周期内的堆分配次数，编译时启用分配统计才有值
+
+    LinkMetrics() : bConnected(false), uReconnects(0), uPollOverruns(0), iQueueDepth(0), uSteadyAllocations(0)
+    {
+        memset(lastSuccessMs, 0, sizeof(lastSuccessMs));
+    }
+};
+
+/* 指标输出，Prometheus文本格式
+ * 各链路线程每秒把LinkMetrics复制一次，轮询路径上只做无锁的整数累加
+ * HTTP: GET /metrics，应答后关闭连接；文本文件: 按周期整体替换，供node_exporter的textfile collector读取
+ * 由BusManager在主线程创建，未启用时instance()为空
+*/
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        MaxRequestSize = 4096           //HTTP请求头最大字节数
+    };
+
+    explicit MetricsExporter(QObject *parent = nullptr);
+    ~MetricsExporter();
+
+    static MetricsExporter *instance();
+
+    //uPort为0不启用HTTP
+    bool listen(const QString &strBindAddr, quint16 uPort);
+    QString errorString() const;
+    //strTextFile为空不写文件
+    void setTextFile(const QString &strTextFile, int iPeriodMs);
+
+    //链路加载时登记，返回链路编号
+    int registerLink(const QString &strName, const QList<quint8> &deviceList);
+    //链路线程调用
+    void publish(int iLink, const LinkMetrics &metrics);
+
+private slots:
+    void slot_newConnection();
+    void slot_readyRead();
+    void slot_disconnected();
+    void slot_writeTextFile();
+
+private:
+    struct LinkEntry
+    {
+        QByteArray name;
+        QList<quint8> deviceList;
+        LinkMetrics metrics;
+    };
+
+    QByteArray render();
+    void appendHeader(QByteArray &text, const char *pName, const char *pType, const char *pHelp);
+
+private:
+    static MetricsExporter *s_instance;
+
+    QTcpServer *m_tcpServer;
+    QTimer *m_textFileTimer;
+    QString m_strTextFile;
+    QHash<QTcpSocket*, QByteArray> m_requestHash;   //未收完的请求头
+
+    QMutex m_linkMutex;
+    QList<LinkEntry> m_linkList;
+};
+
+#endif // METRICSEXPORTER_H
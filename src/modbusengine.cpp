@@ -0,0 +1,583 @@
+﻿#include "modbusengine.h"
+#include "modbusframe.h"
+#include <QDebug>
+#include <string.h>
+
+ModbusEngine::ModbusEngine(QObject *parent) : QObject(parent),
+    m_timeoutTimer(nullptr),
+    m_timeoutMs(1000),
+    m_maxRetries(0),
+    m_maxInFlight(1),
+    m_inFlightCount(0),
+    m_nextTransactionId(0),
+    m_nextCommandId(0),
+    m_linkFailTimeouts(0),
+    m_consecutiveTimeouts(0),
+    m_nextPoll(0),
+    m_pollPending(0),
+    m_retryCount(0)
+{
+    for(int i=0; i<CommandPoolSize; i++)
+        m_commandState[i] = 0;
+    for(int i=0; i<MaxInFlightLimit; i++)
+        m_inFlight[i].bUsed = false;
+
+    m_timeoutTimer = new QTimer(this);
+    m_timeoutTimer->setInterval(10);
+    connect(m_timeoutTimer, &QTimer::timeout, this, &ModbusEngine::slot_checkTimeout);
+}
+
+void ModbusEngine::setTimeout(int iTimeoutMs)
+{
+    m_timeoutMs = iTimeoutMs > 0 ? iTimeoutMs : 1000;
+}
+
+void ModbusEngine::setAdaptiveTimeout(int iFloorMs, int iPercentile, double dFactor, int iRetries)
+{
+    m_rtt.setParameters(iFloorMs, m_timeoutMs, iPercentile, dFactor);
+    m_rtt.resize(m_pollList.size());
+    m_maxRetries = m_rtt.isEnabled() ? qMax(0, iRetries) : 0;
+}
+
+void ModbusEngine::setLinkFailTimeouts(int iTimeouts)
+{
+    m_linkFailTimeouts = iTimeouts > 0 ? iTimeouts : 0;
+}
+
+void ModbusEngine::setMaxInFlight(int iMaxInFlight)
+{
+    m_maxInFlight = qBound(1, iMaxInFlight, (int)MaxInFlightLimit);
+}
+
+int ModbusEngine::addReadTransaction(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount)
+{
+    EngineTransaction transaction;
+    quint8 *pPdu = transaction.frame + FrameHeaderSize;
+    int iPduLength = buildReadPdu(pPdu, eRegTable, uStartAddr, uCount);
+    if(iPduLength < 0)
+    {
+        qDebug()<<QString("Engine: invalid read request at %1 count %2").arg(uStartAddr).arg(uCount);
+        return -1;
+    }
+
+    transaction.uServerAddr = uServerAddr;
+    transaction.eRegTable = eRegTable;
+    transaction.uStartAddr = uStartAddr;
+    transaction.uCount = uCount;
+    transaction.uFunctionCode = pPdu[0];
+    transaction.iPduLength = iPduLength;
+    transaction.iCommandId = -1;
+    transaction.bEnabled = true;
+    transaction.iTagCount = 0;
+    m_pollList.append(transaction);
+    m_pollRetries.append(0);
+    m_rtt.resize(m_pollList.size());
+    return m_pollList.size() - 1;
+}
+
+int ModbusEngine::addWriteTransaction(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount)
+{
+    EngineTransaction transaction;
+    transaction.uServerAddr = uServerAddr;
+    transaction.iCommandId = -1;
+    transaction.bEnabled = true;
+    transaction.iTagCount = 0;
+    if(!buildWritePdu(transaction, eRegTable, uStartAddr, uCount))
+    {
+        qDebug()<<QString("Engine: invalid write request at %1 count %2").arg(uStartAddr).arg(uCount);
+        return -1;
+    }
+    m_pollList.append(transaction);
+    m_pollRetries.append(0);
+    m_rtt.resize(m_pollList.size());
+    return m_pollList.size() - 1;
+}
+
+void ModbusEngine::clearTransactions()
+{
+    clear();
+    m_pollList.clear();
+    m_pollRetries.clear();
+    m_rtt.resize(0);
+}
+
+void ModbusEngine::setWriteValues(int iIndex, const quint16 *pRegValue)
+{
+    if(iIndex < 0 || iIndex >= m_pollList.size())
+        return;
+    encodeWriteValues(m_pollList[iIndex], pRegValue);
+}
+
+void ModbusEngine::setEnabled(int iIndex, bool bEnabled)
+{
+    if(iIndex < 0 || iIndex >= m_pollList.size())
+        return;
+    m_pollList[iIndex].bEnabled = bEnabled;
+}
+
+bool ModbusEngine::buildWritePdu(EngineTransaction &transaction, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount)
+{
+    //线圈单个写05、多个写15，保持寄存器单个写06、多个写16，与QModbusClient一致
+    quint8 *pPdu = transaction.frame + FrameHeaderSize;
+    int iPduLength = 0;
+    memset(pPdu, 0, sizeof(transaction.frame) - FrameHeaderSize);
+    if(eRegTable == QModbusDataUnit::Coils && uCount >= 1 && uCount <= 1968)
+    {
+        if(uCount == 1)
+        {
+            transaction.uFunctionCode = 0x05;
+            iPduLength = 5;
+        }
+        else
+        {
+            transaction.uFunctionCode = 0x0F;
+            putUInt16(pPdu + 3, uCount);
+            pPdu[5] = (quint8)((uCount + 7) / 8);
+            iPduLength = 6 + pPdu[5];
+        }
+    }
+    else if(eRegTable == QModbusDataUnit::HoldingRegisters && uCount >= 1 && uCount <= 123)
+    {
+        if(uCount == 1)
+        {
+            transaction.uFunctionCode = 0x06;
+            iPduLength = 5;
+        }
+        else
+        {
+            transaction.uFunctionCode = 0x10;
+            putUInt16(pPdu + 3, uCount);
+            pPdu[5] = (quint8)(uCount * 2);
+            iPduLength = 6 + pPdu[5];
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    transaction.eRegTable = eRegTable;
+    transaction.uStartAddr = uStartAddr;
+    transaction.uCount = uCount;
+    transaction.iPduLength = iPduLength;
+    pPdu[0] = transaction.uFunctionCode;
+    putUInt16(pPdu + 1, uStartAddr);
+    return true;
+}
+
+void ModbusEngine::encodeWriteValues(EngineTransaction &transaction, const quint16 *pRegValue)
+{
+    quint8 *pPdu = transaction.frame + FrameHeaderSize;
+    switch(transaction.uFunctionCode)
+    {
+    case 0x05:
+        putUInt16(pPdu + 3, pRegValue[0] ? 0xFF00 : 0x0000);
+        break;
+    case 0x06:
+        putUInt16(pPdu + 3, pRegValue[0]);
+        break;
+    case 0x0F:
+        memset(pPdu + 6, 0, pPdu[5]);
+        for(int i=0; i<transaction.uCount; i++)
+        {
+            if(pRegValue[i])
+                pPdu[6 + i / 8] |= (quint8)(1 << (i % 8));
+        }
+        break;
+    case 0x10:
+        for(int i=0; i<transaction.uCount; i++)
+            putUInt16(pPdu + 6 + i * 2, pRegValue[i]);
+        break;
+    default:
+        break;
+    }
+}
+
+void ModbusEngine::startCycle()
+{
+    if(!isConnected())
+        return;
+    m_nextPoll = 0;
+    m_pollPending = 0;
+    for(int i=0; i<m_pollList.size(); i++)
+    {
+        if(m_pollList.at(i).bEnabled)
+            m_pollPending++;
+    }
+    m_pollRetries.fill(0);
+    pump();
+}
+
+bool ModbusEngine::isCycleIdle() const
+{
+    return m_pollPending == 0;
+}
+
+int ModbusEngine::getPendingCount() const
+{
+    return m_pollPending;
+}
+
+const LinkCounters &ModbusEngine::getCounters() const
+{
+    return m_counters;
+}
+
+int ModbusEngine::allocCommand()
+{
+    for(int i=0; i<CommandPoolSize; i++)
+    {
+        if(m_commandState[i] == 0)
+            return i;
+    }
+    qDebug()<<"Engine: command pool full";
+    return -1;
+}
+
+int ModbusEngine::enqueueCommand(const QModbusDataUnit &unit, quint8 uServerAddr, int iTag, int iCommandId)
+{
+    int iIndex = allocCommand();
+    if(iIndex < 0)
+        return -1;
+
+    EngineTransaction &transaction = m_commandPool[iIndex];
+    transaction.uServerAddr = uServerAddr;
+    if(!buildWritePdu(transaction, unit.registerType(), unit.startAddress(), unit.valueCount()))
+    {
+        qDebug()<<QString("Engine: invalid write command at %1 count %2").arg(unit.startAddress()).arg(unit.valueCount());
+        return -1;
+    }
+    const QVector<quint16> valueList = unit.values();
+    encodeWriteValues(transaction, valueList.constData());
+    transaction.iCommandId = iCommandId >= 0 ? iCommandId : m_nextCommandId++;
+    transaction.tagList[0] = iTag;
+    transaction.iTagCount = 1;
+    transaction.commandTimer.start();
+    m_commandState[iIndex] = 1;
+    pump();
+    return transaction.iCommandId;
+}
+
+int ModbusEngine::enqueueMaskCommand(quint16 qRegAddr, quint16 uAndMask, quint16 uOrMask, quint8 uServerAddr, int iTag)
+{
+    //与尚未发送的同一寄存器屏蔽写合并，见mergeMaskWrite
+    for(int i=0; i<CommandPoolSize; i++)
+    {
+        EngineTransaction &queuedCommand = m_commandPool[i];
+        if(m_commandState[i] == 1 && queuedCommand.uFunctionCode == 0x16
+           && queuedCommand.uServerAddr == uServerAddr && queuedCommand.uStartAddr == qRegAddr
+           && queuedCommand.iTagCount < MaxMergedTags)
+        {
+            quint8 *pPdu = queuedCommand.frame + FrameHeaderSize;
+            quint16 uQueuedAnd = getUInt16(pPdu + 3);
+            quint16 uQueuedOr = getUInt16(pPdu + 5);
+            mergeMaskWrite(uQueuedAnd, uQueuedOr, uAndMask, uOrMask);
+            putUInt16(pPdu + 3, uQueuedAnd);
+            putUInt16(pPdu + 5, uQueuedOr);
+            queuedCommand.tagList[queuedCommand.iTagCount++] = iTag;
+            return queuedCommand.iCommandId;
+        }
+    }
+
+    int iIndex = allocCommand();
+    if(iIndex < 0)
+        return -1;
+
+    EngineTransaction &transaction = m_commandPool[iIndex];
+    transaction.uServerAddr = uServerAddr;
+    transaction.eRegTable = QModbusDataUnit::HoldingRegisters;
+    transaction.uStartAddr = qRegAddr;
+    transaction.uCount = 1;
+    transaction.uFunctionCode = 0x16;
+    transaction.iPduLength = 7;
+    quint8 *pPdu = transaction.frame + FrameHeaderSize;
+    pPdu[0] = 0x16;
+    putUInt16(pPdu + 1, qRegAddr);
+    putUInt16(pPdu + 3, uAndMask);
+    putUInt16(pPdu + 5, uOrMask);
+    transaction.iCommandId = m_nextCommandId++;
+    transaction.tagList[0] = iTag;
+    transaction.iTagCount = 1;
+    transaction.commandTimer.start();
+    m_commandState[iIndex] = 1;
+    pump();
+    return transaction.iCommandId;
+}
+
+int ModbusEngine::enqueueReadCommand(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTag)
+{
+    int iIndex = allocCommand();
+    if(iIndex < 0)
+        return -1;
+
+    EngineTransaction &transaction = m_commandPool[iIndex];
+    quint8 *pPdu = transaction.frame + FrameHeaderSize;
+    int iPduLength = buildReadPdu(pPdu, eRegTable, uStartAddr, uCount);
+    if(iPduLength < 0)
+    {
+        qDebug()<<QString("Engine: invalid read command at %1 count %2").arg(uStartAddr).arg(uCount);
+        return -1;
+    }
+    transaction.uServerAddr = uServerAddr;
+    transaction.eRegTable = eRegTable;
+    transaction.uStartAddr = uStartAddr;
+    transaction.uCount = uCount;
+    transaction.uFunctionCode = pPdu[0];
+    transaction.iPduLength = iPduLength;
+    transaction.iCommandId = m_nextCommandId++;
+    transaction.tagList[0] = iTag;
+    transaction.iTagCount = 1;
+    transaction.commandTimer.start();
+    m_commandState[iIndex] = 1;
+    pump();
+    return transaction.iCommandId;
+}
+
+int ModbusEngine::findQueuedCommand() const
+{
+    //命令按入队顺序发送
+    int iIndex = -1;
+    for(int i=0; i<CommandPoolSize; i++)
+    {
+        if(m_commandState[i] == 1 && (iIndex < 0 || m_commandPool[i].iCommandId < m_commandPool[iIndex].iCommandId))
+            iIndex = i;
+    }
+    return iIndex;
+}
+
+bool ModbusEngine::isReadyToSend()
+{
+    return true;
+}
+
+int ModbusEngine::getExtraTimeoutMs(const EngineTransaction &) const
+{
+    return 0;
+}
+
+void ModbusEngine::onTransactionTimeout()
+{
+}
+
+void ModbusEngine::pump()
+{
+    if(!isConnected())
+        return;
+
+    while(m_inFlightCount < m_maxInFlight)
+    {
+        int iCommand = findQueuedCommand();
+        while(m_nextPoll < m_pollList.size() && !m_pollList.at(m_nextPoll).bEnabled)
+            m_nextPoll++;
+        bool bHasPoll = (m_nextPoll < m_pollList.size() || m_retryCount > 0) && m_pollPending > 0;
+        if((iCommand < 0 && !bHasPoll) || !isReadyToSend())
+            break;
+
+        if(iCommand >= 0)
+        {
+            m_commandState[iCommand] = 2;
+            sendTransaction(m_commandPool[iCommand], true, iCommand);
+            continue;
+        }
+        if(m_retryCount > 0)
+        {
+            int iRetry = m_retryList[--m_retryCount];
+            sendTransaction(m_pollList[iRetry], false, iRetry);
+            continue;
+        }
+        int iPoll = m_nextPoll++;
+        sendTransaction(m_pollList[iPoll], false, iPoll);
+    }
+}
+
+void ModbusEngine::sendTransaction(EngineTransaction &transaction, bool bIsCommand, int iIndex)
+{
+    for(int i=0; i<MaxInFlightLimit; i++)
+    {
+        InFlightEntry &entry = m_inFlight[i];
+        if(entry.bUsed)
+            continue;
+
+        quint16 uTransactionId = m_nextTransactionId++;
+        entry.bUsed = true;
+        entry.bIsCommand = bIsCommand;
+        entry.uTransactionId = uTransactionId;
+        entry.iIndex = iIndex;
+        //RTT窗口为空时取上限，即静态超时
+        entry.iExtraMs = getExtraTimeoutMs(transaction);
+        entry.iTimeoutMs = m_rtt.getTimeoutMs(bIsCommand ? -1 : iIndex, transaction.uServerAddr) + entry.iExtraMs;
+        entry.sendTimer.start();
+        m_inFlightCount++;
+        sendFrame(transaction, uTransactionId);
+        return;
+    }
+}
+
+int ModbusEngine::findInFlight(quint16 uTransactionId) const
+{
+    for(int i=0; i<MaxInFlightLimit; i++)
+    {
+        if(m_inFlight[i].bUsed && m_inFlight[i].uTransactionId == uTransactionId)
+            return i;
+    }
+    return -1;
+}
+
+void ModbusEngine::handleResponse(int iEntry, quint8 uServerAddr, const quint8 *pPdu, int iPduLength)
+{
+    if(iEntry < 0 || iEntry >= MaxInFlightLimit || !m_inFlight[iEntry].bUsed)
+        return;
+
+    InFlightEntry &entry = m_inFlight[iEntry];
+    entry.bUsed = false;
+    m_inFlightCount--;
+    m_consecutiveTimeouts = 0;
+    const EngineTransaction &transaction = entry.bIsCommand ? m_commandPool[entry.iIndex] : m_pollList.at(entry.iIndex);
+
+    bool bSuccess = iPduLength >= 1 && uServerAddr == transaction.uServerAddr && pPdu[0] == transaction.uFunctionCode;
+    int iExceptionCode = 0;
+    if(iPduLength >= 2 && uServerAddr == transaction.uServerAddr && pPdu[0] == (transaction.uFunctionCode | 0x80))
+        iExceptionCode = pPdu[1];
+    //异常应答同样是从站的应答时间
+    if(bSuccess || iExceptionCode != 0)
+        m_rtt.addSample(entry.bIsCommand ? -1 : entry.iIndex, transaction.uServerAddr,
+                        entry.sendTimer.nsecsElapsed() / 1000 - entry.iExtraMs * 1000);
+
+    bool bIsRead = bSuccess && transaction.uFunctionCode <= 0x04;
+    if(bIsRead && !parseReadPdu(pPdu, iPduLength, transaction.eRegTable, transaction.uCount, m_regBuffer))
+    {
+        bIsRead = false;
+        bSuccess = false;
+    }
+    m_counters.addResult(bSuccess, iExceptionCode);
+    if(!bSuccess && iExceptionCode == 0)
+        m_counters.uFrameErrors++;
+
+    if(entry.bIsCommand)
+    {
+        if(bIsRead)
+            emit sig_commandRead(transaction.iCommandId, transaction.uServerAddr, transaction.eRegTable, transaction.uStartAddr, m_regBuffer, transaction.uCount);
+        finishCommand(entry.iIndex, bSuccess, iExceptionCode);
+        return;
+    }
+
+    if(bIsRead)
+        emit sig_readBlock(transaction.uServerAddr, transaction.eRegTable, transaction.uStartAddr, m_regBuffer, transaction.uCount);
+    finishPoll(transaction, bSuccess, iExceptionCode);
+}
+
+void ModbusEngine::failInFlight(int iEntry)
+{
+    if(iEntry < 0 || iEntry >= MaxInFlightLimit || !m_inFlight[iEntry].bUsed)
+        return;
+    m_counters.addResult(false, 0);
+    m_counters.uFrameErrors++;
+    releaseInFlight(iEntry, false);
+}
+
+void ModbusEngine::releaseInFlight(int iEntry, bool bSuccess)
+{
+    InFlightEntry &entry = m_inFlight[iEntry];
+    entry.bUsed = false;
+    m_inFlightCount--;
+    if(entry.bIsCommand)
+        finishCommand(entry.iIndex, bSuccess, 0);
+    else
+        finishPoll(m_pollList.at(entry.iIndex), bSuccess, 0);
+}
+
+void ModbusEngine::finishPoll(const EngineTransaction &transaction, bool bSuccess, int iExceptionCode)
+{
+    //周期写失败只计数，不影响读回信号的质量
+    if(!bSuccess && transaction.uFunctionCode <= 0x04)
+        emit sig_pollFailed(transaction.uServerAddr, transaction.eRegTable, transaction.uStartAddr, transaction.uCount, iExceptionCode);
+    if(m_pollPending > 0 && --m_pollPending == 0)
+        emit sig_cycleFinished();
+}
+
+void ModbusEngine::finishCommand(int iIndex, bool bSuccess, int iExceptionCode)
+{
+    //先释放命令池，通知处理中可能再次入队
+    const EngineTransaction &transaction = m_commandPool[iIndex];
+    int iCommandId = transaction.iCommandId;
+    bool bIsMaskWrite = transaction.uFunctionCode == 0x16;
+    qint64 iLatencyUs = transaction.commandTimer.nsecsElapsed() / 1000;
+    int iTagCount = transaction.iTagCount;
+    int tagList[MaxMergedTags];
+    memcpy(tagList, transaction.tagList, sizeof(tagList));
+    m_commandState[iIndex] = 0;
+
+    for(int i=0; i<iTagCount; i++)
+        emit sig_commandFinished(iCommandId, tagList[i], bIsMaskWrite, bSuccess, iExceptionCode, iLatencyUs);
+}
+
+void ModbusEngine::slot_checkTimeout()
+{
+    bool bExpired = false;
+    for(int i=0; i<MaxInFlightLimit; i++)
+    {
+        InFlightEntry &entry = m_inFlight[i];
+        if(!entry.bUsed || !entry.sendTimer.hasExpired(entry.iTimeoutMs))
+            continue;
+
+        bExpired = true;
+        m_counters.addResult(false, 0);
+        m_counters.uTimeouts++;
+        m_consecutiveTimeouts++;
+        const EngineTransaction &transaction = entry.bIsCommand ? m_commandPool[entry.iIndex] : m_pollList.at(entry.iIndex);
+        m_rtt.addTimeout(entry.bIsCommand ? -1 : entry.iIndex, transaction.uServerAddr);
+
+        //超时按RTT估计时多半是丢帧，重发代价小；超时已是上限时不重发，避免一个周期被拖长
+        if(!entry.bIsCommand && m_pollRetries.at(entry.iIndex) < m_maxRetries
+           && m_rtt.hasEstimate(entry.iIndex, transaction.uServerAddr))
+        {
+            m_pollRetries[entry.iIndex]++;
+            m_retryList[m_retryCount++] = entry.iIndex;
+            entry.bUsed = false;
+            m_inFlightCount--;
+            continue;
+        }
+        releaseInFlight(i, false);
+    }
+    if(bExpired)
+        onTransactionTimeout();
+
+    //一个区块超时或异常不代表链路断开，只有连续超时才通知
+    if(m_linkFailTimeouts > 0 && m_consecutiveTimeouts >= m_linkFailTimeouts)
+    {
+        m_consecutiveTimeouts = 0;
+        emit sig_linkFailed();
+    }
+    pump();
+}
+
+void ModbusEngine::setLinkState(bool bConnected)
+{
+    m_consecutiveTimeouts = 0;
+    if(bConnected)
+    {
+        m_timeoutTimer->start();
+    }
+    else
+    {
+        m_timeoutTimer->stop();
+        clear();
+    }
+    emit sig_connectedChanged(bConnected);
+}
+
+void ModbusEngine::clear()
+{
+    for(int i=0; i<MaxInFlightLimit; i++)
+        m_inFlight[i].bUsed = false;
+    m_inFlightCount = 0;
+    m_nextPoll = m_pollList.size();
+    m_pollPending = 0;
+    m_retryCount = 0;
+
+    for(int i=0; i<CommandPoolSize; i++)
+    {
+        if(m_commandState[i] != 0)
+            finishCommand(i, false, 0);
+    }
+}
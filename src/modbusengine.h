@@ -0,0 +1,181 @@
+﻿#ifndef MODBUSENGINE_H
+#define MODBUSENGINE_H
+
+#include <QObject>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "commondefine.h"
+#include "rttestimator.h"
+
+/* 一个Modbus事务，PDU在登记或入队时生成于frame[7]起，发送时由传输层补帧头帧尾
+ * TCP: frame[0..6]为MBAP头 RTU: frame[6]为从站地址，CRC紧跟PDU
+*/
+struct EngineTransaction
+{
+    quint8 uServerAddr;             //从站地址
+    QModbusDataUnit::RegisterType eRegTable; //寄存器类型
+    quint16 uStartAddr;             //起始寄存器地址
+    quint16 uCount;                 //寄存器个数，线圈、离散输入为点数
+    quint8 uFunctionCode;           //功能码
+    int iPduLength;                 //PDU长度
+    quint8 frame[262];              //请求帧，PDU最大253字节
+    int iCommandId;                 //写命令编号，轮询事务为-1
+    bool bEnabled;                  //轮询事务本周期是否发送
+    int iTagCount;                  //合并到本命令的标签个数
+    int tagList[8];                 //命令标签，完成时逐个通知
+    QElapsedTimer commandTimer;     //写命令从入队开始计时
+};
+
+/* 零分配Modbus客户端引擎，与传输无关的部分
+ * 轮询事务加载时一次生成请求PDU，之后每周期原样发送；写命令在预分配的命令池中生成
+ * 应答由传输层在接收缓冲区内定界后交给handleResponse原地解析，收发过程不再分配内存
+ * 派生类实现连接管理、帧头帧尾和应答定界
+*/
+class ModbusEngine : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        FrameHeaderSize = 7,        //frame中PDU之前预留的字节数
+        MaxInFlightLimit = 64,      //同时等待应答的最大事务数
+        CommandPoolSize = 64,       //未完成写命令的最大个数
+        MaxMergedTags = 8           //一个屏蔽写命令最多合并的标签数
+    };
+
+    explicit ModbusEngine(QObject *parent = nullptr);
+
+    void setTimeout(int iTimeoutMs);
+    /* 按实测往返时间自适应超时，setTimeout的值为上限，登记事务前调用
+     * iFloorMs: 超时下限，0不启用
+     * iRetries: 有RTT估计的读事务超时后在本周期内重发的次数，没有估计时超时已是上限，不重发
+    */
+    void setAdaptiveTimeout(int iFloorMs, int iPercentile, double dFactor, int iRetries);
+    virtual void setMaxInFlight(int iMaxInFlight);
+    virtual void connectDevice() = 0;
+    //主动断开，断开后经sig_connectedChanged通知
+    virtual void disconnectDevice() = 0;
+    virtual bool isConnected() const = 0;
+    virtual QString errorString() const = 0;
+    //连续超时的事务数达到iTimeouts时通知sig_linkFailed，期间收到任何应答都重新计数，0不判定
+    void setLinkFailTimeouts(int iTimeouts);
+
+    /* 加载时登记轮询事务，请求PDU一次生成
+     * 返回值: 事务下标，参数超出功能码限制时返回-1
+     * 写事务的值通过setWriteValues直接编码进请求帧
+    */
+    int addReadTransaction(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount);
+    int addWriteTransaction(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount);
+    void clearTransactions();
+    //pRegValue: uCount个寄存器值或线圈点
+    void setWriteValues(int iIndex, const quint16 *pRegValue);
+    //停发的轮询事务在下一次startCycle起不再发送，也不计入周期未完成数
+    void setEnabled(int iIndex, bool bEnabled);
+
+    //发送一个周期的全部轮询事务，同时在途的事务数不超过MaxInFlight
+    void startCycle();
+    bool isCycleIdle() const;
+    int getPendingCount() const;
+    //收发计数，只在链路线程读取
+    const LinkCounters &getCounters() const;
+
+    /* 写命令排在未发送的轮询事务之前，同一寄存器未发送的屏蔽写合并，命令池满时返回-1
+     * iCommandId: 重发的命令沿用原命令编号，完成时按它通知，-1为新编号
+    */
+    int enqueueCommand(const QModbusDataUnit &unit, quint8 uServerAddr, int iTag, int iCommandId = -1);
+    int enqueueMaskCommand(quint16 qRegAddr, quint16 uAndMask, quint16 uOrMask, quint8 uServerAddr, int iTag);
+    //按需读命令，与写命令同一队列，读成功时先通知sig_commandRead再通知sig_commandFinished
+    int enqueueReadCommand(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTag);
+
+    //链路断开时未完成的命令按失败通知，本周期轮询作废
+    void clear();
+
+signals:
+    //读应答解析到预分配缓冲区，pRegValue只在信号处理期间有效，需直连
+    void sig_readBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    //轮询读事务失败 uCount：块内寄存器个数 iExceptionCode：从站异常码，超时或应答不匹配为0
+    void sig_pollFailed(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iExceptionCode);
+    void sig_commandFinished(int iCommandId, int iTag, bool bIsMaskWrite, bool bSuccess, int iExceptionCode, qint64 iLatencyUs);
+    //读命令应答，pRegValue只在信号处理期间有效，需直连
+    void sig_commandRead(int iCommandId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    void sig_connectedChanged(bool bConnected);
+    //本周期的轮询事务全部完成，链路断开作废的周期不通知
+    void sig_cycleFinished();
+    //连续超时达到门限，链路可能已断开，由服务决定是否断开重连
+    void sig_linkFailed();
+
+protected:
+    //补齐帧头帧尾并写出，uTransactionId由基类分配，用于匹配应答
+    virtual void sendFrame(EngineTransaction &transaction, quint16 uTransactionId) = 0;
+    //传输层是否允许立即发送下一帧，RTU需等待帧间静默
+    virtual bool isReadyToSend();
+    //在应答超时之外追加的时间，RTU为请求帧在线上的时间
+    virtual int getExtraTimeoutMs(const EngineTransaction &transaction) const;
+    //事务超时后通知传输层丢弃未完成的应答
+    virtual void onTransactionTimeout();
+
+    void pump();
+    //返回在途事务下标，没有时返回-1
+    int findInFlight(quint16 uTransactionId) const;
+    //pPdu指向接收缓冲区内的应答PDU，处理后释放在途事务
+    void handleResponse(int iEntry, quint8 uServerAddr, const quint8 *pPdu, int iPduLength);
+    //应答帧错误，在途事务按失败结束
+    void failInFlight(int iEntry);
+    //链路建立或断开
+    void setLinkState(bool bConnected);
+
+protected:
+    LinkCounters m_counters;        //字节数由传输层累加
+
+private slots:
+    void slot_checkTimeout();
+
+private:
+    //在途事务，按事务号匹配应答
+    struct InFlightEntry
+    {
+        bool bUsed;
+        bool bIsCommand;
+        quint16 uTransactionId;
+        int iIndex;                 //轮询事务下标或命令池下标
+        int iTimeoutMs;
+        int iExtraMs;               //iTimeoutMs中传输层追加的部分，RTT样本扣除
+        QElapsedTimer sendTimer;
+    };
+
+    bool buildWritePdu(EngineTransaction &transaction, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount);
+    void encodeWriteValues(EngineTransaction &transaction, const quint16 *pRegValue);
+    int allocCommand();
+    int findQueuedCommand() const;
+    void sendTransaction(EngineTransaction &transaction, bool bIsCommand, int iIndex);
+    void releaseInFlight(int iEntry, bool bSuccess);
+    void finishPoll(const EngineTransaction &transaction, bool bSuccess, int iExceptionCode);
+    void finishCommand(int iIndex, bool bSuccess, int iExceptionCode);
+
+private:
+    QTimer *m_timeoutTimer;
+    int m_timeoutMs;
+    RttEstimator m_rtt;                     //块编号为轮询事务下标，命令只按从站估计
+    int m_maxRetries;
+    int m_maxInFlight;
+    int m_inFlightCount;
+    quint16 m_nextTransactionId;
+    int m_nextCommandId;
+    int m_linkFailTimeouts;
+    int m_consecutiveTimeouts;              //自上次收到应答以来超时的事务数
+
+    QVector<EngineTransaction> m_pollList;  //轮询事务，加载后不再增减
+    int m_nextPoll;                         //本周期下一个待发送的轮询事务
+    int m_pollPending;                      //本周期未完成的轮询事务数
+    QVector<quint8> m_pollRetries;          //本周期各轮询事务已重发的次数
+    int m_retryList[MaxInFlightLimit];      //超时待重发的轮询事务，先于未发送的轮询事务发送
+    int m_retryCount;
+
+    EngineTransaction m_commandPool[CommandPoolSize];
+    int m_commandState[CommandPoolSize];    //0：空闲 1：排队 2：在途
+    InFlightEntry m_inFlight[MaxInFlightLimit];
+    quint16 m_regBuffer[2000];              //读应答解析结果，线圈最多2000点
+};
+
+#endif // MODBUSENGINE_H
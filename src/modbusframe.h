@@ -0,0 +1,117 @@
+﻿#ifndef MODBUSFRAME_H
+#define MODBUSFRAME_H
+
+#include "commondefine.h"
+
+//Modbus帧编解码，通信引擎与采集器共用，全部在调用方的缓冲区内完成，不分配内存
+
+inline void putUInt16(quint8 *pData, quint16 uValue)
+{
+    pData[0] = (quint8)(uValue >> 8);
+    pData[1] = (quint8)uValue;
+}
+
+inline quint16 getUInt16(const quint8 *pData)
+{
+    return (quint16)((pData[0] << 8) | pData[1]);
+}
+
+//MBAP头 事务号2字节 协议号2字节 长度2字节 单元号1字节，长度为单元号+PDU，PDU从第7字节开始
+inline void buildMbapHeader(quint8 *pFrame, quint16 uTransactionId, quint8 uServerAddr, int iPduLength)
+{
+    putUInt16(pFrame, uTransactionId);
+    putUInt16(pFrame + 2, 0);
+    putUInt16(pFrame + 4, (quint16)(iPduLength + 1));
+    pFrame[6] = uServerAddr;
+}
+
+//线圈功能码01，离散输入02，输入寄存器04，保持寄存器03
+inline quint8 readFunctionCode(QModbusDataUnit::RegisterType eRegTable)
+{
+    switch(eRegTable)
+    {
+    case QModbusDataUnit::Coils:
+        return 0x01;
+    case QModbusDataUnit::DiscreteInputs:
+        return 0x02;
+    case QModbusDataUnit::InputRegisters:
+        return 0x04;
+    case QModbusDataUnit::HoldingRegisters:
+        return 0x03;
+    default:
+        return 0;
+    }
+}
+
+//生成读请求PDU，返回PDU长度，超出功能码限制返回-1
+inline int buildReadPdu(quint8 *pPdu, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount)
+{
+    quint8 uFunctionCode = readFunctionCode(eRegTable);
+    int iMaxCount = isBitTable(eRegTable) ? 2000 : 125;
+    if(uFunctionCode == 0 || uCount == 0 || uCount > iMaxCount)
+        return -1;
+
+    pPdu[0] = uFunctionCode;
+    putUInt16(pPdu + 1, uStartAddr);
+    putUInt16(pPdu + 3, uCount);
+    return 5;
+}
+
+//解析读应答PDU，字节数与请求不符时返回false，线圈、离散输入每个值为一个点
+inline bool parseReadPdu(const quint8 *pPdu, int iPduLength, QModbusDataUnit::RegisterType eRegTable, quint16 uCount, quint16 *pRegValue)
+{
+    bool bIsBit = isBitTable(eRegTable);
+    int iByteCount = bIsBit ? (uCount + 7) / 8 : uCount * 2;
+    if(iPduLength != 2 + iByteCount || pPdu[0] != readFunctionCode(eRegTable) || pPdu[1] != iByteCount)
+        return false;
+
+    const quint8 *pData = pPdu + 2;
+    for(int i=0; i<uCount; i++)
+        pRegValue[i] = bIsBit ? ((pData[i / 8] >> (i % 8)) & 0x01) : getUInt16(pData + i * 2);
+    return true;
+}
+
+//功能码22屏蔽写的结果，uAndMask为1的位保留，其余位取uOrMask
+inline quint16 applyMaskWrite(quint16 uRegValue, quint16 uAndMask, quint16 uOrMask)
+{
+    return (quint16)((uRegValue & uAndMask) | (uOrMask & ~uAndMask));
+}
+
+/* 同一寄存器的两次屏蔽写合并为一次，uNextAnd/uNextOr为后一次
+ * 后一次保留的位取前一次的OR，其余位取后一次的OR；代理转发的OR可在AND为1的位上置位，不能直接相或
+*/
+inline void mergeMaskWrite(quint16 &uAndMask, quint16 &uOrMask, quint16 uNextAnd, quint16 uNextOr)
+{
+    uOrMask = (quint16)((uOrMask & uNextAnd) | (uNextOr & ~uNextAnd));
+    uAndMask &= uNextAnd;
+}
+
+/* RTU帧CRC16，多项式0xA001，初值0xFFFF，结果低字节在前
+ * 按字节查表，表在首次调用时生成
+*/
+struct ModbusCrcTable
+{
+    quint16 table[256];
+
+    ModbusCrcTable()
+    {
+        for(int i=0; i<256; i++)
+        {
+            quint16 uCrc = (quint16)i;
+            for(int j=0; j<8; j++)
+                uCrc = (uCrc & 0x0001) ? (quint16)((uCrc >> 1) ^ 0xA001) : (quint16)(uCrc >> 1);
+            table[i] = uCrc;
+        }
+    }
+};
+
+inline quint16 modbusCrc16(const quint8 *pData, int iLength)
+{
+    static const ModbusCrcTable crcTable;
+    quint16 uCrc = 0xFFFF;
+    for(int i=0; i<iLength; i++)
+        uCrc = (quint16)((uCrc >> 8) ^ crcTable.table[(uCrc ^ pData[i]) & 0xFF]);
+    return uCrc;
+}
+
+#endif // MODBUSFRAME_H
@@ -0,0 +1,399 @@
+﻿#include "modbusproxyserver.h"
+#include "modbusframe.h"
+#include <QModbusPdu>
+#include <QDebug>
+#include <string.h>
+
+ModbusProxyServer::ModbusProxyServer(QObject *parent) : QObject(parent),
+    m_tcpServer(nullptr),
+    m_maxAgeMs(0),
+    m_maxClients(16),
+    m_nextRequestId(0)
+{
+    m_tcpServer = new QTcpServer(this);
+    connect(m_tcpServer, &QTcpServer::newConnection, this, &ModbusProxyServer::slot_newConnection);
+    m_clock.start();
+}
+
+ModbusProxyServer::~ModbusProxyServer()
+{
+    qDeleteAll(m_clientHash);
+    m_clientHash.clear();
+}
+
+void ModbusProxyServer::setMaxAge(int iMaxAgeMs)
+{
+    m_maxAgeMs = iMaxAgeMs > 0 ? iMaxAgeMs : 0;
+}
+
+void ModbusProxyServer::setMaxClients(int iMaxClients)
+{
+    m_maxClients = iMaxClients > 0 ? iMaxClients : 16;
+}
+
+bool ModbusProxyServer::listen(quint16 uPort)
+{
+    return m_tcpServer->listen(QHostAddress::Any, uPort);
+}
+
+QString ModbusProxyServer::errorString() const
+{
+    return m_tcpServer->errorString();
+}
+
+void ModbusProxyServer::addImageBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount)
+{
+    ProxyImageBlock block;
+    block.uCount = uCount;
+    block.iUpdateMs = -1;
+    block.uExceptionCode = 0;
+    block.valueList.fill(0, uCount);
+    m_imageMap.insert(makeRegKey(uServerAddr, eRegTable, uStartAddr), block);
+    m_serverSet.insert(uServerAddr);
+}
+
+void ModbusProxyServer::updateImage(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount)
+{
+    QMap<quint32, ProxyImageBlock>::iterator itr = m_imageMap.find(makeRegKey(uServerAddr, eRegTable, uStartAddr));
+    if(itr == m_imageMap.end() || itr.value().uCount != iCount)
+        return;
+    memcpy(itr.value().valueList.data(), pRegValue, iCount * sizeof(quint16));
+    itr.value().iUpdateMs = m_clock.elapsed();
+    itr.value().uExceptionCode = 0;
+}
+
+void ModbusProxyServer::setImageError(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, int iExceptionCode)
+{
+    QMap<quint32, ProxyImageBlock>::iterator itr = m_imageMap.find(makeRegKey(uServerAddr, eRegTable, uStartAddr));
+    if(itr == m_imageMap.end())
+        return;
+    itr.value().uExceptionCode = iExceptionCode > 0 ? iExceptionCode : QModbusPdu::GatewayTargetDeviceFailedToRespond;
+}
+
+void ModbusProxyServer::invalidateImage()
+{
+    QMap<quint32, ProxyImageBlock>::iterator itr = m_imageMap.begin();
+    for(; itr != m_imageMap.end(); itr++)
+        itr.value().uExceptionCode = QModbusPdu::GatewayTargetDeviceFailedToRespond;
+}
+
+int ModbusProxyServer::readImage(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, quint16 *pRegValue) const
+{
+    //请求可跨越多个相邻的块，每个块分别检查时效
+    qint64 iNowMs = m_clock.elapsed();
+    quint32 uKey = makeRegKey(uServerAddr, eRegTable, uStartAddr);
+    quint32 uEndKey = uKey + uCount;
+    int iPos = 0;
+    while(uKey < uEndKey)
+    {
+        QMap<quint32, ProxyImageBlock>::const_iterator itr = m_imageMap.upperBound(uKey);
+        if(itr == m_imageMap.constBegin())
+            return QModbusPdu::IllegalDataAddress;
+        itr--;
+        const ProxyImageBlock &block = itr.value();
+        int iOffset = uKey - itr.key();
+        if(iOffset >= block.uCount)
+            return QModbusPdu::IllegalDataAddress;
+        if(block.uExceptionCode != 0)
+            return block.uExceptionCode;
+        if(block.iUpdateMs < 0 || (m_maxAgeMs > 0 && iNowMs - block.iUpdateMs > m_maxAgeMs))
+            return QModbusPdu::GatewayTargetDeviceFailedToRespond;
+
+        int iCopy = qMin((int)(uEndKey - uKey), block.uCount - iOffset);
+        memcpy(pRegValue + iPos, block.valueList.constData() + iOffset, iCopy * sizeof(quint16));
+        iPos += iCopy;
+        uKey += iCopy;
+    }
+    return 0;
+}
+
+quint8 ModbusProxyServer::resolveUnit(quint8 uUnitId) const
+{
+    if(m_serverSet.contains(uUnitId))
+        return uUnitId;
+    if(m_serverSet.size() == 1 && (uUnitId == 0 || uUnitId == 0xFF))
+        return *m_serverSet.constBegin();
+    return 0;
+}
+
+void ModbusProxyServer::slot_newConnection()
+{
+    while(QTcpSocket *pSocket = m_tcpServer->nextPendingConnection())
+    {
+        if(m_clientHash.size() >= m_maxClients)
+        {
+            qDebug()<<"Proxy: client limit reached, connection refused";
+            pSocket->abort();
+            pSocket->deleteLater();
+            continue;
+        }
+
+        ProxyClient *pClient = new ProxyClient;
+        pClient->pSocket = pSocket;
+        pClient->iRxLength = 0;
+        m_clientHash.insert(pSocket, pClient);
+        pSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(pSocket, &QTcpSocket::readyRead, this, &ModbusProxyServer::slot_readyRead);
+        connect(pSocket, &QTcpSocket::disconnected, this, &ModbusProxyServer::slot_disconnected);
+    }
+}
+
+void ModbusProxyServer::slot_disconnected()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    delete m_clientHash.take(pSocket);
+
+    //未完成的写请求照常下发，只是不再回复
+    QHash<int, PendingWrite>::iterator itr = m_pendingWriteHash.begin();
+    while(itr != m_pendingWriteHash.end())
+    {
+        if(itr.value().pSocket == pSocket)
+            itr.value().pSocket = nullptr;
+        itr++;
+    }
+    pSocket->deleteLater();
+}
+
+void ModbusProxyServer::slot_readyRead()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    ProxyClient *pClient = m_clientHash.value(pSocket, nullptr);
+    if(!pClient)
+        return;
+
+    while(true)
+    {
+        qint64 iRead = pSocket->read(reinterpret_cast<char*>(pClient->rxBuffer) + pClient->iRxLength, RxBufferSize - pClient->iRxLength);
+        if(iRead <= 0)
+            break;
+        pClient->iRxLength += iRead;
+
+        int iPos = 0;
+        while(pClient->iRxLength - iPos >= 7)
+        {
+            const quint8 *pFrame = pClient->rxBuffer + iPos;
+            int iLength = getUInt16(pFrame + 4);
+            if(getUInt16(pFrame + 2) != 0 || iLength < 2 || iLength > 254)
+            {
+                qDebug()<<"Proxy: invalid MBAP header, dropping client";
+                pClient->iRxLength = 0;
+                pSocket->abort();
+                return;
+            }
+            if(pClient->iRxLength - iPos < 6 + iLength)
+                break;
+            handleRequest(pSocket, pFrame, 6 + iLength);
+            iPos += 6 + iLength;
+        }
+
+        if(iPos > 0)
+        {
+            memmove(pClient->rxBuffer, pClient->rxBuffer + iPos, pClient->iRxLength - iPos);
+            pClient->iRxLength -= iPos;
+        }
+    }
+}
+
+void ModbusProxyServer::handleRequest(QTcpSocket *pSocket, const quint8 *pFrame, int iLength)
+{
+    quint16 uTransactionId = getUInt16(pFrame);
+    quint8 uUnitId = pFrame[6];
+    const quint8 *pPdu = pFrame + 7;
+    int iPduLength = iLength - 7;
+    quint8 uFunctionCode = pPdu[0];
+
+    quint8 uServerAddr = resolveUnit(uUnitId);
+    if(uServerAddr == 0)
+    {
+        sendException(pSocket, uTransactionId, uUnitId, uFunctionCode, QModbusPdu::GatewayPathUnavailable);
+        return;
+    }
+
+    int iExceptionCode = 0;
+    switch(uFunctionCode)
+    {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    {
+        int iResponseLength = 0;
+        iExceptionCode = handleRead(uServerAddr, pPdu, iPduLength, iResponseLength);
+        if(iExceptionCode == 0)
+            sendResponse(pSocket, uTransactionId, uUnitId, iResponseLength);
+        break;
+    }
+    case 0x05:
+    case 0x06:
+    case 0x0F:
+    case 0x10:
+    case 0x16:
+        //成功时在PLC应答后回复
+        iExceptionCode = handleWrite(pSocket, uTransactionId, uUnitId, uServerAddr, pPdu, iPduLength);
+        break;
+    default:
+        iExceptionCode = QModbusPdu::IllegalFunction;
+        break;
+    }
+
+    if(iExceptionCode != 0)
+        sendException(pSocket, uTransactionId, uUnitId, uFunctionCode, iExceptionCode);
+}
+
+int ModbusProxyServer::handleRead(quint8 uServerAddr, const quint8 *pPdu, int iPduLength, int &iResponseLength)
+{
+    QModbusDataUnit::RegisterType eRegTable = QModbusDataUnit::Invalid;
+    switch(pPdu[0])
+    {
+    case 0x01:
+        eRegTable = QModbusDataUnit::Coils;
+        break;
+    case 0x02:
+        eRegTable = QModbusDataUnit::DiscreteInputs;
+        break;
+    case 0x03:
+        eRegTable = QModbusDataUnit::HoldingRegisters;
+        break;
+    default:
+        eRegTable = QModbusDataUnit::InputRegisters;
+        break;
+    }
+    if(iPduLength != 5)
+        return QModbusPdu::IllegalDataValue;
+
+    quint16 uStartAddr = getUInt16(pPdu + 1);
+    quint16 uCount = getUInt16(pPdu + 3);
+    bool bIsBit = isBitTable(eRegTable);
+    if(uCount == 0 || uCount > (bIsBit ? 2000 : 125))
+        return QModbusPdu::IllegalDataValue;
+    if(uStartAddr + uCount > 0x10000)
+        return QModbusPdu::IllegalDataAddress;
+
+    int iExceptionCode = readImage(uServerAddr, eRegTable, uStartAddr, uCount, m_regBuffer);
+    if(iExceptionCode != 0)
+        return iExceptionCode;
+
+    quint8 *pResponse = m_txBuffer + 7;
+    int iByteCount = bIsBit ? (uCount + 7) / 8 : uCount * 2;
+    pResponse[0] = pPdu[0];
+    pResponse[1] = (quint8)iByteCount;
+    quint8 *pData = pResponse + 2;
+    if(bIsBit)
+    {
+        memset(pData, 0, iByteCount);
+        for(int i=0; i<uCount; i++)
+        {
+            if(m_regBuffer[i])
+                pData[i / 8] |= (quint8)(1 << (i % 8));
+        }
+    }
+    else
+    {
+        for(int i=0; i<uCount; i++)
+            putUInt16(pData + i * 2, m_regBuffer[i]);
+    }
+    iResponseLength = 2 + iByteCount;
+    return 0;
+}
+
+int ModbusProxyServer::handleWrite(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, quint8 uServerAddr, const quint8 *pPdu, int iPduLength)
+{
+    quint8 uFunctionCode = pPdu[0];
+    if(iPduLength < 5)
+        return QModbusPdu::IllegalDataValue;
+    quint16 uStartAddr = getUInt16(pPdu + 1);
+
+    PendingWrite pendingWrite;
+    pendingWrite.pSocket = pSocket;
+    pendingWrite.uTransactionId = uTransactionId;
+    pendingWrite.uUnitId = uUnitId;
+    pendingWrite.uFunctionCode = uFunctionCode;
+    //05 06应答原样回显，15 16回显地址和数量，22回显屏蔽码
+    pendingWrite.iResponseLength = uFunctionCode == 0x16 ? 7 : 5;
+    if(iPduLength < pendingWrite.iResponseLength)
+        return QModbusPdu::IllegalDataValue;
+    memcpy(pendingWrite.responsePdu, pPdu, pendingWrite.iResponseLength);
+
+    int iRequestId = m_nextRequestId++;
+    if(uFunctionCode == 0x16)
+    {
+        if(iPduLength != 7)
+            return QModbusPdu::IllegalDataValue;
+        m_pendingWriteHash.insert(iRequestId, pendingWrite);
+        emit sig_maskWriteRequest(iRequestId, uServerAddr, uStartAddr, getUInt16(pPdu + 3), getUInt16(pPdu + 5));
+        return 0;
+    }
+
+    QModbusDataUnit unit;
+    if(uFunctionCode == 0x05 || uFunctionCode == 0x06)
+    {
+        quint16 uValue = getUInt16(pPdu + 3);
+        if(iPduLength != 5 || (uFunctionCode == 0x05 && uValue != 0xFF00 && uValue != 0x0000))
+            return QModbusPdu::IllegalDataValue;
+        if(uFunctionCode == 0x05)
+        {
+            unit = QModbusDataUnit(QModbusDataUnit::Coils, uStartAddr, 1);
+            unit.setValue(0, uValue ? 1 : 0);
+        }
+        else
+        {
+            unit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, uStartAddr, 1);
+            unit.setValue(0, uValue);
+        }
+    }
+    else
+    {
+        if(iPduLength < 6)
+            return QModbusPdu::IllegalDataValue;
+        quint16 uCount = getUInt16(pPdu + 3);
+        int iByteCount = pPdu[5];
+        bool bIsCoil = uFunctionCode == 0x0F;
+        if(uCount == 0 || uCount > (bIsCoil ? 1968 : 123)
+           || iByteCount != (bIsCoil ? (uCount + 7) / 8 : uCount * 2) || iPduLength != 6 + iByteCount)
+            return QModbusPdu::IllegalDataValue;
+        if(uStartAddr + uCount > 0x10000)
+            return QModbusPdu::IllegalDataAddress;
+
+        const quint8 *pData = pPdu + 6;
+        unit = QModbusDataUnit(bIsCoil ? QModbusDataUnit::Coils : QModbusDataUnit::HoldingRegisters, uStartAddr, uCount);
+        for(int i=0; i<uCount; i++)
+            unit.setValue(i, bIsCoil ? ((pData[i / 8] >> (i % 8)) & 0x01) : getUInt16(pData + i * 2));
+    }
+
+    m_pendingWriteHash.insert(iRequestId, pendingWrite);
+    emit sig_writeRequest(iRequestId, uServerAddr, unit);
+    return 0;
+}
+
+void ModbusProxyServer::finishWrite(int iRequestId, bool bSuccess, int iExceptionCode)
+{
+    QHash<int, PendingWrite>::iterator itr = m_pendingWriteHash.find(iRequestId);
+    if(itr == m_pendingWriteHash.end())
+        return;
+    PendingWrite pendingWrite = itr.value();
+    m_pendingWriteHash.erase(itr);
+    if(!pendingWrite.pSocket)
+        return;
+
+    if(!bSuccess)
+    {
+        sendException(pendingWrite.pSocket, pendingWrite.uTransactionId, pendingWrite.uUnitId, pendingWrite.uFunctionCode,
+                      iExceptionCode != 0 ? iExceptionCode : (int)QModbusPdu::GatewayTargetDeviceFailedToRespond);
+        return;
+    }
+    memcpy(m_txBuffer + 7, pendingWrite.responsePdu, pendingWrite.iResponseLength);
+    sendResponse(pendingWrite.pSocket, pendingWrite.uTransactionId, pendingWrite.uUnitId, pendingWrite.iResponseLength);
+}
+
+void ModbusProxyServer::sendResponse(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, int iPduLength)
+{
+    buildMbapHeader(m_txBuffer, uTransactionId, uUnitId, iPduLength);
+    pSocket->write(reinterpret_cast<const char*>(m_txBuffer), 7 + iPduLength);
+}
+
+void ModbusProxyServer::sendException(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, quint8 uFunctionCode, int iExceptionCode)
+{
+    m_txBuffer[7] = (quint8)(uFunctionCode | 0x80);
+    m_txBuffer[8] = (quint8)iExceptionCode;
+    sendResponse(pSocket, uTransactionId, uUnitId, 2);
+}
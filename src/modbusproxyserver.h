@@ -0,0 +1,119 @@
+﻿#ifndef MODBUSPROXYSERVER_H
+#define MODBUSPROXYSERVER_H
+
+#include <QObject>
+#include <QVector>
+#include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include "commondefine.h"
+
+//过程映像中的一个块，与一个轮询读请求块对应，线圈、离散输入每个值为一个点
+struct ProxyImageBlock
+{
+    quint16 uCount;
+    qint64 iUpdateMs;               //最近一次读回的时间，未读回为-1
+    quint8 uExceptionCode;          //最近一次轮询失败时应答的异常码，读回后清零
+    QVector<quint16> valueList;
+};
+
+/* Modbus TCP扇出代理
+ * 多个SCADA、HMI客户端连到本服务而不是PLC，读请求由轮询得到的过程映像直接应答，PLC只承担一路轮询
+ * 映像超过最大时效或尚未读回时应答异常0x0B（网关目标无应答），不在轮询计划内的地址应答0x02
+ * 写请求（05 06 15 16 22）经服务的命令通道转发到PLC，PLC应答后再回复客户端
+ * 单元号为链路上的从站地址，链路只有一个从站时单元号0和255也指向该从站
+*/
+class ModbusProxyServer : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        RxBufferSize = 1024         //每个客户端的接收缓冲区字节数
+    };
+
+    explicit ModbusProxyServer(QObject *parent = nullptr);
+    ~ModbusProxyServer();
+
+    //iMaxAgeMs: 映像的最大时效，0为不限
+    void setMaxAge(int iMaxAgeMs);
+    void setMaxClients(int iMaxClients);
+    bool listen(quint16 uPort);
+    QString errorString() const;
+
+    //登记过程映像块，与轮询读请求块一一对应
+    void addImageBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount);
+    //读应答到达时更新映像 pRegValue：块内iCount个寄存器值或点
+    void updateImage(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    //轮询失败，之后读该块时转发从站异常码，超时等通讯错误为0x0B，直到再次读回
+    void setImageError(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, int iExceptionCode);
+    //链路断开，全部映像块按通讯错误处理
+    void invalidateImage();
+
+    /* 转发的写请求完成
+     * iExceptionCode: PLC异常码，失败且为0时按网关目标无应答回复
+    */
+    void finishWrite(int iRequestId, bool bSuccess, int iExceptionCode);
+
+signals:
+    //客户端写请求，完成后调用finishWrite
+    void sig_writeRequest(int iRequestId, quint8 uServerAddr, const QModbusDataUnit &unit);
+    void sig_maskWriteRequest(int iRequestId, quint8 uServerAddr, quint16 uRegAddr, quint16 uAndMask, quint16 uOrMask);
+
+private slots:
+    void slot_newConnection();
+    void slot_readyRead();
+    void slot_disconnected();
+
+private:
+    struct ProxyClient
+    {
+        QTcpSocket *pSocket;
+        quint8 rxBuffer[RxBufferSize];
+        int iRxLength;
+    };
+
+    //等待PLC应答的写请求，应答PDU在收到请求时生成
+    struct PendingWrite
+    {
+        QTcpSocket *pSocket;
+        quint16 uTransactionId;
+        quint8 uUnitId;
+        quint8 uFunctionCode;
+        quint8 responsePdu[7];
+        int iResponseLength;
+    };
+
+    void handleRequest(QTcpSocket *pSocket, const quint8 *pFrame, int iLength);
+    //返回0或异常码
+    int handleRead(quint8 uServerAddr, const quint8 *pPdu, int iPduLength, int &iResponseLength);
+    int handleWrite(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, quint8 uServerAddr, const quint8 *pPdu, int iPduLength);
+    //从映像读取连续的寄存器，返回0或异常码
+    int readImage(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, quint16 *pRegValue) const;
+    //单元号对应的从站地址，无对应从站时返回0
+    quint8 resolveUnit(quint8 uUnitId) const;
+    void sendResponse(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, int iPduLength);
+    void sendException(QTcpSocket *pSocket, quint16 uTransactionId, quint8 uUnitId, quint8 uFunctionCode, int iExceptionCode);
+
+private:
+    QTcpServer *m_tcpServer;
+    QElapsedTimer m_clock;
+    int m_maxAgeMs;
+    int m_maxClients;
+    int m_nextRequestId;
+
+    //过程映像 Key:makeRegKey(从站地址, 寄存器类型, 块起始地址)
+    QMap<quint32, ProxyImageBlock> m_imageMap;
+    QSet<quint8> m_serverSet;
+    QHash<QTcpSocket*, ProxyClient*> m_clientHash;
+    //Key:请求编号
+    QHash<int, PendingWrite> m_pendingWriteHash;
+
+    quint16 m_regBuffer[2000];
+    quint8 m_txBuffer[260];         //应答帧，PDU从第7字节开始
+};
+
+#endif // MODBUSPROXYSERVER_H
@@ -0,0 +1,278 @@
+﻿#include "modbusrtuengine.h"
+#include "modbusframe.h"
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
+ModbusRtuEngine::ModbusRtuEngine(QObject *parent) : ModbusEngine(parent),
+    m_serialPort(nullptr),
+    m_frameDelayTimer(nullptr),
+    m_baudRate(9600),
+    m_dataBits(8),
+    m_parity(QSerialPort::NoParity),
+    m_stopBits(QSerialPort::OneStop),
+    m_charTimeNs(1041667),
+    m_interFrameDelayNs(3645833),
+    m_interCharTimeoutNs(1562500),
+    m_bFrameLog(false),
+    m_uTransactionId(0),
+    m_uServerAddr(0),
+    m_uFunctionCode(0),
+    m_lastActivityNs(0),
+    m_rxLength(0),
+    m_crcErrorCount(0),
+    m_frameErrorCount(0)
+{
+    m_serialPort = new QSerialPort(this);
+    connect(m_serialPort, &QSerialPort::readyRead, this, &ModbusRtuEngine::slot_readyRead);
+    connect(m_serialPort, &QSerialPort::errorOccurred, this, &ModbusRtuEngine::slot_errorOccurred);
+
+    m_frameDelayTimer = new QTimer(this);
+    m_frameDelayTimer->setSingleShot(true);
+    m_frameDelayTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_frameDelayTimer, &QTimer::timeout, this, [this]() {
+        pump();
+    });
+    m_lineTimer.start();
+}
+
+void ModbusRtuEngine::setSerialParameters(const QString &strPortName, int iBaudRate, int iDataBits, int iParity, int iStopBits)
+{
+    m_strPortName = strPortName;
+    m_baudRate = iBaudRate;
+    m_dataBits = iDataBits;
+    m_parity = iParity;
+    m_stopBits = iStopBits;
+}
+
+void ModbusRtuEngine::setTiming(qint64 iCharTimeNs, int iInterFrameDelayUs, int iInterCharTimeoutUs)
+{
+    m_charTimeNs = iCharTimeNs;
+    m_interFrameDelayNs = iInterFrameDelayUs * 1000LL;
+    m_interCharTimeoutNs = iInterCharTimeoutUs * 1000LL;
+}
+
+void ModbusRtuEngine::setFrameLog(bool bFrameLog)
+{
+    m_bFrameLog = bFrameLog;
+}
+
+void ModbusRtuEngine::setMaxInFlight(int)
+{
+    ModbusEngine::setMaxInFlight(1);
+}
+
+void ModbusRtuEngine::connectDevice()
+{
+    if(m_serialPort->isOpen())
+        return;
+
+    m_serialPort->setPortName(m_strPortName);
+    m_serialPort->setBaudRate(m_baudRate);
+    m_serialPort->setDataBits((QSerialPort::DataBits)m_dataBits);
+    m_serialPort->setParity((QSerialPort::Parity)m_parity);
+    m_serialPort->setStopBits((QSerialPort::StopBits)m_stopBits);
+    m_serialPort->setFlowControl(QSerialPort::NoFlowControl);
+    if(!m_serialPort->open(QIODevice::ReadWrite))
+    {
+        setLinkState(false);
+        return;
+    }
+
+    m_serialPort->clear();
+    setLowLatency();
+    m_rxLength = 0;
+    m_lastActivityNs = m_lineTimer.nsecsElapsed();
+    setLinkState(true);
+}
+
+void ModbusRtuEngine::disconnectDevice()
+{
+    if(!m_serialPort->isOpen())
+        return;
+    m_serialPort->close();
+    m_rxLength = 0;
+    setLinkState(false);
+}
+
+bool ModbusRtuEngine::isConnected() const
+{
+    return m_serialPort->isOpen();
+}
+
+QString ModbusRtuEngine::errorString() const
+{
+    return m_serialPort->errorString();
+}
+
+void ModbusRtuEngine::setLowLatency()
+{
+#ifdef Q_OS_LINUX
+    //驱动默认攒批上报（USB适配器常见16ms），打开低延迟后读到数据的时间才接近字节到达的时间
+    serial_struct serialInfo;
+    int iFd = m_serialPort->handle();
+    if(ioctl(iFd, TIOCGSERIAL, &serialInfo) == 0)
+    {
+        serialInfo.flags |= ASYNC_LOW_LATENCY;
+        ioctl(iFd, TIOCSSERIAL, &serialInfo);
+    }
+#endif
+}
+
+void ModbusRtuEngine::sendFrame(EngineTransaction &transaction, quint16 uTransactionId)
+{
+    //从站地址在PDU前一个字节，CRC低字节在前紧跟PDU
+    quint8 *pAdu = transaction.frame + FrameHeaderSize - 1;
+    int iLength = transaction.iPduLength + 1;
+    pAdu[0] = transaction.uServerAddr;
+    quint16 uCrc = modbusCrc16(pAdu, iLength);
+    pAdu[iLength] = (quint8)uCrc;
+    pAdu[iLength + 1] = (quint8)(uCrc >> 8);
+    iLength += 2;
+
+    m_uTransactionId = uTransactionId;
+    m_uServerAddr = transaction.uServerAddr;
+    m_uFunctionCode = transaction.uFunctionCode;
+    m_rxLength = 0;
+    if(m_bFrameLog)
+        qDebug()<<"RTU tx:"<<QByteArray::fromRawData(reinterpret_cast<const char*>(pAdu), iLength).toHex();
+    m_serialPort->write(reinterpret_cast<const char*>(pAdu), iLength);
+    m_counters.uBytesOut += iLength;
+    //帧最后一个字节离开线路的时间
+    m_lastActivityNs = m_lineTimer.nsecsElapsed() + iLength * m_charTimeNs;
+}
+
+bool ModbusRtuEngine::isReadyToSend()
+{
+    qint64 iWaitNs = m_lastActivityNs + m_interFrameDelayNs - m_lineTimer.nsecsElapsed();
+    if(iWaitNs <= 0)
+        return true;
+    if(!m_frameDelayTimer->isActive())
+        m_frameDelayTimer->start((int)((iWaitNs + 999999) / 1000000));
+    return false;
+}
+
+int ModbusRtuEngine::getExtraTimeoutMs(const EngineTransaction &transaction) const
+{
+    return (int)((transaction.iPduLength + 3) * m_charTimeNs / 1000000) + 1;
+}
+
+void ModbusRtuEngine::onTransactionTimeout()
+{
+    //迟到的应答到达时已无在途事务，按噪声丢弃
+    m_rxLength = 0;
+}
+
+int ModbusRtuEngine::getExpectedLength() const
+{
+    if(m_rxLength < 2)
+        return 0;
+    if(m_rxBuffer[0] != m_uServerAddr)
+        return -1;
+    if(m_rxBuffer[1] == (m_uFunctionCode | 0x80))
+        return 5;
+    if(m_rxBuffer[1] != m_uFunctionCode)
+        return -1;
+
+    switch(m_uFunctionCode)
+    {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+        return m_rxLength < 3 ? 0 : 5 + m_rxBuffer[2];
+    case 0x05:
+    case 0x06:
+    case 0x0F:
+    case 0x10:
+        return 8;
+    case 0x16:
+        return 10;
+    default:
+        return -1;
+    }
+}
+
+void ModbusRtuEngine::dropFrame(const char *pReason)
+{
+    qDebug()<<QString("RTU engine: %1, frame dropped (CRC errors %2, frame errors %3)")
+                    .arg(pReason)
+                    .arg(m_crcErrorCount)
+                    .arg(m_frameErrorCount);
+    m_rxLength = 0;
+    failInFlight(findInFlight(m_uTransactionId));
+}
+
+void ModbusRtuEngine::slot_readyRead()
+{
+    qint64 iNowNs = m_lineTimer.nsecsElapsed();
+    int iEntry = findInFlight(m_uTransactionId);
+    while(true)
+    {
+        qint64 iRead = m_serialPort->read(reinterpret_cast<char*>(m_rxBuffer) + m_rxLength, RxBufferSize - m_rxLength);
+        if(iRead <= 0)
+            break;
+        m_counters.uBytesIn += iRead;
+
+        //没有在途事务时收到的是噪声或超时后的应答，只刷新静默起点
+        if(iEntry < 0)
+        {
+            m_rxLength = 0;
+            m_lastActivityNs = iNowNs;
+            continue;
+        }
+
+        //本次读到的字节在线上连续到达，之前的间隔扣除其传输时间即为字符间隔
+        if(m_rxLength > 0 && iNowNs - m_lastActivityNs - iRead * m_charTimeNs > m_interCharTimeoutNs)
+        {
+            m_frameErrorCount++;
+            m_lastActivityNs = iNowNs;
+            dropFrame("inter-character timeout");
+            iEntry = -1;
+            continue;
+        }
+        m_lastActivityNs = iNowNs;
+        m_rxLength += iRead;
+
+        int iExpected = getExpectedLength();
+        if(iExpected == 0 || (iExpected > 0 && m_rxLength < iExpected))
+            continue;
+        if(iExpected < 0 || m_rxLength > iExpected)
+        {
+            m_frameErrorCount++;
+            dropFrame("unexpected response");
+            iEntry = -1;
+            continue;
+        }
+
+        if(m_bFrameLog)
+            qDebug()<<"RTU rx:"<<QByteArray::fromRawData(reinterpret_cast<const char*>(m_rxBuffer), iExpected).toHex();
+        quint16 uCrc = modbusCrc16(m_rxBuffer, iExpected - 2);
+        if(m_rxBuffer[iExpected - 2] != (quint8)uCrc || m_rxBuffer[iExpected - 1] != (quint8)(uCrc >> 8))
+        {
+            m_crcErrorCount++;
+            dropFrame("CRC error");
+            iEntry = -1;
+            continue;
+        }
+
+        //解析完成前不再读串口，缓冲区内的PDU保持有效
+        m_rxLength = 0;
+        handleResponse(iEntry, m_rxBuffer[0], m_rxBuffer + 1, iExpected - 3);
+        iEntry = -1;
+    }
+    pump();
+}
+
+void ModbusRtuEngine::slot_errorOccurred(QSerialPort::SerialPortError eError)
+{
+    if(eError == QSerialPort::NoError || eError == QSerialPort::TimeoutError)
+        return;
+
+    qDebug()<<"RTU engine: serial port error " + m_serialPort->errorString();
+    //设备拔出或读写失败时关闭，由服务重连
+    if(eError == QSerialPort::ResourceError || eError == QSerialPort::ReadError || eError == QSerialPort::WriteError)
+        disconnectDevice();
+}
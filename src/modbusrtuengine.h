@@ -0,0 +1,87 @@
+﻿#ifndef MODBUSRTUENGINE_H
+#define MODBUSRTUENGINE_H
+
+#include <QSerialPort>
+#include "modbusengine.h"
+
+/* 零分配Modbus RTU主站
+ * 请求PDU由基类在轮询计划加载时生成，发送时只在PDU前补从站地址、PDU后补CRC，直接从事务帧写出
+ * 应答按请求的功能码推算帧长定界，CRC查表校验后在接收缓冲区内原地解析
+ * 字符间超时: 两次读到数据的间隔扣除本次字节的传输时间即为线上的字符间隔，超过t1.5整帧丢弃
+ * 帧间静默: 最后一次收发之后满t3.5才发送下一帧
+*/
+class ModbusRtuEngine : public ModbusEngine
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        RxBufferSize = 512          //接收缓冲区字节数，RTU帧最大256字节
+    };
+
+    explicit ModbusRtuEngine(QObject *parent = nullptr);
+
+    /* 设置串口参数
+     * iParity: QSerialPort::Parity
+     * iStopBits: QSerialPort::StopBits
+    */
+    void setSerialParameters(const QString &strPortName, int iBaudRate, int iDataBits, int iParity, int iStopBits);
+    /* 设置线路时间
+     * iCharTimeNs: 一个字符的传输时间
+     * iInterFrameDelayUs: 帧间静默t3.5
+     * iInterCharTimeoutUs: 字符间超时，USB转串口等按块上报数据的适配器需放宽
+    */
+    void setTiming(qint64 iCharTimeNs, int iInterFrameDelayUs, int iInterCharTimeoutUs);
+    //逐帧输出收发的ADU，用于与QModbusRtuSerialMaster的报文对照
+    void setFrameLog(bool bFrameLog);
+
+    //串口同一时刻只有一个事务在线上
+    void setMaxInFlight(int iMaxInFlight) override;
+    void connectDevice() override;
+    void disconnectDevice() override;
+    bool isConnected() const override;
+    QString errorString() const override;
+
+protected:
+    void sendFrame(EngineTransaction &transaction, quint16 uTransactionId) override;
+    bool isReadyToSend() override;
+    int getExtraTimeoutMs(const EngineTransaction &transaction) const override;
+    void onTransactionTimeout() override;
+
+private slots:
+    void slot_readyRead();
+    void slot_errorOccurred(QSerialPort::SerialPortError eError);
+
+private:
+    //按请求功能码和已收到的字节推算应答帧长，字节不足时返回0，无法定界时返回-1
+    int getExpectedLength() const;
+    //丢弃当前帧，在途事务按失败结束
+    void dropFrame(const char *pReason);
+    void setLowLatency();
+
+private:
+    QSerialPort *m_serialPort;
+    QTimer *m_frameDelayTimer;          //等待帧间静默后继续发送
+    QElapsedTimer m_lineTimer;          //线路时间基准
+    QString m_strPortName;
+    int m_baudRate;
+    int m_dataBits;
+    int m_parity;
+    int m_stopBits;
+    qint64 m_charTimeNs;
+    qint64 m_interFrameDelayNs;
+    qint64 m_interCharTimeoutNs;
+    bool m_bFrameLog;
+
+    quint16 m_uTransactionId;           //当前在途事务
+    quint8 m_uServerAddr;               //当前请求的从站地址
+    quint8 m_uFunctionCode;             //当前请求的功能码
+    qint64 m_lastActivityNs;            //最后一个字节离开或到达线路的时间
+
+    quint8 m_rxBuffer[RxBufferSize];
+    int m_rxLength;
+    qint64 m_crcErrorCount;
+    qint64 m_frameErrorCount;           //字符间超时、帧长或功能码不符
+};
+
+#endif // MODBUSRTUENGINE_H
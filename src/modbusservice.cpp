@@ -1,4 +1,9 @@
 ﻿#include "modbusservice.h"
+#include "modbustcpengine.h"
+#include "modbusrtuengine.h"
+#include "modbusframe.h"
+#include "asynclogger.h"
+#include "realtimemode.h"
 #include <QCoreApplication>
 #include <QSettings>
 #include <QSerialPort>
@@ -7,182 +12,546 @@
 #include <QFile>
 #include <QUrl>
 #include <QDebug>
+#include <QDateTime>
+#include <QDeadlineTimer>
 #include <math.h>
+#include <algorithm>
 #include <QRandomGenerator>
 
-ModBusService::ModBusService(QObject *parent) : QObject(parent),
+ModBusService::ModBusService(const QString &strLinkGroup, QObject *parent) : QObject(parent),
+    m_strLinkGroup(strLinkGroup),
     m_modbusDevice(nullptr),
     m_recvTimer(nullptr),
-    m_reconnectionTimer(nullptr)
+    m_reconnectionTimer(nullptr),
+    m_connectTimer(nullptr),
+    m_reconnectAttempt(0),
+    m_reconnectMinMs(500),
+    m_reconnectMaxMs(30000),
+    m_linkFailTimeouts(0),
+    m_deadLinkMs(0),
+    m_engine(nullptr),
+    m_proxyServer(nullptr),
+    m_apiServer(nullptr),
+    m_scriptHost(nullptr),
+    m_burstSampler(nullptr),
+    m_dataVersion(0),
+    m_loggedVersion(0),
+    m_logSource(-1),
+    m_metricsLink(-1),
+    m_bEverConnected(false),
+    m_metricsTimer(nullptr),
+    m_wallOffsetMs(0),
+    m_allocWarmupCycles(0),
+    m_lastAllocCount(0),
+    m_reportedAllocations(0),
+    m_staleMs(0),
+    m_staleTimer(nullptr),
+    m_alarmTimer(nullptr),
+    m_pollOverrunCount(0),
+    m_bMaskWrite(true),
+    m_bIsSerial(false),
+    m_pollPeriodMs(100),
+    m_pollMaxGap(0)
 {
+    //未指定链路时按ConnectType使用Serial或TCP节，指定时为多串口中的一个串口
+    if(m_strLinkGroup.isEmpty())
+    {
+        QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+        QSettings settings(configPath,QSettings::IniFormat);
+        m_bIsSerial = settings.value("ConnectType",1).toInt() == 0;
+        m_strLinkGroup = m_bIsSerial ? "Serial" : "TCP";
+    }
+    else
+    {
+        m_bIsSerial = true;
+    }
+
     initJsonFile();
 
-    m_recvTimer = new QTimer(this);
-    m_recvTimer->setInterval(100);
-    connect(m_recvTimer, &QTimer::timeout, this, &ModBusService::slot_recvTimeout);
+    connect(&m_requestScheduler, &RequestScheduler::sig_readReady, this, &ModBusService::slot_readReady);
+    connect(&m_requestScheduler, &RequestScheduler::sig_commandFinished, this, &ModBusService::slot_commandFinished);
+    connect(&m_requestScheduler, &RequestScheduler::sig_commandRead, this, &ModBusService::slot_commandRead, Qt::DirectConnection);
+    connect(&m_requestScheduler, &RequestScheduler::sig_pollCycleFinished, this, &ModBusService::slot_pollCycleFinished);
+    connect(&m_requestScheduler, &RequestScheduler::sig_linkFailed, this, &ModBusService::slot_linkFailed);
+    connect(&m_requestScheduler, &RequestScheduler::sig_pollFailed, this, &ModBusService::slot_pollFailed);
+
+    //周期起点对齐到周期边界加相位，同周期的链路、设备同相采样
+    QSettings settings(qApp->applicationDirPath() + "/config/Config.ini", QSettings::IniFormat);
+    m_recvTimer = new CycleTimer(this);
+    m_recvTimer->setInterval(m_pollPeriodMs);
+    m_recvTimer->setPhase(settings.value(m_strLinkGroup + "/PhaseMs",0).toInt());
+    connect(m_recvTimer, &CycleTimer::sig_cycle, this, &ModBusService::slot_recvTimeout);
 
     m_reconnectionTimer = new QTimer(this);
-    m_reconnectionTimer->setInterval(500);
+    m_reconnectionTimer->setSingleShot(true);
     connect(m_reconnectionTimer, &QTimer::timeout, this, &ModBusService::slot_reconnection);
 
+    m_connectTimer = new QTimer(this);
+    m_connectTimer->setSingleShot(true);
+    connect(m_connectTimer, &QTimer::timeout, this, &ModBusService::slot_connectTimeout);
+
+    //过期判断的精度为过期时间的1/4
+    m_staleTimer = new QTimer(this);
+    m_staleTimer->setInterval(qMax(100, m_staleMs / 4));
+    connect(m_staleTimer, &QTimer::timeout, this, &ModBusService::slot_staleCheck);
+    m_staleTimer->start();
+
+    m_alarmTimer = new QTimer(this);
+    m_alarmTimer->setSingleShot(true);
+    m_alarmTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_alarmTimer, &QTimer::timeout, this, &ModBusService::slot_alarmTimer);
+
     initConnection();
+    initProxyServer();
+    initApiServer();
+    initLogger();
+    initMetrics();
+    initScripts();
+    initBurst();
+    initRealtime();
 
-    m_reconnectionTimer->start();
+    //首次连接立即进行
+    m_reconnectionTimer->start(0);
 }
 
-QModbusDataUnit ModBusService::readRequest(quint16 qRegAddr, int iRegCount) const
+QModbusDataUnit ModBusService::readRequest(QModbusDataUnit::RegisterType eRegTable, quint16 qRegAddr, int iRegCount) const
 {
-    return QModbusDataUnit(QModbusDataUnit::HoldingRegisters, qRegAddr, iRegCount);
+    //线圈功能码01，离散输入02，输入寄存器04，保持寄存器03
+    return QModbusDataUnit(eRegTable, qRegAddr, iRegCount);
 }
 
-QModbusDataUnit ModBusService::writeRequest(quint16 qRegAddr, int iRegCount) const
+QModbusDataUnit ModBusService::writeRequest(QModbusDataUnit::RegisterType eRegTable, quint16 qRegAddr, int iRegCount) const
 {
-    return QModbusDataUnit(QModbusDataUnit::HoldingRegisters, qRegAddr, iRegCount);
+    //线圈单个写05、多个写15，保持寄存器单个写06、多个写16
+    return QModbusDataUnit(eRegTable, qRegAddr, iRegCount);
 }
 
 void ModBusService::readRegister()
 {
+    //引擎的轮询读事务已在加载时登记
     if (!m_modbusDevice)
         return;
 
-    QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.begin();
-    while(itr != m_signalParamMap.end())
+    for(int i=0; i<m_pollBlockList.size(); i++)
     {
-        quint16 qRegAddr = itr.key();
-        int iRegBitLengh = itr.value().iRegBitLengh;
-        if (auto *reply = m_modbusDevice->sendReadRequest(readRequest(qRegAddr, iRegBitLengh/16), m_protocolParam.uServerAddr))
-        {
-            if (!reply->isFinished())
-                connect(reply, &QModbusReply::finished, this, &ModBusService::slot_readReady);
-            else
-                delete reply; // broadcast replies return immediately
-        }
-        else
-        {
-            qDebug()<<"Read error: " + m_modbusDevice->errorString();
-        }
-        itr++;
+        const PollBlock &block = m_pollBlockList.at(i);
+        m_requestScheduler.enqueuePoll(readRequest(block.eRegTable, block.uStartAddr, block.uRegCount), block.uServerAddr, false);
     }
 }
 
 void ModBusService::writeRegister()
 {
-    if (!m_modbusDevice)
+    if (!m_modbusDevice && !m_engine)
         return;
 
-    QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.begin();
-    while(itr != m_signalParamMap.end())
+    quint16 regValues[1968];    //一次写请求最多1968个线圈或123个寄存器
+    for(int i=0; i<m_writeBlockList.size(); i++)
     {
-        quint16 qRegAddr = itr.key();
-        int iRegBitLengh = itr.value().iRegBitLengh;
-        bool bIsReadReg = itr.value().bIsReadReg;
-        if(bIsReadReg)
+        const PollBlock &block = m_writeBlockList.at(i);
+        //位域寄存器不整体改写PLC自有的位
+        bool bWholeWrite = m_writeFieldMaskList.at(i) == 0xFFFF || refreshFieldRegister(i);
+        if(m_engine)
         {
-            itr++;
+            //值直接编码进引擎的请求帧
+            m_engine->setEnabled(m_engineWriteList.at(i), bWholeWrite);
+            if(bWholeWrite)
+            {
+                fillWriteBlockValues(block, regValues);
+                m_engine->setWriteValues(m_engineWriteList.at(i), regValues);
+            }
             continue;
         }
+        if(!bWholeWrite)
+            continue;
 
-        QModbusDataUnit writeUnit = writeRequest(qRegAddr, iRegBitLengh/16);
-        QVector<quint16> mList = getWriteRegValues(qRegAddr);
-        writeUnit.setValues(mList);
+        fillWriteBlockValues(block, regValues);
 
-        if (auto *reply = m_modbusDevice->sendWriteRequest(writeUnit, m_protocolParam.uServerAddr))
-        {
-            if (!reply->isFinished()) {
-                connect(reply, &QModbusReply::finished, this, [this, reply](){
-                    if (reply->error() == QModbusDevice::ProtocolError)
-                    {
-                        qDebug()<<QString("Write response error: %1 (Mobus exception: 0x%2)")
-                                        .arg(reply->errorString())
-                                        .arg(reply->rawResult().exceptionCode());
-                    }
-                    else if (reply->error() != QModbusDevice::NoError)
-                    {
-                        qDebug()<<QString("Write response error: %1 (code: 0x%2)")
-                                        .arg(reply->errorString())
-                                        .arg(reply->error(),-1,16);
-                    }
-                    reply->deleteLater();
-                });
-            }
-            else
-            {
-                // broadcast replies return immediately
-                reply->deleteLater();
-            }
-        }
-        else
-        {
-            qDebug()<<"Write error: " + m_modbusDevice->errorString();
-        }
-        itr++;
+        QModbusDataUnit writeUnit = writeRequest(block.eRegTable, block.uStartAddr, block.uRegCount);
+        for(int j=0; j<block.uRegCount; j++)
+            writeUnit.setValue(j, regValues[j]);
+        sendWriteUnit(writeUnit, block.uServerAddr);
+    }
+}
+
+bool ModBusService::refreshFieldRegister(int iBlock)
+{
+    const PollBlock &block = m_writeBlockList.at(iBlock);
+    quint32 uRegKey = makeRegKey(block.uServerAddr, block.eRegTable, block.uStartAddr);
+    //从未读回时不写，否则PLC的位按0写出，本服务的位也会被写成加载时的0
+    if(!m_outputRegCache.contains(uRegKey))
+        return false;
+    if(!m_bMaskWrite || m_noMaskWriteSet.contains(block.uServerAddr))
+        return true;
+    if(m_writeRefreshList.at(iBlock) >= 0)
+        return false;
+
+    const RegisterInterval &interval = m_intervalMap[uRegKey];
+    quint16 uFieldMask = m_writeFieldMaskList.at(iBlock);
+    quint16 uOrMask = 0;
+    for(int i=0; i<interval.iSignalCount; i++)
+    {
+        const SignalParameter &signalParam = m_signalList.at(interval.iFirstSignal + i);
+        uOrMask |= (quint16)(signalParam.uValue << signalParam.uBitPos);
+    }
+    quint16 uAndMask = ~uFieldMask;
+    uOrMask &= uFieldMask;
+    const SignalCodec &signalCodec = m_signalCodecMap[block.uServerAddr];
+    signalCodec.splitRegisters(uAndMask, 1, &uAndMask);
+    signalCodec.splitRegisters(uOrMask, 1, &uOrMask);
+    //入队时同步完成的命令在返回编号前通知，入队期间记为-2
+    m_writeRefreshList[iBlock] = -2;
+    int iCommandId = m_engine ? m_engine->enqueueMaskCommand(block.uStartAddr, uAndMask, uOrMask, block.uServerAddr, RefreshCommandTag)
+                              : m_requestScheduler.enqueueMaskCommand(block.uStartAddr, uAndMask, uOrMask, block.uServerAddr, RefreshCommandTag);
+    if(m_writeRefreshList.at(iBlock) == -2)
+        m_writeRefreshList[iBlock] = iCommandId;
+    return false;
+}
+
+quint16 ModBusService::getFieldMask(const RegisterInterval &interval) const
+{
+    if(interval.eRegTable != QModbusDataUnit::HoldingRegisters || interval.uRegCount != 1)
+        return 0xFFFF;
+    quint16 uFieldMask = 0;
+    for(int i=0; i<interval.iSignalCount; i++)
+    {
+        const SignalParameter &signalParam = m_signalList.at(interval.iFirstSignal + i);
+        uFieldMask |= (quint16)(((1u << signalParam.uLength) - 1) << signalParam.uBitPos);
+    }
+    return uFieldMask;
+}
+
+void ModBusService::sendWriteUnit(const QModbusDataUnit &writeUnit, quint8 uServerAddr)
+{
+    m_requestScheduler.enqueuePoll(writeUnit, uServerAddr, true);
+}
+
+int ModBusService::writeSignalValue(const QString &strKey, double dValue)
+{
+    int iSignalIndex = m_signalIndexHash.value(strKey, -1);
+    if(iSignalIndex < 0)
+    {
+        qDebug()<<"Write error: unknown signal " + strKey;
+        return -1;
+    }
+    return writeSignalValue(iSignalIndex, dValue);
+}
+
+int ModBusService::writeSignalValue(int iSignalIndex, double dValue)
+{
+    if(iSignalIndex < 0 || iSignalIndex >= m_signalList.size())
+    {
+        qDebug()<<QString("Write error: unknown signal index %1").arg(iSignalIndex);
+        return -1;
+    }
+    SignalParameter &signalParam = m_signalList[iSignalIndex];
+    if(m_derivedEngine.isDerived(iSignalIndex))
+    {
+        qDebug()<<"Write error: " + signalParam.strKey + " is a derived signal";
+        return -1;
+    }
+
+    quint32 uRegKey = makeRegKey(signalParam.uServerAddr, signalParam.eRegTable, signalParam.uRegisterAddr);
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constFind(uRegKey);
+    if(itr == m_intervalMap.constEnd() || itr.value().bIsReadReg)
+    {
+        qDebug()<<"Write error: " + signalParam.strKey + " is not an output";
+        return -1;
+    }
+
+    quint64 uRawValue = 0;
+    if(!m_signalCodecMap[signalParam.uServerAddr].encode(signalParam, dValue, uRawValue))
+    {
+        qDebug()<<QString("Write error: %1 out of range for %2").arg(dValue).arg(signalParam.strKey);
+        return -1;
+    }
+    signalParam.uValue = uRawValue;
+    signalParam.dValue = dValue;
+    return enqueueSignalCommand(iSignalIndex);
+}
+
+int ModBusService::enqueueReadCommand(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTag)
+{
+    if(m_engine)
+        return m_engine->enqueueReadCommand(uServerAddr, eRegTable, uStartAddr, uCount, iTag);
+    return m_requestScheduler.enqueueReadCommand(readRequest(eRegTable, uStartAddr, uCount), uServerAddr, iTag);
+}
+
+const SignalParameter *ModBusService::findSignal(const QString &strKey) const
+{
+    int iSignalIndex = m_signalIndexHash.value(strKey, -1);
+    return iSignalIndex < 0 ? nullptr : &m_signalList.at(iSignalIndex);
+}
+
+int ModBusService::findSignalIndex(const QString &strKey) const
+{
+    return m_signalIndexHash.value(strKey, -1);
+}
+
+int ModBusService::enqueueSignalCommand(int iSignalIndex, int iCommandId)
+{
+    const SignalParameter &signalParam = m_signalList.at(iSignalIndex);
+    quint32 uRegKey = makeRegKey(signalParam.uServerAddr, signalParam.eRegTable, signalParam.uRegisterAddr);
+    const RegisterInterval &interval = m_intervalMap[uRegKey];
+    m_pendingCommandMap[uRegKey]++;
+
+    //保持寄存器的位域只改自己的位，同一寄存器未发送的屏蔽写由调度器合并
+    if(m_bMaskWrite && !m_noMaskWriteSet.contains(interval.uServerAddr)
+       && interval.eRegTable == QModbusDataUnit::HoldingRegisters
+       && interval.uRegCount == 1 && signalParam.uLength < 16)
+    {
+        const SignalCodec &signalCodec = m_signalCodecMap[interval.uServerAddr];
+        quint16 uFieldMask = (quint16)(((1u << signalParam.uLength) - 1) << signalParam.uBitPos);
+        quint16 uAndMask = ~uFieldMask;
+        quint16 uOrMask = (quint16)(signalParam.uValue << signalParam.uBitPos) & uFieldMask;
+        signalCodec.splitRegisters(uAndMask, 1, &uAndMask);
+        signalCodec.splitRegisters(uOrMask, 1, &uOrMask);
+        int iCommandId = m_engine ? m_engine->enqueueMaskCommand(interval.uStartAddr, uAndMask, uOrMask, interval.uServerAddr, iSignalIndex)
+                                     : m_requestScheduler.enqueueMaskCommand(interval.uStartAddr, uAndMask, uOrMask, interval.uServerAddr, iSignalIndex);
+        if(iCommandId < 0 && --m_pendingCommandMap[uRegKey] <= 0)
+            m_pendingCommandMap.remove(uRegKey);
+        return iCommandId;
     }
+
+    //16位寄存器的其它位域取当前缓存值
+    QModbusDataUnit writeUnit = writeRequest(interval.eRegTable, interval.uStartAddr, interval.uRegCount);
+    if(isBitTable(interval.eRegTable))
+        writeUnit.setValue(0, signalParam.uValue ? 1 : 0);
+    else
+        writeUnit.setValues(getWriteRegValues(interval));
+    int iQueuedId = m_engine ? m_engine->enqueueCommand(writeUnit, interval.uServerAddr, iSignalIndex, iCommandId)
+                                : m_requestScheduler.enqueueCommand(writeUnit, interval.uServerAddr, iSignalIndex, iCommandId);
+    //引擎命令池满时不会有完成通知
+    if(iQueuedId < 0 && --m_pendingCommandMap[uRegKey] <= 0)
+        m_pendingCommandMap.remove(uRegKey);
+    return iQueuedId;
 }
 
-void ModBusService::updateParamValue(quint16 qRegAddr, quint64 qRegValue)
+void ModBusService::decodeBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 qStartAddr, const quint16 *pRegValue, int iCount)
 {
-    //寄存器到SignalMap
-    QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.find(qRegAddr);
-    if(itr != m_signalParamMap.end())
+    if(m_proxyServer)
+        m_proxyServer->updateImage(uServerAddr, eRegTable, qStartAddr, pRegValue, iCount);
+    //一个应答只取一次时间，块内信号的时间相同
+    qint64 iAcqMonoNs = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    qint64 iAcqTimeMs = iAcqMonoNs / 1000000 + m_wallOffsetMs;
+    m_metrics.lastSuccessMs[uServerAddr] = iAcqTimeMs;
+    m_reconnectAttempt = 0;
+
+    //位域范围、数据类型已在加载时由PollPlanner检查，此处不再判断
+    QHash<quint8, SignalCodec>::const_iterator codecItr = m_signalCodecMap.constFind(uServerAddr);
+    if(codecItr == m_signalCodecMap.constEnd())
+        return;
+    const SignalCodec &signalCodec = codecItr.value();
+    bool bIsBit = isBitTable(eRegTable);
+    quint32 uStartKey = makeRegKey(uServerAddr, eRegTable, qStartAddr);
+    quint32 uEndKey = uStartKey + iCount;
+    bool bChanged = false;
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.lowerBound(uStartKey);
+    while(itr != m_intervalMap.constEnd() && itr.key() + itr.value().uRegCount <= uEndKey)
     {
-        int iRegBitLengh = itr.value().iRegBitLengh;
-        QList<SignalParameter> mList = itr.value().spList;
-        if(iRegBitLengh == 16)
+        const RegisterInterval &interval = itr.value();
+        const quint16 *pIntervalValue = pRegValue + (itr.key() - uStartKey);
+
+        if(!interval.bIsReadReg && interval.uRegCount == 1 && !bIsBit)
+            m_outputRegCache.insert(itr.key(), (quint16)signalCodec.combineRegisters(pIntervalValue, 1));
+
+        //写命令未完成时读回的是旧值
+        if(!interval.bIsReadReg && m_pendingCommandMap.contains(itr.key()))
         {
-            for(int j=0; j<mList.size();j++)
-            {
-                quint16 qPos = mList.at(j).uBitPos;
-                quint16 qBitLen = mList.at(j).uLength;
-                quint16 paramValue = 0;
-                bool bRet = getParamValue16(qRegValue, qPos, qBitLen, paramValue);
-                if(bRet)
-                {
-                    m_signalParamMap[itr.key()].spList[j].uValue = paramValue;
-                    //                    QString strkey = mList.at(j).strKey;
-                    //                    QString strValue = QString::number(paramValue);
-                    //                    emit sig_setPLCMapValue(strkey, strValue);
-                }
-            }
+            itr++;
+            continue;
         }
-        else if(iRegBitLengh == 32 || iRegBitLengh == 64)
+
+        //线圈、离散输入每个值为一个点，不做字节序转换
+        quint64 qRegValue = bIsBit ? *pIntervalValue : signalCodec.combineRegisters(pIntervalValue, interval.uRegCount);
+        for(int i=0; i<interval.iSignalCount; i++)
         {
-            if(mList.size() > 0)
+            int iSignalIndex = interval.iFirstSignal + i;
+            SignalParameter &signalParam = m_signalList[iSignalIndex];
+            quint64 uOldValue = signalParam.uValue;
+            signalCodec.decode(signalParam, qRegValue);
+            signalParam.iAcqMonoNs = iAcqMonoNs;
+            signalParam.iAcqTimeMs = iAcqTimeMs;
+            //值改变、首次读回或质量恢复时记录数据版本，查询接口按版本取增量
+            bool bSignalChanged = signalParam.uValue != uOldValue || signalParam.uQuality != Quality_Good;
+            if(m_derivedEngine.hasDependents(iSignalIndex))
+                m_derivedEngine.markInput(iSignalIndex, bSignalChanged);
+            if(m_alarmEngine.hasAlarms(iSignalIndex))
+                m_alarmEngine.markInput(iSignalIndex, bSignalChanged);
+            if(m_aggregator.isEnabled(iSignalIndex))
+                m_aggregator.addSample(iSignalIndex, signalParam.dValue, iAcqMonoNs, m_wallOffsetMs);
+            if(bSignalChanged)
             {
-                quint64 paramValue = qRegValue;
-                m_signalParamMap[itr.key()].spList[0].uValue = paramValue;
+                signalParam.uQuality = Quality_Good;
+                signalParam.uExceptionCode = 0;
+                if(!bChanged)
+                {
+                    m_dataVersion++;
+                    bChanged = true;
+                }
+                signalParam.uVersion = m_dataVersion;
             }
+            if(m_burstSampler && m_burstSampler->isWatched(iSignalIndex))
+                m_burstSampler->signalUpdated(iSignalIndex, signalParam);
         }
+        itr++;
     }
+
+    if(evaluateDerived(bChanged))
+        bChanged = true;
+    if(bChanged && m_apiServer)
+        m_apiServer->setDataVersion(m_dataVersion);
+    evaluateAlarms();
 }
 
-bool ModBusService::getParamValue16(quint16 regValue, quint16 valuePos, quint16 valueSize, quint16 &paramValue)
+bool ModBusService::evaluateDerived(bool bVersionTaken)
 {
-    if((valuePos + valueSize) > 16)
-    {
+    //与输入同一版本，输入未改变时另取一个版本
+    if(!m_derivedEngine.hasPending())
         return false;
+    quint64 uVersion = bVersionTaken ? m_dataVersion : m_dataVersion + 1;
+    bool bChanged = m_derivedEngine.evaluate(m_signalList, uVersion);
+    const QVector<int> &updatedList = m_derivedEngine.getUpdatedList();
+    for(int i=0; i<updatedList.size(); i++)
+    {
+        int iSignalIndex = updatedList.at(i);
+        if(m_alarmEngine.hasAlarms(iSignalIndex))
+            m_alarmEngine.markInput(iSignalIndex, true);
+        const SignalParameter &signalParam = m_signalList.at(iSignalIndex);
+        if(m_aggregator.isEnabled(iSignalIndex) && signalParam.uQuality == Quality_Good)
+            m_aggregator.addSample(iSignalIndex, signalParam.dValue, signalParam.iAcqMonoNs, m_wallOffsetMs);
+        if(m_burstSampler && m_burstSampler->isWatched(iSignalIndex))
+            m_burstSampler->signalUpdated(iSignalIndex, signalParam);
     }
-    paramValue = (quint16)((regValue >> valuePos) & (0xFFFF >> (16-valueSize)));
+    if(!bChanged)
+        return false;
+    m_dataVersion = uVersion;
     return true;
 }
 
-bool ModBusService::getParamValue32(quint32 regValue, quint16 valuePos, quint16 valueSize, quint32 &paramValue)
+void ModBusService::evaluateAlarms()
 {
-    if((valuePos + valueSize) > 32)
+    if(!m_alarmEngine.hasPending())
+        return;
+    m_alarmEngine.evaluate(m_signalList);
+    flushAlarmEvents();
+}
+
+void ModBusService::flushAggregates()
+{
+    if(m_aggregator.getSignalCount() == 0)
+        return;
+    m_aggregator.closeExpired(QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs(), m_wallOffsetMs);
+    if(m_apiServer)
+        m_apiServer->appendAggregates(m_aggregator.getRecordList());
+    m_aggregator.clearRecords();
+}
+
+void ModBusService::flushBurstEdges()
+{
+    if(!m_burstSampler)
+        return;
+    const QVector<SignalEdge> &edgeList = m_burstSampler->getEdgeList();
+    if(m_logSource >= 0)
     {
-        return false;
+        for(int i=0; i<edgeList.size(); i++)
+            pushLogEvent(LogRecord_Edge, edgeList.at(i).iSignalIndex, 0, edgeList.at(i).dValue, edgeList.at(i).iTimeMs);
     }
-    paramValue = (quint32)((regValue >> valuePos) & (0xFFFFFFFF >> (32-valueSize)));
-    return true;
+    if(!edgeList.isEmpty() && m_apiServer)
+        m_apiServer->appendEdges(edgeList);
+    m_burstSampler->clearEdges();
 }
 
-bool ModBusService::getParamValue64(quint64 regValue, quint16 valuePos, quint16 valueSize, quint64 &paramValue)
+void ModBusService::slot_alarmTimer()
 {
-    if((valuePos + valueSize) > 64)
+    m_alarmEngine.checkDelays(m_signalList, QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs(), m_wallOffsetMs);
+    flushAlarmEvents();
+}
+
+void ModBusService::flushAlarmEvents()
+{
+    //告警行在日志线程中格式化，未启用调试输出时不写
+    const QVector<AlarmEvent> &eventList = m_alarmEngine.getEventList();
+    if(m_logSource >= 0)
     {
-        return false;
+        for(int i=0; i<eventList.size(); i++)
+        {
+            const AlarmEvent &alarmEvent = eventList.at(i);
+            pushLogEvent(LogRecord_Alarm, alarmEvent.iAlarm, alarmEvent.bActive ? 1 : 0, alarmEvent.dValue);
+        }
     }
-    paramValue = (quint64)((regValue >> valuePos) & (0xFFFFFFFFFFFFFFFF >> (64-valueSize)));
-    return true;
+    if(!eventList.isEmpty() && m_apiServer)
+        m_apiServer->appendAlarmEvents(eventList);
+    m_alarmEngine.clearEvents();
+
+    //延时中的告警没有新读回时由定时补上，提前唤醒不会误报
+    qint64 iDeadlineNs = m_alarmEngine.nextDeadlineNs();
+    if(iDeadlineNs == 0)
+    {
+        m_alarmTimer->stop();
+        return;
+    }
+    qint64 iWaitNs = iDeadlineNs - QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    m_alarmTimer->start((int)qMax<qint64>(0, (iWaitNs + 999999) / 1000000));
+}
+
+void ModBusService::markBlockQuality(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 qStartAddr, int iCount, int iQuality, int iExceptionCode)
+{
+    quint32 uStartKey = makeRegKey(uServerAddr, eRegTable, qStartAddr);
+    quint32 uEndKey = uStartKey + iCount;
+    bool bChanged = false;
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.lowerBound(uStartKey);
+    while(itr != m_intervalMap.constEnd() && itr.key() + itr.value().uRegCount <= uEndKey)
+    {
+        const RegisterInterval &interval = itr.value();
+        for(int i=0; i<interval.iSignalCount; i++)
+        {
+            SignalParameter &signalParam = m_signalList[interval.iFirstSignal + i];
+            if(signalParam.uQuality == iQuality && signalParam.uExceptionCode == iExceptionCode)
+                continue;
+            if(m_derivedEngine.hasDependents(interval.iFirstSignal + i))
+                m_derivedEngine.markInput(interval.iFirstSignal + i, true);
+            if(!bChanged)
+            {
+                m_dataVersion++;
+                bChanged = true;
+            }
+            signalParam.uQuality = iQuality;
+            signalParam.uExceptionCode = iExceptionCode;
+            signalParam.uVersion = m_dataVersion;
+            if(m_burstSampler && m_burstSampler->isWatched(interval.iFirstSignal + i))
+                m_burstSampler->signalUpdated(interval.iFirstSignal + i, signalParam);
+        }
+        itr++;
+    }
+
+    if(evaluateDerived(bChanged))
+        bChanged = true;
+    if(bChanged && m_apiServer)
+        m_apiServer->setDataVersion(m_dataVersion);
+    evaluateAlarms();
+}
+
+void ModBusService::markAllCommError()
+{
+    //尚未读回的信号保持无值
+    bool bChanged = false;
+    for(int i=0; i<m_signalList.size(); i++)
+    {
+        SignalParameter &signalParam = m_signalList[i];
+        if(signalParam.uQuality == Quality_NoValue || signalParam.uQuality == Quality_CommError)
+            continue;
+        if(!bChanged)
+        {
+            m_dataVersion++;
+            bChanged = true;
+        }
+        signalParam.uQuality = Quality_CommError;
+        signalParam.uExceptionCode = 0;
+        signalParam.uVersion = m_dataVersion;
+    }
+
+    if(bChanged && m_apiServer)
+        m_apiServer->setDataVersion(m_dataVersion);
 }
 
 bool ModBusService::setParamValue16(quint16 oldRegValue, quint16 valuePos, quint16 valueSize, quint16 setValue, quint16 &newRegValue)
@@ -233,168 +602,89 @@ bool ModBusService::setParamValue64(quint64 oldRegValue, quint16 valuePos, quint
     return true;
 }
 
-QVector<quint16> ModBusService::getWriteRegValues(quint16 qRegAddr)
+QVector<quint16> ModBusService::getWriteRegValues(const RegisterInterval &interval)
+{
+    QVector<quint16> regValuesList(interval.uRegCount);
+    fillWriteRegValues(interval, regValuesList.data());
+    return regValuesList;
+}
+
+void ModBusService::fillWriteRegValues(const RegisterInterval &interval, quint16 *pRegValue)
 {
-    QVector<quint16> regValuesList;
-    QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.find(qRegAddr);
-    if(itr != m_signalParamMap.end())
+    quint64 qRegValue = 0;
+    if(interval.uRegCount == 1)
     {
-        int iRegBitLengh = itr.value().iRegBitLengh;
-        QList<SignalParameter> mList = itr.value().spList;
-        if(iRegBitLengh == 16)
-        {
-            quint16 qRegValue = 0x0;
-            for(int j=0; j<mList.size();j++)
-            {
-                quint16 qPos = mList.at(j).uBitPos;
-                quint16 qBitLen = mList.at(j).uLength;
-                quint16 setValue = mList.at(j).uValue;
-//                if(qRegAddr == 43011)
-//                    setValue = QRandomGenerator::global()->generate() % 2;
-//                if(qRegAddr == 43031)
-//                    setValue = QRandomGenerator::global()->generate() % 65536;
-                quint16 qNewValue = 0;
-                setParamValue16(qRegValue, qPos, qBitLen, setValue, qNewValue);
-                qRegValue  = qNewValue;
-            }
-            regValuesList.append(qRegValue);
-        }
-        else if(iRegBitLengh == 32)
+        //16位寄存器在最近读回值上替换各位域，未定义的位保持PLC的值
+        quint16 qRegValue16 = m_outputRegCache.value(makeRegKey(interval.uServerAddr, interval.eRegTable, interval.uStartAddr), 0);
+        for(int j=0; j<interval.iSignalCount; j++)
         {
-            if(mList.size() > 0)
-            {
-                quint32 setValue = mList.at(0).uValue;
-//                if(qRegAddr == 43035)
-//                    setValue = QRandomGenerator::global()->generate() % 999999;
-                quint16 qNewValueHigh = setValue >> 16;
-                quint16 qNewValueLow = setValue;
-                regValuesList.append(qNewValueHigh);
-                regValuesList.append(qNewValueLow);
-            }
-        }
-        else if(iRegBitLengh == 64)
-        {
-            if(mList.size() > 0)
-            {
-                quint64 setValue = mList.at(0).uValue;
-//                if(qRegAddr == 43051)
-//                    setValue = QRandomGenerator::global()->generate() % 999999999;
-                quint16 qNewValueHigh2 = setValue >> 16*3;
-                quint16 qNewValueHigh1 = setValue >> 16*2;
-                quint16 qNewValueLow2 = setValue >> 16;
-                quint16 qNewValueLow1 = setValue;
-                regValuesList.append(qNewValueHigh2);
-                regValuesList.append(qNewValueHigh1);
-                regValuesList.append(qNewValueLow2);
-                regValuesList.append(qNewValueLow1);
-            }
+            const SignalParameter &signalParam = m_signalList.at(interval.iFirstSignal + j);
+            quint16 qNewValue = 0;
+            setParamValue16(qRegValue16, signalParam.uBitPos, signalParam.uLength, signalParam.uValue, qNewValue);
+            qRegValue16 = qNewValue;
         }
+        qRegValue = qRegValue16;
     }
-    return regValuesList;
+    else
+    {
+        qRegValue = m_signalList.at(interval.iFirstSignal).uValue;
+    }
+
+    m_signalCodecMap[interval.uServerAddr].splitRegisters(qRegValue, interval.uRegCount, pRegValue);
 }
 
-void ModBusService::readRegister2Redis()
-{
-    //SignalMap到Redis数据库
-//    bool isChanged = false;
-//    quint16 qRegAddr = m_protocolParam.uReadStartAddr;
-//    int qRegCounts = m_protocolParam.iReadRegCounts;
-//    int qRegAddrEnd = m_protocolParam.uReadStartAddr+qRegCounts;
-//    for( ; qRegAddr < qRegAddrEnd; qRegAddr++)
-//    {
-//        QList<SignalParameter> mList = m_signalParamMap.value(qRegAddr);
-//        for(int j=0; j<mList.size();j++)
-//        {
-//            QString strKey = mList.at(j).strKey;
-//            QString regValue = QString::number(mList.at(j).uValue);
-//            QString mapValue = m_readMap.value(strKey);
-//            if(!isEqualString(regValue,mapValue))
-//            {
-//                m_readMap[strKey] = regValue;
-//                isChanged = true;
-//            }
-//        }
-//    }
-
-    //值有变化再写入Redis
-//    if(isChanged)
-//        m_pRedisClient->writeMap2Redis(TOPIC_READ, m_readMap);
-}
-
-void ModBusService::redis2WriteRegister()
-{
-    //读Redis数据到WriteMap
-//    m_pRedisClient->readRedis2Map(TOPIC_WRITE, m_writeMap);
-
-    //WriteMap到SignalMap
-//    quint16 qRegAddr = m_protocolParam.uWriteStartAddr;
-//    int qRegCounts = m_protocolParam.iWriteRegCounts;
-//    for( ; qRegAddr < (m_protocolParam.uWriteStartAddr+qRegCounts); qRegAddr++)
-//    {
-//        QList<SignalParameter> mList = m_signalParamMap.value(qRegAddr);
-//        for(int j=0; j<mList.size();j++)
-//        {
-//            QString strKey = mList.at(j).strKey;
-//            QString regValue = QString::number(mList.at(j).uValue);
-//            QString mapValue = m_writeMap.value(strKey);
-//            if(!isEqualString(regValue,mapValue))
-//            {
-//                m_signalParamMap[qRegAddr][j].uValue = (quint16)mapValue.toUInt();
-//            }
-//        }
-//    }
-//    //WriteMap到寄存器，QModbus只有值改变了才会写入
-//    writeRegister();
+void ModBusService::fillWriteBlockValues(const PollBlock &block, quint16 *pRegValue)
+{
+    //写请求块由PollPlanner按区间表生成，块内区间连续
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constFind(makeRegKey(block.uServerAddr, block.eRegTable, block.uStartAddr));
+    if(isBitTable(block.eRegTable))
+    {
+        for(int i=0; i<block.uRegCount; i++, itr++)
+            pRegValue[i] = m_signalList.at(itr.value().iFirstSignal).uValue ? 1 : 0;
+        return;
+    }
+    fillWriteRegValues(itr.value(), pRegValue);
 }
 
 void ModBusService::slot_recvTimeout()
 {
-    readRegister();
-    writeRegister();
+    checkAllocations();
+    bool bPollIdle = m_engine ? m_engine->isCycleIdle() : m_requestScheduler.isPollIdle();
+    if(bPollIdle)
+    {
+        m_cycleTimer.start();
+        //系统时间可能被校时，每周期重新取一次差值
+        m_wallOffsetMs = QDateTime::currentMSecsSinceEpoch() - QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs() / 1000000;
+        readRegister();
+        writeRegister();
+        if(m_engine)
+            m_engine->startCycle();
+    }
+    else
+    {
+        //上一周期的轮询还未完成，跳过本周期，命令通道不受影响
+        m_pollOverrunCount++;
+        int iQueueDepth = m_engine ? m_engine->getPendingCount() : m_requestScheduler.getQueueDepth();
+        pushLogEvent(LogRecord_Overrun, iQueueDepth, m_pollOverrunCount, 0);
+    }
+
+    if(m_bIsSerial && !m_engine && m_logSource >= 0)
+    {
+        qint64 iBusTimeUs = m_requestScheduler.takeBusTimeUs();
+        pushLogEvent(LogRecord_BusTime, m_pollPeriodMs, iBusTimeUs, iBusTimeUs / (10.0 * m_pollPeriodMs));
+    }
+    flushAggregates();
+    flushBurstEdges();
     printData();
 }
 
-void ModBusService::slot_readReady()
+void ModBusService::slot_readReady(QModbusReply *reply)
 {
-    auto reply = qobject_cast<QModbusReply *>(sender());
-    if (!reply)
-        return;
-
     if (reply->error() == QModbusDevice::NoError)
     {
         const QModbusDataUnit unit = reply->result();
-        if(unit.valueCount() == 1)
-        {
-            quint16 regAddr = unit.startAddress();
-            quint16 regValue = unit.value(0);
-            quint64 regValueCombine = regValue;
-            updateParamValue(regAddr, regValueCombine);
-        }
-        else if(unit.valueCount() == 2)
-        {
-            //寄存器到SignalMap
-            quint16 regAddr = unit.startAddress();
-            quint16 regValueHigh = unit.value(0);
-            quint16 regValueLow = unit.value(1);
-            quint64 regValueCombine = (static_cast<quint32>(regValueHigh) << 16) | regValueLow;
-//            qDebug()<<"regAddr:"<<regAddr<<"regValueHigh:"<<regValueHigh<<"regValueLow:"<<regValueLow<<"regValueCombine"<<regValueCombine;
-
-            updateParamValue(regAddr, regValueCombine);
-        }
-        else if(unit.valueCount() == 4)
-        {
-            quint16 regAddr = unit.startAddress();
-            quint16 regValueHigh2 = unit.value(0);
-            quint16 regValueHigh1 = unit.value(1);
-            quint16 regValueLow2 = unit.value(2);
-            quint16 regValueLow1 = unit.value(3);
-            quint64 regValueCombine =   (static_cast<quint64>(regValueHigh2) << 16*3)
-                                      | (static_cast<quint64>(regValueHigh1) << 16*2)
-                                      | (static_cast<quint64>(regValueLow2) << 16)
-                                      | (static_cast<quint64>(regValueLow1));
-
-            updateParamValue(regAddr, regValueCombine);
-        }
+        const QVector<quint16> valueList = unit.values();
+        decodeBlock(reply->serverAddress(), unit.registerType(), unit.startAddress(), valueList.constData(), valueList.size());
     }
     else if (reply->error() == QModbusDevice::ProtocolError)
     {
@@ -408,34 +698,651 @@ void ModBusService::slot_readReady()
                         .arg(reply->errorString())
                         .arg(reply->error());
     }
+}
+
+void ModBusService::slot_commandFinished(int iCommandId, int iSignalIndex, bool bIsMaskWrite, bool bSuccess, int iExceptionCode, qint64 iLatencyUs)
+{
+    if(iSignalIndex == BurstSampler::CommandTag)
+    {
+        if(m_burstSampler)
+            m_burstSampler->readFinished(bSuccess);
+        return;
+    }
+    if(iSignalIndex == RefreshCommandTag)
+    {
+        for(int i=0; i<m_writeRefreshList.size(); i++)
+        {
+            if(m_writeRefreshList.at(i) != iCommandId && m_writeRefreshList.at(i) != -2)
+                continue;
+            m_writeRefreshList[i] = -1;
+            //从站不支持功能码22，下一周期起改为读-改-写
+            quint8 uServerAddr = m_writeBlockList.at(i).uServerAddr;
+            if(bIsMaskWrite && iExceptionCode == QModbusPdu::IllegalFunction && !m_noMaskWriteSet.contains(uServerAddr))
+            {
+                qDebug()<<QString("Server %1 does not support Mask Write Register, falling back to read-modify-write")
+                                .arg(uServerAddr);
+                m_noMaskWriteSet.insert(uServerAddr);
+            }
+        }
+        return;
+    }
+    //脚本按命令编号等待，信号写命令在确定最终结果后通知
+    if(iSignalIndex < 0 && m_scriptHost)
+        m_scriptHost->commandFinished(iCommandId, bSuccess, iExceptionCode);
+    if(iSignalIndex == ScriptHost::CommandTag)
+        return;
+
+    //代理转发的写请求，标签为-1-请求编号
+    if(iSignalIndex < 0)
+    {
+        finishProxyWrite(-1 - iSignalIndex, bSuccess);
+        if(m_proxyServer)
+            m_proxyServer->finishWrite(-1 - iSignalIndex, bSuccess, iExceptionCode);
+        return;
+    }
+
+    const SignalParameter &signalParam = m_signalList.at(iSignalIndex);
+    quint32 uRegKey = makeRegKey(signalParam.uServerAddr, signalParam.eRegTable, signalParam.uRegisterAddr);
+    if(--m_pendingCommandMap[uRegKey] <= 0)
+        m_pendingCommandMap.remove(uRegKey);
+
+    //从站不支持功能码22，之后该从站改用缓存值读-改-写，本次命令沿用原命令编号重新下发
+    if(bIsMaskWrite && iExceptionCode == QModbusPdu::IllegalFunction)
+    {
+        if(!m_noMaskWriteSet.contains(signalParam.uServerAddr))
+            qDebug()<<QString("Server %1 does not support Mask Write Register, falling back to read-modify-write")
+                            .arg(signalParam.uServerAddr);
+        m_noMaskWriteSet.insert(signalParam.uServerAddr);
+        if(enqueueSignalCommand(iSignalIndex, iCommandId) >= 0)
+            return;
+        bSuccess = false;
+    }
+
+    if(m_scriptHost)
+        m_scriptHost->commandFinished(iCommandId, bSuccess, iExceptionCode);
+    if(m_debugType != 0)
+    {
+        qDebug()<<QString("Write command %1 %2 %3 in %4 us")
+                        .arg(iCommandId)
+                        .arg(signalParam.strKey)
+                        .arg(bSuccess ? "acknowledged" : "failed")
+                        .arg(iLatencyUs);
+    }
+    emit sig_writeFinished(signalParam.strKey, iCommandId, bSuccess, iLatencyUs);
+}
 
-    reply->deleteLater();
+void ModBusService::slot_commandRead(int iCommandId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount)
+{
+    decodeBlock(uServerAddr, eRegTable, uStartAddr, pRegValue, iCount);
+    if(m_scriptHost)
+        m_scriptHost->commandRead(iCommandId, pRegValue, iCount);
 }
 
 void ModBusService::slot_reconnection()
 {
+    //连接结果由slot_engineConnectedChanged或slot_deviceStateChanged处理
+    m_connectTimer->start();
+    if (m_engine)
+    {
+        m_engine->connectDevice();
+        return;
+    }
+
     if (!m_modbusDevice)
         return;
 
-    if (m_modbusDevice->state() != QModbusDevice::ConnectedState)
+    if (m_modbusDevice->state() == QModbusDevice::UnconnectedState && !m_modbusDevice->connectDevice())
+        linkDown(m_modbusDevice->errorString());
+}
+
+void ModBusService::slot_connectTimeout()
+{
+    //TCP对端无应答时连接要等内核重传超时，按应答超时中止
+    if (m_engine && !m_engine->isConnected())
+        m_engine->disconnectDevice();
+    else if (m_modbusDevice && m_modbusDevice->state() != QModbusDevice::ConnectedState)
+        m_modbusDevice->disconnectDevice();
+}
+
+void ModBusService::slot_deviceStateChanged(QModbusDevice::State eState)
+{
+    if (eState == QModbusDevice::ConnectedState)
     {
-        if (!m_modbusDevice->connectDevice())
+        //QModbusTcpClient的套接字是其子对象
+        if (!m_bIsSerial)
+            ModbusTcpEngine::applyDeadLinkTimeout(m_modbusDevice->findChild<QTcpSocket*>(), m_deadLinkMs);
+        linkUp();
+    }
+    else if (eState == QModbusDevice::UnconnectedState)
+    {
+        linkDown(m_modbusDevice->errorString());
+    }
+}
+
+void ModBusService::slot_deviceErrorOccurred(QModbusDevice::Error eError)
+{
+    switch (eError)
+    {
+    case QModbusDevice::NoError:
+        return;
+    case QModbusDevice::TimeoutError:
+    case QModbusDevice::ProtocolError:
+    case QModbusDevice::ReplyAbortedError:
+        //只影响单个请求，在应答中处理
+        if (m_debugType != 0)
+            qDebug()<<QString("[%1] Request error: ").arg(m_strLinkGroup) + m_modbusDevice->errorString();
+        return;
+    default:
+        break;
+    }
+
+    //串口或套接字读写失败、连接错误，断开后由状态变化安排重连
+    qDebug()<<QString("[%1] QModbusDevice::Error").arg(m_strLinkGroup)<<m_modbusDevice->errorString();
+    if (m_modbusDevice->state() == QModbusDevice::UnconnectedState)
+        linkDown(m_modbusDevice->errorString());
+    else
+        m_modbusDevice->disconnectDevice();
+}
+
+void ModBusService::slot_linkFailed()
+{
+    qDebug()<<QString("[%1] %2 consecutive timeouts, link considered lost").arg(m_strLinkGroup).arg(m_linkFailTimeouts);
+    if (m_engine)
+        m_engine->disconnectDevice();
+    else if (m_modbusDevice)
+        m_modbusDevice->disconnectDevice();
+}
+
+void ModBusService::linkUp()
+{
+    m_connectTimer->stop();
+    m_reconnectionTimer->stop();
+    qDebug()<<QString("[%1] Connect success").arg(m_strLinkGroup);
+    m_recvTimer->start();
+    m_allocWarmupCycles = AllocWarmupCycles;
+    setConnected(true);
+    if (m_scriptHost)
+        m_scriptHost->start();
+}
+
+void ModBusService::linkDown(const QString &strError)
+{
+    m_connectTimer->stop();
+    m_recvTimer->stop();
+    //先销毁脚本，断线作废的命令不再恢复脚本
+    if (m_scriptHost)
+        m_scriptHost->stop();
+    if (m_burstSampler)
+        m_burstSampler->stop();
+    if (!m_engine)
+        m_requestScheduler.clear();
+    markAllCommError();
+    if (m_proxyServer)
+        m_proxyServer->invalidateImage();
+
+    //连接断开或首次失败时输出，之后的重试失败不重复输出
+    if (m_metrics.bConnected || m_reconnectAttempt == 0)
+    {
+        qDebug()<<QString("[%1] Connect failed: ").arg(m_strLinkGroup) + strError;
+        setConnected(false);
+    }
+    scheduleReconnect();
+}
+
+void ModBusService::scheduleReconnect()
+{
+    if (m_reconnectionTimer->isActive())
+        return;
+
+    //每次失败间隔加倍，在[间隔/2, 间隔]内随机，PLC重启时多个链路、多个主站的重连错开
+    int iShift = qMin(m_reconnectAttempt, 16);
+    qint64 iDelayMs = qMin<qint64>((qint64)m_reconnectMinMs << iShift, m_reconnectMaxMs);
+    iDelayMs = iDelayMs / 2 + QRandomGenerator::global()->bounded((int)(iDelayMs / 2) + 1);
+    m_reconnectAttempt++;
+    if (m_debugType != 0)
+        qDebug()<<QString("[%1] Reconnect attempt %2 in %3 ms").arg(m_strLinkGroup).arg(m_reconnectAttempt).arg(iDelayMs);
+    m_reconnectionTimer->start((int)iDelayMs);
+}
+
+void ModBusService::slot_engineReadBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount)
+{
+    decodeBlock(uServerAddr, eRegTable, uStartAddr, pRegValue, iCount);
+}
+
+void ModBusService::slot_pollFailed(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iExceptionCode)
+{
+    markBlockQuality(uServerAddr, eRegTable, uStartAddr, uCount,
+                     iExceptionCode > 0 ? Quality_Exception : Quality_CommError, iExceptionCode);
+    if(m_proxyServer)
+        m_proxyServer->setImageError(uServerAddr, eRegTable, uStartAddr, iExceptionCode);
+
+    //调度器的失败已在slot_readReady中输出
+    if(m_engine)
+        qDebug()<<QString("Engine response error: server %1 table %2 address %3 (Mobus exception: 0x%4)")
+                        .arg(uServerAddr)
+                        .arg(eRegTable)
+                        .arg(uStartAddr + REGADDR_OFFSET)
+                        .arg(iExceptionCode, 0, 16);
+}
+
+void ModBusService::slot_staleCheck()
+{
+    qint64 iStaleNs = (qint64)m_staleMs * 1000000;
+    qint64 iNowNs = QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+    bool bChanged = false;
+    for(int i=0; i<m_signalList.size(); i++)
+    {
+        SignalParameter &signalParam = m_signalList[i];
+        if(signalParam.uQuality != Quality_Good || iNowNs - signalParam.iAcqMonoNs <= iStaleNs)
+            continue;
+        if(m_derivedEngine.hasDependents(i))
+            m_derivedEngine.markInput(i, true);
+        if(!bChanged)
+        {
+            m_dataVersion++;
+            bChanged = true;
+        }
+        signalParam.uQuality = Quality_Stale;
+        signalParam.uVersion = m_dataVersion;
+    }
+
+    if(evaluateDerived(bChanged))
+        bChanged = true;
+    if(bChanged && m_apiServer)
+        m_apiServer->setDataVersion(m_dataVersion);
+    evaluateAlarms();
+}
+
+void ModBusService::slot_engineConnectedChanged(bool bConnected)
+{
+    if (bConnected)
+        linkUp();
+    else
+        linkDown(m_engine->errorString());
+}
+
+void ModBusService::slot_pollCycleFinished()
+{
+    if(!m_cycleTimer.isValid())
+        return;
+    m_metrics.cycleHistogram.add(m_cycleTimer.nsecsElapsed() / 1000000.0);
+    m_cycleTimer.invalidate();
+}
+
+void ModBusService::setConnected(bool bConnected)
+{
+    if(bConnected && !m_metrics.bConnected && m_bEverConnected)
+        m_metrics.uReconnects++;
+    if(bConnected)
+        m_bEverConnected = true;
+    else
+        m_cycleTimer.invalidate();
+    m_metrics.bConnected = bConnected;
+    emit sig_setConnected(bConnected);
+}
+
+void ModBusService::slot_publishMetrics()
+{
+    m_metrics.counters = m_engine ? m_engine->getCounters() : m_requestScheduler.getCounters();
+    m_metrics.iQueueDepth = m_engine ? m_engine->getPendingCount() : m_requestScheduler.getQueueDepth();
+    m_metrics.uPollOverruns = m_pollOverrunCount;
+    m_metrics.cycleJitter = m_recvTimer->getJitterStats();
+    MetricsExporter::instance()->publish(m_metricsLink, m_metrics);
+}
+
+void ModBusService::initScripts()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    QStringList scriptList = settings.value(m_strLinkGroup + "/Scripts").toStringList();
+    scriptList.removeAll(QString());
+    if(scriptList.isEmpty())
+        return;
+
+    m_scriptHost = new ScriptHost(this, m_strLinkGroup, this);
+    QStringList unknownList = m_scriptHost->setScripts(scriptList);
+    if(!unknownList.isEmpty())
+        qDebug()<<QString("[%1] Unknown scripts: %2, scripts need a build with CONFIG+=coroutines")
+                        .arg(m_strLinkGroup)
+                        .arg(unknownList.join(","));
+    if(m_scriptHost->getScriptCount() == 0)
+    {
+        delete m_scriptHost;
+        m_scriptHost = nullptr;
+        return;
+    }
+    qDebug()<<QString("[%1] %2 acquisition scripts").arg(m_strLinkGroup).arg(m_scriptHost->getScriptCount());
+}
+
+void ModBusService::initBurst()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    QStringList keyList = settings.value(m_strLinkGroup + "/BurstSignals").toStringList();
+    keyList.removeAll(QString());
+    if(keyList.isEmpty())
+        return;
+
+    m_burstSampler = new BurstSampler(this, m_strLinkGroup, this);
+    m_burstSampler->setLogSource(m_logSource);
+    if(m_burstSampler->init(m_signalList, m_signalIndexHash, m_pollBlockList, m_intervalMap) == 0)
+    {
+        delete m_burstSampler;
+        m_burstSampler = nullptr;
+    }
+}
+
+void ModBusService::initRealtime()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    if(settings.value("Realtime/Enable",0).toInt() != 1)
+        return;
+    int priority = settings.value("Realtime/Priority",0).toInt();
+    int cpu = settings.value(m_strLinkGroup + "/RealtimeCpu",-1).toInt();
+
+    //服务在链路线程内创建，设置的是当前线程
+    if(RealtimeMode::setCurrentThread(priority, cpu) && (priority > 0 || cpu >= 0))
+        qDebug()<<QString("[%1] Realtime: SCHED_FIFO priority %2, CPU %3").arg(m_strLinkGroup).arg(priority).arg(cpu);
+    if(!m_engine)
+        qDebug()<<QString("[%1] Realtime: QModbusClient allocates a reply per request, set Engine=1 for allocation-free polling").arg(m_strLinkGroup);
+
+    //写命令、区间缓存按最大数量一次预留
+    m_pendingCommandMap.reserve(m_intervalMap.size());
+    m_outputRegCache.reserve(m_intervalMap.size());
+}
+
+quint64 ModBusService::getSteadyAllocations() const
+{
+    return m_metrics.uSteadyAllocations;
+}
+
+void ModBusService::checkAllocations()
+{
+    if(!RealtimeMode::isAllocCounterEnabled())
+        return;
+
+    //统计的是上一周期开始到本周期开始之间本线程的分配，含应答处理、定时器和指标发布
+    quint64 uAllocCount = RealtimeMode::getThreadAllocCount();
+    quint64 uCycleAllocations = uAllocCount - m_lastAllocCount;
+    m_lastAllocCount = uAllocCount;
+    if(m_allocWarmupCycles > 0)
+    {
+        m_allocWarmupCycles--;
+        return;
+    }
+    m_metrics.uSteadyAllocations += uCycleAllocations;
+    if(m_metrics.uSteadyAllocations == m_reportedAllocations || m_debugType == 0)
+        return;
+
+    //输出本身会分配，输出后重新取基准
+    qDebug()<<QString("[%1] %2 heap allocations in steady-state cycles, %3 in the last cycle")
+                    .arg(m_strLinkGroup)
+                    .arg(m_metrics.uSteadyAllocations)
+                    .arg(uCycleAllocations);
+    m_reportedAllocations = m_metrics.uSteadyAllocations;
+    m_lastAllocCount = RealtimeMode::getThreadAllocCount();
+}
+
+void ModBusService::initMetrics()
+{
+    MetricsExporter *pExporter = MetricsExporter::instance();
+    if(!pExporter)
+        return;
+
+    QList<quint8> deviceList = m_signalCodecMap.keys();
+    std::sort(deviceList.begin(), deviceList.end());
+    m_metricsLink = pExporter->registerLink(m_strLinkGroup, deviceList);
+    pExporter->publish(m_metricsLink, m_metrics);
+
+    //发布在链路线程内，复制一次快照，轮询路径不加锁
+    m_metricsTimer = new QTimer(this);
+    m_metricsTimer->setInterval(1000);
+    connect(m_metricsTimer, &QTimer::timeout, this, &ModBusService::slot_publishMetrics);
+    m_metricsTimer->start();
+}
+
+void ModBusService::slot_proxyWriteRequest(int iRequestId, quint8 uServerAddr, const QModbusDataUnit &unit)
+{
+    const QVector<quint16> valueList = unit.values();
+    int iExceptionCode = applyProxyWrite(iRequestId, uServerAddr, unit.registerType(), unit.startAddress(), valueList.constData(), valueList.size());
+    if(iExceptionCode != 0)
+    {
+        m_proxyServer->finishWrite(iRequestId, false, iExceptionCode);
+        return;
+    }
+
+    int iCommandId = m_engine ? m_engine->enqueueCommand(unit, uServerAddr, -1 - iRequestId)
+                                 : m_requestScheduler.enqueueCommand(unit, uServerAddr, -1 - iRequestId);
+    if(iCommandId < 0)
+    {
+        finishProxyWrite(iRequestId, false);
+        m_proxyServer->finishWrite(iRequestId, false, QModbusPdu::ServerDeviceBusy);
+    }
+}
+
+void ModBusService::slot_proxyMaskWriteRequest(int iRequestId, quint8 uServerAddr, quint16 uRegAddr, quint16 uAndMask, quint16 uOrMask)
+{
+    //写到输出寄存器时以最近读回值为底算出写后的值
+    quint32 uRegKey = makeRegKey(uServerAddr, QModbusDataUnit::HoldingRegisters, uRegAddr);
+    quint16 uRegValue = 0;
+    QHash<quint8, SignalCodec>::const_iterator codecItr = m_signalCodecMap.constFind(uServerAddr);
+    if(codecItr != m_signalCodecMap.constEnd())
+        codecItr.value().splitRegisters(m_outputRegCache.value(uRegKey, 0), 1, &uRegValue);
+    uRegValue = applyMaskWrite(uRegValue, uAndMask, uOrMask);
+    int iExceptionCode = applyProxyWrite(iRequestId, uServerAddr, QModbusDataUnit::HoldingRegisters, uRegAddr, &uRegValue, 1);
+    if(iExceptionCode != 0)
+    {
+        m_proxyServer->finishWrite(iRequestId, false, iExceptionCode);
+        return;
+    }
+
+    int iCommandId = m_engine ? m_engine->enqueueMaskCommand(uRegAddr, uAndMask, uOrMask, uServerAddr, -1 - iRequestId)
+                                 : m_requestScheduler.enqueueMaskCommand(uRegAddr, uAndMask, uOrMask, uServerAddr, -1 - iRequestId);
+    if(iCommandId < 0)
+    {
+        finishProxyWrite(iRequestId, false);
+        m_proxyServer->finishWrite(iRequestId, false, QModbusPdu::ServerDeviceBusy);
+    }
+}
+
+int ModBusService::applyProxyWrite(int iRequestId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount)
+{
+    QHash<quint8, SignalCodec>::const_iterator codecItr = m_signalCodecMap.constFind(uServerAddr);
+    if(codecItr == m_signalCodecMap.constEnd() || iCount <= 0)
+        return 0;
+    const SignalCodec &signalCodec = codecItr.value();
+    bool bIsBit = isBitTable(eRegTable);
+    quint32 uStartKey = makeRegKey(uServerAddr, eRegTable, uStartAddr);
+    quint32 uEndKey = uStartKey + iCount;
+
+    //多寄存器输出只写了一部分时无法换算成信号值，按非法地址拒绝
+    QMap<quint32, RegisterInterval>::const_iterator firstItr = m_intervalMap.lowerBound(uStartKey);
+    if(firstItr != m_intervalMap.constBegin())
+    {
+        QMap<quint32, RegisterInterval>::const_iterator prevItr = firstItr;
+        prevItr--;
+        if(!prevItr.value().bIsReadReg && prevItr.key() + prevItr.value().uRegCount > uStartKey)
+            return QModbusPdu::IllegalDataAddress;
+    }
+    QMap<quint32, RegisterInterval>::const_iterator itr = firstItr;
+    while(itr != m_intervalMap.constEnd() && itr.key() < uEndKey)
+    {
+        if(!itr.value().bIsReadReg && itr.key() + itr.value().uRegCount > uEndKey)
+            return QModbusPdu::IllegalDataAddress;
+        itr++;
+    }
+
+    for(itr = firstItr; itr != m_intervalMap.constEnd() && itr.key() < uEndKey; itr++)
+    {
+        const RegisterInterval &interval = itr.value();
+        if(interval.bIsReadReg)
+            continue;
+        const quint16 *pIntervalValue = pRegValue + (itr.key() - uStartKey);
+        QVector<ProxyWriteUndo> &undoList = m_proxyWriteUndoHash[iRequestId];
+        ProxyWriteUndo undo;
+        undo.uRegKey = itr.key();
+        undo.dOldValue = 0;
+        if(interval.uRegCount == 1 && !bIsBit)
+        {
+            QHash<quint32, quint16>::const_iterator cacheItr = m_outputRegCache.constFind(itr.key());
+            undo.iSignalIndex = -1;
+            undo.bHadValue = cacheItr != m_outputRegCache.constEnd();
+            undo.uOldValue = undo.bHadValue ? cacheItr.value() : 0;
+            undo.uNewValue = (quint16)signalCodec.combineRegisters(pIntervalValue, 1);
+            m_outputRegCache.insert(itr.key(), (quint16)undo.uNewValue);
+            undoList.append(undo);
+        }
+
+        //与writeSignalValue相同，只改值，版本在读回时更新
+        quint64 qRegValue = bIsBit ? *pIntervalValue : signalCodec.combineRegisters(pIntervalValue, interval.uRegCount);
+        for(int i=0; i<interval.iSignalCount; i++)
         {
-            if(!m_reconnectionTimer->isActive())
+            SignalParameter &signalParam = m_signalList[interval.iFirstSignal + i];
+            undo.iSignalIndex = interval.iFirstSignal + i;
+            undo.bHadValue = true;
+            undo.uOldValue = signalParam.uValue;
+            undo.dOldValue = signalParam.dValue;
+            signalCodec.decode(signalParam, qRegValue);
+            undo.uNewValue = signalParam.uValue;
+            undoList.append(undo);
+        }
+        m_pendingCommandMap[itr.key()]++;
+        m_proxyWriteKeyHash[iRequestId].append(itr.key());
+    }
+    return 0;
+}
+
+void ModBusService::finishProxyWrite(int iRequestId, bool bSuccess)
+{
+    QHash<int, QVector<ProxyWriteUndo> >::iterator undoItr = m_proxyWriteUndoHash.find(iRequestId);
+    if(undoItr != m_proxyWriteUndoHash.end() && !bSuccess)
+    {
+        //PLC没有写入，恢复改写前的值，否则下一周期的循环写仍会把被拒绝的值写出
+        const QVector<ProxyWriteUndo> &undoList = undoItr.value();
+        for(int i=0; i<undoList.size(); i++)
+        {
+            const ProxyWriteUndo &undo = undoList.at(i);
+            if(undo.iSignalIndex < 0)
             {
-                qDebug()<<"Connect failed: " + m_modbusDevice->errorString();
-                m_reconnectionTimer->start();
-                emit sig_setConnected(false);
+                QHash<quint32, quint16>::iterator cacheItr = m_outputRegCache.find(undo.uRegKey);
+                if(cacheItr == m_outputRegCache.end() || cacheItr.value() != undo.uNewValue)
+                    continue;
+                if(undo.bHadValue)
+                    cacheItr.value() = (quint16)undo.uOldValue;
+                else
+                    m_outputRegCache.erase(cacheItr);
+                continue;
             }
+            //之后被操作员或别的代理请求改写过的信号不恢复
+            SignalParameter &signalParam = m_signalList[undo.iSignalIndex];
+            if(signalParam.uValue != undo.uNewValue)
+                continue;
+            signalParam.uValue = undo.uOldValue;
+            signalParam.dValue = undo.dOldValue;
         }
     }
+    if(undoItr != m_proxyWriteUndoHash.end())
+        m_proxyWriteUndoHash.erase(undoItr);
 
-    if (m_modbusDevice->state() == QModbusDevice::ConnectedState)
+    QHash<int, QVector<quint32> >::iterator itr = m_proxyWriteKeyHash.find(iRequestId);
+    if(itr == m_proxyWriteKeyHash.end())
+        return;
+    const QVector<quint32> &keyList = itr.value();
+    for(int i=0; i<keyList.size(); i++)
     {
-        qDebug()<<"Connect success";
-        m_reconnectionTimer->stop();
-        m_recvTimer->start();
-        emit sig_setConnected(true);
+        if(--m_pendingCommandMap[keyList.at(i)] <= 0)
+            m_pendingCommandMap.remove(keyList.at(i));
+    }
+    m_proxyWriteKeyHash.erase(itr);
+}
+
+void ModBusService::initProxyServer()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    int proxyPort = settings.value(m_strLinkGroup + "/ProxyPort",0).toInt();
+    int proxyMaxAgeMs = settings.value(m_strLinkGroup + "/ProxyMaxAgeMs",0).toInt();
+    int proxyMaxClients = settings.value(m_strLinkGroup + "/ProxyMaxClients",16).toInt();
+    if (proxyPort <= 0)
+        return;
+
+    m_proxyServer = new ModbusProxyServer(this);
+    //未配置时效时允许错过两个轮询周期
+    m_proxyServer->setMaxAge(proxyMaxAgeMs > 0 ? proxyMaxAgeMs : 3 * m_pollPeriodMs);
+    m_proxyServer->setMaxClients(proxyMaxClients);
+    for(int i=0; i<m_pollBlockList.size(); i++)
+    {
+        const PollBlock &block = m_pollBlockList.at(i);
+        m_proxyServer->addImageBlock(block.uServerAddr, block.eRegTable, block.uStartAddr, block.uRegCount);
+    }
+    connect(m_proxyServer, &ModbusProxyServer::sig_writeRequest, this, &ModBusService::slot_proxyWriteRequest);
+    connect(m_proxyServer, &ModbusProxyServer::sig_maskWriteRequest, this, &ModBusService::slot_proxyMaskWriteRequest);
+
+    if (!m_proxyServer->listen(proxyPort))
+    {
+        qDebug()<<QString("[%1] Proxy listen on port %2 failed: ").arg(m_strLinkGroup).arg(proxyPort) + m_proxyServer->errorString();
+        return;
+    }
+    qDebug()<<QString("[%1] Proxy listening on port %2, %3 image blocks")
+                    .arg(m_strLinkGroup)
+                    .arg(proxyPort)
+                    .arg(m_pollBlockList.size());
+}
+
+void ModBusService::initApiServer()
+{
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    QString apiSocket = settings.value(m_strLinkGroup + "/ApiSocket").toString();
+    int apiBatchMs = settings.value(m_strLinkGroup + "/ApiBatchMs",100).toInt();
+    if (apiSocket.isEmpty())
+        return;
+
+    m_apiServer = new SignalApiServer(this);
+    m_apiServer->setSignalList(&m_signalList);
+    m_apiServer->setAlarmEngine(&m_alarmEngine);
+    m_apiServer->setBatchPeriod(apiBatchMs);
+    m_apiServer->setDataVersion(m_dataVersion);
+    if (!m_apiServer->listen(apiSocket))
+    {
+        qDebug()<<QString("[%1] API listen on %2 failed: ").arg(m_strLinkGroup).arg(apiSocket) + m_apiServer->errorString();
+        return;
+    }
+    m_aggregator.setup(m_signalList);
+    qDebug()<<QString("[%1] API listening on %2, %3 signals, %4 aggregated")
+                    .arg(m_strLinkGroup)
+                    .arg(apiSocket)
+                    .arg(m_signalList.size())
+                    .arg(m_aggregator.getSignalCount());
+}
+
+void ModBusService::initEngine(ModbusEngine *pEngine, int iTimeoutMs, int iMaxInFlight)
+{
+    m_engine = pEngine;
+    m_engine->setTimeout(iTimeoutMs);
+    m_engine->setMaxInFlight(iMaxInFlight);
+    m_engine->setLinkFailTimeouts(m_linkFailTimeouts);
+
+    //读应答在引擎缓冲区内直接解码，必须直连
+    connect(m_engine, &ModbusEngine::sig_readBlock, this, &ModBusService::slot_engineReadBlock, Qt::DirectConnection);
+    connect(m_engine, &ModbusEngine::sig_pollFailed, this, &ModBusService::slot_pollFailed);
+    connect(m_engine, &ModbusEngine::sig_commandFinished, this, &ModBusService::slot_commandFinished);
+    connect(m_engine, &ModbusEngine::sig_commandRead, this, &ModBusService::slot_commandRead, Qt::DirectConnection);
+    connect(m_engine, &ModbusEngine::sig_connectedChanged, this, &ModBusService::slot_engineConnectedChanged);
+    connect(m_engine, &ModbusEngine::sig_cycleFinished, this, &ModBusService::slot_pollCycleFinished);
+    connect(m_engine, &ModbusEngine::sig_linkFailed, this, &ModBusService::slot_linkFailed);
+
+    for(int i=0; i<m_pollBlockList.size(); i++)
+    {
+        const PollBlock &block = m_pollBlockList.at(i);
+        m_engine->addReadTransaction(block.uServerAddr, block.eRegTable, block.uStartAddr, block.uRegCount);
+    }
+    m_engineWriteList.clear();
+    for(int i=0; i<m_writeBlockList.size(); i++)
+    {
+        const PollBlock &block = m_writeBlockList.at(i);
+        m_engineWriteList.append(m_engine->addWriteTransaction(block.uServerAddr, block.eRegTable, block.uStartAddr, block.uRegCount));
     }
 }
 
@@ -444,17 +1351,46 @@ void ModBusService::initConnection()
     QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
     QSettings settings(configPath,QSettings::IniFormat);
 
-    int connectType = settings.value("ConnectType",1).toInt(); //0 Serial 1 TCP
-    m_debugType = settings.value("Debug",0).toInt(); //调试类型 0：不输出 1：按寄存器地址输出 2：按每个数据输出
+    int connectType = m_bIsSerial ? 0 : 1; //0 Serial 1 TCP
+    m_debugType = settings.value("Debug",0).toInt(); //调试类型 0：不输出 1：按寄存器地址输出 2：按每个数据输出 3：只输出变化的数据
 
-    QString serialPortName = settings.value("Serial/PortName","COM1").toString();
-    QString serialParity = settings.value("Serial/Parity","None").toString(); //None Even Odd Space Mark
-    int serialBaudRate = settings.value("Serial/BaudRate",115200).toInt(); //1200 2400 4800 9600 19200 38400 57600 115200
-    int serialDataBits = settings.value("Serial/DataBits",8).toInt(); //5 6 7 8
-    int serialStopBits = settings.value("Serial/StopBits",1).toInt(); // OneStop:1 OneAndHalfStop:3 TwoStop:2
+    //串口参数取自本链路的节，单链路时为Serial节
+    QString serialPortName = settings.value(m_strLinkGroup + "/PortName","COM1").toString();
+    QString serialParity = settings.value(m_strLinkGroup + "/Parity","None").toString(); //None Even Odd Space Mark
+    int serialBaudRate = settings.value(m_strLinkGroup + "/BaudRate",115200).toInt(); //1200 2400 4800 9600 19200 38400 57600 115200
+    int serialDataBits = settings.value(m_strLinkGroup + "/DataBits",8).toInt(); //5 6 7 8
+    int serialStopBits = settings.value(m_strLinkGroup + "/StopBits",1).toInt(); // OneStop:1 OneAndHalfStop:3 TwoStop:2
     QString tcpIPPort = settings.value("TCP/IPPort","127.0.0.1:502").toString();
     int timeOut = settings.value("Exception/Timeout",1000).toInt();
     int numberOfRetries = settings.value("Exception/NumberOfRetries",0).toInt();
+    int timeoutFloorMs = settings.value("Exception/TimeoutFloorMs",0).toInt();
+    int timeoutPercentile = settings.value("Exception/TimeoutPercentile",99).toInt();
+    double timeoutFactor = settings.value("Exception/TimeoutFactor",2.0).toDouble();
+    int maxInFlight = settings.value("Scheduler/MaxInFlight",1).toInt();
+    int interFrameDelayUs = settings.value(m_strLinkGroup + "/InterFrameDelayUs",0).toInt();
+    int turnaroundUs = settings.value(m_strLinkGroup + "/TurnaroundUs",1000).toInt();
+    m_bMaskWrite = settings.value("Scheduler/MaskWrite",1).toInt() != 0;
+    int useEngine = settings.value(m_strLinkGroup + "/Engine",0).toInt();
+    int interCharTimeoutUs = settings.value(m_strLinkGroup + "/InterCharTimeoutUs",0).toInt();
+    int frameLog = settings.value(m_strLinkGroup + "/FrameLog",0).toInt();
+    m_reconnectMinMs = qMax(10, settings.value("Exception/ReconnectMinMs",500).toInt());
+    m_reconnectMaxMs = qMax(m_reconnectMinMs, settings.value("Exception/ReconnectMaxMs",30000).toInt());
+    //串口链路上各从站的超时互不相关，重开串口无助于恢复，只对TCP判定
+    m_linkFailTimeouts = connectType == 1 ? settings.value("Exception/LinkFailTimeouts",3).toInt() : 0;
+    m_deadLinkMs = settings.value("TCP/DeadLinkMs",3000).toInt();
+    m_connectTimer->setInterval(qMax(timeOut, 1000));
+
+    //TCP可选零分配引擎，QModbusTcpClient作为备用
+    if (connectType == 1 && useEngine == 1)
+    {
+        const QUrl url = QUrl::fromUserInput(tcpIPPort);
+        ModbusTcpEngine *tcpEngine = new ModbusTcpEngine(this);
+        tcpEngine->setServer(url.host(), url.port(502));
+        tcpEngine->setDeadLinkTimeout(m_deadLinkMs);
+        initEngine(tcpEngine, timeOut, maxInFlight);
+        tcpEngine->setAdaptiveTimeout(timeoutFloorMs, timeoutPercentile, timeoutFactor, numberOfRetries);
+        return;
+    }
 
     int nSerialParity = QSerialPort::NoParity;
     if(serialParity == "Even"){
@@ -470,7 +1406,28 @@ void ModBusService::initConnection()
     //Serial
     if (connectType == 0)
     {
-        m_modbusDevice = new QModbusRtuSerialMaster(this);
+        m_rtuTiming.setSerialParameters(serialBaudRate, serialDataBits, nSerialParity, serialStopBits);
+        m_rtuTiming.setTurnaroundUs(turnaroundUs);
+
+        //串口可选零分配RTU引擎，QModbusRtuSerialMaster作为备用
+        if (useEngine == 1)
+        {
+            ModbusRtuEngine *rtuEngine = new ModbusRtuEngine(this);
+            rtuEngine->setSerialParameters(serialPortName, serialBaudRate, serialDataBits, nSerialParity, serialStopBits);
+            rtuEngine->setTiming(m_rtuTiming.getCharTimeNs(),
+                                 interFrameDelayUs > 0 ? interFrameDelayUs : m_rtuTiming.getInterFrameDelayUs(),
+                                 interCharTimeoutUs > 0 ? interCharTimeoutUs : m_rtuTiming.getInterCharTimeoutUs());
+            rtuEngine->setFrameLog(frameLog != 0);
+            initEngine(rtuEngine, timeOut, 1);
+            rtuEngine->setAdaptiveTimeout(timeoutFloorMs, timeoutPercentile, timeoutFactor, numberOfRetries);
+            checkRtuBudget();
+            return;
+        }
+
+        QModbusRtuSerialMaster *rtuMaster = new QModbusRtuSerialMaster(this);
+        //帧间静默默认按波特率计算t3.5，从站允许时可配置更小的值
+        rtuMaster->setInterFrameDelay(interFrameDelayUs > 0 ? interFrameDelayUs : m_rtuTiming.getInterFrameDelayUs());
+        m_modbusDevice = rtuMaster;
         m_modbusDevice->setConnectionParameter(QModbusDevice::SerialPortNameParameter,
                                              serialPortName);
         m_modbusDevice->setConnectionParameter(QModbusDevice::SerialParityParameter,
@@ -492,168 +1449,368 @@ void ModBusService::initConnection()
     m_modbusDevice->setTimeout(timeOut);
     m_modbusDevice->setNumberOfRetries(numberOfRetries);
 
-    connect(m_modbusDevice, &QModbusClient::errorOccurred, [this](QModbusDevice::Error) {
-//        qDebug()<<"QModbusDevice::Error"<<m_modbusDevice->errorString();
-        m_recvTimer->stop();
-        if(!m_reconnectionTimer->isActive())
-        {
-            qDebug()<<"QModbusDevice::Error"<<m_modbusDevice->errorString();
-            m_reconnectionTimer->start();
-            emit sig_setConnected(false);
-        }
-    });
+    //串口同一时刻只有一个事务在线上，多排一个请求到QModbusRtuSerialMaster，应答后隔t3.5立即发出下一帧
+    m_requestScheduler.setClient(m_modbusDevice);
+    m_requestScheduler.setMaxInFlight(connectType == 0 ? 2 : maxInFlight);
+    m_requestScheduler.setRtuTiming(connectType == 0 ? &m_rtuTiming : nullptr);
+    m_requestScheduler.setLinkFailTimeouts(m_linkFailTimeouts);
+    m_requestScheduler.setAdaptiveTimeout(timeoutFloorMs, timeOut, timeoutPercentile, timeoutFactor);
+    m_requestScheduler.setPollBlocks(m_pollBlockList);
+    if (connectType == 0)
+        checkRtuBudget();
+
+    connect(m_modbusDevice, &QModbusClient::stateChanged, this, &ModBusService::slot_deviceStateChanged);
+    connect(m_modbusDevice, &QModbusClient::errorOccurred, this, &ModBusService::slot_deviceErrorOccurred);
 }
 
 void ModBusService::initJsonFile()
 {
-    QString filePath = qApp->applicationDirPath() + "/config/Protocol.json";
-    m_jsonFile.loadJson(filePath);
-    m_signalParamMap.clear();
-    m_signalParamMap= m_jsonFile.getDataStructMap();
-    m_protocolParam.uServerAddr = m_jsonFile.getServerAddress();
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+
+    //链路上的从站，每项为 从站地址:协议文件[:信号Key前缀]，未配置时为Protocol.json及其ServerAddress
+    QStringList unitList = settings.value(m_strLinkGroup + "/Units").toStringList();
+    if(unitList.isEmpty())
+        unitList.append(QString());
+
+    QMap<quint32, SignalSturct> dataMap;
+    QList<DerivedSignalDef> derivedList;
+    QStringList derivedPrefixList;      //派生信号所属从站的Key前缀，表达式中的Key先按前缀查找
+    QList<AlarmDef> alarmList;
+    QStringList alarmPrefixList;
+    m_signalCodecMap.clear();
+    for(int i=0; i<unitList.size(); i++)
+    {
+        QStringList unitParts = unitList.at(i).trimmed().split(':');
+        QString strFileName = unitParts.size() > 1 ? unitParts.at(1) : QString("Protocol.json");
+        QString strKeyPrefix = unitParts.size() > 2 ? unitParts.at(2) : QString();
 
-    initReadMap();
-    initWriteMap();
+        ProtocolJson jsonFile;
+        jsonFile.loadJson(qApp->applicationDirPath() + "/config/" + strFileName);
+        uint uServerAddr = unitParts.at(0).isEmpty() ? jsonFile.getServerAddress() : unitParts.at(0).toUInt();
+        if(uServerAddr < 1 || uServerAddr > 247 || m_signalCodecMap.contains(uServerAddr))
+        {
+            qDebug()<<QString("[%1] Invalid or duplicate unit %2, skipped").arg(m_strLinkGroup).arg(unitList.at(i));
+            continue;
+        }
+
+        SignalCodec &signalCodec = m_signalCodecMap[uServerAddr];
+        signalCodec.setByteSwap(jsonFile.getByteSwap());
+        signalCodec.setWordSwap(jsonFile.getWordSwap());
+
+        //同一协议文件可用于多个从站，信号Key加前缀区分
+        QMap<quint32, SignalSturct> unitMap = jsonFile.getDataStructMap();
+        QMap<quint32, SignalSturct>::iterator itr = unitMap.begin();
+        while(itr != unitMap.end())
+        {
+            SignalSturct &signalStruct = itr.value();
+            for(int j=0; j<signalStruct.spList.size(); j++)
+            {
+                signalStruct.spList[j].uServerAddr = uServerAddr;
+                signalStruct.spList[j].strKey.prepend(strKeyPrefix);
+            }
+            dataMap.insert(makeRegKey(uServerAddr, regKeyTable(itr.key()), regKeyAddr(itr.key())), signalStruct);
+            itr++;
+        }
+
+        QList<DerivedSignalDef> unitDerivedList = jsonFile.getDerivedList();
+        for(int j=0; j<unitDerivedList.size(); j++)
+        {
+            unitDerivedList[j].signalParam.uServerAddr = uServerAddr;
+            unitDerivedList[j].signalParam.strKey.prepend(strKeyPrefix);
+            derivedList.append(unitDerivedList.at(j));
+            derivedPrefixList.append(strKeyPrefix);
+        }
+
+        QList<AlarmDef> unitAlarmList = jsonFile.getAlarmList();
+        for(int j=0; j<unitAlarmList.size(); j++)
+        {
+            unitAlarmList[j].strKey.prepend(strKeyPrefix);
+            alarmList.append(unitAlarmList.at(j));
+            alarmPrefixList.append(strKeyPrefix);
+        }
+    }
+
+    m_pollPlanner.analyse(dataMap);
+    m_signalList = m_pollPlanner.getSignalList();
+    m_intervalMap = m_pollPlanner.getIntervalMap();
+    m_signalIndexHash.clear();
+    for(int i=0; i<m_signalList.size(); i++)
+    {
+        const QString &strKey = m_signalList.at(i).strKey;
+        if(m_signalIndexHash.contains(strKey))
+        {
+            qDebug()<<QString("[%1] Duplicate signal key %2, set a key prefix in Units").arg(m_strLinkGroup).arg(strKey);
+            continue;
+        }
+        m_signalIndexHash.insert(strKey, i);
+    }
+    initDerived(derivedList, derivedPrefixList);
+    initAlarms(alarmList, alarmPrefixList);
+    int pollMaxGap = settings.value("Poll/MaxGap",0).toInt();
+    m_pollMaxGap = pollMaxGap;
+    m_pollPeriodMs = settings.value("Poll/Period",100).toInt();
+    m_staleMs = settings.value("Poll/StaleMs",0).toInt();
+    if(m_staleMs <= 0)
+        m_staleMs = 3 * m_pollPeriodMs;
+    int pollMaxRegCount = settings.value("Poll/MaxRegCount",125).toInt();
+    int pollMaxBitGap = settings.value("Poll/MaxBitGap",0).toInt();
+    int pollMaxBitCount = settings.value("Poll/MaxBitCount",2000).toInt();
+    m_pollBlockList = m_pollPlanner.planBlocks(pollMaxGap, pollMaxRegCount, pollMaxBitGap, pollMaxBitCount);
+    m_writeBlockList = m_pollPlanner.planWriteBlocks();
+    m_writeFieldMaskList.clear();
+    for(int i=0; i<m_writeBlockList.size(); i++)
+    {
+        const PollBlock &block = m_writeBlockList.at(i);
+        quint32 uRegKey = makeRegKey(block.uServerAddr, block.eRegTable, block.uStartAddr);
+        m_writeFieldMaskList.append(block.uRegCount == 1 ? getFieldMask(m_intervalMap[uRegKey]) : 0xFFFF);
+    }
+    m_writeRefreshList.fill(-1, m_writeBlockList.size());
+    qDebug()<<QString("[%1] Poll plan: %2 units, %3 registers, %4 read requests per cycle, %5 conflicts")
+                    .arg(m_strLinkGroup)
+                    .arg(m_signalCodecMap.size())
+                    .arg(m_intervalMap.size())
+                    .arg(m_pollBlockList.size())
+                    .arg(m_pollPlanner.getConflictList().size());
 }
 
-void ModBusService::initReadMap()
+void ModBusService::initDerived(const QList<DerivedSignalDef> &derivedList, const QStringList &derivedPrefixList)
 {
-//    m_readMap.clear();
-//    quint16 qRegAddr = m_protocolParam.uReadStartAddr;
-//    int qRegCounts = m_protocolParam.iReadRegCounts;
+    //先登记全部派生信号的Key，表达式可引用其它派生信号
+    m_derivedEngine.clear();
+    QVector<int> indexList;
+    for(int i=0; i<derivedList.size(); i++)
+    {
+        const QString &strKey = derivedList.at(i).signalParam.strKey;
+        if(m_signalIndexHash.contains(strKey))
+        {
+            qDebug()<<QString("[%1] Duplicate signal key %2, derived signal skipped").arg(m_strLinkGroup).arg(strKey);
+            indexList.append(-1);
+            continue;
+        }
+        indexList.append(m_signalList.size());
+        m_signalIndexHash.insert(strKey, m_signalList.size());
+        m_signalList.append(derivedList.at(i).signalParam);
+    }
+
+    //编译失败的派生信号保留在信号表中，质量一直为无值
+    for(int i=0; i<derivedList.size(); i++)
+    {
+        if(indexList.at(i) < 0)
+            continue;
+        QString strError;
+        if(!m_derivedEngine.addSignal(indexList.at(i), derivedList.at(i).strExpr, derivedPrefixList.at(i), m_signalIndexHash, strError))
+            qDebug()<<QString("[%1] Derived signal %2: %3").arg(m_strLinkGroup).arg(derivedList.at(i).signalParam.strKey).arg(strError);
+    }
 
-//    for( ; qRegAddr < (m_protocolParam.uReadStartAddr+qRegCounts); qRegAddr++)
-//    {
-//        QList<SignalParameter> mList = m_signalParamMap.value(qRegAddr);
-//        for(int j=0; j<mList.size();j++)
-//        {
-//            QString strKey = mList.at(j).strKey;
-//            QString strValue = QString::number(mList.at(j).uValue);
-//            m_readMap.insert(strKey, strValue);
-//        }
-//    }
+    QString strError;
+    if(!m_derivedEngine.finalize(m_signalList, strError))
+        qDebug()<<QString("[%1] Derived signals: %2").arg(m_strLinkGroup).arg(strError);
+    if(m_derivedEngine.getSignalCount() > 0)
+        qDebug()<<QString("[%1] Derived signals: %2 compiled").arg(m_strLinkGroup).arg(m_derivedEngine.getSignalCount());
 }
 
-void ModBusService::initWriteMap()
+void ModBusService::initAlarms(const QList<AlarmDef> &alarmList, const QStringList &alarmPrefixList)
 {
-//    m_writeMap.clear();
-//    quint16 qRegAddr = m_protocolParam.uWriteStartAddr;
-//    int qRegCounts = m_protocolParam.iWriteRegCounts;
+    m_alarmEngine.clear();
+    for(int i=0; i<alarmList.size(); i++)
+    {
+        AlarmDef alarmDef = alarmList.at(i);
+        int iSignalIndex = m_signalIndexHash.value(alarmPrefixList.at(i) + alarmDef.strSignalKey, -1);
+        if(iSignalIndex < 0)
+            iSignalIndex = m_signalIndexHash.value(alarmDef.strSignalKey, -1);
+        if(iSignalIndex < 0)
+        {
+            qDebug()<<QString("[%1] Alarm %2: unknown signal %3, skipped").arg(m_strLinkGroup).arg(alarmDef.strKey).arg(alarmDef.strSignalKey);
+            continue;
+        }
+        alarmDef.strSignalKey = m_signalList.at(iSignalIndex).strKey;
+        m_alarmEngine.addAlarm(alarmDef, iSignalIndex);
+    }
+    m_alarmEngine.finalize(m_signalList.size());
+    if(m_alarmEngine.getAlarmCount() > 0)
+        qDebug()<<QString("[%1] Alarms: %2 defined").arg(m_strLinkGroup).arg(m_alarmEngine.getAlarmCount());
+}
+
+void ModBusService::checkRtuBudget()
+{
+    qint64 iPlanUs = 0;
+    for(int i=0; i<m_pollBlockList.size(); i++)
+    {
+        const PollBlock &block = m_pollBlockList.at(i);
+        iPlanUs += m_rtuTiming.transactionTimeUs(readRequest(block.eRegTable, block.uStartAddr, block.uRegCount), false, false);
+    }
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constBegin();
+    while(itr != m_intervalMap.constEnd())
+    {
+        const RegisterInterval &interval = itr.value();
+        if(!interval.bIsReadReg)
+            iPlanUs += m_rtuTiming.transactionTimeUs(writeRequest(interval.eRegTable, interval.uStartAddr, interval.uRegCount), true, false);
+        itr++;
+    }
 
-//    for( ; qRegAddr < (m_protocolParam.uWriteStartAddr+qRegCounts); qRegAddr++)
-//    {
-//        QList<SignalParameter> mList = m_signalParamMap.value(qRegAddr);
-//        for(int j=0; j<mList.size();j++)
-//        {
-//            QString strKey = mList.at(j).strKey;
-//            QString strValue = QString::number(mList.at(j).uValue);
-//            m_writeMap.insert(strKey, strValue);
-//        }
-//    }
+    qint64 iPeriodUs = m_pollPeriodMs * 1000LL;
+    qDebug()<<QString("[%1] RTU bus: char %2 us, t3.5 %3 us, poll plan %4 us per %5 ms cycle (%6%)")
+                    .arg(m_strLinkGroup)
+                    .arg(m_rtuTiming.getCharTimeNs() / 1000.0, 0, 'f', 1)
+                    .arg(m_rtuTiming.getInterFrameDelayUs())
+                    .arg(iPlanUs)
+                    .arg(m_pollPeriodMs)
+                    .arg(iPlanUs * 100.0 / iPeriodUs, 0, 'f', 1);
+    if(iPlanUs > iPeriodUs)
+        qDebug()<<QString("Warning: RTU poll plan needs %1 us but Poll/Period is %2 ms, cycles will be skipped")
+                        .arg(iPlanUs)
+                        .arg(m_pollPeriodMs);
+
+    int iBreakEvenGap = m_rtuTiming.breakEvenGap();
+    if(m_pollMaxGap < iBreakEvenGap)
+        qDebug()<<QString("Hint: merging gaps of up to %1 registers (Poll/MaxGap) costs less bus time than an extra request")
+                        .arg(iBreakEvenGap);
 }
 
+void ModBusService::initLogger()
+{
+    if(m_debugType == 0)
+        return;
+
+    QString configPath = qApp->applicationDirPath() + "/config/Config.ini";
+    QSettings settings(configPath,QSettings::IniFormat);
+    AsyncLogger::instance()->setMaxLinesPerSec(settings.value("Log/MaxLinesPerSec",2000).toInt());
+
+    //行的固定部分在加载时格式化一次，每周期只写数值
+    QVector<LogRowFormat> signalRows;
+    for(int i=0; i<m_signalList.size(); i++)
+    {
+        const SignalParameter &signalParam = m_signalList.at(i);
+        LogRowFormat row;
+        row.prefix = QString("%1 %2 %3 %4 %5 %6 ")
+                         .arg(i+1,3)
+                         .arg(signalParam.strKey,26)
+                         .arg(signalParam.strType,10)
+                         .arg(signalParam.uLength,10)
+                         .arg(signalParam.uBitPos,10)
+                         .arg(signalParam.uRegisterAddr + REGADDR_OFFSET,10).toUtf8();
+        row.suffix = QString(" %1").arg(signalParam.strParamName,20).toUtf8();
+        signalRows.append(row);
+    }
+
+    QVector<LogRowFormat> registerRows;
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constBegin();
+    while(itr != m_intervalMap.constEnd())
+    {
+        LogRowFormat row;
+        row.prefix = QString("%1 %2 ")
+                         .arg(registerRows.size()+1,3)
+                         .arg(itr.value().uStartAddr + REGADDR_OFFSET,10).toUtf8();
+        registerRows.append(row);
+        itr++;
+    }
+    //告警行按告警序号
+    QVector<LogRowFormat> alarmRows;
+    for(int i=0; i<m_alarmEngine.getAlarmCount(); i++)
+    {
+        const AlarmDef &alarmDef = m_alarmEngine.getAlarmDef(i);
+        LogRowFormat row;
+        row.prefix = alarmDef.strKey.toUtf8();
+        row.suffix = alarmDef.strSignalKey.toUtf8();
+        alarmRows.append(row);
+    }
+
+    //跳变行按信号下标，突发采样在之后加载，未监视的信号也登记
+    QVector<LogRowFormat> edgeRows;
+    for(int i=0; i<m_signalList.size(); i++)
+    {
+        LogRowFormat row;
+        row.prefix = m_signalList.at(i).strKey.toUtf8();
+        edgeRows.append(row);
+    }
+    m_logSource = AsyncLogger::instance()->registerSource(m_strLinkGroup, signalRows, registerRows, alarmRows, edgeRows);
+}
 
-bool ModBusService::isEqualString(const QString &str1, const QString &str2)
+void ModBusService::pushLogEvent(int iType, int iRow, quint64 uValue, double dValue, qint64 iTimeMs)
 {
-    int ret = QString::compare(str1,str2);
-    if(ret == 0)
-        return true;
-    else
-        return false;
+    if(m_logSource < 0)
+        return;
+    LogRecord record;
+    record.iTimeMs = iTimeMs != 0 ? iTimeMs : QDateTime::currentMSecsSinceEpoch();
+    record.iType = iType;
+    record.iSource = m_logSource;
+    record.iRow = iRow;
+    record.uValue = uValue;
+    record.dValue = dValue;
+    record.uQuality = Quality_Good;
+    record.uExceptionCode = 0;
+    AsyncLogger::instance()->push(record);
 }
 
 void ModBusService::printData()
 {
-    if(m_debugType == 0)
+    //只把数值写入日志队列，格式化和输出在日志线程
+    if(m_debugType == 0 || m_logSource < 0)
         return;
+    //只输出变化的行时，没有变化的周期不输出
+    if(m_debugType == 3 && m_dataVersion == m_loggedVersion)
+        return;
+
+    AsyncLogger *pLogger = AsyncLogger::instance();
+    LogRecord record;
+    record.iTimeMs = QDateTime::currentMSecsSinceEpoch();
+    record.iType = LogRecord_Separator;
+    record.iSource = m_logSource;
+    record.iRow = 0;
+    record.uValue = 0;
+    record.dValue = 0;
+    record.uQuality = Quality_Good;
+    record.uExceptionCode = 0;
+    pLogger->push(record);
 
     if(m_debugType == 1)
     {
-        QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.begin();
-        int iCount = 0;
-        while(itr != m_signalParamMap.end())
+        record.iType = LogRecord_Register;
+        record.iRow = 0;
+        QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constBegin();
+        while(itr != m_intervalMap.constEnd())
         {
-            int iRegBitLengh = itr.value().iRegBitLengh;
-            QList<SignalParameter> mList = itr.value().spList;
+            const RegisterInterval &interval = itr.value();
             quint64 qRegValue64 = 0;
-            if(iRegBitLengh == 16)
+            if(interval.uRegCount == 1 && !isBitTable(interval.eRegTable))
             {
                 quint16 qRegValue = 0x0;
-                for(int j=0; j<mList.size();j++)
+                for(int j=0; j<interval.iSignalCount; j++)
                 {
-                    quint16 qPos = mList.at(j).uBitPos;
-                    quint16 qBitLen = mList.at(j).uLength;
-                    quint16 setValue = mList.at(j).uValue;
+                    const SignalParameter &signalParam = m_signalList.at(interval.iFirstSignal + j);
                     quint16 qNewValue = 0;
-                    setParamValue16(qRegValue, qPos, qBitLen, setValue, qNewValue);
+                    setParamValue16(qRegValue, signalParam.uBitPos, signalParam.uLength, signalParam.uValue, qNewValue);
                     qRegValue  = qNewValue;
                 }
                 qRegValue64 = qRegValue;
             }
-            else if(iRegBitLengh == 32 || iRegBitLengh == 64)
-            {
-                if(mList.size() > 0)
-                {
-                    qRegValue64 = mList.at(0).uValue;
-                }
-            }
-
-            if(iCount == 0)
+            else
             {
-                QString strInfo = QString("==================================================================================================================");
-                //                    printf(strInfo.toStdString().c_str());
-                qDebug()<<strInfo;
+                qRegValue64 = m_signalList.at(interval.iFirstSignal).uValue;
             }
 
-            QString logInfo = QString("%1 %2 %3")
-                                  .arg(iCount+1,3)
-                                  .arg(itr.key() + REGADDR_OFFSET,10)
-                                  .arg(QString::number(qRegValue64,16),10);
-            //                printf(logInfo.toStdString().c_str());
-            qDebug()<<logInfo;
-            iCount++;
+            record.uValue = qRegValue64;
+            pLogger->push(record);
+            record.iRow++;
             itr++;
         }
     }
 
-    if(m_debugType == 2)
+    if(m_debugType == 2 || m_debugType == 3)
     {
-        QMap<quint16, SignalSturct>::iterator itr = m_signalParamMap.begin();
-        int iCount = 0;
-        while(itr != m_signalParamMap.end())
+        record.iType = LogRecord_Signal;
+        for(int i=0; i<m_signalList.size(); i++)
         {
-            QList<SignalParameter> mList = itr.value().spList;
-            for(int j=0; j<mList.size();j++)
-            {
-                QString strKey = mList.at(j).strKey;
-                QString strName= mList.at(j).strParamName;
-                QString strType = mList.at(j).strType;
-                quint16 qBitLen = mList.at(j).uLength;
-                quint16 qPos = mList.at(j).uBitPos;
-                quint16 qRegisterAddr = mList.at(j).uRegisterAddr + REGADDR_OFFSET;
-                quint64 qValue = mList.at(j).uValue;
-
-                if(iCount == 0)
-                {
-                    QString strInfo = QString("==================================================================================================================");
-                    //                    printf(strInfo.toStdString().c_str());
-                    qDebug()<<strInfo;
-                }
-                QString logInfo = QString("%1 %2 %3 %4 %5 %6 %7 %8")
-                                      .arg(iCount+1,3)
-                                      .arg(strKey,26)
-                                      .arg(strType,10)
-                                      .arg(qBitLen,10)
-                                      .arg(qPos,10)
-                                      .arg(qRegisterAddr,10)
-                                      .arg(QString::number(qValue,10),10)
-                                      .arg(strName,20);
-                //                printf(logInfo.toStdString().c_str());
-
-                qDebug()<<logInfo;
-                iCount++;
-            }
-            itr++;
+            const SignalParameter &signalParam = m_signalList.at(i);
+            if(m_debugType == 3 && signalParam.uVersion <= m_loggedVersion)
+                continue;
+            record.iRow = i;
+            record.dValue = signalParam.dValue;
+            record.uQuality = signalParam.uQuality;
+            record.uExceptionCode = signalParam.uExceptionCode;
+            pLogger->push(record);
         }
     }
+    m_loggedVersion = m_dataVersion;
 }
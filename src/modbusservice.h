@@ -4,37 +4,95 @@
 #include <QObject>
 #include <QModbusClient>
 #include <QTimer>
+#include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
 #include "commondefine.h"
 #include "protocoljson.h"
+#include "pollplanner.h"
+#include "signalcodec.h"
+#include "requestscheduler.h"
+#include "rtutiming.h"
+#include "modbusengine.h"
+#include "modbusproxyserver.h"
+#include "signalapiserver.h"
+#include "metricsexporter.h"
+#include "cycletimer.h"
+#include "scripthost.h"
+#include "derivedsignalengine.h"
+#include "alarmengine.h"
+#include "signalaggregator.h"
+#include "burstsampler.h"
 
 class ModBusService : public QObject
 {
     Q_OBJECT
 public:
-    explicit ModBusService(QObject *parent = nullptr);
+    enum
+    {
+        AllocWarmupCycles = 10,         //连上后不检查堆分配的周期数
+        RefreshCommandTag = INT_MIN + 2 //位域寄存器周期屏蔽写的标签，与脚本、突发读命令区分
+    };
+
+    /* strLinkGroup: Config.ini中链路的节名，多串口时每个串口一个服务
+     * 为空时按ConnectType使用Serial或TCP节
+    */
+    explicit ModBusService(const QString &strLinkGroup = QString(), QObject *parent = nullptr);
+
+    /* 操作员写输出信号，命令排在所有轮询请求之前，链路空闲即发送
+     * strKey: 信号Key
+     * dValue: 工程值
+     * 返回值: 命令编号，完成时通过sig_writeFinished通知，失败返回-1
+    */
+    int writeSignalValue(const QString &strKey, double dValue);
+    //同上，iSignalIndex为findSignalIndex的返回值，重复写同一信号时不再查找Key
+    int writeSignalValue(int iSignalIndex, double dValue);
+    /* 按需读命令，与写命令同一队列，应答同轮询一样解码进信号表
+     * iTag: ScriptHost::CommandTag或BurstSampler::CommandTag，完成时通知对应的一方
+     * 返回值: 命令编号，失败返回-1
+    */
+    int enqueueReadCommand(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTag = ScriptHost::CommandTag);
+    //信号表中的信号，没有时返回nullptr，只在链路线程使用
+    const SignalParameter *findSignal(const QString &strKey) const;
+    //信号Key在加载协议时映射为信号表下标，没有时返回-1
+    int findSignalIndex(const QString &strKey) const;
+    inline const SignalParameter &signalAt(int iSignalIndex) const
+    {
+        return m_signalList.at(iSignalIndex);
+    }
+    //预热之后各轮询周期内本线程的堆分配次数，编译时启用分配统计才有值，只在链路线程读取
+    quint64 getSteadyAllocations() const;
 
 signals:
-    void sig_setPLCMapValue(const QString &strKey, const QString &strValue);
     void sig_setConnected(bool isConnected);
+    //写命令完成 iLatencyUs：从下发命令到收到应答的时间
+    void sig_writeFinished(const QString &strKey, int iCommandId, bool bSuccess, qint64 iLatencyUs);
 
 private:
-    QModbusDataUnit readRequest(quint16 qRegAddr, int iRegCount) const;
-    QModbusDataUnit writeRequest(quint16 qRegAddr, int iRegCount) const;
+    QModbusDataUnit readRequest(QModbusDataUnit::RegisterType eRegTable, quint16 qRegAddr, int iRegCount) const;
+    QModbusDataUnit writeRequest(QModbusDataUnit::RegisterType eRegTable, quint16 qRegAddr, int iRegCount) const;
     void readRegister();
     void writeRegister();
+    void sendWriteUnit(const QModbusDataUnit &writeUnit, quint8 uServerAddr);
 
-    //qRegAddr：寄存器地址  qRegValue：寄存器值
-    void updateParamValue(quint16 qRegAddr, quint64 qRegValue);
-
-    /* 从寄存器值中获取指定位置、长度的值
-     * regValue: 整个寄存器读取的值
-     * valuePos: 获取值的起始位置
-     * valueSize: 获取值的长度
-     * paramValue: 输出参数值
+    //按区间表解析一个读请求块，换算结果写入信号表 qStartAddr：块起始地址 pRegValue：块内iCount个寄存器值，线圈、离散输入每个值为一个点
+    void decodeBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 qStartAddr, const quint16 *pRegValue, int iCount);
+    //读请求块失败，块内信号置为通讯错误或异常，值保留最后一次读回的值
+    void markBlockQuality(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 qStartAddr, int iCount, int iQuality, int iExceptionCode);
+    //链路断开，已读回的信号全部置为通讯错误
+    void markAllCommError();
+    /* 计算输入改变的派生信号
+     * bVersionTaken: 本次已取过数据版本，派生信号用同一版本
+     * 返回值: 是否有派生信号改变
     */
-    bool getParamValue16(quint16 regValue, quint16 valuePos, quint16 valueSize, quint16 &paramValue);
-    bool getParamValue32(quint32 regValue, quint16 valuePos, quint16 valueSize, quint32 &paramValue);
-    bool getParamValue64(quint64 regValue, quint16 valuePos, quint16 valueSize, quint64 &paramValue);
+    bool evaluateDerived(bool bVersionTaken);
+    //计算信号读回后待计算的告警，事件输出到日志和查询接口
+    void evaluateAlarms();
+    void flushAlarmEvents();
+    //结束到时的聚合窗口并交给查询接口，每周期调用
+    void flushAggregates();
+    //监视信号的跳变交给查询接口，每周期调用
+    void flushBurstEdges();
 
     /* 设置寄存器某位置的数值
      * oldRegValue: 寄存器读取的值
@@ -47,42 +105,188 @@ private:
     bool setParamValue32(quint32 oldRegValue, quint16 valuePos, quint16 valueSize, quint32 setValue, quint32 &newRegValue);
     bool setParamValue64(quint64 oldRegValue, quint16 valuePos, quint16 valueSize, quint64 setValue, quint64 &newRegValue);
 
-    QVector<quint16> getWriteRegValues(quint16 qRegAddr);
-
-    //写寄存器数据到Redis
-    void readRegister2Redis();
+    //按设备字节序、字序生成写寄存器的值，16位寄存器以最近读回值为底，不覆盖PLC自有的位
+    QVector<quint16> getWriteRegValues(const RegisterInterval &interval);
+    void fillWriteRegValues(const RegisterInterval &interval, quint16 *pRegValue);
+    //生成一个周期写请求的值，线圈每个值为一个点
+    void fillWriteBlockValues(const PollBlock &block, quint16 *pRegValue);
+    //16位输出寄存器中本服务信号占用的位，其余位归PLC
+    quint16 getFieldMask(const RegisterInterval &interval) const;
+    /* 周期写第iBlock个位域寄存器块
+     * 返回值: 是否按整个寄存器写，屏蔽写或从未读回时返回false
+    */
+    bool refreshFieldRegister(int iBlock);
 
-    //Redis到读寄存器
-    void redis2WriteRegister();
+    /* 写命令入队，位域输出优先使用功能码22屏蔽写
+     * iCommandId: 屏蔽写被拒绝后重发时沿用原命令编号，-1为新编号
+    */
+    int enqueueSignalCommand(int iSignalIndex, int iCommandId = -1);
+    /* 代理客户端写到本服务输出区间的值记入输出信号，区间按写命令未完成处理，否则下一周期的循环写会改回旧值
+     * 改写前的值保留到请求完成，PLC拒绝时由finishProxyWrite恢复
+     * pRegValue: 线上的寄存器值，线圈每个值为一个点
+     * 返回值: 0，或只写了输出区间一部分时的异常码
+    */
+    int applyProxyWrite(int iRequestId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    /* 代理写请求完成或未能入队，释放其标记的输出区间
+     * bSuccess: PLC确认写入，否则恢复改写前的缓存和信号值
+    */
+    void finishProxyWrite(int iRequestId, bool bSuccess);
 
 private slots:
     void slot_recvTimeout();
-    void slot_readReady();
+    void slot_readReady(QModbusReply *reply);
+    void slot_commandFinished(int iCommandId, int iSignalIndex, bool bIsMaskWrite, bool bSuccess, int iExceptionCode, qint64 iLatencyUs);
+    //读命令应答，pRegValue只在处理期间有效
+    void slot_commandRead(int iCommandId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
     void slot_reconnection();
+    //连接超时未建立时中止本次连接
+    void slot_connectTimeout();
+    //QModbusClient的连接状态和错误，单个请求的超时、异常不断开连接
+    void slot_deviceStateChanged(QModbusDevice::State eState);
+    void slot_deviceErrorOccurred(QModbusDevice::Error eError);
+    //连续超时，主动断开后重连
+    void slot_linkFailed();
+    void slot_engineReadBlock(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    //引擎或调度器的轮询读失败 iExceptionCode：从站异常码，超时、帧错误为0
+    void slot_pollFailed(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iExceptionCode);
+    //超过时效未读回的信号置为过期
+    void slot_staleCheck();
+    //告警延时到期
+    void slot_alarmTimer();
+    void slot_engineConnectedChanged(bool bConnected);
+    //一个周期的轮询全部完成，记录周期耗时
+    void slot_pollCycleFinished();
+    void slot_publishMetrics();
+    //代理客户端的写请求，经命令通道转发
+    void slot_proxyWriteRequest(int iRequestId, quint8 uServerAddr, const QModbusDataUnit &unit);
+    void slot_proxyMaskWriteRequest(int iRequestId, quint8 uServerAddr, quint16 uRegAddr, quint16 uAndMask, quint16 uOrMask);
 
 private:
     void initConnection();
     void reConnection();
+    void linkUp();
+    void linkDown(const QString &strError);
+    //按指数退避加随机抖动安排下一次连接
+    void scheduleReconnect();
     void initJsonFile();
-    void initReadMap();
-    void initWriteMap();
-    bool isEqualString(const QString &str1, const QString &str2);
+    //派生信号追加到信号表末尾并编译，derivedPrefixList与derivedList一一对应
+    void initDerived(const QList<DerivedSignalDef> &derivedList, const QStringList &derivedPrefixList);
+    //告警的信号Key按所属从站的前缀查找，找不到再按原样查找
+    void initAlarms(const QList<AlarmDef> &alarmList, const QStringList &alarmPrefixList);
+    //使用零分配引擎，轮询和周期写事务一次登记
+    void initEngine(ModbusEngine *pEngine, int iTimeoutMs, int iMaxInFlight);
+    //链路节ProxyPort非0时启动Modbus TCP扇出代理，映像块与读请求块一一对应
+    void initProxyServer();
+    //链路节ApiSocket非空时启动信号查询接口
+    void initApiServer();
+    //串口链路估算每周期总线时间，超出轮询周期时告警
+    void checkRtuBudget();
+    //调试输出的行格式登记到异步日志
+    void initLogger();
+    //启用指标输出时登记本链路，每秒发布一次
+    void initMetrics();
+    //链路节Scripts非空时创建脚本宿主，连上时启动脚本
+    void initScripts();
+    //链路节BurstSignals非空时创建突发采样
+    void initBurst();
+    //Realtime节启用时设置链路线程的调度策略和CPU，预留容器容量
+    void initRealtime();
+    //启用分配统计时，稳态周期内有堆分配则计数
+    void checkAllocations();
+    //连接状态变化，更新指标并通知
+    void setConnected(bool bConnected);
     void printData();
+    //状态行写入异步日志，周期路径上不格式化文字，未启用调试输出时不写 iTimeMs：记录时间，0为当前时间
+    void pushLogEvent(int iType, int iRow, quint64 uValue, double dValue, qint64 iTimeMs = 0);
 
 private:
+    //代理写请求改写前的值，PLC拒绝时恢复
+    struct ProxyWriteUndo
+    {
+        quint32 uRegKey;
+        int iSignalIndex;           //-1为输出寄存器缓存
+        bool bHadValue;             //寄存器缓存改写前有值
+        quint64 uOldValue;
+        double dOldValue;
+        quint64 uNewValue;          //本请求写入的值，之后被别的写改过时不恢复
+    };
+
+    QString m_strLinkGroup;     //链路节名 Serial、TCP或多串口中的串口节名
     QModbusClient *m_modbusDevice;
-    QTimer *m_recvTimer;
-    QTimer *m_reconnectionTimer;
-    ProtocolJson m_jsonFile;
+    CycleTimer *m_recvTimer;    //轮询周期，按单调时钟绝对起点触发
+    QTimer *m_reconnectionTimer;   //单次定时，间隔由scheduleReconnect计算
+    QTimer *m_connectTimer;         //连接超时
+    int m_reconnectAttempt;         //连续重连失败次数，链路读到数据后清零
+    int m_reconnectMinMs;           //首次重连间隔
+    int m_reconnectMaxMs;           //重连间隔上限
+    int m_linkFailTimeouts;         //连续超时判定断开的门限，仅TCP，0不判定
+    int m_deadLinkMs;               //TCP死链检测时间，0使用系统默认
+    ModbusEngine *m_engine;     //链路节Engine=1时使用，否则为空
+    ModbusProxyServer *m_proxyServer;   //未启用代理时为空
+    SignalApiServer *m_apiServer;       //未启用查询接口时为空
+    ScriptHost *m_scriptHost;           //未配置脚本时为空
+    BurstSampler *m_burstSampler;       //未配置突发采样时为空
+    PollPlanner m_pollPlanner;
+    //各从站的字节序 Key:从站地址
+    QHash<quint8, SignalCodec> m_signalCodecMap;
+    RequestScheduler m_requestScheduler;
+    RtuTiming m_rtuTiming;
     SignalProtocolParam m_protocolParam;  //协议参数
 
-    //保存参数Map Key:寄存器地址 QList<SignalParameter>寄存器下对应的参数列表
-    QMap<quint16, SignalSturct> m_signalParamMap;
+    //信号表，按寄存器区间顺序存放，区间通过iFirstSignal、iSignalCount引用
+    QVector<SignalParameter> m_signalList;
+    //Key:信号Key Value:信号表下标
+    QHash<QString, int> m_signalIndexHash;
+    //派生信号追加在信号表末尾，输入读回后增量计算
+    DerivedSignalEngine m_derivedEngine;
+    AlarmEngine m_alarmEngine;
+    //聚合结果只推送给查询接口，未启用查询接口时不聚合
+    SignalAggregator m_aggregator;
+    //数据版本，有信号值改变的读请求块每块加1
+    quint64 m_dataVersion;
+    quint64 m_loggedVersion;    //上次调试输出时的数据版本
+    int m_logSource;            //异步日志的数据源编号，未启用调试输出为-1
+    LinkMetrics m_metrics;      //收发计数在引擎或调度器中，发布时合并
+    int m_metricsLink;          //指标输出的链路编号，未启用为-1
+    bool m_bEverConnected;      //曾连上过，之后再连上记为重连
+    QTimer *m_metricsTimer;
+    QElapsedTimer m_cycleTimer; //本周期轮询开始计时，周期作废时无效
+    qint64 m_wallOffsetMs;      //系统时间减单调时钟ms，每周期更新一次，读回时由单调时间换算系统时间
+    int m_allocWarmupCycles;    //连上后不检查分配的周期数，首次读回、建立连接时的分配不计
+    quint64 m_lastAllocCount;   //上一周期开始时本线程的堆分配次数
+    quint64 m_reportedAllocations;  //已输出过的稳态分配次数
+    int m_staleMs;              //信号过期时间ms
+    QTimer *m_staleTimer;
+    QTimer *m_alarmTimer;       //单次定时，到最近的告警延时到期
+    //有未完成写命令的输出区间 Key:寄存器Key Value:未完成命令数，期间不用读回值覆盖
+    QHash<quint32, int> m_pendingCommandMap;
+    //代理写请求覆盖的输出区间 Key:代理请求编号 Value:寄存器Key
+    QHash<int, QVector<quint32> > m_proxyWriteKeyHash;
+    //代理写请求改写前的缓存和信号值 Key:代理请求编号
+    QHash<int, QVector<ProxyWriteUndo> > m_proxyWriteUndoHash;
+    int m_pollOverrunCount;     //轮询未在周期内完成而跳过的次数
+    //输出16位寄存器最近读回的值 Key:寄存器Key，读-改-写以此为底
+    QHash<quint32, quint16> m_outputRegCache;
+    bool m_bMaskWrite;          //位域输出使用功能码22
+    QSet<quint8> m_noMaskWriteSet;  //返回过非法功能码的从站，改为读-改-写
+    bool m_bIsSerial;           //串口RTU链路
+    int m_pollPeriodMs;         //轮询周期ms
+    int m_pollMaxGap;           //合并读请求允许跨越的空闲寄存器个数
 
-    QMap<QString, QString> m_readMap;
-    QMap<QString, QString> m_writeMap;
+    //寄存器区间表 Key:makeRegKey(从站地址, 寄存器类型, 起始寄存器地址)
+    QMap<quint32, RegisterInterval> m_intervalMap;
+    //读请求块
+    QList<PollBlock> m_pollBlockList;
+    //周期写请求块
+    QList<PollBlock> m_writeBlockList;
+    //周期写请求块对应的引擎事务下标
+    QVector<int> m_engineWriteList;
+    //周期写请求块中本服务占用的位，整个寄存器或多个寄存器、线圈归本服务时为0xFFFF
+    QVector<quint16> m_writeFieldMaskList;
+    //位域寄存器块未完成的周期屏蔽写命令编号，没有时为-1，完成前不再入队
+    QVector<int> m_writeRefreshList;
 
-    int m_debugType; //调试类型 0：不输出 1：按寄存器地址输出 2：按每个数据输出
+    int m_debugType; //调试类型 0：不输出 1：按寄存器地址输出 2：按每个数据输出 3：只输出变化的数据
 };
 
 #endif // MODBUSSERVICE_H
@@ -0,0 +1,134 @@
+﻿#include "modbustcpengine.h"
+#include "modbusframe.h"
+#include <QDebug>
+#include <string.h>
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+ModbusTcpEngine::ModbusTcpEngine(QObject *parent) : ModbusEngine(parent),
+    m_socket(nullptr),
+    m_uPort(502),
+    m_deadLinkMs(0),
+    m_rxLength(0)
+{
+    m_socket = new QTcpSocket(this);
+    connect(m_socket, &QTcpSocket::readyRead, this, &ModbusTcpEngine::slot_readyRead);
+    connect(m_socket, &QTcpSocket::stateChanged, this, &ModbusTcpEngine::slot_stateChanged);
+}
+
+void ModbusTcpEngine::setServer(const QString &strHost, quint16 uPort)
+{
+    m_strHost = strHost;
+    m_uPort = uPort;
+}
+
+void ModbusTcpEngine::setDeadLinkTimeout(int iDeadLinkMs)
+{
+    m_deadLinkMs = iDeadLinkMs;
+}
+
+void ModbusTcpEngine::connectDevice()
+{
+    if(m_socket->state() == QAbstractSocket::UnconnectedState)
+        m_socket->connectToHost(m_strHost, m_uPort);
+}
+
+void ModbusTcpEngine::disconnectDevice()
+{
+    //abort立即关闭，状态变化时释放在途事务
+    if(m_socket->state() != QAbstractSocket::UnconnectedState)
+        m_socket->abort();
+}
+
+void ModbusTcpEngine::applyDeadLinkTimeout(QAbstractSocket *pSocket, int iDeadLinkMs)
+{
+    if(!pSocket || iDeadLinkMs <= 0)
+        return;
+    pSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+#ifdef Q_OS_LINUX
+    //空闲1/3后开始探测，间隔1/3，2次无应答断开，保活以秒为单位
+    int iFd = (int)pSocket->socketDescriptor();
+    int iIntervalSec = qMax(1, iDeadLinkMs / 3000);
+    int iProbeCount = 2;
+    unsigned int uUserTimeoutMs = (unsigned int)iDeadLinkMs;
+    setsockopt(iFd, IPPROTO_TCP, TCP_KEEPIDLE, &iIntervalSec, sizeof(iIntervalSec));
+    setsockopt(iFd, IPPROTO_TCP, TCP_KEEPINTVL, &iIntervalSec, sizeof(iIntervalSec));
+    setsockopt(iFd, IPPROTO_TCP, TCP_KEEPCNT, &iProbeCount, sizeof(iProbeCount));
+    setsockopt(iFd, IPPROTO_TCP, TCP_USER_TIMEOUT, &uUserTimeoutMs, sizeof(uUserTimeoutMs));
+#endif
+}
+
+bool ModbusTcpEngine::isConnected() const
+{
+    return m_socket->state() == QAbstractSocket::ConnectedState;
+}
+
+QString ModbusTcpEngine::errorString() const
+{
+    return m_socket->errorString();
+}
+
+void ModbusTcpEngine::sendFrame(EngineTransaction &transaction, quint16 uTransactionId)
+{
+    buildMbapHeader(transaction.frame, uTransactionId, transaction.uServerAddr, transaction.iPduLength);
+    m_socket->write(reinterpret_cast<const char*>(transaction.frame), FrameHeaderSize + transaction.iPduLength);
+    m_counters.uBytesOut += FrameHeaderSize + transaction.iPduLength;
+}
+
+void ModbusTcpEngine::slot_readyRead()
+{
+    while(true)
+    {
+        qint64 iRead = m_socket->read(reinterpret_cast<char*>(m_rxBuffer) + m_rxLength, RxBufferSize - m_rxLength);
+        if(iRead <= 0)
+            break;
+        m_rxLength += iRead;
+        m_counters.uBytesIn += iRead;
+
+        int iPos = 0;
+        while(m_rxLength - iPos >= 7)
+        {
+            const quint8 *pFrame = m_rxBuffer + iPos;
+            int iLength = getUInt16(pFrame + 4);
+            if(getUInt16(pFrame + 2) != 0 || iLength < 2 || iLength > 254)
+            {
+                //帧边界已错位，断开后由服务重连
+                qDebug()<<"Engine: invalid MBAP header, dropping connection";
+                m_rxLength = 0;
+                m_socket->abort();
+                return;
+            }
+            if(m_rxLength - iPos < 6 + iLength)
+                break;
+            //超时后到达的应答已无对应事务，丢弃
+            handleResponse(findInFlight(getUInt16(pFrame)), pFrame[6], pFrame + 7, iLength - 1);
+            iPos += 6 + iLength;
+        }
+
+        if(iPos > 0)
+        {
+            memmove(m_rxBuffer, m_rxBuffer + iPos, m_rxLength - iPos);
+            m_rxLength -= iPos;
+        }
+    }
+    pump();
+}
+
+void ModbusTcpEngine::slot_stateChanged(QAbstractSocket::SocketState eState)
+{
+    if(eState == QAbstractSocket::ConnectedState)
+    {
+        m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        applyDeadLinkTimeout(m_socket, m_deadLinkMs);
+        m_rxLength = 0;
+        setLinkState(true);
+    }
+    else if(eState == QAbstractSocket::UnconnectedState)
+    {
+        m_rxLength = 0;
+        setLinkState(false);
+    }
+}
@@ -0,0 +1,53 @@
+﻿#ifndef MODBUSTCPENGINE_H
+#define MODBUSTCPENGINE_H
+
+#include <QTcpSocket>
+#include "modbusengine.h"
+
+/* 零分配Modbus TCP客户端
+ * 请求按事务号流水发送，发送时只写MBAP头；应答在接收缓冲区内按MBAP长度定界、按事务号匹配
+ * 不支持的场景（重试）仍使用QModbusClient + RequestScheduler
+*/
+class ModbusTcpEngine : public ModbusEngine
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        RxBufferSize = 4096         //接收缓冲区字节数
+    };
+
+    explicit ModbusTcpEngine(QObject *parent = nullptr);
+
+    void setServer(const QString &strHost, quint16 uPort);
+    //死链检测时间，连接建立时设置，0使用系统默认
+    void setDeadLinkTimeout(int iDeadLinkMs);
+    void connectDevice() override;
+    void disconnectDevice() override;
+    bool isConnected() const override;
+    QString errorString() const override;
+
+    /* 开启TCP保活并设置未确认数据的超时（仅Linux），对端断电、网线断开时内核在iDeadLinkMs左右断开连接
+     * 链路空闲时由保活探测，有数据在途时由TCP_USER_TIMEOUT判定，不产生Modbus报文
+     * QModbusTcpClient内部的套接字也用此函数设置
+    */
+    static void applyDeadLinkTimeout(QAbstractSocket *pSocket, int iDeadLinkMs);
+
+protected:
+    void sendFrame(EngineTransaction &transaction, quint16 uTransactionId) override;
+
+private slots:
+    void slot_readyRead();
+    void slot_stateChanged(QAbstractSocket::SocketState eState);
+
+private:
+    QTcpSocket *m_socket;
+    QString m_strHost;
+    quint16 m_uPort;
+    int m_deadLinkMs;
+
+    quint8 m_rxBuffer[RxBufferSize];
+    int m_rxLength;
+};
+
+#endif // MODBUSTCPENGINE_H
@@ -0,0 +1,290 @@
+﻿#include "pollplanner.h"
+#include <QDebug>
+
+PollPlanner::PollPlanner(QObject *parent) : QObject(parent)
+{
+
+}
+
+void PollPlanner::analyse(const QMap<quint32, SignalSturct> &dataMap)
+{
+    m_intervalMap.clear();
+    m_signalList.clear();
+    m_conflictList.clear();
+
+    quint32 uPrevEndKey = 0;    //上一个区间结束Key（不含）
+    QMap<quint32, SignalSturct>::const_iterator itr = dataMap.constBegin();
+    while(itr != dataMap.constEnd())
+    {
+        quint32 uRegKey = itr.key();
+        quint16 qRegAddr = regKeyAddr(uRegKey);
+        QModbusDataUnit::RegisterType eRegTable = regKeyTable(uRegKey);
+        const SignalSturct &srcStruct = itr.value();
+
+        SignalSturct dstStruct;
+        dstStruct.iRegBitLengh = srcStruct.iRegBitLengh;
+        dstStruct.bIsReadReg = srcStruct.bIsReadReg;
+
+        quint32 uUsedMask = 0;
+        for(int j=0; j<srcStruct.spList.size(); j++)
+        {
+            const SignalParameter &signalParam = srcStruct.spList.at(j);
+            quint16 qPos = signalParam.uBitPos;
+            quint16 qBitLen = signalParam.uLength;
+
+            if(qBitLen == 0 || (qBitLen > 16 && qBitLen != 32 && qBitLen != 64))
+            {
+                addConflict(signalParam, "Length must be 1-16, 32 or 64");
+                continue;
+            }
+
+            int iRegBitLengh = qBitLen > 16 ? qBitLen : 16;
+            if(isBitTable(eRegTable))
+            {
+                if(qBitLen != 1 || qPos != 0)
+                {
+                    addConflict(signalParam, "coils and discrete inputs must have Length 1 and BitPos 0");
+                    continue;
+                }
+                iRegBitLengh = 1;
+            }
+            if(!checkDataType(signalParam, eRegTable))
+                continue;
+
+            if(iRegBitLengh != dstStruct.iRegBitLengh)
+            {
+                addConflict(signalParam, QString("register is already %1 bit").arg(dstStruct.iRegBitLengh));
+                continue;
+            }
+
+            bool bIsReadReg = !signalParam.strType.contains("O");
+            if(bIsReadReg != dstStruct.bIsReadReg)
+            {
+                addConflict(signalParam, "input and output signals share one register");
+                continue;
+            }
+            if(!bIsReadReg && (eRegTable == QModbusDataUnit::DiscreteInputs || eRegTable == QModbusDataUnit::InputRegisters))
+            {
+                addConflict(signalParam, "output signal in a read-only table");
+                continue;
+            }
+
+            if(iRegBitLengh == 16)
+            {
+                if((qPos + qBitLen) > 16)
+                {
+                    addConflict(signalParam, "BitPos + Length > 16");
+                    continue;
+                }
+
+                quint32 uMask = ((1u << qBitLen) - 1) << qPos;
+                if(uUsedMask & uMask)
+                {
+                    //输入寄存器允许同一位被不同信号解析，输出寄存器重叠会互相覆盖
+                    if(!dstStruct.bIsReadReg)
+                    {
+                        addConflict(signalParam, "bit field overlaps another output");
+                        continue;
+                    }
+                    addConflict(signalParam, "bit field overlaps another input (kept)");
+                }
+                uUsedMask |= uMask;
+            }
+            else if(iRegBitLengh == 1)
+            {
+                if(!dstStruct.spList.isEmpty())
+                {
+                    addConflict(signalParam, QString("address is already used by %1").arg(dstStruct.spList.first().strKey));
+                    continue;
+                }
+            }
+            else
+            {
+                if(qPos != 0)
+                {
+                    addConflict(signalParam, QString("BitPos must be 0 for %1 bit signals").arg(iRegBitLengh));
+                    continue;
+                }
+                if(!dstStruct.spList.isEmpty())
+                {
+                    addConflict(signalParam, QString("%1 bit register is already used by %2")
+                                                 .arg(iRegBitLengh)
+                                                 .arg(dstStruct.spList.first().strKey));
+                    continue;
+                }
+            }
+
+            dstStruct.spList.append(signalParam);
+        }
+
+        if(dstStruct.spList.isEmpty())
+        {
+            itr++;
+            continue;
+        }
+
+        //多寄存器信号与相邻地址重叠
+        int iRegCount = isBitTable(eRegTable) ? 1 : dstStruct.iRegBitLengh / 16;
+        if(uRegKey < uPrevEndKey || qRegAddr + iRegCount > 0x10000)
+        {
+            for(int j=0; j<dstStruct.spList.size(); j++)
+                addConflict(dstStruct.spList.at(j), "register range overlaps a neighbouring signal");
+            itr++;
+            continue;
+        }
+
+        RegisterInterval interval;
+        interval.uServerAddr = regKeyServer(uRegKey);
+        interval.eRegTable = eRegTable;
+        interval.uStartAddr = qRegAddr;
+        interval.uRegCount = iRegCount;
+        interval.bIsReadReg = dstStruct.bIsReadReg;
+        interval.iFirstSignal = m_signalList.size();
+        interval.iSignalCount = dstStruct.spList.size();
+        m_intervalMap.insert(uRegKey, interval);
+        for(int j=0; j<dstStruct.spList.size(); j++)
+            m_signalList.append(dstStruct.spList.at(j));
+        uPrevEndKey = uRegKey + iRegCount;
+        itr++;
+    }
+}
+
+QList<PollBlock> PollPlanner::planBlocks(int iMaxGap, int iMaxRegCount, int iMaxBitGap, int iMaxBitCount) const
+{
+    QList<PollBlock> blockList;
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constBegin();
+    while(itr != m_intervalMap.constEnd())
+    {
+        const RegisterInterval &interval = itr.value();
+        if(!blockList.isEmpty() && blockList.last().uServerAddr == interval.uServerAddr
+           && blockList.last().eRegTable == interval.eRegTable)
+        {
+            PollBlock &lastBlock = blockList.last();
+            bool bIsBit = isBitTable(interval.eRegTable);
+            int iGap = interval.uStartAddr - (lastBlock.uStartAddr + lastBlock.uRegCount);
+            int iNewCount = interval.uStartAddr + interval.uRegCount - lastBlock.uStartAddr;
+            if(iGap <= (bIsBit ? iMaxBitGap : iMaxGap) && iNewCount <= (bIsBit ? iMaxBitCount : iMaxRegCount))
+            {
+                lastBlock.uRegCount = iNewCount;
+                itr++;
+                continue;
+            }
+        }
+
+        PollBlock block;
+        block.uServerAddr = interval.uServerAddr;
+        block.eRegTable = interval.eRegTable;
+        block.uStartAddr = interval.uStartAddr;
+        block.uRegCount = interval.uRegCount;
+        blockList.append(block);
+        itr++;
+    }
+    return blockList;
+}
+
+QList<PollBlock> PollPlanner::planWriteBlocks() const
+{
+    QList<PollBlock> blockList;
+    quint32 uPrevKey = 0;
+    QMap<quint32, RegisterInterval>::const_iterator itr = m_intervalMap.constBegin();
+    while(itr != m_intervalMap.constEnd())
+    {
+        const RegisterInterval &interval = itr.value();
+        if(interval.bIsReadReg)
+        {
+            itr++;
+            continue;
+        }
+
+        if(interval.eRegTable == QModbusDataUnit::Coils && !blockList.isEmpty()
+           && blockList.last().eRegTable == QModbusDataUnit::Coils
+           && itr.key() == uPrevKey + 1 && blockList.last().uRegCount < 1968)
+        {
+            blockList.last().uRegCount++;
+            uPrevKey = itr.key();
+            itr++;
+            continue;
+        }
+
+        PollBlock block;
+        block.uServerAddr = interval.uServerAddr;
+        block.eRegTable = interval.eRegTable;
+        block.uStartAddr = interval.uStartAddr;
+        block.uRegCount = interval.uRegCount;
+        blockList.append(block);
+        uPrevKey = itr.key();
+        itr++;
+    }
+    return blockList;
+}
+
+QMap<quint32, RegisterInterval> PollPlanner::getIntervalMap() const
+{
+    return m_intervalMap;
+}
+
+QVector<SignalParameter> PollPlanner::getSignalList() const
+{
+    return m_signalList;
+}
+
+QStringList PollPlanner::getConflictList() const
+{
+    return m_conflictList;
+}
+
+bool PollPlanner::checkDataType(const SignalParameter &signalParam, QModbusDataUnit::RegisterType eRegTable)
+{
+    quint16 qBitLen = signalParam.uLength;
+    switch(signalParam.iDataType)
+    {
+    case DataType_Int:
+        if(qBitLen < 2 || isBitTable(eRegTable))
+        {
+            addConflict(signalParam, "Int needs a register table and Length >= 2");
+            return false;
+        }
+        break;
+    case DataType_Float32:
+        if(qBitLen != 32 || isBitTable(eRegTable))
+        {
+            addConflict(signalParam, "Float32 needs Length 32");
+            return false;
+        }
+        break;
+    case DataType_Float64:
+        if(qBitLen != 64 || isBitTable(eRegTable))
+        {
+            addConflict(signalParam, "Float64 needs Length 64");
+            return false;
+        }
+        break;
+    case DataType_BCD:
+        if(qBitLen % 4 != 0 || isBitTable(eRegTable))
+        {
+            addConflict(signalParam, "BCD needs Length to be a multiple of 4");
+            return false;
+        }
+        break;
+    default:
+        break;
+    }
+    if(signalParam.dScale == 0)
+    {
+        addConflict(signalParam, "Scale must not be 0");
+        return false;
+    }
+    return true;
+}
+
+void PollPlanner::addConflict(const SignalParameter &signalParam, const QString &strReason)
+{
+    QString strInfo = QString("Protocol conflict: %1 (RegisterAddr %2 BitPos %3 Length %4): %5")
+                          .arg(signalParam.strKey)
+                          .arg(signalParam.uRegisterAddr + REGADDR_OFFSET)
+                          .arg(signalParam.uBitPos)
+                          .arg(signalParam.uLength)
+                          .arg(strReason);
+    m_conflictList.append(strInfo);
+    qDebug()<<strInfo;
+}
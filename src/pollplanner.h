@@ -0,0 +1,48 @@
+﻿#ifndef POLLPLANNER_H
+#define POLLPLANNER_H
+
+#include <QObject>
+#include <QMap>
+#include <QStringList>
+#include <QVector>
+#include "commondefine.h"
+
+class PollPlanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PollPlanner(QObject *parent = nullptr);
+
+    /* 加载时分析协议，剔除冲突信号，生成寄存器区间表和信号表
+     * dataMap: 寄存器Map，多个从站的Map按makeRegKey(从站地址, 寄存器类型, 寄存器地址)合并
+     * 通过检查的信号按区间顺序连续存入信号表，其位域、寄存器宽度、数据类型均已合法，解码时无需再做范围检查
+    */
+    void analyse(const QMap<quint32, SignalSturct> &dataMap);
+
+    /* 按区间表合并生成读请求块，不同从站、不同寄存器类型不合并
+     * iMaxGap: 两个区间之间允许一起读取的最大空闲寄存器个数
+     * iMaxRegCount: 单个读请求最大寄存器个数
+     * iMaxBitGap: 线圈、离散输入允许一起读取的最大空闲点数
+     * iMaxBitCount: 线圈、离散输入单个读请求最大点数
+    */
+    QList<PollBlock> planBlocks(int iMaxGap, int iMaxRegCount, int iMaxBitGap, int iMaxBitCount) const;
+
+    //按区间表生成周期写请求，连续的输出线圈合并为一次写（功能码15最多1968点），输出寄存器每个区间一次写
+    QList<PollBlock> planWriteBlocks() const;
+
+    QMap<quint32, RegisterInterval> getIntervalMap() const;
+    QVector<SignalParameter> getSignalList() const;
+    QStringList getConflictList() const;
+
+private:
+    void addConflict(const SignalParameter &signalParam, const QString &strReason);
+    bool checkDataType(const SignalParameter &signalParam, QModbusDataUnit::RegisterType eRegTable);
+
+private:
+    //Key:makeRegKey(从站地址, 寄存器类型, 起始寄存器地址)
+    QMap<quint32, RegisterInterval> m_intervalMap;
+    QVector<SignalParameter> m_signalList;
+    QStringList m_conflictList;
+};
+
+#endif // POLLPLANNER_H
@@ -36,6 +36,8 @@ void ProtocolJson::loadJson(const QString &filePath)
         resetData();
         QJsonObject rootObj = doc.object();
         m_serverAddress = rootObj.value("ServerAddress").toString().toUInt();
+        m_byteSwap = rootObj.value("ByteOrder").toString() == "LittleEndian";   //寄存器内字节序，默认BigEndian
+        m_wordSwap = rootObj.value("WordOrder").toString() == "LittleEndian";   //多寄存器字序，默认BigEndian高位字在前
 
         QJsonArray signalArray = rootObj.value("SignalArray").toArray();
         m_allSignalCounts = signalArray.size();
@@ -49,6 +51,21 @@ void ProtocolJson::loadJson(const QString &filePath)
             quint16 registerAddr = obj.value("RegisterAddr").toString().toUInt() - REGADDR_OFFSET;   //寄存器地址
             quint16 bitPos = obj.value("BitPos").toString().toUInt();                //BIT位
             quint16 length = obj.value("Length").toString().toUInt();                //数据BIT位长度
+            QString table = obj.value("Table").toString();                          //寄存器类型，默认保持寄存器
+            QString dataType = obj.value("DataType").toString();                    //数据类型，默认无符号整数
+            QString scale = obj.value("Scale").toString();                          //缩放系数
+            QString offset = obj.value("Offset").toString();                        //偏移
+            int aggregateMs = obj.value("AggregateMs").toString().toInt();           //聚合窗口，0不聚合
+
+            QModbusDataUnit::RegisterType eRegTable = QModbusDataUnit::HoldingRegisters;
+            if(table == "Coil")
+                eRegTable = QModbusDataUnit::Coils;
+            else if(table == "DiscreteInput")
+                eRegTable = QModbusDataUnit::DiscreteInputs;
+            else if(table == "InputRegister")
+                eRegTable = QModbusDataUnit::InputRegisters;
+            else if(!table.isEmpty() && table != "HoldingRegister")
+                qDebug() << "Unknown Table" << table << "for" << strKey << ", using HoldingRegister";
 
             SignalParameter signalParam;
             signalParam.strKey = strKey;
@@ -59,9 +76,23 @@ void ProtocolJson::loadJson(const QString &filePath)
             signalParam.uBitPos = bitPos;
             signalParam.uLength = length;
             signalParam.uValue = 0;
+            signalParam.eRegTable = eRegTable;
+            signalParam.uServerAddr = m_serverAddress;
+            signalParam.iDataType = parseDataType(dataType, signalParam);
+            signalParam.dScale = scale.isEmpty() ? 1.0 : scale.toDouble();
+            signalParam.dOffset = offset.isEmpty() ? 0.0 : offset.toDouble();
+            signalParam.dValue = signalParam.dOffset;
+            signalParam.uVersion = 0;
+            signalParam.uQuality = Quality_NoValue;
+            signalParam.uExceptionCode = 0;
+            signalParam.iAcqMonoNs = 0;
+            signalParam.iAcqTimeMs = 0;
+            signalParam.iAggregateMs = qMax(0, aggregateMs);
 
             int iRegBitLengh = 16;
-            if(length == 32)
+            if(isBitTable(eRegTable))
+                iRegBitLengh = 1;
+            else if(length == 32)
                 iRegBitLengh = 32;
             else if(length == 64)
                 iRegBitLengh = 64;
@@ -70,9 +101,10 @@ void ProtocolJson::loadJson(const QString &filePath)
             if(type.contains("O"))
                 bIsReadReg = false;
 
-            if(m_dataMap.find(registerAddr) != m_dataMap.end())
+            quint32 uRegKey = makeRegKey(eRegTable, registerAddr);
+            if(m_dataMap.find(uRegKey) != m_dataMap.end())
             {
-                m_dataMap[registerAddr].spList.append(signalParam);
+                m_dataMap[uRegKey].spList.append(signalParam);
             }
             else
             {
@@ -80,19 +112,132 @@ void ProtocolJson::loadJson(const QString &filePath)
                 signalStruct.iRegBitLengh = iRegBitLengh;
                 signalStruct.bIsReadReg = bIsReadReg;
                 signalStruct.spList.append(signalParam);
-                m_dataMap.insert(registerAddr,signalStruct);
+                m_dataMap.insert(uRegKey,signalStruct);
+            }
+        }
+
+        //派生信号，工程值即表达式的结果
+        QJsonArray derivedArray = rootObj.value("DerivedArray").toArray();
+        for(int i = 0; i < derivedArray.size(); i++)
+        {
+            QJsonObject obj = derivedArray.at(i).toObject();
+            DerivedSignalDef derivedDef;
+            SignalParameter &signalParam = derivedDef.signalParam;
+            signalParam.strKey = obj.value("Key").toString();
+            signalParam.strParamName = obj.value("ParamName").toString();
+            signalParam.strType = obj.value("Type").toString();
+            signalParam.strDesc = obj.value("Desc").toString();
+            signalParam.uRegisterAddr = 0;
+            signalParam.uBitPos = 0;
+            signalParam.uLength = 0;
+            signalParam.uValue = 0;
+            signalParam.eRegTable = QModbusDataUnit::HoldingRegisters;
+            signalParam.uServerAddr = m_serverAddress;
+            signalParam.iDataType = DataType_Float64;
+            signalParam.dScale = 1.0;
+            signalParam.dOffset = 0.0;
+            signalParam.dValue = 0.0;
+            signalParam.uVersion = 0;
+            signalParam.uQuality = Quality_NoValue;
+            signalParam.uExceptionCode = 0;
+            signalParam.iAcqMonoNs = 0;
+            signalParam.iAcqTimeMs = 0;
+            signalParam.iAggregateMs = qMax(0, obj.value("AggregateMs").toString().toInt());
+            derivedDef.strExpr = obj.value("Expr").toString();
+            m_derivedList.append(derivedDef);
+        }
+
+        //信号告警，Signal可以是派生信号
+        QJsonArray alarmArray = rootObj.value("AlarmArray").toArray();
+        for(int i = 0; i < alarmArray.size(); i++)
+        {
+            QJsonObject obj = alarmArray.at(i).toObject();
+            AlarmDef alarmDef;
+            alarmDef.strKey = obj.value("Key").toString();                          //告警Key
+            alarmDef.strSignalKey = obj.value("Signal").toString();                 //监视的信号Key
+            alarmDef.strDesc = obj.value("Desc").toString();                        //告警描述
+            QString kind = obj.value("Kind").toString();                            //High、Low、Rate、Equal、NotEqual
+            alarmDef.dLimit = obj.value("Limit").toString().toDouble();             //限值
+            alarmDef.dDeadband = obj.value("Deadband").toString().toDouble();       //回差
+            alarmDef.iDelayMs = obj.value("DelayMs").toString().toInt();            //延时
+            QString severity = obj.value("Severity").toString();                    //告警等级，默认1
+            alarmDef.iSeverity = severity.isEmpty() ? 1 : qBound(0, severity.toInt(), 255);
+
+            if(kind == "High")
+                alarmDef.iKind = Alarm_High;
+            else if(kind == "Low")
+                alarmDef.iKind = Alarm_Low;
+            else if(kind == "Rate")
+                alarmDef.iKind = Alarm_Rate;
+            else if(kind == "Equal")
+                alarmDef.iKind = Alarm_Equal;
+            else if(kind == "NotEqual")
+                alarmDef.iKind = Alarm_NotEqual;
+            else
+            {
+                qDebug() << "Unknown alarm Kind" << kind << "for" << alarmDef.strKey << ", skipped";
+                continue;
             }
+            m_alarmList.append(alarmDef);
         }
     }
 
     file.close();
 }
 
-QMap<quint16, SignalSturct> ProtocolJson::getDataStructMap()
+int ProtocolJson::parseDataType(const QString &dataType, const SignalParameter &signalParam)
+{
+    //Int16、Float32等带位宽的写法需与Length一致，不一致时以Length为准并给出提示
+    int iTypeBits = 0;
+    int iDataType = DataType_UInt;
+    if(dataType.isEmpty() || dataType.startsWith("UInt"))
+    {
+        iTypeBits = dataType.mid(4).toInt();
+    }
+    else if(dataType.startsWith("Int"))
+    {
+        iDataType = DataType_Int;
+        iTypeBits = dataType.mid(3).toInt();
+    }
+    else if(dataType == "Float32" || dataType == "Float")
+    {
+        iDataType = DataType_Float32;
+        iTypeBits = 32;
+    }
+    else if(dataType == "Float64" || dataType == "Double")
+    {
+        iDataType = DataType_Float64;
+        iTypeBits = 64;
+    }
+    else if(dataType == "BCD")
+    {
+        iDataType = DataType_BCD;
+    }
+    else
+    {
+        qDebug() << "Unknown DataType" << dataType << "for" << signalParam.strKey << ", using UInt";
+    }
+
+    if(iTypeBits != 0 && iTypeBits != signalParam.uLength)
+        qDebug() << "DataType" << dataType << "does not match Length" << signalParam.uLength << "for" << signalParam.strKey;
+    return iDataType;
+}
+
+QMap<quint32, SignalSturct> ProtocolJson::getDataStructMap()
 {
     return m_dataMap;
 }
 
+QList<DerivedSignalDef> ProtocolJson::getDerivedList()
+{
+    return m_derivedList;
+}
+
+QList<AlarmDef> ProtocolJson::getAlarmList()
+{
+    return m_alarmList;
+}
+
 int ProtocolJson::getReadRegisterCounts()
 {
     return m_readRegisterCounts;
@@ -128,6 +273,16 @@ quint8 ProtocolJson::getFunctionCode()
     return m_functionCode;
 }
 
+bool ProtocolJson::getByteSwap()
+{
+    return m_byteSwap;
+}
+
+bool ProtocolJson::getWordSwap()
+{
+    return m_wordSwap;
+}
+
 void ProtocolJson::saveJson()
 {
 //    QString configPath = qApp->applicationDirPath() + "/config/Protocol_221.json";
@@ -181,6 +336,8 @@ void ProtocolJson::saveJson()
 void ProtocolJson::resetData()
 {
     m_dataMap.clear();
+    m_derivedList.clear();
+    m_alarmList.clear();
     m_readRegisterCounts = 0;
     m_writeRegisterCounts = 0;
     m_allSignalCounts = 0;
@@ -188,4 +345,6 @@ void ProtocolJson::resetData()
     m_readStartAddress = 0;
     m_writeStartAddress = 0;
     m_functionCode = 0;
+    m_byteSwap = false;
+    m_wordSwap = false;
 }
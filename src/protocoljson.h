@@ -11,7 +11,9 @@ class ProtocolJson : public QObject
 public:
     explicit ProtocolJson(QObject *parent = nullptr);
     void loadJson(const QString &filePath);
-    QMap<quint16,SignalSturct> getDataStructMap();
+    QMap<quint32,SignalSturct> getDataStructMap();
+    QList<DerivedSignalDef> getDerivedList();
+    QList<AlarmDef> getAlarmList();
 
     int getReadRegisterCounts();
     int getWriteRegisterCounts();
@@ -20,13 +22,18 @@ public:
     quint16 getReadStartAddress();
     quint16 getWriteStartAddress();
     quint8 getFunctionCode();
+    bool getByteSwap();     //寄存器内低字节在前
+    bool getWordSwap();     //多寄存器低位字在前
 
 private:
     void saveJson();    //test
     void resetData();
+    int parseDataType(const QString &dataType, const SignalParameter &signalParam);
 
 private:
-    QMap<quint16,SignalSturct> m_dataMap;
+    QMap<quint32,SignalSturct> m_dataMap;    //Key:makeRegKey(寄存器类型, 寄存器地址)
+    QList<DerivedSignalDef> m_derivedList;  //DerivedArray，按文件中的顺序
+    QList<AlarmDef> m_alarmList;            //AlarmArray，按文件中的顺序
     int m_readRegisterCounts;
     int m_writeRegisterCounts;
     int m_allSignalCounts;
@@ -34,6 +41,8 @@ private:
     quint16 m_readStartAddress;
     quint16 m_writeStartAddress;
     quint8 m_functionCode;
+    bool m_byteSwap;
+    bool m_wordSwap;
 };
 
 #endif // PROTOCOLJSON_H
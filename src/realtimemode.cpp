@@ -0,0 +1,163 @@
+﻿#include "realtimemode.h"
+#include <QDebug>
+#include <string.h>
+#include <stdlib.h>
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <errno.h>
+#endif
+
+#if defined(MODBUS_ALLOC_COUNTER) && defined(__GLIBC__)
+/* 可执行文件中的定义优先于libc，Qt、libstdc++的分配都经过这里
+ * 只计数，实际分配交给glibc的内部入口，free不需替换
+*/
+extern "C" void *__libc_malloc(size_t uSize);
+extern "C" void *__libc_calloc(size_t uCount, size_t uSize);
+extern "C" void *__libc_realloc(void *pMemory, size_t uSize);
+extern "C" void *__libc_memalign(size_t uAlignment, size_t uSize);
+
+static __thread quint64 t_allocCount = 0;
+
+extern "C" void *malloc(size_t uSize)
+{
+    t_allocCount++;
+    return __libc_malloc(uSize);
+}
+
+extern "C" void *calloc(size_t uCount, size_t uSize)
+{
+    t_allocCount++;
+    return __libc_calloc(uCount, uSize);
+}
+
+extern "C" void *realloc(void *pMemory, size_t uSize)
+{
+    t_allocCount++;
+    return __libc_realloc(pMemory, uSize);
+}
+
+extern "C" void *memalign(size_t uAlignment, size_t uSize)
+{
+    t_allocCount++;
+    return __libc_memalign(uAlignment, uSize);
+}
+
+extern "C" void *aligned_alloc(size_t uAlignment, size_t uSize)
+{
+    t_allocCount++;
+    return __libc_memalign(uAlignment, uSize);
+}
+
+extern "C" int posix_memalign(void **ppMemory, size_t uAlignment, size_t uSize)
+{
+    t_allocCount++;
+    void *pMemory = __libc_memalign(uAlignment, uSize);
+    if(!pMemory)
+        return ENOMEM;
+    *ppMemory = pMemory;
+    return 0;
+}
+#define ALLOC_COUNTER_ENABLED 1
+#endif
+
+bool RealtimeMode::lockMemory(int iHeapReserveKB)
+{
+#ifdef Q_OS_LINUX
+    //释放的内存留在堆内不还给系统，大块也从堆分配，锁定后不再缺页；所有线程共用一个堆，预留对链路线程同样有效
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        qDebug()<<"Realtime: mlockall failed: " + QString(strerror(errno)) + ", check RLIMIT_MEMLOCK or CAP_IPC_LOCK";
+        return false;
+    }
+
+    if(iHeapReserveKB > 0)
+    {
+        size_t uReserveBytes = (size_t)iHeapReserveKB * 1024;
+        char *pReserve = static_cast<char*>(malloc(uReserveBytes));
+        if(pReserve)
+        {
+            for(size_t i=0; i<uReserveBytes; i+=4096)
+                pReserve[i] = 0;
+            free(pReserve);
+        }
+    }
+    prefaultStack();
+    return true;
+#else
+    Q_UNUSED(iHeapReserveKB);
+    qDebug()<<"Realtime: memory locking is only supported on Linux";
+    return false;
+#endif
+}
+
+bool RealtimeMode::setCurrentThread(int iPriority, int iCpu)
+{
+#ifdef Q_OS_LINUX
+    bool bResult = true;
+    if(iCpu >= 0)
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(iCpu, &cpuSet);
+        int iError = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if(iError != 0)
+        {
+            qDebug()<<QString("Realtime: bind to CPU %1 failed: ").arg(iCpu) + QString(strerror(iError));
+            bResult = false;
+        }
+    }
+    if(iPriority > 0)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), iPriority, sched_get_priority_max(SCHED_FIFO));
+        int iError = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(iError != 0)
+        {
+            qDebug()<<QString("Realtime: SCHED_FIFO priority %1 failed: ").arg(iPriority) + QString(strerror(iError)) + ", check RLIMIT_RTPRIO or CAP_SYS_NICE";
+            bResult = false;
+        }
+    }
+    prefaultStack();
+    return bResult;
+#else
+    Q_UNUSED(iPriority);
+    Q_UNUSED(iCpu);
+    qDebug()<<"Realtime: thread scheduling is only supported on Linux";
+    return false;
+#endif
+}
+
+void RealtimeMode::prefaultStack()
+{
+    //每页写一次，经volatile指针写防止被优化掉
+    char stack[StackPrefaultBytes];
+    volatile char *pStack = stack;
+    for(int i=0; i<StackPrefaultBytes; i+=4096)
+        pStack[i] = 0;
+}
+
+bool RealtimeMode::isAllocCounterEnabled()
+{
+#ifdef ALLOC_COUNTER_ENABLED
+    return true;
+#else
+    return false;
+#endif
+}
+
+quint64 RealtimeMode::getThreadAllocCount()
+{
+#ifdef ALLOC_COUNTER_ENABLED
+    return t_allocCount;
+#else
+    return 0;
+#endif
+}
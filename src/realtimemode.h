@@ -0,0 +1,36 @@
+﻿#ifndef REALTIMEMODE_H
+#define REALTIMEMODE_H
+
+#include <QtGlobal>
+
+/* 实时模式，仅Linux
+ * 进程内存全部锁定，关闭堆收缩和mmap分配，启动时预先触碰一段堆，稳态运行不再缺页
+ * I/O线程可设为SCHED_FIFO并绑定CPU
+ * 编译时定义MODBUS_ALLOC_COUNTER（qmake CONFIG+=alloc_counter）替换malloc系列函数，按线程统计堆分配次数，用于验证稳态周期零分配
+*/
+class RealtimeMode
+{
+public:
+    enum
+    {
+        StackPrefaultBytes = 256 * 1024     //线程启动时触碰的栈大小
+    };
+
+    /* 锁定内存，在创建链路线程之前调用
+     * iHeapReserveKB: 预先分配并触碰的堆大小，释放后留在进程内供之后的分配使用
+    */
+    static bool lockMemory(int iHeapReserveKB);
+    /* 设置当前线程
+     * iPriority: SCHED_FIFO优先级1-99，0不改调度策略
+     * iCpu: 绑定的CPU编号，-1不绑定
+    */
+    static bool setCurrentThread(int iPriority, int iCpu);
+    //触碰当前线程的栈，之后的调用不再因栈增长缺页
+    static void prefaultStack();
+
+    static bool isAllocCounterEnabled();
+    //当前线程累计的堆分配次数，未启用统计时为0
+    static quint64 getThreadAllocCount();
+};
+
+#endif // REALTIMEMODE_H
@@ -0,0 +1,334 @@
+﻿#include "requestscheduler.h"
+#include "modbusframe.h"
+#include <QModbusRequest>
+#include <QDebug>
+
+RequestScheduler::RequestScheduler(QObject *parent) : QObject(parent),
+    m_pClient(nullptr),
+    m_maxInFlight(1),
+    m_inFlight(0),
+    m_pollInFlight(0),
+    m_nextCommandId(1),
+    m_pRtuTiming(nullptr),
+    m_busTimeUs(0),
+    m_linkFailTimeouts(0),
+    m_consecutiveTimeouts(0)
+{
+
+}
+
+void RequestScheduler::setClient(QModbusClient *pClient)
+{
+    m_pClient = pClient;
+}
+
+void RequestScheduler::setMaxInFlight(int iMaxInFlight)
+{
+    m_maxInFlight = qMax(1, iMaxInFlight);
+}
+
+void RequestScheduler::setRtuTiming(const RtuTiming *pRtuTiming)
+{
+    m_pRtuTiming = pRtuTiming;
+}
+
+void RequestScheduler::setLinkFailTimeouts(int iTimeouts)
+{
+    m_linkFailTimeouts = iTimeouts > 0 ? iTimeouts : 0;
+}
+
+void RequestScheduler::setAdaptiveTimeout(int iFloorMs, int iCeilingMs, int iPercentile, double dFactor)
+{
+    m_rtt.setParameters(iFloorMs, iCeilingMs, iPercentile, dFactor);
+}
+
+void RequestScheduler::setPollBlocks(const QList<PollBlock> &blockList)
+{
+    m_blockIndexHash.clear();
+    for(int i=0; i<blockList.size(); i++)
+    {
+        const PollBlock &block = blockList.at(i);
+        m_blockIndexHash.insert(makeRegKey(block.uServerAddr, block.eRegTable, block.uStartAddr), i);
+    }
+    m_rtt.resize(blockList.size());
+}
+
+int RequestScheduler::getRttBlock(const ModbusRequestItem &item) const
+{
+    if(item.bIsWrite)
+        return -1;
+    return m_blockIndexHash.value(makeRegKey(item.iServerAddr, item.dataUnit.registerType(), item.dataUnit.startAddress()), -1);
+}
+
+void RequestScheduler::enqueuePoll(const QModbusDataUnit &dataUnit, int iServerAddr, bool bIsWrite)
+{
+    ModbusRequestItem item;
+    item.bIsWrite = bIsWrite;
+    item.bIsMaskWrite = false;
+    item.uAndMask = 0xFFFF;
+    item.uOrMask = 0;
+    item.dataUnit = dataUnit;
+    item.iServerAddr = iServerAddr;
+    item.iCommandId = -1;
+    m_pollQueue.enqueue(item);
+    pump();
+}
+
+int RequestScheduler::enqueueCommand(const QModbusDataUnit &dataUnit, int iServerAddr, int iTag, int iCommandId)
+{
+    ModbusRequestItem item;
+    item.bIsWrite = true;
+    item.bIsMaskWrite = false;
+    item.uAndMask = 0xFFFF;
+    item.uOrMask = 0;
+    item.dataUnit = dataUnit;
+    item.iServerAddr = iServerAddr;
+    item.iCommandId = iCommandId >= 0 ? iCommandId : m_nextCommandId++;
+    item.tagList.append(iTag);
+    item.commandTimer.start();
+    m_commandQueue.enqueue(item);
+    pump();
+    return item.iCommandId;
+}
+
+int RequestScheduler::enqueueReadCommand(const QModbusDataUnit &dataUnit, int iServerAddr, int iTag)
+{
+    ModbusRequestItem item;
+    item.bIsWrite = false;
+    item.bIsMaskWrite = false;
+    item.uAndMask = 0xFFFF;
+    item.uOrMask = 0;
+    item.dataUnit = dataUnit;
+    item.iServerAddr = iServerAddr;
+    item.iCommandId = m_nextCommandId++;
+    item.tagList.append(iTag);
+    item.commandTimer.start();
+    m_commandQueue.enqueue(item);
+    pump();
+    return item.iCommandId;
+}
+
+int RequestScheduler::enqueueMaskCommand(quint16 qRegAddr, quint16 uAndMask, quint16 uOrMask, int iServerAddr, int iTag)
+{
+    //与尚未发送的同一寄存器屏蔽写合并，见mergeMaskWrite
+    for(int i=0; i<m_commandQueue.size(); i++)
+    {
+        ModbusRequestItem &queuedItem = m_commandQueue[i];
+        if(queuedItem.bIsMaskWrite && queuedItem.iServerAddr == iServerAddr
+           && queuedItem.dataUnit.startAddress() == qRegAddr)
+        {
+            mergeMaskWrite(queuedItem.uAndMask, queuedItem.uOrMask, uAndMask, uOrMask);
+            queuedItem.tagList.append(iTag);
+            return queuedItem.iCommandId;
+        }
+    }
+
+    ModbusRequestItem item;
+    item.bIsWrite = true;
+    item.bIsMaskWrite = true;
+    item.uAndMask = uAndMask;
+    item.uOrMask = uOrMask;
+    item.dataUnit = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, qRegAddr, 1);
+    item.iServerAddr = iServerAddr;
+    item.iCommandId = m_nextCommandId++;
+    item.tagList.append(iTag);
+    item.commandTimer.start();
+    m_commandQueue.enqueue(item);
+    pump();
+    return item.iCommandId;
+}
+
+void RequestScheduler::clear()
+{
+    m_consecutiveTimeouts = 0;
+    m_pollQueue.clear();
+    while(!m_commandQueue.isEmpty())
+        commandFinished(m_commandQueue.dequeue(), false, 0);
+}
+
+bool RequestScheduler::isPollIdle() const
+{
+    return m_pollQueue.isEmpty() && m_pollInFlight == 0;
+}
+
+int RequestScheduler::getQueueDepth() const
+{
+    return m_commandQueue.size() + m_pollQueue.size();
+}
+
+qint64 RequestScheduler::takeBusTimeUs()
+{
+    qint64 iBusTimeUs = m_busTimeUs;
+    m_busTimeUs = 0;
+    return iBusTimeUs;
+}
+
+const LinkCounters &RequestScheduler::getCounters() const
+{
+    return m_counters;
+}
+
+int RequestScheduler::getRequestPduSize(const ModbusRequestItem &item) const
+{
+    //读请求、单个写为5字节，屏蔽写7字节，多个写为6字节加数据
+    int iCount = (int)item.dataUnit.valueCount();
+    if(item.bIsMaskWrite)
+        return 7;
+    if(!item.bIsWrite || iCount <= 1)
+        return 5;
+    if(item.dataUnit.registerType() == QModbusDataUnit::Coils)
+        return 6 + (iCount + 7) / 8;
+    return 6 + iCount * 2;
+}
+
+void RequestScheduler::pump()
+{
+    if (!m_pClient || m_pClient->state() != QModbusDevice::ConnectedState)
+        return;
+
+    while(m_inFlight < m_maxInFlight)
+    {
+        //命令通道优先
+        ModbusRequestItem item;
+        if(!m_commandQueue.isEmpty())
+            item = m_commandQueue.dequeue();
+        else if(!m_pollQueue.isEmpty())
+            item = m_pollQueue.dequeue();
+        else
+            break;
+
+        if(!sendItem(item) && item.iCommandId >= 0)
+            commandFinished(item, false, 0);
+    }
+}
+
+bool RequestScheduler::sendItem(ModbusRequestItem &item)
+{
+    QModbusReply *reply = nullptr;
+    if(m_rtt.isEnabled())
+        m_pClient->setTimeout(m_rtt.getTimeoutMs(getRttBlock(item), item.iServerAddr));
+    item.sendTimer.start();
+    if(item.bIsMaskWrite)
+    {
+        QModbusRequest request(QModbusRequest::MaskWriteRegister,
+                               quint16(item.dataUnit.startAddress()), item.uAndMask, item.uOrMask);
+        reply = m_pClient->sendRawRequest(request, item.iServerAddr);
+    }
+    else if(item.bIsWrite)
+        reply = m_pClient->sendWriteRequest(item.dataUnit, item.iServerAddr);
+    else
+        reply = m_pClient->sendReadRequest(item.dataUnit, item.iServerAddr);
+
+    if (!reply)
+    {
+        qDebug()<<QString("%1 error: ").arg(item.bIsWrite ? "Write" : "Read") + m_pClient->errorString();
+        return false;
+    }
+
+    if(m_pRtuTiming)
+        m_busTimeUs += m_pRtuTiming->transactionTimeUs(item.dataUnit, item.bIsWrite, item.bIsMaskWrite);
+    //RTU帧为地址加CRC，TCP为MBAP头
+    m_counters.uBytesOut += getRequestPduSize(item) + (m_pRtuTiming ? 3 : 7);
+
+    if (reply->isFinished())
+    {
+        // broadcast replies return immediately
+        m_counters.addResult(true, 0);
+        if(item.iCommandId >= 0)
+            commandFinished(item, true, 0);
+        reply->deleteLater();
+        return true;
+    }
+
+    m_inFlight++;
+    if(item.iCommandId < 0)
+        m_pollInFlight++;
+    connect(reply, &QModbusReply::finished, this, [this, reply, item](){
+        replyFinished(reply, item);
+    });
+    return true;
+}
+
+void RequestScheduler::replyFinished(QModbusReply *reply, const ModbusRequestItem &item)
+{
+    m_inFlight--;
+    if(item.iCommandId < 0)
+        m_pollInFlight--;
+
+    QModbusDevice::Error eError = reply->error();
+    int iResultException = eError == QModbusDevice::ProtocolError ? reply->rawResult().exceptionCode() : 0;
+    m_counters.addResult(eError == QModbusDevice::NoError, iResultException);
+    if(eError == QModbusDevice::TimeoutError)
+    {
+        m_counters.uTimeouts++;
+        m_consecutiveTimeouts++;
+        m_rtt.addTimeout(getRttBlock(item), item.iServerAddr);
+    }
+    else if(eError == QModbusDevice::NoError || eError == QModbusDevice::ProtocolError)
+    {
+        m_consecutiveTimeouts = 0;
+        m_rtt.addSample(getRttBlock(item), item.iServerAddr, item.sendTimer.nsecsElapsed() / 1000);
+    }
+    if(eError == QModbusDevice::NoError || eError == QModbusDevice::ProtocolError)
+        m_counters.uBytesIn += reply->rawResult().size() + (m_pRtuTiming ? 3 : 7);
+
+    if(item.bIsWrite)
+    {
+        int iExceptionCode = 0;
+        if (reply->error() == QModbusDevice::ProtocolError)
+        {
+            qDebug()<<QString("Write response error: %1 (Mobus exception: 0x%2)")
+                            .arg(reply->errorString())
+                            .arg(reply->rawResult().exceptionCode());
+            iExceptionCode = reply->rawResult().exceptionCode();
+        }
+        else if (reply->error() != QModbusDevice::NoError)
+        {
+            qDebug()<<QString("Write response error: %1 (code: 0x%2)")
+                            .arg(reply->errorString())
+                            .arg(reply->error(),-1,16);
+        }
+
+        if(item.iCommandId >= 0)
+            commandFinished(item, reply->error() == QModbusDevice::NoError, iExceptionCode);
+    }
+    else if(item.iCommandId >= 0)
+    {
+        int iExceptionCode = eError == QModbusDevice::ProtocolError ? reply->rawResult().exceptionCode() : 0;
+        if(eError == QModbusDevice::NoError)
+        {
+            const QModbusDataUnit unit = reply->result();
+            const QVector<quint16> valueList = unit.values();
+            emit sig_commandRead(item.iCommandId, item.iServerAddr, unit.registerType(), unit.startAddress(), valueList.constData(), valueList.size());
+        }
+        commandFinished(item, eError == QModbusDevice::NoError, iExceptionCode);
+    }
+    else
+    {
+        emit sig_readReady(reply);
+    }
+
+    //应答中止是链路断开时丢弃的请求，由链路断开统一处理
+    if(item.iCommandId < 0 && !item.bIsWrite && eError != QModbusDevice::NoError && eError != QModbusDevice::ReplyAbortedError)
+        emit sig_pollFailed(item.iServerAddr, item.dataUnit.registerType(), item.dataUnit.startAddress(), item.dataUnit.valueCount(), iResultException);
+
+    reply->deleteLater();
+    if(item.iCommandId < 0 && m_pollInFlight == 0 && m_pollQueue.isEmpty())
+        emit sig_pollCycleFinished();
+
+    //单个请求超时或异常只影响该请求，连续超时才判定链路断开
+    if(m_linkFailTimeouts > 0 && m_consecutiveTimeouts >= m_linkFailTimeouts)
+    {
+        m_consecutiveTimeouts = 0;
+        emit sig_linkFailed();
+        return;
+    }
+    pump();
+}
+
+void RequestScheduler::commandFinished(const ModbusRequestItem &item, bool bSuccess, int iExceptionCode)
+{
+    qint64 iLatencyUs = item.commandTimer.nsecsElapsed() / 1000;
+    for(int i=0; i<item.tagList.size(); i++)
+        emit sig_commandFinished(item.iCommandId, item.tagList.at(i), item.bIsMaskWrite, bSuccess, iExceptionCode, iLatencyUs);
+}
@@ -0,0 +1,120 @@
+﻿#ifndef REQUESTSCHEDULER_H
+#define REQUESTSCHEDULER_H
+
+#include <QObject>
+#include <QQueue>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QModbusClient>
+#include "rtutiming.h"
+#include "rttestimator.h"
+#include "commondefine.h"
+
+//排队中的Modbus请求
+struct ModbusRequestItem
+{
+    bool bIsWrite;                  //写请求还是读请求
+    bool bIsMaskWrite;              //功能码22屏蔽写，寄存器地址取dataUnit.startAddress()
+    quint16 uAndMask;               //屏蔽写AND掩码 结果=(当前值 & uAndMask) | (uOrMask & ~uAndMask)
+    quint16 uOrMask;                //屏蔽写OR掩码
+    QModbusDataUnit dataUnit;       //请求数据
+    int iServerAddr;                //服务器地址
+    int iCommandId;                 //命令写编号，轮询请求为-1
+    QList<int> tagList;             //调用者附带的数据，命令完成时每项通知一次，合并的屏蔽写有多项
+    QElapsedTimer commandTimer;     //命令从下发到应答的计时
+    QElapsedTimer sendTimer;        //交给QModbusClient起的计时，作为RTT样本
+};
+
+/* 两级请求队列
+ * 命令通道: 操作员写命令，排在所有轮询请求之前，链路空闲即发送
+ * 轮询通道: 周期读、周期写，只使用命令通道剩余的链路容量
+*/
+class RequestScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RequestScheduler(QObject *parent = nullptr);
+
+    void setClient(QModbusClient *pClient);
+    void setMaxInFlight(int iMaxInFlight);  //同时等待应答的最大请求数
+    //串口链路设置RTU总线时间，用于统计每周期总线占用，TCP为nullptr
+    void setRtuTiming(const RtuTiming *pRtuTiming);
+    //连续超时的请求数达到iTimeouts时通知sig_linkFailed，期间收到任何应答都重新计数，0不判定
+    void setLinkFailTimeouts(int iTimeouts);
+    /* 按实测往返时间设置每个请求的超时，参数同RttEstimator::setParameters，iFloorMs为0不启用
+     * 超时在发送前设置到QModbusClient，QModbusClient的重试沿用同一超时
+    */
+    void setAdaptiveTimeout(int iFloorMs, int iCeilingMs, int iPercentile, double dFactor);
+    //读请求块按起始地址对应到RTT窗口，未登记的请求只按从站估计
+    void setPollBlocks(const QList<PollBlock> &blockList);
+
+    void enqueuePoll(const QModbusDataUnit &dataUnit, int iServerAddr, bool bIsWrite);
+    /* 返回命令编号，完成时通过sig_commandFinished通知，iTag原样返回
+     * iCommandId: 重发的命令沿用原命令编号，-1为新编号
+    */
+    int enqueueCommand(const QModbusDataUnit &dataUnit, int iServerAddr, int iTag, int iCommandId = -1);
+    /* 功能码22屏蔽写命令，同一寄存器尚未发送的屏蔽写合并为一条
+     * uAndMask: 保留的位为1
+     * uOrMask: 需置1的位
+    */
+    int enqueueMaskCommand(quint16 qRegAddr, quint16 uAndMask, quint16 uOrMask, int iServerAddr, int iTag);
+    //按需读命令，与写命令同一队列，读成功时先通知sig_commandRead再通知sig_commandFinished
+    int enqueueReadCommand(const QModbusDataUnit &dataUnit, int iServerAddr, int iTag);
+
+    //断线时丢弃排队中的请求，未发送的命令按失败通知
+    void clear();
+
+    bool isPollIdle() const;        //上一周期的轮询请求是否已全部完成
+    int getQueueDepth() const;
+    //取出并清零自上次调用以来已发送事务的估算总线时间
+    qint64 takeBusTimeUs();
+    //收发计数，字节数按请求和应答PDU加帧头帧尾估算
+    const LinkCounters &getCounters() const;
+
+signals:
+    //读请求应答，reply在信号返回后由调度器释放
+    void sig_readReady(QModbusReply *reply);
+    /* 命令写完成
+     * bIsMaskWrite: 是否以功能码22发送
+     * iExceptionCode: Modbus异常码，无异常为0
+     * iLatencyUs: 从下发命令到收到应答的时间
+    */
+    void sig_commandFinished(int iCommandId, int iTag, bool bIsMaskWrite, bool bSuccess, int iExceptionCode, qint64 iLatencyUs);
+    //读命令应答，参数同ModbusEngine::sig_commandRead
+    void sig_commandRead(int iCommandId, quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, const quint16 *pRegValue, int iCount);
+    //轮询读请求失败，参数同ModbusEngine::sig_pollFailed
+    void sig_pollFailed(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iExceptionCode);
+    //本周期的轮询请求全部完成
+    void sig_pollCycleFinished();
+    //连续超时达到门限，链路可能已断开
+    void sig_linkFailed();
+
+private:
+    void pump();
+    bool sendItem(ModbusRequestItem &item);
+    void replyFinished(QModbusReply *reply, const ModbusRequestItem &item);
+    void commandFinished(const ModbusRequestItem &item, bool bSuccess, int iExceptionCode);
+    //请求PDU字节数
+    int getRequestPduSize(const ModbusRequestItem &item) const;
+    //读请求块的RTT窗口编号，写请求和未登记的块为-1
+    int getRttBlock(const ModbusRequestItem &item) const;
+
+private:
+    QModbusClient *m_pClient;
+    QQueue<ModbusRequestItem> m_commandQueue;
+    QQueue<ModbusRequestItem> m_pollQueue;
+    int m_maxInFlight;
+    int m_inFlight;
+    int m_pollInFlight;
+    int m_nextCommandId;
+    const RtuTiming *m_pRtuTiming;
+    qint64 m_busTimeUs;
+    LinkCounters m_counters;
+    int m_linkFailTimeouts;
+    int m_consecutiveTimeouts;      //自上次收到应答以来超时的请求数
+    RttEstimator m_rtt;
+    //Key:makeRegKey(从站地址, 寄存器类型, 起始地址) Value:RTT窗口编号
+    QHash<quint32, int> m_blockIndexHash;
+};
+
+#endif // REQUESTSCHEDULER_H
@@ -0,0 +1,108 @@
+﻿#include "rttestimator.h"
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+RttEstimator::RttEstimator() :
+    m_floorMs(0),
+    m_ceilingMs(1000),
+    m_percentile(99),
+    m_factor(2.0)
+{
+
+}
+
+void RttEstimator::setParameters(int iFloorMs, int iCeilingMs, int iPercentile, double dFactor)
+{
+    m_ceilingMs = iCeilingMs > 0 ? iCeilingMs : 1000;
+    m_floorMs = qBound(0, iFloorMs, m_ceilingMs);
+    m_percentile = qBound(50, iPercentile, 100);
+    m_factor = dFactor >= 1.0 ? dFactor : 1.0;
+
+    //样本只在启用时保存，窗口一次分配
+    m_deviceList.resize(isEnabled() ? 256 : 0);
+    for(int i=0; i<m_deviceList.size(); i++)
+        clearWindow(m_deviceList[i]);
+    resize(m_blockList.size());
+}
+
+bool RttEstimator::isEnabled() const
+{
+    return m_floorMs > 0;
+}
+
+void RttEstimator::resize(int iBlockCount)
+{
+    m_blockList.resize(isEnabled() ? iBlockCount : 0);
+    for(int i=0; i<m_blockList.size(); i++)
+        clearWindow(m_blockList[i]);
+}
+
+int RttEstimator::getTimeoutMs(int iBlock, quint8 uServerAddr) const
+{
+    if(!isEnabled())
+        return m_ceilingMs;
+    if(iBlock >= 0 && iBlock < m_blockList.size() && m_blockList.at(iBlock).iCount >= MinSamples)
+        return getWindowTimeoutMs(m_blockList.at(iBlock));
+    return getWindowTimeoutMs(m_deviceList.at(uServerAddr));
+}
+
+bool RttEstimator::hasEstimate(int iBlock, quint8 uServerAddr) const
+{
+    if(!isEnabled())
+        return false;
+    if(iBlock >= 0 && iBlock < m_blockList.size() && m_blockList.at(iBlock).iCount >= MinSamples)
+        return true;
+    return m_deviceList.at(uServerAddr).iCount >= MinSamples;
+}
+
+void RttEstimator::addSample(int iBlock, quint8 uServerAddr, qint64 iRttUs)
+{
+    if(!isEnabled())
+        return;
+    if(iBlock >= 0 && iBlock < m_blockList.size())
+        addWindowSample(m_blockList[iBlock], iRttUs);
+    addWindowSample(m_deviceList[uServerAddr], iRttUs);
+}
+
+void RttEstimator::addTimeout(int iBlock, quint8 uServerAddr)
+{
+    if(!isEnabled())
+        return;
+    if(iBlock >= 0 && iBlock < m_blockList.size())
+        m_blockList[iBlock].iBackoff = qMin(m_blockList.at(iBlock).iBackoff + 1, (int)MaxBackoff);
+    RttWindow &window = m_deviceList[uServerAddr];
+    window.iBackoff = qMin(window.iBackoff + 1, (int)MaxBackoff);
+}
+
+void RttEstimator::clearWindow(RttWindow &window)
+{
+    memset(&window, 0, sizeof(RttWindow));
+    window.iBaseMs = m_ceilingMs;
+}
+
+void RttEstimator::addWindowSample(RttWindow &window, qint64 iRttUs)
+{
+    window.sampleUs[window.iNext] = (quint32)qBound<qint64>(0, iRttUs, 0xFFFFFFFF);
+    window.iNext = (window.iNext + 1) % SampleCount;
+    if(window.iCount < SampleCount)
+        window.iCount++;
+    window.iBackoff = 0;
+    if(window.iCount < MinSamples)
+        return;
+
+    //样本少，每次应答重新取一次百分位
+    quint32 sortedUs[SampleCount];
+    memcpy(sortedUs, window.sampleUs, window.iCount * sizeof(quint32));
+    int iRank = qBound(0, (int)ceil(window.iCount * m_percentile / 100.0) - 1, window.iCount - 1);
+    std::nth_element(sortedUs, sortedUs + iRank, sortedUs + window.iCount);
+    double dTimeoutMs = sortedUs[iRank] * m_factor / 1000.0;
+    window.iBaseMs = qBound(m_floorMs, (int)ceil(dTimeoutMs), m_ceilingMs);
+}
+
+int RttEstimator::getWindowTimeoutMs(const RttWindow &window) const
+{
+    if(window.iCount < MinSamples)
+        return m_ceilingMs;
+    return qMin(window.iBaseMs << window.iBackoff, m_ceilingMs);
+}
@@ -0,0 +1,62 @@
+﻿#ifndef RTTESTIMATOR_H
+#define RTTESTIMATOR_H
+
+#include <QVector>
+
+/* 往返时间估计，按读请求块和从站分别统计最近的应答时间
+ * 超时 = 百分位RTT * 系数，限制在[下限, 上限]内；连续超时时按次数加倍，收到应答后恢复
+ * 块的样本不足时用所属从站的估计，从站也不足时用上限，即原静态超时
+*/
+class RttEstimator
+{
+public:
+    enum
+    {
+        SampleCount = 64,           //每个窗口保留的样本数
+        MinSamples = 8,             //少于此样本数不估计
+        MaxBackoff = 4              //连续超时加倍的最大次数
+    };
+
+    RttEstimator();
+
+    /* iFloorMs: 超时下限，0不启用自适应，始终使用上限
+     * iCeilingMs: 超时上限
+     * iPercentile: 50-100
+     * dFactor: 百分位RTT的倍数
+    */
+    void setParameters(int iFloorMs, int iCeilingMs, int iPercentile, double dFactor);
+    bool isEnabled() const;
+    //iBlockCount: 读请求块个数，块编号为0到iBlockCount-1，清空已有样本
+    void resize(int iBlockCount);
+
+    //iBlock小于0只按从站估计
+    int getTimeoutMs(int iBlock, quint8 uServerAddr) const;
+    //块或从站已有足够样本，超时是估计值而不是上限
+    bool hasEstimate(int iBlock, quint8 uServerAddr) const;
+    void addSample(int iBlock, quint8 uServerAddr, qint64 iRttUs);
+    void addTimeout(int iBlock, quint8 uServerAddr);
+
+private:
+    struct RttWindow
+    {
+        quint32 sampleUs[SampleCount];
+        int iCount;
+        int iNext;
+        int iBaseMs;                //按当前样本计算的超时，不含加倍
+        int iBackoff;               //连续超时次数
+    };
+
+    void clearWindow(RttWindow &window);
+    void addWindowSample(RttWindow &window, qint64 iRttUs);
+    int getWindowTimeoutMs(const RttWindow &window) const;
+
+private:
+    int m_floorMs;
+    int m_ceilingMs;
+    int m_percentile;
+    double m_factor;
+    QVector<RttWindow> m_blockList;
+    QVector<RttWindow> m_deviceList;    //下标为从站地址
+};
+
+#endif // RTTESTIMATOR_H
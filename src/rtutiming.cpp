@@ -0,0 +1,102 @@
+﻿#include "rtutiming.h"
+
+RtuTiming::RtuTiming() :
+    m_charTimeNs(0),
+    m_interFrameDelayUs(0),
+    m_interCharTimeoutUs(0),
+    m_turnaroundUs(0)
+{
+    setSerialParameters(115200, 8, 0, 1);
+}
+
+void RtuTiming::setSerialParameters(int iBaudRate, int iDataBits, int iParity, int iStopBits)
+{
+    if(iBaudRate <= 0)
+        iBaudRate = 9600;
+
+    //以半位为单位，一位半停止位为3
+    int iHalfBits = 2 * (1 + iDataBits) + (iParity != 0 ? 2 : 0);
+    if(iStopBits == 3)
+        iHalfBits += 3;
+    else
+        iHalfBits += 2 * iStopBits;
+    m_charTimeNs = (qint64)iHalfBits * 500000000LL / iBaudRate;
+
+    if(iBaudRate > 19200)
+    {
+        m_interFrameDelayUs = 1750;
+        m_interCharTimeoutUs = 750;
+    }
+    else
+    {
+        m_interFrameDelayUs = (int)((m_charTimeNs * 35 / 10 + 999) / 1000);
+        m_interCharTimeoutUs = (int)((m_charTimeNs * 15 / 10 + 999) / 1000);
+    }
+}
+
+void RtuTiming::setTurnaroundUs(int iTurnaroundUs)
+{
+    m_turnaroundUs = iTurnaroundUs;
+}
+
+qint64 RtuTiming::getCharTimeNs() const
+{
+    return m_charTimeNs;
+}
+
+int RtuTiming::getInterFrameDelayUs() const
+{
+    return m_interFrameDelayUs;
+}
+
+int RtuTiming::getInterCharTimeoutUs() const
+{
+    return m_interCharTimeoutUs;
+}
+
+int RtuTiming::getTurnaroundUs() const
+{
+    return m_turnaroundUs;
+}
+
+qint64 RtuTiming::frameTimeUs(int iBytes) const
+{
+    return (iBytes * m_charTimeNs + 999) / 1000 + m_interFrameDelayUs;
+}
+
+qint64 RtuTiming::transactionTimeUs(const QModbusDataUnit &dataUnit, bool bIsWrite, bool bIsMaskWrite) const
+{
+    //RTU帧 = 地址1 + 功能码1 + 数据 + CRC2
+    int iCount = dataUnit.valueCount();
+    bool bIsBit = dataUnit.registerType() == QModbusDataUnit::Coils
+                  || dataUnit.registerType() == QModbusDataUnit::DiscreteInputs;
+    int iDataBytes = bIsBit ? (iCount + 7) / 8 : iCount * 2;
+
+    int iRequestBytes = 0;
+    int iResponseBytes = 0;
+    if(bIsMaskWrite)
+    {
+        iRequestBytes = 10;
+        iResponseBytes = 10;
+    }
+    else if(bIsWrite)
+    {
+        //单个写05/06请求、应答均为8字节，多个写15/16请求带字节数和数据
+        iRequestBytes = iCount == 1 ? 8 : 9 + iDataBytes;
+        iResponseBytes = 8;
+    }
+    else
+    {
+        iRequestBytes = 8;
+        iResponseBytes = 5 + iDataBytes;
+    }
+
+    return frameTimeUs(iRequestBytes) + m_turnaroundUs + frameTimeUs(iResponseBytes);
+}
+
+int RtuTiming::breakEvenGap() const
+{
+    //多一次读事务: 请求8字节 + 应答头尾5字节 + 两个t3.5 + 从站响应时间；每个空闲寄存器2字节
+    qint64 iTransactionNs = 13 * m_charTimeNs + 2000LL * m_interFrameDelayUs + 1000LL * m_turnaroundUs;
+    return (int)(iTransactionNs / (2 * m_charTimeNs));
+}
@@ -0,0 +1,50 @@
+﻿#ifndef RTUTIMING_H
+#define RTUTIMING_H
+
+#include <QModbusDataUnit>
+
+/* RTU总线时间计算
+ * 字符时间 = (起始位 + 数据位 + 校验位 + 停止位) / 波特率
+ * 帧间静默 t3.5、字符间超时 t1.5，波特率大于19200时按规范取固定值1750us、750us
+*/
+class RtuTiming
+{
+public:
+    RtuTiming();
+
+    /* 设置串口参数
+     * iParity: QSerialPort::Parity
+     * iStopBits: QSerialPort::StopBits 1:一位 2:两位 3:一位半
+    */
+    void setSerialParameters(int iBaudRate, int iDataBits, int iParity, int iStopBits);
+    //从站收到请求到开始应答的时间，计入每个事务
+    void setTurnaroundUs(int iTurnaroundUs);
+
+    qint64 getCharTimeNs() const;
+    int getInterFrameDelayUs() const;       //t3.5
+    int getInterCharTimeoutUs() const;      //t1.5
+    int getTurnaroundUs() const;
+
+    //iBytes个字节的帧在线上的时间，含帧后t3.5
+    qint64 frameTimeUs(int iBytes) const;
+
+    /* 一次请求-应答事务占用总线的时间
+     * dataUnit: 请求的数据，线圈、离散输入按点计
+     * bIsWrite: 写请求
+     * bIsMaskWrite: 功能码22屏蔽写
+    */
+    qint64 transactionTimeUs(const QModbusDataUnit &dataUnit, bool bIsWrite, bool bIsMaskWrite) const;
+
+    /* 合并读取的收支平衡点: 多读iGap个空闲寄存器的时间等于多一次事务的时间
+     * 串口上小于该值的空闲寄存器合并读取更省总线时间
+    */
+    int breakEvenGap() const;
+
+private:
+    qint64 m_charTimeNs;
+    int m_interFrameDelayUs;
+    int m_interCharTimeoutUs;
+    int m_turnaroundUs;
+};
+
+#endif // RTUTIMING_H
@@ -0,0 +1,315 @@
+﻿#include "scripthost.h"
+#include "modbusservice.h"
+#include "cycletimer.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDebug>
+
+ScriptHost::ScriptHost(ModBusService *pService, const QString &strLinkGroup, QObject *parent) : QObject(parent),
+    m_pService(pService),
+    m_strLinkGroup(strLinkGroup),
+    m_bIssuing(false),
+    m_bRunning(false),
+    m_bStartPending(false),
+    m_resumeTimer(nullptr),
+    m_deadlineTimer(nullptr)
+{
+    for(int i=0; i<MaxPendingOps; i++)
+        m_opList[i].bUsed = false;
+
+    m_resumeTimer = new QTimer(this);
+    m_resumeTimer->setSingleShot(true);
+    m_resumeTimer->setInterval(0);
+    connect(m_resumeTimer, &QTimer::timeout, this, &ScriptHost::slot_resume);
+
+    m_deadlineTimer = new QTimer(this);
+    m_deadlineTimer->setSingleShot(true);
+    m_deadlineTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_deadlineTimer, &QTimer::timeout, this, &ScriptHost::slot_deadline);
+}
+
+ScriptHost::~ScriptHost()
+{
+    stop();
+}
+
+QHash<QString, ScriptEntry> &ScriptHost::registry()
+{
+    static QHash<QString, ScriptEntry> s_registry;
+    return s_registry;
+}
+
+bool ScriptHost::registerScript(const char *pName, ScriptEntry pEntry)
+{
+    registry().insert(QString::fromLatin1(pName), pEntry);
+    return true;
+}
+
+QStringList ScriptHost::setScripts(const QStringList &nameList)
+{
+    QStringList unknownList;
+    m_entryList.clear();
+    for(int i=0; i<nameList.size(); i++)
+    {
+        QString strName = nameList.at(i).trimmed();
+        if(strName.isEmpty())
+            continue;
+        ScriptEntry pEntry = registry().value(strName, nullptr);
+        if(pEntry)
+            m_entryList.append(pEntry);
+        else
+            unknownList.append(strName);
+    }
+    return unknownList;
+}
+
+int ScriptHost::getScriptCount() const
+{
+    return m_entryList.size();
+}
+
+void ScriptHost::start()
+{
+    if(m_bRunning || m_entryList.isEmpty())
+        return;
+    m_bRunning = true;
+    m_bStartPending = true;
+    m_resumeTimer->start();
+}
+
+void ScriptHost::stop()
+{
+    m_bRunning = false;
+    m_bStartPending = false;
+    //销毁协程帧时等待体逐个注销，剩余的操作一并作废
+    QList<ScriptTaskHandle*> taskList = m_taskList;
+    for(int i=0; i<taskList.size(); i++)
+        taskList.at(i)->destroy();
+    m_taskList.clear();
+    for(int i=0; i<MaxPendingOps; i++)
+        m_opList[i].bUsed = false;
+    m_resumeTimer->stop();
+    m_deadlineTimer->stop();
+}
+
+int ScriptHost::allocOp(int iTimeoutMs, ScriptWaiter *pWaiter)
+{
+    if(!m_bRunning)
+        return -1;
+    for(int i=0; i<MaxPendingOps; i++)
+    {
+        PendingOp &op = m_opList[i];
+        if(op.bUsed)
+            continue;
+        op.bUsed = true;
+        op.bDone = false;
+        op.iCommandId = -1;
+        op.iDeadlineNs = iTimeoutMs > 0 ? CycleTimer::monotonicNs() + iTimeoutMs * 1000000LL : 0;
+        op.bIsSleep = false;
+        op.pWaiter = pWaiter;
+        op.result = ScriptResult();
+        return i;
+    }
+    qDebug()<<QString("[%1] Script: too many pending operations").arg(m_strLinkGroup);
+    return -1;
+}
+
+int ScriptHost::startRead(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTimeoutMs, ScriptWaiter *pWaiter)
+{
+    int iOp = allocOp(iTimeoutMs, pWaiter);
+    if(iOp < 0)
+        return -1;
+
+    m_bIssuing = true;
+    int iCommandId = m_pService->enqueueReadCommand(uServerAddr, eRegTable, uStartAddr, uCount);
+    m_bIssuing = false;
+    return setIssued(iOp, iCommandId);
+}
+
+int ScriptHost::startWrite(int iSignalIndex, double dValue, int iTimeoutMs, ScriptWaiter *pWaiter)
+{
+    int iOp = allocOp(iTimeoutMs, pWaiter);
+    if(iOp < 0)
+        return -1;
+
+    //写命令走信号写的正常路径，未完成期间读回值不覆盖输出
+    m_bIssuing = true;
+    int iCommandId = m_pService->writeSignalValue(iSignalIndex, dValue);
+    m_bIssuing = false;
+    return setIssued(iOp, iCommandId);
+}
+
+int ScriptHost::startSleep(int iSleepMs, ScriptWaiter *pWaiter)
+{
+    int iOp = allocOp(qMax(1, iSleepMs), pWaiter);
+    if(iOp < 0)
+        return -1;
+    m_opList[iOp].bIsSleep = true;
+    updateDeadlineTimer();
+    return iOp;
+}
+
+int ScriptHost::setIssued(int iOp, int iCommandId)
+{
+    QVector<EarlyFinish> earlyList = m_earlyList;
+    m_earlyList.clear();
+    if(iCommandId < 0)
+    {
+        m_opList[iOp].bUsed = false;
+        return -1;
+    }
+
+    m_opList[iOp].iCommandId = iCommandId;
+    for(int i=0; i<earlyList.size(); i++)
+    {
+        if(earlyList.at(i).iCommandId == iCommandId)
+            completeOp(iOp, earlyList.at(i).iStatus, earlyList.at(i).iExceptionCode);
+    }
+    updateDeadlineTimer();
+    return iOp;
+}
+
+void ScriptHost::cancel(int iOp)
+{
+    if(iOp < 0 || iOp >= MaxPendingOps)
+        return;
+    m_opList[iOp].bUsed = false;
+}
+
+int ScriptHost::findOp(int iCommandId) const
+{
+    for(int i=0; i<MaxPendingOps; i++)
+    {
+        if(m_opList[i].bUsed && !m_opList[i].bDone && m_opList[i].iCommandId == iCommandId)
+            return i;
+    }
+    return -1;
+}
+
+void ScriptHost::commandRead(int iCommandId, const quint16 *pRegValue, int iCount)
+{
+    int iOp = findOp(iCommandId);
+    if(iOp < 0)
+        return;
+    QVector<quint16> &valueList = m_opList[iOp].result.valueList;
+    valueList.resize(iCount);
+    for(int i=0; i<iCount; i++)
+        valueList[i] = pRegValue[i];
+}
+
+void ScriptHost::commandFinished(int iCommandId, bool bSuccess, int iExceptionCode)
+{
+    int iStatus = bSuccess ? Script_Ok : (iExceptionCode > 0 ? Script_Exception : Script_CommError);
+    int iOp = findOp(iCommandId);
+    if(iOp >= 0)
+    {
+        completeOp(iOp, iStatus, iExceptionCode);
+        return;
+    }
+    //入队时发送失败的命令在返回编号之前就已完成
+    if(m_bIssuing)
+    {
+        EarlyFinish earlyFinish;
+        earlyFinish.iCommandId = iCommandId;
+        earlyFinish.iStatus = iStatus;
+        earlyFinish.iExceptionCode = iExceptionCode;
+        m_earlyList.append(earlyFinish);
+    }
+}
+
+void ScriptHost::completeOp(int iOp, int iStatus, int iExceptionCode)
+{
+    PendingOp &op = m_opList[iOp];
+    op.bDone = true;
+    op.result.iStatus = iStatus;
+    op.result.iExceptionCode = iExceptionCode;
+    m_resumeTimer->start();
+}
+
+void ScriptHost::slot_resume()
+{
+    if(m_bStartPending)
+    {
+        m_bStartPending = false;
+        for(int i=0; i<m_entryList.size() && m_bRunning; i++)
+            m_entryList.at(i)(this);
+    }
+
+    //先释放操作再恢复，脚本恢复后可立即发起下一个操作
+    for(int i=0; i<MaxPendingOps && m_bRunning; i++)
+    {
+        PendingOp &op = m_opList[i];
+        if(!op.bUsed || !op.bDone)
+            continue;
+        op.bUsed = false;
+        op.pWaiter->resume(op.result);
+    }
+    updateDeadlineTimer();
+}
+
+void ScriptHost::slot_deadline()
+{
+    qint64 iNowNs = CycleTimer::monotonicNs();
+    for(int i=0; i<MaxPendingOps; i++)
+    {
+        PendingOp &op = m_opList[i];
+        if(!op.bUsed || op.bDone || op.iDeadlineNs == 0 || op.iDeadlineNs > iNowNs)
+            continue;
+        completeOp(i, op.bIsSleep ? Script_Ok : Script_Timeout, 0);
+    }
+    updateDeadlineTimer();
+}
+
+void ScriptHost::updateDeadlineTimer()
+{
+    qint64 iNextNs = 0;
+    for(int i=0; i<MaxPendingOps; i++)
+    {
+        const PendingOp &op = m_opList[i];
+        if(op.bUsed && !op.bDone && op.iDeadlineNs != 0 && (iNextNs == 0 || op.iDeadlineNs < iNextNs))
+            iNextNs = op.iDeadlineNs;
+    }
+    if(iNextNs == 0)
+    {
+        m_deadlineTimer->stop();
+        return;
+    }
+    //向上取整到ms，不早于超时唤醒
+    m_deadlineTimer->start((int)qMax<qint64>(0, (iNextNs - CycleTimer::monotonicNs() + 999999) / 1000000));
+}
+
+const SignalParameter *ScriptHost::findSignal(const QString &strKey) const
+{
+    return m_pService->findSignal(strKey);
+}
+
+int ScriptHost::findSignalIndex(const QString &strKey) const
+{
+    return m_pService->findSignalIndex(strKey);
+}
+
+const SignalParameter &ScriptHost::signalAt(int iSignalIndex) const
+{
+    return m_pService->signalAt(iSignalIndex);
+}
+
+QVariant ScriptHost::setting(const QString &strKey, const QVariant &defaultValue) const
+{
+    QSettings settings(qApp->applicationDirPath() + "/config/Config.ini", QSettings::IniFormat);
+    return settings.value(m_strLinkGroup + "/" + strKey, defaultValue);
+}
+
+QString ScriptHost::linkGroup() const
+{
+    return m_strLinkGroup;
+}
+
+void ScriptHost::addTask(ScriptTaskHandle *pTask)
+{
+    m_taskList.append(pTask);
+}
+
+void ScriptHost::removeTask(ScriptTaskHandle *pTask)
+{
+    m_taskList.removeOne(pTask);
+}
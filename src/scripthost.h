@@ -0,0 +1,157 @@
+﻿#ifndef SCRIPTHOST_H
+#define SCRIPTHOST_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QStringList>
+#include <QVariant>
+#include <limits.h>
+#include "commondefine.h"
+
+class ModBusService;
+class ScriptHost;
+
+//脚本操作结果
+enum ScriptStatus
+{
+    Script_Ok = 0,
+    Script_Exception,               //从站异常应答，异常码见iExceptionCode
+    Script_CommError,               //超时、帧错误或链路断开
+    Script_Timeout,                 //超过操作自带的超时，命令仍在链路上，迟到的应答丢弃
+    Script_Rejected                 //未能入队：链路未连接、命令池满、信号不可写
+};
+
+struct ScriptResult
+{
+    int iStatus;                    //ScriptStatus
+    int iExceptionCode;
+    QVector<quint16> valueList;     //读操作的寄存器值，线圈、离散输入每个值为一个点
+
+    ScriptResult() : iStatus(Script_Ok), iExceptionCode(0) {}
+    bool isOk() const { return iStatus == Script_Ok; }
+};
+
+//等待操作完成的一方，由协程等待体实现
+class ScriptWaiter
+{
+public:
+    virtual ~ScriptWaiter() {}
+    virtual void resume(const ScriptResult &result) = 0;
+};
+
+//运行中的脚本，链路断开时由宿主销毁，协程帧内的等待体随之注销
+class ScriptTaskHandle
+{
+public:
+    virtual ~ScriptTaskHandle() {}
+    virtual void destroy() = 0;
+};
+
+//脚本入口，创建并启动一个脚本协程
+typedef void (*ScriptEntry)(ScriptHost *pHost);
+
+/* 采集脚本宿主，每条链路一个，运行在链路线程
+ * 脚本是链路线程上的协程，读写经命令通道排在轮询之前，按命令编号匹配完成通知，一个脚本同一时刻只等待一个操作
+ * 完成的操作在事件循环的下一轮恢复脚本，不在引擎、调度器的通知中重入
+ * 读命令的应答同轮询一样解码进信号表，脚本通过findSignal取值
+ * 链路连上时按Scripts配置启动脚本，断开时销毁，重连后从头运行
+ * 协程部分需C++20，见scripttask.h；未以CONFIG+=coroutines编译时没有已注册的脚本
+*/
+class ScriptHost : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        MaxPendingOps = 64,         //同时等待的操作数
+        CommandTag = INT_MIN        //脚本读命令的标签，与信号下标、代理请求区分
+    };
+
+    ScriptHost(ModBusService *pService, const QString &strLinkGroup, QObject *parent = nullptr);
+    ~ScriptHost();
+
+    //静态初始化时登记脚本，名称用于Scripts配置
+    static bool registerScript(const char *pName, ScriptEntry pEntry);
+    //返回未登记的脚本名
+    QStringList setScripts(const QStringList &nameList);
+    int getScriptCount() const;
+
+    void start();
+    void stop();
+
+    /* 脚本操作，返回操作编号，未能入队返回-1
+     * iTimeoutMs: 操作超时，0只按链路的请求超时
+    */
+    int startRead(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTimeoutMs, ScriptWaiter *pWaiter);
+    int startWrite(int iSignalIndex, double dValue, int iTimeoutMs, ScriptWaiter *pWaiter);
+    int startSleep(int iSleepMs, ScriptWaiter *pWaiter);
+    //等待体销毁时注销，之后的完成通知丢弃
+    void cancel(int iOp);
+
+    //信号表中的信号，没有时返回nullptr
+    const SignalParameter *findSignal(const QString &strKey) const;
+    //信号表下标，脚本启动时查一次，之后按下标取值；没有时返回-1
+    int findSignalIndex(const QString &strKey) const;
+    const SignalParameter &signalAt(int iSignalIndex) const;
+    //本链路节中的脚本参数
+    QVariant setting(const QString &strKey, const QVariant &defaultValue = QVariant()) const;
+    QString linkGroup() const;
+
+    void addTask(ScriptTaskHandle *pTask);
+    void removeTask(ScriptTaskHandle *pTask);
+
+    //服务转发的命令完成通知
+    void commandRead(int iCommandId, const quint16 *pRegValue, int iCount);
+    void commandFinished(int iCommandId, bool bSuccess, int iExceptionCode);
+
+private slots:
+    void slot_resume();
+    void slot_deadline();
+
+private:
+    struct PendingOp
+    {
+        bool bUsed;
+        bool bDone;
+        int iCommandId;             //尚未入队或睡眠为-1
+        qint64 iDeadlineNs;         //单调时钟，0为无
+        bool bIsSleep;
+        ScriptWaiter *pWaiter;
+        ScriptResult result;
+    };
+
+    //入队期间同步完成、尚不知道编号的命令
+    struct EarlyFinish
+    {
+        int iCommandId;
+        int iStatus;
+        int iExceptionCode;
+    };
+
+    static QHash<QString, ScriptEntry> &registry();
+    int allocOp(int iTimeoutMs, ScriptWaiter *pWaiter);
+    int findOp(int iCommandId) const;
+    //命令已入队，记下编号，入队期间已完成的按结果结束；返回操作编号
+    int setIssued(int iOp, int iCommandId);
+    void completeOp(int iOp, int iStatus, int iExceptionCode);
+    //按最早的超时重新定时
+    void updateDeadlineTimer();
+
+private:
+    ModBusService *m_pService;
+    QString m_strLinkGroup;
+    QList<ScriptEntry> m_entryList;
+    QList<ScriptTaskHandle*> m_taskList;
+    PendingOp m_opList[MaxPendingOps];
+    bool m_bIssuing;                //正在入队，入队期间未匹配的完成通知先记下
+    QVector<EarlyFinish> m_earlyList;
+    bool m_bRunning;
+    bool m_bStartPending;           //连上后在下一轮事件循环启动脚本
+    QTimer *m_resumeTimer;
+    QTimer *m_deadlineTimer;
+};
+
+#endif // SCRIPTHOST_H
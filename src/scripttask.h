@@ -0,0 +1,228 @@
+﻿#ifndef SCRIPTTASK_H
+#define SCRIPTTASK_H
+
+#include <coroutine>
+#include <exception>
+#include "scripthost.h"
+
+/* 采集脚本的协程接口，需C++20，qmake CONFIG+=coroutines
+ * 脚本是返回ScriptTask、第一个参数为ScriptDevice的协程，在链路线程上运行，等待时不占线程
+ *
+ *   static ScriptTask handshake(ScriptDevice device)
+ *   {
+ *       ScriptResult result = co_await device.write("Request", 1, 500);
+ *       result = co_await device.read(QModbusDataUnit::HoldingRegisters, 100, 2);
+ *       if(result.isOk() && device.value("Ack") == 1)   //循环中取值先用signalId查出下标
+ *           ...
+ *       co_await device.sleep(1000);
+ *   }
+ *   static const bool s_handshake = ScriptHost::registerScript("handshake",
+ *       [](ScriptHost *pHost){ handshake(ScriptDevice(pHost, 1)); });
+ *
+ * 链路断开时协程在等待处被销毁，局部对象正常析构，重连后从头运行
+*/
+
+class ScriptDevice
+{
+public:
+    //uServerAddr: read的默认从站
+    explicit ScriptDevice(ScriptHost *pHost, quint8 uServerAddr = 1) : m_pHost(pHost), m_uServerAddr(uServerAddr) {}
+
+    ScriptHost *host() const { return m_pHost; }
+    quint8 serverAddr() const { return m_uServerAddr; }
+
+    //信号表下标，没有该信号时返回-1；按下标的重载不再查找Key
+    int signalId(const QString &strKey) const { return m_pHost->findSignalIndex(strKey); }
+
+    //当前信号表中的值、质量，没有该信号时值为0、质量为Quality_NoValue
+    double value(int iSignalId) const
+    {
+        return iSignalId < 0 ? 0 : m_pHost->signalAt(iSignalId).dValue;
+    }
+    double value(const QString &strKey) const { return value(signalId(strKey)); }
+    int quality(int iSignalId) const
+    {
+        return iSignalId < 0 ? (int)Quality_NoValue : (int)m_pHost->signalAt(iSignalId).uQuality;
+    }
+    int quality(const QString &strKey) const { return quality(signalId(strKey)); }
+
+    class Awaiter;
+    //读寄存器，应答同时解码进信号表；iTimeoutMs为0只按链路的请求超时
+    Awaiter read(QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTimeoutMs = 0) const;
+    Awaiter read(const PollBlock &block, int iTimeoutMs = 0) const;
+    //读一个信号所在的寄存器
+    Awaiter readSignal(int iSignalId, int iTimeoutMs = 0) const;
+    Awaiter readSignal(const QString &strKey, int iTimeoutMs = 0) const;
+    //写输出信号的工程值，与操作员写命令同一路径
+    Awaiter write(int iSignalId, double dValue, int iTimeoutMs = 0) const;
+    Awaiter write(const QString &strKey, double dValue, int iTimeoutMs = 0) const;
+    Awaiter sleep(int iSleepMs) const;
+
+private:
+    ScriptHost *m_pHost;
+    quint8 m_uServerAddr;
+};
+
+//co_await的结果为ScriptResult，未能入队时不挂起，直接返回Script_Rejected
+class ScriptDevice::Awaiter : public ScriptWaiter
+{
+public:
+    enum OpType
+    {
+        Op_Read = 0,
+        Op_Write,
+        Op_Sleep
+    };
+
+    Awaiter(ScriptHost *pHost, int iOpType) : m_pHost(pHost), m_iOpType(iOpType), m_iOp(-1),
+        m_uServerAddr(0), m_eRegTable(QModbusDataUnit::HoldingRegisters), m_uStartAddr(0), m_uCount(0),
+        m_iSignalIndex(-1), m_dValue(0), m_iTimeoutMs(0) {}
+    //只在挂起时登记操作，之前按值传递
+    ~Awaiter()
+    {
+        if(m_iOp >= 0)
+            m_pHost->cancel(m_iOp);
+    }
+
+    bool await_ready() const { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_handle = handle;
+        if(m_iOpType == Op_Read)
+            m_iOp = m_uCount > 0 ? m_pHost->startRead(m_uServerAddr, m_eRegTable, m_uStartAddr, m_uCount, m_iTimeoutMs, this) : -1;
+        else if(m_iOpType == Op_Write)
+            m_iOp = m_pHost->startWrite(m_iSignalIndex, m_dValue, m_iTimeoutMs, this);
+        else
+            m_iOp = m_pHost->startSleep(m_iTimeoutMs, this);
+        if(m_iOp >= 0)
+            return true;
+        m_result.iStatus = Script_Rejected;
+        return false;
+    }
+
+    ScriptResult await_resume() { return m_result; }
+
+    void resume(const ScriptResult &result) override
+    {
+        m_iOp = -1;
+        m_result = result;
+        m_handle.resume();
+    }
+
+private:
+    friend class ScriptDevice;
+    ScriptHost *m_pHost;
+    int m_iOpType;
+    int m_iOp;
+    std::coroutine_handle<> m_handle;
+    ScriptResult m_result;
+    quint8 m_uServerAddr;
+    QModbusDataUnit::RegisterType m_eRegTable;
+    quint16 m_uStartAddr;
+    quint16 m_uCount;
+    int m_iSignalIndex;
+    double m_dValue;
+    int m_iTimeoutMs;               //睡眠时为睡眠时间
+};
+
+inline ScriptDevice::Awaiter ScriptDevice::read(QModbusDataUnit::RegisterType eRegTable, quint16 uStartAddr, quint16 uCount, int iTimeoutMs) const
+{
+    Awaiter awaiter(m_pHost, Awaiter::Op_Read);
+    awaiter.m_uServerAddr = m_uServerAddr;
+    awaiter.m_eRegTable = eRegTable;
+    awaiter.m_uStartAddr = uStartAddr;
+    awaiter.m_uCount = uCount;
+    awaiter.m_iTimeoutMs = iTimeoutMs;
+    return awaiter;
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::read(const PollBlock &block, int iTimeoutMs) const
+{
+    Awaiter awaiter(m_pHost, Awaiter::Op_Read);
+    awaiter.m_uServerAddr = block.uServerAddr;
+    awaiter.m_eRegTable = block.eRegTable;
+    awaiter.m_uStartAddr = block.uStartAddr;
+    awaiter.m_uCount = block.uRegCount;
+    awaiter.m_iTimeoutMs = iTimeoutMs;
+    return awaiter;
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::readSignal(int iSignalId, int iTimeoutMs) const
+{
+    //没有该信号时寄存器个数为0，不入队
+    Awaiter awaiter(m_pHost, Awaiter::Op_Read);
+    awaiter.m_iTimeoutMs = iTimeoutMs;
+    if(iSignalId < 0)
+        return awaiter;
+    const SignalParameter &signalParam = m_pHost->signalAt(iSignalId);
+    awaiter.m_uServerAddr = signalParam.uServerAddr;
+    awaiter.m_eRegTable = signalParam.eRegTable;
+    awaiter.m_uStartAddr = signalParam.uRegisterAddr;
+    awaiter.m_uCount = isBitTable(signalParam.eRegTable) ? 1 : (signalParam.uBitPos + signalParam.uLength + 15) / 16;
+    return awaiter;
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::write(int iSignalId, double dValue, int iTimeoutMs) const
+{
+    Awaiter awaiter(m_pHost, Awaiter::Op_Write);
+    awaiter.m_iSignalIndex = iSignalId;
+    awaiter.m_dValue = dValue;
+    awaiter.m_iTimeoutMs = iTimeoutMs;
+    return awaiter;
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::readSignal(const QString &strKey, int iTimeoutMs) const
+{
+    return readSignal(signalId(strKey), iTimeoutMs);
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::write(const QString &strKey, double dValue, int iTimeoutMs) const
+{
+    return write(signalId(strKey), dValue, iTimeoutMs);
+}
+
+inline ScriptDevice::Awaiter ScriptDevice::sleep(int iSleepMs) const
+{
+    Awaiter awaiter(m_pHost, Awaiter::Op_Sleep);
+    awaiter.m_iTimeoutMs = iSleepMs;
+    return awaiter;
+}
+
+//脚本协程的返回类型，立即开始运行，结束或被宿主销毁时释放协程帧
+class ScriptTask
+{
+public:
+    struct promise_type : public ScriptTaskHandle
+    {
+        template<class... Args>
+        promise_type(ScriptDevice &device, Args &&...) : m_pHost(device.host())
+        {
+            m_pHost->addTask(this);
+        }
+        template<class... Args>
+        promise_type(const ScriptDevice &device, Args &&...) : m_pHost(device.host())
+        {
+            m_pHost->addTask(this);
+        }
+        ~promise_type()
+        {
+            m_pHost->removeTask(this);
+        }
+
+        ScriptTask get_return_object() { return ScriptTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        void destroy() override
+        {
+            std::coroutine_handle<promise_type>::from_promise(*this).destroy();
+        }
+
+        ScriptHost *m_pHost;
+    };
+};
+
+#endif // SCRIPTTASK_H
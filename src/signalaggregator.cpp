@@ -0,0 +1,94 @@
+﻿#include "signalaggregator.h"
+
+SignalAggregator::SignalAggregator()
+{
+
+}
+
+void SignalAggregator::setup(const QVector<SignalParameter> &signalList)
+{
+    m_stateList.clear();
+    m_stateIndexList.fill(-1, signalList.size());
+    for(int i=0; i<signalList.size(); i++)
+    {
+        int iAggregateMs = signalList.at(i).iAggregateMs;
+        if(iAggregateMs <= 0)
+            continue;
+        AggregateState state;
+        state.iSignalIndex = i;
+        state.iWindowNs = iAggregateMs * 1000000LL;
+        state.iStartNs = 0;
+        state.dMin = 0;
+        state.dMax = 0;
+        state.dSum = 0;
+        state.dLast = 0;
+        state.uCount = 0;
+        m_stateIndexList[i] = m_stateList.size();
+        m_stateList.append(state);
+    }
+    //每个信号每周期通常最多结束一个窗口
+    m_recordList.clear();
+    m_recordList.reserve(m_stateList.size() * 2);
+}
+
+int SignalAggregator::getSignalCount() const
+{
+    return m_stateList.size();
+}
+
+void SignalAggregator::addSample(int iSignalIndex, double dValue, qint64 iAcqMonoNs, qint64 iWallOffsetMs)
+{
+    AggregateState &state = m_stateList[m_stateIndexList.at(iSignalIndex)];
+    if(state.uCount > 0 && iAcqMonoNs >= state.iStartNs + state.iWindowNs)
+        closeWindow(state, iWallOffsetMs);
+    if(state.uCount == 0)
+    {
+        state.iStartNs = iAcqMonoNs - iAcqMonoNs % state.iWindowNs;
+        state.dMin = dValue;
+        state.dMax = dValue;
+        state.dSum = 0;
+    }
+    else
+    {
+        state.dMin = qMin(state.dMin, dValue);
+        state.dMax = qMax(state.dMax, dValue);
+    }
+    state.dSum += dValue;
+    state.dLast = dValue;
+    state.uCount++;
+}
+
+void SignalAggregator::closeExpired(qint64 iNowNs, qint64 iWallOffsetMs)
+{
+    for(int i=0; i<m_stateList.size(); i++)
+    {
+        AggregateState &state = m_stateList[i];
+        if(state.uCount > 0 && iNowNs >= state.iStartNs + state.iWindowNs)
+            closeWindow(state, iWallOffsetMs);
+    }
+}
+
+void SignalAggregator::closeWindow(AggregateState &state, qint64 iWallOffsetMs)
+{
+    AggregateRecord record;
+    record.iSignalIndex = state.iSignalIndex;
+    record.dMin = state.dMin;
+    record.dMax = state.dMax;
+    record.dAvg = state.dSum / state.uCount;
+    record.dLast = state.dLast;
+    record.uCount = state.uCount;
+    record.iStartTimeMs = state.iStartNs / 1000000 + iWallOffsetMs;
+    record.iWindowMs = (int)(state.iWindowNs / 1000000);
+    m_recordList.append(record);
+    state.uCount = 0;
+}
+
+const QVector<AggregateRecord> &SignalAggregator::getRecordList() const
+{
+    return m_recordList;
+}
+
+void SignalAggregator::clearRecords()
+{
+    m_recordList.resize(0);
+}
@@ -0,0 +1,66 @@
+﻿#ifndef SIGNALAGGREGATOR_H
+#define SIGNALAGGREGATOR_H
+
+#include <QVector>
+#include "commondefine.h"
+
+//一个聚合窗口的结果
+struct AggregateRecord
+{
+    int iSignalIndex;
+    double dMin;
+    double dMax;
+    double dAvg;
+    double dLast;
+    quint32 uCount;                 //窗口内的读回次数
+    qint64 iStartTimeMs;            //窗口起点，自1970年起的ms
+    int iWindowMs;
+};
+
+/* 信号窗口聚合，每个信号O(1)状态，在解码时逐次累加，实时值不受影响
+ * 窗口按单调时钟对齐到窗口长度的整数倍，同长度的信号同时结束
+ * 窗口内有读回才输出，通讯中断期间没有记录
+*/
+class SignalAggregator
+{
+public:
+    SignalAggregator();
+
+    //按信号表的iAggregateMs建立状态
+    void setup(const QVector<SignalParameter> &signalList);
+    int getSignalCount() const;
+
+    inline bool isEnabled(int iSignalIndex) const
+    {
+        return iSignalIndex < m_stateIndexList.size() && m_stateIndexList.at(iSignalIndex) >= 0;
+    }
+    //读回一次，跨过窗口时先结束上一个窗口；iWallOffsetMs为系统时间减单调时钟ms
+    void addSample(int iSignalIndex, double dValue, qint64 iAcqMonoNs, qint64 iWallOffsetMs);
+    //结束已到时的窗口，每周期调用
+    void closeExpired(qint64 iNowNs, qint64 iWallOffsetMs);
+
+    const QVector<AggregateRecord> &getRecordList() const;
+    void clearRecords();
+
+private:
+    struct AggregateState
+    {
+        int iSignalIndex;
+        qint64 iWindowNs;
+        qint64 iStartNs;            //当前窗口起点，单调时钟ns
+        double dMin;
+        double dMax;
+        double dSum;
+        double dLast;
+        quint32 uCount;             //0为当前没有窗口
+    };
+
+    void closeWindow(AggregateState &state, qint64 iWallOffsetMs);
+
+private:
+    QVector<AggregateState> m_stateList;
+    QVector<int> m_stateIndexList;      //按信号下标，不聚合为-1
+    QVector<AggregateRecord> m_recordList;
+};
+
+#endif // SIGNALAGGREGATOR_H
@@ -0,0 +1,420 @@
+﻿#include "signalapiserver.h"
+#include <QtEndian>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <string.h>
+
+SignalApiServer::SignalApiServer(QObject *parent) : QObject(parent),
+    m_localServer(nullptr),
+    m_publishTimer(nullptr),
+    m_pSignalList(nullptr),
+    m_pAlarmEngine(nullptr),
+    m_epoch(0),
+    m_dataVersion(0)
+{
+    //纪元不能为0，客户端首次请求时以0表示没有纪元
+    m_epoch = QRandomGenerator::global()->generate() | 1;
+    m_txBuffer.reserve(4096);
+
+    m_localServer = new QLocalServer(this);
+    connect(m_localServer, &QLocalServer::newConnection, this, &SignalApiServer::slot_newConnection);
+
+    m_publishTimer = new QTimer(this);
+    m_publishTimer->setInterval(100);
+    connect(m_publishTimer, &QTimer::timeout, this, &SignalApiServer::slot_publish);
+}
+
+SignalApiServer::~SignalApiServer()
+{
+    qDeleteAll(m_clientHash);
+    m_clientHash.clear();
+}
+
+void SignalApiServer::setSignalList(const QVector<SignalParameter> *pSignalList)
+{
+    m_pSignalList = pSignalList;
+}
+
+void SignalApiServer::setAlarmEngine(const AlarmEngine *pAlarmEngine)
+{
+    m_pAlarmEngine = pAlarmEngine;
+}
+
+void SignalApiServer::setBatchPeriod(int iBatchMs)
+{
+    m_publishTimer->setInterval(iBatchMs > 0 ? iBatchMs : 100);
+}
+
+bool SignalApiServer::listen(const QString &strName)
+{
+    //上次异常退出留下的套接字文件
+    QLocalServer::removeServer(strName);
+    if(!m_localServer->listen(strName))
+        return false;
+    m_publishTimer->start();
+    return true;
+}
+
+QString SignalApiServer::errorString() const
+{
+    return m_localServer->errorString();
+}
+
+void SignalApiServer::setDataVersion(quint64 uDataVersion)
+{
+    m_dataVersion = uDataVersion;
+}
+
+void SignalApiServer::appendAlarmEvents(const QVector<AlarmEvent> &eventList)
+{
+    m_alarmEventList += eventList;
+}
+
+void SignalApiServer::appendAggregates(const QVector<AggregateRecord> &recordList)
+{
+    m_aggregateList += recordList;
+}
+
+void SignalApiServer::appendEdges(const QVector<SignalEdge> &edgeList)
+{
+    m_edgeList += edgeList;
+}
+
+void SignalApiServer::slot_newConnection()
+{
+    while(QLocalSocket *pSocket = m_localServer->nextPendingConnection())
+    {
+        ApiClient *pClient = new ApiClient;
+        pClient->pSocket = pSocket;
+        pClient->iRxLength = 0;
+        pClient->bSubscribed = false;
+        pClient->bAggregates = false;
+        pClient->uSentVersion = 0;
+        m_clientHash.insert(pSocket, pClient);
+        connect(pSocket, &QLocalSocket::readyRead, this, &SignalApiServer::slot_readyRead);
+        connect(pSocket, &QLocalSocket::disconnected, this, &SignalApiServer::slot_disconnected);
+    }
+}
+
+void SignalApiServer::slot_disconnected()
+{
+    QLocalSocket *pSocket = qobject_cast<QLocalSocket*>(sender());
+    delete m_clientHash.take(pSocket);
+    pSocket->deleteLater();
+}
+
+void SignalApiServer::slot_readyRead()
+{
+    QLocalSocket *pSocket = qobject_cast<QLocalSocket*>(sender());
+    ApiClient *pClient = m_clientHash.value(pSocket, nullptr);
+    if(!pClient)
+        return;
+
+    while(true)
+    {
+        qint64 iRead = pSocket->read(reinterpret_cast<char*>(pClient->rxBuffer) + pClient->iRxLength, MaxRequestSize - pClient->iRxLength);
+        if(iRead <= 0)
+            break;
+        pClient->iRxLength += iRead;
+
+        int iPos = 0;
+        while(pClient->iRxLength - iPos >= 5)
+        {
+            const quint8 *pFrame = pClient->rxBuffer + iPos;
+            quint32 uLength = qFromLittleEndian<quint32>(pFrame);
+            if(uLength < 1 || uLength > MaxRequestSize - 4)
+            {
+                //帧边界已错位，断开连接
+                sendError(pSocket, 2);
+                pClient->iRxLength = 0;
+                pSocket->disconnectFromServer();
+                return;
+            }
+            if(pClient->iRxLength - iPos < (int)(4 + uLength))
+                break;
+            handleRequest(*pClient, pFrame + 4, uLength);
+            iPos += 4 + uLength;
+        }
+
+        if(iPos > 0)
+        {
+            memmove(pClient->rxBuffer, pClient->rxBuffer + iPos, pClient->iRxLength - iPos);
+            pClient->iRxLength -= iPos;
+        }
+    }
+}
+
+void SignalApiServer::handleRequest(ApiClient &client, const quint8 *pRequest, int iLength)
+{
+    quint8 uType = pRequest[0];
+    switch(uType)
+    {
+    case 0x01:
+        sendCatalog(client.pSocket);
+        break;
+    case 0x02:
+        sendValues(client.pSocket, 0x82, 0);
+        break;
+    case 0x03:
+    case 0x04:
+    {
+        if(iLength != 13)
+        {
+            sendError(client.pSocket, 2);
+            break;
+        }
+        quint32 uEpoch = qFromLittleEndian<quint32>(pRequest + 1);
+        quint64 uSinceVersion = qFromLittleEndian<quint64>(pRequest + 5);
+        //纪元不符或版本超前说明服务已重启，只能发快照
+        if(uEpoch != m_epoch || uSinceVersion > m_dataVersion)
+            sendValues(client.pSocket, 0x82, 0);
+        else
+            sendValues(client.pSocket, 0x83, uSinceVersion);
+        if(uType == 0x04)
+        {
+            client.bSubscribed = true;
+            client.uSentVersion = m_dataVersion;
+        }
+        break;
+    }
+    case 0x05:
+        client.bSubscribed = false;
+        break;
+    case 0x06:
+        sendAlarmCatalog(client.pSocket);
+        break;
+    case 0x07:
+        client.bAggregates = true;
+        break;
+    case 0x08:
+        client.bAggregates = false;
+        break;
+    default:
+        sendError(client.pSocket, 1);
+        break;
+    }
+}
+
+void SignalApiServer::slot_publish()
+{
+    if(!m_alarmEventList.isEmpty())
+    {
+        buildAlarmFrame();
+        QHash<QLocalSocket*, ApiClient*>::iterator alarmItr = m_clientHash.begin();
+        while(alarmItr != m_clientHash.end())
+        {
+            ApiClient *pClient = alarmItr.value();
+            alarmItr++;
+            if(pClient->bSubscribed && pClient->pSocket->bytesToWrite() <= MaxBacklogBytes)
+                pClient->pSocket->write(m_txBuffer);
+        }
+        m_alarmEventList.resize(0);
+    }
+
+    if(!m_edgeList.isEmpty())
+    {
+        buildEdgeFrame();
+        QHash<QLocalSocket*, ApiClient*>::iterator edgeItr = m_clientHash.begin();
+        while(edgeItr != m_clientHash.end())
+        {
+            ApiClient *pClient = edgeItr.value();
+            edgeItr++;
+            if(pClient->bSubscribed && pClient->pSocket->bytesToWrite() <= MaxBacklogBytes)
+                pClient->pSocket->write(m_txBuffer);
+        }
+        m_edgeList.resize(0);
+    }
+
+    if(!m_aggregateList.isEmpty())
+    {
+        buildAggregateFrame();
+        QHash<QLocalSocket*, ApiClient*>::iterator aggregateItr = m_clientHash.begin();
+        while(aggregateItr != m_clientHash.end())
+        {
+            ApiClient *pClient = aggregateItr.value();
+            aggregateItr++;
+            if(pClient->bAggregates && pClient->pSocket->bytesToWrite() <= MaxBacklogBytes)
+                pClient->pSocket->write(m_txBuffer);
+        }
+        m_aggregateList.resize(0);
+    }
+
+    QHash<QLocalSocket*, ApiClient*>::iterator itr = m_clientHash.begin();
+    while(itr != m_clientHash.end())
+    {
+        ApiClient *pClient = itr.value();
+        itr++;
+        if(!pClient->bSubscribed || pClient->uSentVersion >= m_dataVersion)
+            continue;
+        if(pClient->pSocket->bytesToWrite() > MaxBacklogBytes)
+            continue;
+        sendValues(pClient->pSocket, 0x84, pClient->uSentVersion);
+        pClient->uSentVersion = m_dataVersion;
+    }
+}
+
+void SignalApiServer::sendCatalog(QLocalSocket *pSocket)
+{
+    int iCount = m_pSignalList ? m_pSignalList->size() : 0;
+    beginFrame(0x81);
+    appendUInt32(m_epoch);
+    appendUInt32(iCount);
+    for(int i=0; i<iCount; i++)
+    {
+        const QByteArray strKey = m_pSignalList->at(i).strKey.toUtf8();
+        appendUInt16(strKey.size());
+        m_txBuffer.append(strKey);
+    }
+    endFrame(pSocket);
+}
+
+void SignalApiServer::sendAlarmCatalog(QLocalSocket *pSocket)
+{
+    int iCount = m_pAlarmEngine ? m_pAlarmEngine->getAlarmCount() : 0;
+    beginFrame(0x86);
+    appendUInt32(m_epoch);
+    appendUInt32(iCount);
+    for(int i=0; i<iCount; i++)
+    {
+        const AlarmDef &alarmDef = m_pAlarmEngine->getAlarmDef(i);
+        appendUInt32(m_pAlarmEngine->getSignalIndex(i));
+        m_txBuffer.append((char)alarmDef.iKind);
+        m_txBuffer.append((char)alarmDef.iSeverity);
+        m_txBuffer.append((char)(m_pAlarmEngine->isActive(i) ? 1 : 0));
+        const QByteArray strKey = alarmDef.strKey.toUtf8();
+        appendUInt16(strKey.size());
+        m_txBuffer.append(strKey);
+    }
+    endFrame(pSocket);
+}
+
+void SignalApiServer::buildAlarmFrame()
+{
+    beginFrame(0x85);
+    appendUInt32(m_epoch);
+    appendUInt32(m_alarmEventList.size());
+    for(int i=0; i<m_alarmEventList.size(); i++)
+    {
+        const AlarmEvent &alarmEvent = m_alarmEventList.at(i);
+        quint64 uBits = 0;
+        memcpy(&uBits, &alarmEvent.dValue, sizeof(uBits));
+        appendUInt32(alarmEvent.iAlarm);
+        m_txBuffer.append((char)(alarmEvent.bActive ? 1 : 0));
+        appendUInt64(uBits);
+        appendUInt64(alarmEvent.iTimeMs);
+    }
+    qToLittleEndian<quint32>(m_txBuffer.size() - 4, m_txBuffer.data());
+}
+
+void SignalApiServer::buildEdgeFrame()
+{
+    beginFrame(0x88);
+    appendUInt32(m_epoch);
+    appendUInt32(m_edgeList.size());
+    for(int i=0; i<m_edgeList.size(); i++)
+    {
+        const SignalEdge &edge = m_edgeList.at(i);
+        quint64 uBits = 0;
+        memcpy(&uBits, &edge.dValue, sizeof(uBits));
+        appendUInt32(edge.iSignalIndex);
+        appendUInt64(uBits);
+        appendUInt64(edge.iTimeMs);
+        appendUInt64(edge.iMonoNs);
+    }
+    qToLittleEndian<quint32>(m_txBuffer.size() - 4, m_txBuffer.data());
+}
+
+void SignalApiServer::buildAggregateFrame()
+{
+    beginFrame(0x87);
+    appendUInt32(m_epoch);
+    appendUInt32(m_aggregateList.size());
+    for(int i=0; i<m_aggregateList.size(); i++)
+    {
+        const AggregateRecord &record = m_aggregateList.at(i);
+        appendUInt32(record.iSignalIndex);
+        appendUInt64(record.iStartTimeMs);
+        appendUInt32(record.iWindowMs);
+        appendUInt32(record.uCount);
+        const double values[4] = {record.dMin, record.dMax, record.dAvg, record.dLast};
+        for(int j=0; j<4; j++)
+        {
+            quint64 uBits = 0;
+            memcpy(&uBits, &values[j], sizeof(uBits));
+            appendUInt64(uBits);
+        }
+    }
+    qToLittleEndian<quint32>(m_txBuffer.size() - 4, m_txBuffer.data());
+}
+
+void SignalApiServer::sendValues(QLocalSocket *pSocket, quint8 uType, quint64 uSinceVersion)
+{
+    beginFrame(uType);
+    appendUInt32(m_epoch);
+    appendUInt64(m_dataVersion);
+    int iCountPos = m_txBuffer.size();
+    appendUInt32(0);
+
+    //从未读回也未失败的信号版本为0，不在快照和增量中
+    quint32 uCount = 0;
+    int iSignalCount = m_pSignalList ? m_pSignalList->size() : 0;
+    for(int i=0; i<iSignalCount; i++)
+    {
+        const SignalParameter &signalParam = m_pSignalList->at(i);
+        if(signalParam.uVersion == 0 || signalParam.uVersion <= uSinceVersion)
+            continue;
+        quint64 uBits = 0;
+        memcpy(&uBits, &signalParam.dValue, sizeof(uBits));
+        appendUInt32(i);
+        appendUInt64(uBits);
+        m_txBuffer.append((char)signalParam.uQuality);
+        m_txBuffer.append((char)signalParam.uExceptionCode);
+        appendUInt64(signalParam.iAcqTimeMs);
+        appendUInt64(signalParam.iAcqMonoNs);
+        uCount++;
+    }
+    qToLittleEndian<quint32>(uCount, m_txBuffer.data() + iCountPos);
+    endFrame(pSocket);
+}
+
+void SignalApiServer::sendError(QLocalSocket *pSocket, quint8 uErrorCode)
+{
+    beginFrame(0xFF);
+    m_txBuffer.append((char)uErrorCode);
+    endFrame(pSocket);
+}
+
+void SignalApiServer::beginFrame(quint8 uType)
+{
+    //已预留容量，清空不释放
+    m_txBuffer.resize(0);
+    appendUInt32(0);
+    m_txBuffer.append((char)uType);
+}
+
+void SignalApiServer::endFrame(QLocalSocket *pSocket)
+{
+    qToLittleEndian<quint32>(m_txBuffer.size() - 4, m_txBuffer.data());
+    pSocket->write(m_txBuffer);
+}
+
+void SignalApiServer::appendUInt16(quint16 uValue)
+{
+    char data[2];
+    qToLittleEndian<quint16>(uValue, data);
+    m_txBuffer.append(data, 2);
+}
+
+void SignalApiServer::appendUInt32(quint32 uValue)
+{
+    char data[4];
+    qToLittleEndian<quint32>(uValue, data);
+    m_txBuffer.append(data, 4);
+}
+
+void SignalApiServer::appendUInt64(quint64 uValue)
+{
+    char data[8];
+    qToLittleEndian<quint64>(uValue, data);
+    m_txBuffer.append(data, 8);
+}
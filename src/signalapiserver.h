@@ -0,0 +1,114 @@
+﻿#ifndef SIGNALAPISERVER_H
+#define SIGNALAPISERVER_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include <QByteArray>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "commondefine.h"
+#include "alarmengine.h"
+#include "signalaggregator.h"
+#include "burstsampler.h"
+
+/* 信号查询接口，UNIX域套接字，二进制协议，整数和浮点均为小端
+ * 帧: u32 长度（不含自身） u8 类型 载荷
+ * 请求
+ *   0x01 目录                           应答0x81: u32 纪元 u32 个数 {u16 Key长度 Key(UTF-8)}，信号序号即目录中的顺序
+ *   0x02 快照                           应答0x82
+ *   0x03 增量 u32 纪元 u64 版本         应答0x83，纪元不符或版本超前时应答0x82快照
+ *   0x04 订阅 u32 纪元 u64 版本         先应答0x82或0x83，之后每个批次周期有变化时推送0x84
+ *   0x05 取消订阅
+ *   0x06 告警目录                       应答0x86: u32 纪元 u32 个数 {u32 信号序号 u8 类型 u8 等级 u8 当前是否告警 u16 Key长度 Key(UTF-8)}，告警序号即目录中的顺序
+ *   0x07 订阅聚合                       之后每个批次周期有结束的聚合窗口时推送0x87
+ *   0x08 取消订阅聚合
+ * 数据帧 0x82 0x83 0x84: u32 纪元 u64 当前版本 u32 个数 {u32 信号序号 f64 工程值 u8 质量 u8 异常码 i64 读回时间ms i64 读回单调时间ns}
+ *   质量见SignalQuality，非GOOD时工程值为最后一次读回的值；读回时间自1970年起，单调时间为CLOCK_MONOTONIC
+ * 告警帧 0x85: u32 纪元 u32 个数 {u32 告警序号 u8 1产生0恢复 f64 触发值 i64 触发时间ms}，订阅者每个批次周期有告警事件时推送
+ *   类型见AlarmKind，Rate告警的触发值为每秒变化量
+ * 聚合帧 0x87: u32 纪元 u32 个数 {u32 信号序号 i64 窗口起点ms u32 窗口ms u32 读回次数 f64 最小 f64 最大 f64 平均 f64 最后}，积压时丢弃
+ * 跳变帧 0x88: u32 纪元 u32 个数 {u32 信号序号 f64 跳变后的工程值 i64 读回时间ms i64 读回单调时间ns}，突发采样的监视信号，订阅者每个批次周期有跳变时推送，积压时丢弃
+ * 错误帧 0xFF: u8 错误码 1:未知请求 2:请求长度错误
+ * 纪元在服务启动时随机生成，客户端纪元不符时需重新取目录
+ * 订阅者积压超过上限时跳过本批次，变化合并到下一批次发送；告警事件不合并，积压时丢弃，客户端以0x06的当前状态为准
+*/
+class SignalApiServer : public QObject
+{
+    Q_OBJECT
+public:
+    enum
+    {
+        MaxRequestSize = 64,            //请求帧最大字节数
+        MaxBacklogBytes = 1024 * 1024   //订阅者未发出的字节数上限
+    };
+
+    explicit SignalApiServer(QObject *parent = nullptr);
+    ~SignalApiServer();
+
+    //信号表由服务持有，加载后不再增减
+    void setSignalList(const QVector<SignalParameter> *pSignalList);
+    //告警由服务持有，未设置时告警目录为空
+    void setAlarmEngine(const AlarmEngine *pAlarmEngine);
+    void setBatchPeriod(int iBatchMs);
+    bool listen(const QString &strName);
+    QString errorString() const;
+
+    //信号值变化后由服务更新
+    void setDataVersion(quint64 uDataVersion);
+    //告警事件，下一个批次周期推送
+    void appendAlarmEvents(const QVector<AlarmEvent> &eventList);
+    //结束的聚合窗口，下一个批次周期推送
+    void appendAggregates(const QVector<AggregateRecord> &recordList);
+    //突发采样监视信号的跳变，下一个批次周期推送
+    void appendEdges(const QVector<SignalEdge> &edgeList);
+
+private slots:
+    void slot_newConnection();
+    void slot_readyRead();
+    void slot_disconnected();
+    void slot_publish();
+
+private:
+    struct ApiClient
+    {
+        QLocalSocket *pSocket;
+        quint8 rxBuffer[MaxRequestSize];
+        int iRxLength;
+        bool bSubscribed;
+        bool bAggregates;               //订阅了聚合
+        quint64 uSentVersion;           //已推送到的版本
+    };
+
+    void handleRequest(ApiClient &client, const quint8 *pRequest, int iLength);
+    void sendCatalog(QLocalSocket *pSocket);
+    void sendAlarmCatalog(QLocalSocket *pSocket);
+    //告警帧在m_txBuffer中生成一次，发给全部订阅者
+    void buildAlarmFrame();
+    void buildAggregateFrame();
+    void buildEdgeFrame();
+    //uSinceVersion为0时发送全部信号
+    void sendValues(QLocalSocket *pSocket, quint8 uType, quint64 uSinceVersion);
+    void sendError(QLocalSocket *pSocket, quint8 uErrorCode);
+    void beginFrame(quint8 uType);
+    void endFrame(QLocalSocket *pSocket);
+    void appendUInt16(quint16 uValue);
+    void appendUInt32(quint32 uValue);
+    void appendUInt64(quint64 uValue);
+
+private:
+    QLocalServer *m_localServer;
+    QTimer *m_publishTimer;
+    const QVector<SignalParameter> *m_pSignalList;
+    const AlarmEngine *m_pAlarmEngine;
+    QVector<AlarmEvent> m_alarmEventList;   //待推送的告警事件
+    QVector<AggregateRecord> m_aggregateList;   //待推送的聚合窗口
+    QVector<SignalEdge> m_edgeList;             //待推送的跳变
+    quint32 m_epoch;
+    quint64 m_dataVersion;
+    QHash<QLocalSocket*, ApiClient*> m_clientHash;
+    QByteArray m_txBuffer;              //应答帧，复用容量
+};
+
+#endif // SIGNALAPISERVER_H
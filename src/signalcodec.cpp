@@ -0,0 +1,140 @@
+﻿#include "signalcodec.h"
+#include <string.h>
+#include <math.h>
+
+SignalCodec::SignalCodec() :
+    m_bByteSwap(false),
+    m_bWordSwap(false)
+{
+
+}
+
+void SignalCodec::setByteSwap(bool bByteSwap)
+{
+    m_bByteSwap = bByteSwap;
+}
+
+void SignalCodec::setWordSwap(bool bWordSwap)
+{
+    m_bWordSwap = bWordSwap;
+}
+
+quint64 SignalCodec::combineRegisters(const quint16 *pRegValue, int iRegCount) const
+{
+    quint64 qRegValue = 0;
+    for(int i=0; i<iRegCount; i++)
+    {
+        quint16 qWord = pRegValue[m_bWordSwap ? (iRegCount-1-i) : i];
+        if(m_bByteSwap)
+            qWord = (quint16)((qWord >> 8) | (qWord << 8));
+        qRegValue = (qRegValue << 16) | qWord;
+    }
+    return qRegValue;
+}
+
+void SignalCodec::splitRegisters(quint64 qRegValue, int iRegCount, quint16 *pRegValue) const
+{
+    for(int i=iRegCount-1; i>=0; i--)
+    {
+        quint16 qWord = (quint16)qRegValue;
+        if(m_bByteSwap)
+            qWord = (quint16)((qWord >> 8) | (qWord << 8));
+        pRegValue[m_bWordSwap ? (iRegCount-1-i) : i] = qWord;
+        qRegValue >>= 16;
+    }
+}
+
+void SignalCodec::decode(SignalParameter &signalParam, quint64 qRegValue) const
+{
+    quint16 qBitLen = signalParam.uLength;
+    quint64 uRawValue = qRegValue;
+    if(qBitLen < 64)
+        uRawValue = (qRegValue >> signalParam.uBitPos) & ((Q_UINT64_C(1) << qBitLen) - 1);
+    signalParam.uValue = uRawValue;
+
+    double dValue = 0;
+    switch(signalParam.iDataType)
+    {
+    case DataType_Int:
+    {
+        //按Length位符号扩展
+        quint64 uSignBit = Q_UINT64_C(1) << (qBitLen - 1);
+        dValue = (double)(qint64)((uRawValue ^ uSignBit) - uSignBit);
+        break;
+    }
+    case DataType_Float32:
+    {
+        quint32 uBits = (quint32)uRawValue;
+        float fValue = 0;
+        memcpy(&fValue, &uBits, sizeof(fValue));
+        dValue = fValue;
+        break;
+    }
+    case DataType_Float64:
+        memcpy(&dValue, &uRawValue, sizeof(dValue));
+        break;
+    case DataType_BCD:
+    {
+        double dWeight = 1;
+        for(int i=0; i<qBitLen; i+=4)
+        {
+            dValue += ((uRawValue >> i) & 0xF) * dWeight;
+            dWeight *= 10;
+        }
+        break;
+    }
+    default:
+        dValue = (double)uRawValue;
+        break;
+    }
+
+    signalParam.dValue = dValue * signalParam.dScale + signalParam.dOffset;
+}
+
+bool SignalCodec::encode(const SignalParameter &signalParam, double dValue, quint64 &uRawValue) const
+{
+    quint16 qBitLen = signalParam.uLength;
+    quint64 uMask = qBitLen < 64 ? ((Q_UINT64_C(1) << qBitLen) - 1) : ~Q_UINT64_C(0);
+    double dRaw = (dValue - signalParam.dOffset) / signalParam.dScale;
+
+    switch(signalParam.iDataType)
+    {
+    case DataType_Int:
+    {
+        double dLimit = ldexp(1.0, qBitLen - 1);
+        if(dRaw < -dLimit || dRaw >= dLimit)
+            return false;
+        uRawValue = (quint64)(qint64)llround(dRaw) & uMask;
+        return true;
+    }
+    case DataType_Float32:
+    {
+        float fValue = (float)dRaw;
+        quint32 uBits = 0;
+        memcpy(&uBits, &fValue, sizeof(uBits));
+        uRawValue = uBits;
+        return true;
+    }
+    case DataType_Float64:
+        memcpy(&uRawValue, &dRaw, sizeof(uRawValue));
+        return true;
+    case DataType_BCD:
+    {
+        if(dRaw < 0 || dRaw >= pow(10.0, qBitLen / 4))
+            return false;
+        quint64 uDecimal = (quint64)floor(dRaw + 0.5);
+        uRawValue = 0;
+        for(int i=0; i<qBitLen; i+=4)
+        {
+            uRawValue |= (uDecimal % 10) << i;
+            uDecimal /= 10;
+        }
+        return true;
+    }
+    default:
+        if(dRaw < 0 || dRaw >= ldexp(1.0, qBitLen))
+            return false;
+        uRawValue = (quint64)floor(dRaw + 0.5) & uMask;
+        return true;
+    }
+}
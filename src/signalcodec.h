@@ -0,0 +1,42 @@
+﻿#ifndef SIGNALCODEC_H
+#define SIGNALCODEC_H
+
+#include "commondefine.h"
+
+//信号编解码：寄存器字节序/字序、数据类型转换、线性缩放，在解码时一次完成
+class SignalCodec
+{
+public:
+    SignalCodec();
+
+    void setByteSwap(bool bByteSwap);
+    void setWordSwap(bool bWordSwap);
+
+    /* 按设备字节序、字序把连续寄存器合并为一个值，第一个寄存器在高位
+     * pRegValue: 寄存器值
+     * iRegCount: 寄存器个数 1、2、4
+    */
+    quint64 combineRegisters(const quint16 *pRegValue, int iRegCount) const;
+
+    /* combineRegisters的逆过程
+     * qRegValue: 合并后的值
+     * iRegCount: 寄存器个数 1、2、4
+     * pRegValue: 输出寄存器值
+    */
+    void splitRegisters(quint64 qRegValue, int iRegCount, quint16 *pRegValue) const;
+
+    //从寄存器值中取出信号原始位并换算工程值，写入signalParam.uValue和dValue
+    void decode(SignalParameter &signalParam, quint64 qRegValue) const;
+
+    /* 工程值换算为原始位，超出数据类型范围时返回false
+     * dValue: 工程值
+     * uRawValue: 输出原始位，可直接写入寄存器的uBitPos位置
+    */
+    bool encode(const SignalParameter &signalParam, double dValue, quint64 &uRawValue) const;
+
+private:
+    bool m_bByteSwap;
+    bool m_bWordSwap;
+};
+
+#endif // SIGNALCODEC_H
@@ -142,6 +142,9 @@ void MainWindow::on_connectType_currentIndexChanged(int index)
             statusBar()->showMessage(tr("Could not create Modbus server."), 5000);
     } else {
         QModbusDataUnitMap reg;
+        reg.insert(QModbusDataUnit::Coils, { QModbusDataUnit::Coils, 0, 50000});
+        reg.insert(QModbusDataUnit::DiscreteInputs, { QModbusDataUnit::DiscreteInputs, 0, 50000});
+        reg.insert(QModbusDataUnit::InputRegisters, { QModbusDataUnit::InputRegisters, 0, 50000});
         reg.insert(QModbusDataUnit::HoldingRegisters, { QModbusDataUnit::HoldingRegisters, 0, 50000});
 
 
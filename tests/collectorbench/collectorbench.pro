@@ -0,0 +1,17 @@
+QT -= gui
+QT += testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_collectorbench
+
+include(../../src/TFModbusService32.pri)
+include(../common/common.pri)
+
+HEADERS += \
+    tcpslavehost.h
+
+SOURCES += \
+        tcpslavehost.cpp \
+        tst_collectorbench.cpp
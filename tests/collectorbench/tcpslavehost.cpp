@@ -0,0 +1,109 @@
+﻿#include "tcpslavehost.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+
+TcpSlaveHost::TcpSlaveHost(QObject *parent) : QObject(parent)
+{
+
+}
+
+bool TcpSlaveHost::listen(int iCount)
+{
+    for(int i=0; i<iCount; i++)
+    {
+        QTcpServer *pServer = new QTcpServer(this);
+        if(!pServer->listen(QHostAddress::LocalHost, 0))
+            return false;
+        connect(pServer, &QTcpServer::newConnection, this, &TcpSlaveHost::slot_newConnection);
+        m_serverList.append(pServer);
+        m_portList.append(pServer->serverPort());
+    }
+    return true;
+}
+
+QList<quint16> TcpSlaveHost::getPortList() const
+{
+    return m_portList;
+}
+
+void TcpSlaveHost::slot_newConnection()
+{
+    QTcpServer *pServer = qobject_cast<QTcpServer*>(sender());
+    while(pServer->hasPendingConnections())
+    {
+        QTcpSocket *pSocket = pServer->nextPendingConnection();
+        pSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_rxBufferHash.insert(pSocket, QByteArray());
+        connect(pSocket, &QTcpSocket::readyRead, this, &TcpSlaveHost::slot_readyRead);
+        connect(pSocket, &QTcpSocket::disconnected, this, &TcpSlaveHost::slot_disconnected);
+    }
+}
+
+void TcpSlaveHost::slot_readyRead()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    QByteArray &rxBuffer = m_rxBufferHash[pSocket];
+    rxBuffer.append(pSocket->readAll());
+
+    //MBAP头7字节，长度字段含单元标识
+    while(rxBuffer.size() >= 7)
+    {
+        int iLength = ((quint8)rxBuffer.at(4) << 8) | (quint8)rxBuffer.at(5);
+        if(rxBuffer.size() < 6 + iLength)
+            break;
+        QByteArray pdu = buildResponse(rxBuffer.mid(7, iLength - 1));
+        QByteArray adu = rxBuffer.left(4);
+        adu.append((char)((pdu.size() + 1) >> 8));
+        adu.append((char)((pdu.size() + 1) & 0xFF));
+        adu.append(rxBuffer.at(6));
+        adu.append(pdu);
+        pSocket->write(adu);
+        rxBuffer.remove(0, 6 + iLength);
+    }
+}
+
+void TcpSlaveHost::slot_disconnected()
+{
+    QTcpSocket *pSocket = qobject_cast<QTcpSocket*>(sender());
+    m_rxBufferHash.remove(pSocket);
+    pSocket->deleteLater();
+}
+
+QByteArray TcpSlaveHost::buildResponse(const QByteArray &pdu) const
+{
+    QByteArray response;
+    quint8 uFunctionCode = pdu.isEmpty() ? 0 : (quint8)pdu.at(0);
+    if(pdu.size() < 5 || uFunctionCode < 1 || uFunctionCode > 4)
+    {
+        response.append((char)(uFunctionCode | 0x80));
+        response.append((char)0x01);
+        return response;
+    }
+
+    quint16 uAddr = (quint16)(((quint8)pdu.at(1) << 8) | (quint8)pdu.at(2));
+    quint16 uCount = (quint16)(((quint8)pdu.at(3) << 8) | (quint8)pdu.at(4));
+    response.append((char)uFunctionCode);
+    if(uFunctionCode <= 2)
+    {
+        QByteArray bits((uCount + 7) / 8, 0);
+        for(int i=0; i<uCount; i++)
+        {
+            if((uAddr + i) % 2 == 1)
+                bits[i / 8] = (char)(bits.at(i / 8) | (1 << (i % 8)));
+        }
+        response.append((char)bits.size());
+        response.append(bits);
+    }
+    else
+    {
+        response.append((char)(uCount * 2));
+        for(int i=0; i<uCount; i++)
+        {
+            quint16 uValue = (quint16)(uAddr + i);
+            response.append((char)(uValue >> 8));
+            response.append((char)(uValue & 0xFF));
+        }
+    }
+    return response;
+}
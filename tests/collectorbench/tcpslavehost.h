@@ -0,0 +1,40 @@
+﻿#ifndef TCPSLAVEHOST_H
+#define TCPSLAVEHOST_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QByteArray>
+
+class QTcpServer;
+class QTcpSocket;
+
+/* 进程内模拟的Modbus TCP从站，每个端口一台，全部在宿主线程的事件循环中应答
+ * 只应答读请求，寄存器值等于地址，线圈、离散输入按地址奇偶，其它功能码应答非法功能
+*/
+class TcpSlaveHost : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TcpSlaveHost(QObject *parent = nullptr);
+
+    //在宿主线程内调用，监听127.0.0.1上iCount个临时端口
+    Q_INVOKABLE bool listen(int iCount);
+    //listen返回后其它线程可读
+    QList<quint16> getPortList() const;
+
+private slots:
+    void slot_newConnection();
+    void slot_readyRead();
+    void slot_disconnected();
+
+private:
+    QByteArray buildResponse(const QByteArray &pdu) const;
+
+private:
+    QList<QTcpServer*> m_serverList;
+    QList<quint16> m_portList;
+    QHash<QTcpSocket*, QByteArray> m_rxBufferHash;
+};
+
+#endif // TCPSLAVEHOST_H
@@ -0,0 +1,170 @@
+﻿#include <QtTest>
+#include <QThread>
+#include "tcpslavehost.h"
+#include "testconfig.h"
+#include "collector.h"
+
+/* 采集器容量基准，设备为进程内模拟的Modbus TCP从站，从站在单独线程中应答
+ * 按设备数×每台信号数×工作线程数运行，预热后统计每个工作线程的信号解码速率和CPU占用
+ * 结果按线程输出，另断言无错误、吞吐不低于标称值的一半
+*/
+class TestCollectorBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void throughput_data();
+    void throughput();
+
+private:
+    static int connectedCount(const Collector &collector);
+
+private:
+    QThread m_slaveThread;
+    TcpSlaveHost *m_slaveHost;
+};
+
+static const int s_maxDevices = 256;
+static const int s_periodMs = 100;
+static const int s_warmUpMs = 1000;
+static const int s_measureMs = 3000;
+
+//某个工作线程在统计区间起点的累计值
+struct WorkerSnapshot
+{
+    qint64 iSignalCount;
+    qint64 iTransactionCount;
+    qint64 iErrorCount;
+    qint64 iCpuTimeNs;
+};
+
+static WorkerSnapshot takeSnapshot(const CollectorWorker *pWorker)
+{
+    WorkerSnapshot snapshot;
+    snapshot.iSignalCount = pWorker->getSignalCount();
+    snapshot.iTransactionCount = pWorker->getTransactionCount();
+    snapshot.iErrorCount = pWorker->getErrorCount();
+    snapshot.iCpuTimeNs = pWorker->getCpuTimeNs();
+    return snapshot;
+}
+
+void TestCollectorBench::initTestCase()
+{
+    m_slaveHost = new TcpSlaveHost();
+    m_slaveHost->moveToThread(&m_slaveThread);
+    connect(&m_slaveThread, &QThread::finished, m_slaveHost, &QObject::deleteLater);
+    m_slaveThread.start();
+
+    bool bListening = false;
+    QVERIFY(QMetaObject::invokeMethod(m_slaveHost, "listen", Qt::BlockingQueuedConnection,
+                                      Q_RETURN_ARG(bool, bListening), Q_ARG(int, s_maxDevices)));
+    QVERIFY(bListening);
+}
+
+void TestCollectorBench::cleanupTestCase()
+{
+    m_slaveThread.quit();
+    m_slaveThread.wait();
+}
+
+int TestCollectorBench::connectedCount(const Collector &collector)
+{
+    int iConnected = 0;
+    for(int i=0; i<collector.getWorkerCount(); i++)
+        iConnected += collector.getWorker(i)->getConnectedCount();
+    return iConnected;
+}
+
+void TestCollectorBench::throughput_data()
+{
+    QTest::addColumn<int>("devices");
+    QTest::addColumn<int>("signalsPerDevice");
+    QTest::addColumn<int>("workers");
+    QTest::newRow("16x100, 1 worker") << 16 << 100 << 1;
+    QTest::newRow("64x100, 2 workers") << 64 << 100 << 2;
+    QTest::newRow("64x1000, 4 workers") << 64 << 1000 << 4;
+    QTest::newRow("256x100, 4 workers") << 256 << 100 << 4;
+}
+
+void TestCollectorBench::throughput()
+{
+    QFETCH(int, devices);
+    QFETCH(int, signalsPerDevice);
+    QFETCH(int, workers);
+
+    QList<TestSignal> signalList;
+    for(int i=0; i<signalsPerDevice; i++)
+    {
+        TestSignal testSignal;
+        testSignal.strKey = QString("Value%1").arg(i);
+        testSignal.uRegisterAddr = (quint16)i;
+        testSignal.strType = "AI";
+        testSignal.iLength = 16;
+        signalList.append(testSignal);
+    }
+    QVERIFY(TestConfig::writeProtocol("Protocol.json", 1, signalList));
+    QVERIFY(TestConfig::writeDevices("Devices.json", 1, m_slaveHost->getPortList().mid(0, devices)));
+    QVERIFY(TestConfig::writeConfig(QString("[Collector]\n"
+                                            "Enable=1\n"
+                                            "Workers=%1\n"
+                                            "Period=%2\n"
+                                            "Timeout=1000\n"
+                                            "StatsPeriod=3600\n"
+                                            "DeviceFile=Devices.json\n"
+                                            "[Poll]\n"
+                                            "MaxGap=0\n"
+                                            "MaxRegCount=125\n")
+                                    .arg(workers)
+                                    .arg(s_periodMs)));
+
+    Collector collector;
+    QVERIFY(collector.start());
+    QCOMPARE(collector.getWorkerCount(), workers);
+    QTRY_COMPARE_WITH_TIMEOUT(connectedCount(collector), devices, 5000);
+    QTest::qWait(s_warmUpMs);
+
+    QVector<WorkerSnapshot> startList;
+    for(int i=0; i<workers; i++)
+        startList.append(takeSnapshot(collector.getWorker(i)));
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+    QTest::qWait(s_measureMs);
+    double dSeconds = elapsedTimer.elapsed() / 1000.0;
+
+    double dTotalSignalRate = 0;
+    qint64 iTotalErrors = 0;
+    for(int i=0; i<workers; i++)
+    {
+        const CollectorWorker *pWorker = collector.getWorker(i);
+        WorkerSnapshot endSnapshot = takeSnapshot(pWorker);
+        const WorkerSnapshot &startSnapshot = startList.at(i);
+        double dSignalRate = (endSnapshot.iSignalCount - startSnapshot.iSignalCount) / dSeconds;
+        double dRequestRate = (endSnapshot.iTransactionCount - startSnapshot.iTransactionCount) / dSeconds;
+        double dCores = (endSnapshot.iCpuTimeNs - startSnapshot.iCpuTimeNs) / 1e9 / dSeconds;
+        qDebug()<<QString("worker %1: %2 devices, %3 signals/s, %4 requests/s, CPU %5 cores, %6 signals/s per core")
+                        .arg(i)
+                        .arg(pWorker->getDeviceCount())
+                        .arg(dSignalRate, 0, 'f', 0)
+                        .arg(dRequestRate, 0, 'f', 0)
+                        .arg(dCores, 0, 'f', 3)
+                        .arg(dCores > 0 ? dSignalRate / dCores : 0, 0, 'f', 0);
+        dTotalSignalRate += dSignalRate;
+        iTotalErrors += endSnapshot.iErrorCount - startSnapshot.iErrorCount;
+    }
+
+    double dNominalRate = (double)devices * signalsPerDevice * 1000 / s_periodMs;
+    qDebug()<<QString("%1 devices x %2 signals, %3 workers: %4 signals/s of nominal %5")
+                    .arg(devices)
+                    .arg(signalsPerDevice)
+                    .arg(workers)
+                    .arg(dTotalSignalRate, 0, 'f', 0)
+                    .arg(dNominalRate, 0, 'f', 0);
+    QCOMPARE(iTotalErrors, 0LL);
+    QVERIFY(dTotalSignalRate >= dNominalRate / 2);
+}
+
+QTEST_GUILESS_MAIN(TestCollectorBench)
+
+#include "tst_collectorbench.moc"
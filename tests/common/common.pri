@@ -0,0 +1,12 @@
+# 测试共用的伪终端RTU从站
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/ptyslave.h \
+    $$PWD/testconfig.h
+
+SOURCES += \
+        $$PWD/ptyslave.cpp \
+        $$PWD/testconfig.cpp
+
+LIBS += -lutil
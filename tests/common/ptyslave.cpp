@@ -0,0 +1,344 @@
+﻿#include "ptyslave.h"
+#include "modbusframe.h"
+#include <QSocketNotifier>
+#include <QTimer>
+#include <pty.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+PtySlave::PtySlave(QObject *parent) : QObject(parent),
+    m_masterFd(-1),
+    m_slaveFd(-1),
+    m_notifier(nullptr),
+    m_responseDelayMs(0),
+    m_uExceptionAddr(0),
+    m_uExceptionCode(0),
+    m_bCorruptNext(false),
+    m_bSplitNext(false),
+    m_iCounterAddr(-1),
+    m_lastTxNs(-1),
+    m_responseCount(0),
+    m_pendingResponses(0)
+{
+    m_timer.start();
+}
+
+PtySlave::~PtySlave()
+{
+    delete m_notifier;
+    if(m_masterFd >= 0)
+        ::close(m_masterFd);
+    if(m_slaveFd >= 0)
+        ::close(m_slaveFd);
+}
+
+bool PtySlave::open()
+{
+    char name[256];
+    if(openpty(&m_masterFd, &m_slaveFd, name, nullptr, nullptr) != 0)
+        return false;
+
+    //从端原始模式，不回显、不转换换行，主站打开前就不会改动收到的字节
+    termios tio;
+    tcgetattr(m_slaveFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_slaveFd, TCSANOW, &tio);
+    fcntl(m_masterFd, F_SETFL, fcntl(m_masterFd, F_GETFL) | O_NONBLOCK);
+
+    m_strPortName = QString::fromLocal8Bit(name);
+    m_notifier = new QSocketNotifier(m_masterFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &PtySlave::slot_readable);
+    return true;
+}
+
+QString PtySlave::portName() const
+{
+    return m_strPortName;
+}
+
+qint64 PtySlave::elapsedNs() const
+{
+    return m_timer.nsecsElapsed();
+}
+
+void PtySlave::setServers(const QList<quint8> &serverList)
+{
+    m_serverList = serverList;
+}
+
+void PtySlave::setResponseDelayMs(int iDelayMs)
+{
+    m_responseDelayMs = iDelayMs;
+}
+
+void PtySlave::setExceptionAddress(quint16 uAddr, quint8 uExceptionCode)
+{
+    m_uExceptionAddr = uAddr;
+    m_uExceptionCode = uExceptionCode;
+}
+
+void PtySlave::corruptNextResponse()
+{
+    m_bCorruptNext = true;
+}
+
+void PtySlave::splitNextResponse()
+{
+    m_bSplitNext = true;
+}
+
+void PtySlave::setCounterAddress(int iAddr)
+{
+    m_iCounterAddr = iAddr;
+}
+
+quint16 PtySlave::value(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr) const
+{
+    quint32 uKey = ((quint32)uServerAddr << 24) | ((quint32)eRegTable << 16) | uAddr;
+    return m_valueHash.value(uKey, initialValue(uServerAddr, eRegTable, uAddr));
+}
+
+quint16 PtySlave::initialValue(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr)
+{
+    if(isBitTable(eRegTable))
+        return (uAddr + uServerAddr) % 3 == 0 ? 1 : 0;
+    if(eRegTable == QModbusDataUnit::InputRegisters)
+        return (quint16)(uAddr ^ 0x5A5A ^ uServerAddr);
+    return (quint16)(uAddr * 7 + uServerAddr * 1000);
+}
+
+void PtySlave::setValue(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr, quint16 uValue)
+{
+    quint32 uKey = ((quint32)uServerAddr << 24) | ((quint32)eRegTable << 16) | uAddr;
+    m_valueHash.insert(uKey, uValue);
+}
+
+const QVector<PtyRequest> &PtySlave::requests() const
+{
+    return m_requestList;
+}
+
+void PtySlave::clearRequests()
+{
+    m_requestList.clear();
+}
+
+int PtySlave::responseCount() const
+{
+    return m_responseCount;
+}
+
+bool PtySlave::isResponding() const
+{
+    return m_pendingResponses > 0;
+}
+
+void PtySlave::slot_readable()
+{
+    char buffer[512];
+    while(true)
+    {
+        ssize_t iRead = ::read(m_masterFd, buffer, sizeof(buffer));
+        if(iRead <= 0)
+            break;
+        m_rxBuffer.append(buffer, (int)iRead);
+    }
+
+    while(true)
+    {
+        int iLength = requestLength();
+        if(iLength == 0 || m_rxBuffer.size() < iLength)
+            break;
+        if(iLength < 0)
+        {
+            m_rxBuffer.clear();
+            break;
+        }
+        QByteArray adu = m_rxBuffer.left(iLength);
+        m_rxBuffer.remove(0, iLength);
+        const quint8 *pAdu = reinterpret_cast<const quint8*>(adu.constData());
+        quint16 uCrc = modbusCrc16(pAdu, iLength - 2);
+        if(pAdu[iLength - 2] != (quint8)uCrc || pAdu[iLength - 1] != (quint8)(uCrc >> 8))
+        {
+            m_rxBuffer.clear();
+            break;
+        }
+        handleRequest(adu);
+    }
+}
+
+int PtySlave::requestLength() const
+{
+    if(m_rxBuffer.size() < 2)
+        return 0;
+    switch((quint8)m_rxBuffer.at(1))
+    {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+    case 0x05:
+    case 0x06:
+        return 8;
+    case 0x0F:
+    case 0x10:
+        return m_rxBuffer.size() < 7 ? 0 : 9 + (quint8)m_rxBuffer.at(6);
+    case 0x16:
+        return 10;
+    default:
+        return -1;
+    }
+}
+
+void PtySlave::handleRequest(const QByteArray &adu)
+{
+    PtyRequest request;
+    request.adu = adu;
+    request.iArrivalNs = elapsedNs();
+    request.iGapNs = m_lastTxNs < 0 ? -1 : request.iArrivalNs - m_lastTxNs;
+    m_requestList.append(request);
+
+    quint8 uServerAddr = (quint8)adu.at(0);
+    emit sig_request(uServerAddr, (quint8)adu.at(1));
+    if(!m_serverList.isEmpty() && !m_serverList.contains(uServerAddr))
+        return;
+
+    QByteArray pdu = buildResponse(adu);
+    if(m_responseDelayMs <= 0)
+    {
+        sendResponse(pdu);
+        return;
+    }
+    m_pendingResponses++;
+    QTimer::singleShot(m_responseDelayMs, this, [this, pdu]() {
+        m_pendingResponses--;
+        sendResponse(pdu);
+    });
+}
+
+QByteArray PtySlave::buildResponse(const QByteArray &adu)
+{
+    //返回含从站地址、不含CRC的应答
+    const quint8 *pAdu = reinterpret_cast<const quint8*>(adu.constData());
+    quint8 uServerAddr = pAdu[0];
+    quint8 uFunctionCode = pAdu[1];
+    quint16 uStartAddr = getUInt16(pAdu + 2);
+    quint16 uCount = (uFunctionCode == 0x05 || uFunctionCode == 0x06 || uFunctionCode == 0x16) ? 1 : getUInt16(pAdu + 4);
+
+    QByteArray pdu;
+    pdu.append((char)uServerAddr);
+    if(m_uExceptionCode != 0 && m_uExceptionAddr >= uStartAddr && m_uExceptionAddr < uStartAddr + uCount)
+    {
+        pdu.append((char)(uFunctionCode | 0x80));
+        pdu.append((char)m_uExceptionCode);
+        return pdu;
+    }
+
+    pdu.append((char)uFunctionCode);
+    switch(uFunctionCode)
+    {
+    case 0x01:
+    case 0x02:
+    {
+        QModbusDataUnit::RegisterType eRegTable = uFunctionCode == 0x01 ? QModbusDataUnit::Coils : QModbusDataUnit::DiscreteInputs;
+        QByteArray bitBytes((uCount + 7) / 8, 0);
+        for(int i=0; i<uCount; i++)
+        {
+            if(value(uServerAddr, eRegTable, uStartAddr + i))
+                bitBytes[i / 8] = (char)(bitBytes.at(i / 8) | (1 << (i % 8)));
+        }
+        pdu.append((char)bitBytes.size());
+        pdu.append(bitBytes);
+        break;
+    }
+    case 0x03:
+    case 0x04:
+    {
+        QModbusDataUnit::RegisterType eRegTable = uFunctionCode == 0x03 ? QModbusDataUnit::HoldingRegisters : QModbusDataUnit::InputRegisters;
+        pdu.append((char)(uCount * 2));
+        for(int i=0; i<uCount; i++)
+        {
+            quint16 uValue = value(uServerAddr, eRegTable, uStartAddr + i);
+            pdu.append((char)(uValue >> 8));
+            pdu.append((char)uValue);
+        }
+        if(eRegTable == QModbusDataUnit::HoldingRegisters && m_iCounterAddr >= uStartAddr && m_iCounterAddr < uStartAddr + uCount)
+            setValue(uServerAddr, eRegTable, (quint16)m_iCounterAddr, value(uServerAddr, eRegTable, (quint16)m_iCounterAddr) + 1);
+        break;
+    }
+    case 0x05:
+        setValue(uServerAddr, QModbusDataUnit::Coils, uStartAddr, getUInt16(pAdu + 4) == 0xFF00 ? 1 : 0);
+        pdu.append(adu.mid(2, 4));
+        break;
+    case 0x06:
+        setValue(uServerAddr, QModbusDataUnit::HoldingRegisters, uStartAddr, getUInt16(pAdu + 4));
+        pdu.append(adu.mid(2, 4));
+        break;
+    case 0x0F:
+        for(int i=0; i<uCount; i++)
+            setValue(uServerAddr, QModbusDataUnit::Coils, uStartAddr + i, (pAdu[7 + i / 8] >> (i % 8)) & 0x01);
+        pdu.append(adu.mid(2, 4));
+        break;
+    case 0x10:
+        for(int i=0; i<uCount; i++)
+            setValue(uServerAddr, QModbusDataUnit::HoldingRegisters, uStartAddr + i, getUInt16(pAdu + 7 + i * 2));
+        pdu.append(adu.mid(2, 4));
+        break;
+    case 0x16:
+    {
+        quint16 uOldValue = value(uServerAddr, QModbusDataUnit::HoldingRegisters, uStartAddr);
+        setValue(uServerAddr, QModbusDataUnit::HoldingRegisters, uStartAddr,
+                 applyMaskWrite(uOldValue, getUInt16(pAdu + 4), getUInt16(pAdu + 6)));
+        pdu.append(adu.mid(2, 6));
+        break;
+    }
+    default:
+        break;
+    }
+    return pdu;
+}
+
+void PtySlave::sendResponse(const QByteArray &pdu)
+{
+    QByteArray adu = pdu;
+    quint16 uCrc = modbusCrc16(reinterpret_cast<const quint8*>(adu.constData()), adu.size());
+    if(m_bCorruptNext)
+        uCrc = ~uCrc;
+    m_bCorruptNext = false;
+    adu.append((char)uCrc);
+    adu.append((char)(uCrc >> 8));
+    m_responseCount++;
+
+    if(!m_bSplitNext)
+    {
+        writeAdu(adu);
+        return;
+    }
+    m_bSplitNext = false;
+    writeAdu(adu.left(3));
+    QByteArray tail = adu.mid(3);
+    QTimer::singleShot(0, this, [this, tail]() {
+        writeAdu(tail);
+    });
+}
+
+void PtySlave::writeAdu(const QByteArray &adu)
+{
+    const char *pData = adu.constData();
+    int iLeft = adu.size();
+    while(iLeft > 0)
+    {
+        ssize_t iWritten = ::write(m_masterFd, pData, iLeft);
+        if(iWritten < 0)
+        {
+            if(errno == EAGAIN || errno == EINTR)
+                continue;
+            break;
+        }
+        pData += iWritten;
+        iLeft -= (int)iWritten;
+    }
+    m_lastTxNs = elapsedNs();
+}
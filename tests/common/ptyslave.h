@@ -0,0 +1,97 @@
+﻿#ifndef PTYSLAVE_H
+#define PTYSLAVE_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QModbusDataUnit>
+
+class QSocketNotifier;
+
+//从站收到的一个请求帧
+struct PtyRequest
+{
+    QByteArray adu;                 //含从站地址和CRC
+    qint64 iArrivalNs;              //读到完整帧的时间，PtySlave::elapsedNs的时基
+    qint64 iGapNs;                  //距上一个应答写出的时间，之前没有应答为-1
+};
+
+/* 测试用Modbus RTU从站，在伪终端主端收发，被测主站打开portName()
+ * 伪终端没有波特率，字节立即到达，请求之间的间隔只反映主站自己的等待
+ * 寄存器、线圈的初值由地址生成，写请求改写后读回新值
+*/
+class PtySlave : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PtySlave(QObject *parent = nullptr);
+    ~PtySlave();
+
+    bool open();
+    QString portName() const;
+    qint64 elapsedNs() const;
+
+    //只应答列出的从站地址，为空时应答全部
+    void setServers(const QList<quint8> &serverList);
+    //收到请求后延时应答，0立即应答
+    void setResponseDelayMs(int iDelayMs);
+    //读写范围包含uAddr时应答异常
+    void setExceptionAddress(quint16 uAddr, quint8 uExceptionCode);
+    //下一个应答的CRC取反
+    void corruptNextResponse();
+    //下一个应答分两次写出，第二段在下一轮事件循环
+    void splitNextResponse();
+    //保持寄存器uAddr每被读一次加1，模拟持续变化的值，-1不启用
+    void setCounterAddress(int iAddr);
+
+    quint16 value(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr) const;
+    //模拟PLC自己改写寄存器
+    void setValue(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr, quint16 uValue);
+    static quint16 initialValue(quint8 uServerAddr, QModbusDataUnit::RegisterType eRegTable, quint16 uAddr);
+
+    const QVector<PtyRequest> &requests() const;
+    void clearRequests();
+    //已写出的应答数，不含不应答的从站地址
+    int responseCount() const;
+    //有请求在等待延时应答
+    bool isResponding() const;
+
+signals:
+    void sig_request(quint8 uServerAddr, quint8 uFunctionCode);
+
+private slots:
+    void slot_readable();
+
+private:
+    //按功能码推算请求帧长，字节不足返回0，无法识别返回-1
+    int requestLength() const;
+    void handleRequest(const QByteArray &adu);
+    QByteArray buildResponse(const QByteArray &adu);
+    void sendResponse(const QByteArray &pdu);
+    void writeAdu(const QByteArray &adu);
+
+private:
+    int m_masterFd;
+    int m_slaveFd;                  //保持打开，被测主站关闭从端时主端不会挂断
+    QString m_strPortName;
+    QSocketNotifier *m_notifier;
+    QElapsedTimer m_timer;
+    QByteArray m_rxBuffer;
+    QList<quint8> m_serverList;
+    int m_responseDelayMs;
+    quint16 m_uExceptionAddr;
+    quint8 m_uExceptionCode;        //0不应答异常
+    bool m_bCorruptNext;
+    bool m_bSplitNext;
+    int m_iCounterAddr;
+    qint64 m_lastTxNs;              //最近一个应答写出的时间，没有为-1
+    int m_responseCount;
+    int m_pendingResponses;
+    QHash<quint32, quint16> m_valueHash;
+    QVector<PtyRequest> m_requestList;
+};
+
+#endif // PTYSLAVE_H
@@ -0,0 +1,81 @@
+﻿#include "testconfig.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+QString TestConfig::configDir()
+{
+    return qApp->applicationDirPath() + "/config";
+}
+
+bool TestConfig::writeConfig(const QString &strIni)
+{
+    return writeFile("Config.ini", strIni.toUtf8());
+}
+
+bool TestConfig::writeProtocol(const QString &strFileName, quint8 uServerAddr, const QList<TestSignal> &signalList,
+                               const QList<TestAlarm> &alarmList)
+{
+    QJsonArray signalArray;
+    for(int i=0; i<signalList.size(); i++)
+    {
+        const TestSignal &testSignal = signalList.at(i);
+        QJsonObject obj;
+        obj.insert("Key", testSignal.strKey);
+        obj.insert("ParamName", testSignal.strKey);
+        obj.insert("Type", testSignal.strType);
+        obj.insert("Desc", QString());
+        obj.insert("Length", QString::number(testSignal.iLength));
+        obj.insert("BitPos", QString::number(testSignal.uBitPos));
+        obj.insert("RegisterAddr", QString::number(testSignal.uRegisterAddr));
+        if(!testSignal.strTable.isEmpty())
+            obj.insert("Table", testSignal.strTable);
+        signalArray.append(obj);
+    }
+    QJsonArray alarmArray;
+    for(int i=0; i<alarmList.size(); i++)
+    {
+        const TestAlarm &testAlarm = alarmList.at(i);
+        QJsonObject obj;
+        obj.insert("Key", testAlarm.strKey);
+        obj.insert("Signal", testAlarm.strSignalKey);
+        obj.insert("Kind", testAlarm.strKind);
+        obj.insert("Limit", QString::number(testAlarm.dLimit));
+        alarmArray.append(obj);
+    }
+    QJsonObject rootObj;
+    rootObj.insert("ServerAddress", QString::number(uServerAddr));
+    rootObj.insert("SignalArray", signalArray);
+    if(!alarmArray.isEmpty())
+        rootObj.insert("AlarmArray", alarmArray);
+    return writeFile(strFileName, QJsonDocument(rootObj).toJson());
+}
+
+bool TestConfig::writeDevices(const QString &strFileName, quint8 uServerAddr, const QList<quint16> &portList)
+{
+    QJsonArray deviceArray;
+    for(int i=0; i<portList.size(); i++)
+    {
+        QJsonObject obj;
+        obj.insert("Name", QString("Device%1").arg(i));
+        obj.insert("IPPort", QString("127.0.0.1:%1").arg(portList.at(i)));
+        obj.insert("ServerAddress", QString::number(uServerAddr));
+        obj.insert("Protocol", QString("Protocol.json"));
+        deviceArray.append(obj);
+    }
+    QJsonObject rootObj;
+    rootObj.insert("DeviceArray", deviceArray);
+    return writeFile(strFileName, QJsonDocument(rootObj).toJson());
+}
+
+bool TestConfig::writeFile(const QString &strFileName, const QByteArray &content)
+{
+    QDir().mkpath(configDir());
+    QFile file(configDir() + "/" + strFileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(content) == content.size();
+}
@@ -0,0 +1,48 @@
+﻿#ifndef TESTCONFIG_H
+#define TESTCONFIG_H
+
+#include <QString>
+#include <QList>
+#include <QByteArray>
+
+//协议文件中的一个信号
+struct TestSignal
+{
+    TestSignal() : uRegisterAddr(0), uBitPos(0), iLength(16) {}
+
+    QString strKey;
+    quint16 uRegisterAddr;
+    quint16 uBitPos;
+    QString strTable;               //空为保持寄存器
+    QString strType;                //含O为输出
+    int iLength;
+};
+
+//协议文件中的一个告警
+struct TestAlarm
+{
+    QString strKey;
+    QString strSignalKey;
+    QString strKind;                //High、Low、Rate、Equal、NotEqual
+    double dLimit;
+};
+
+/* 服务按qApp->applicationDirPath()下的config读配置，测试在自己的目录下生成
+ * 每个测试用例重新写Config.ini后再创建服务
+*/
+class TestConfig
+{
+public:
+    static QString configDir();
+    //strIni: Config.ini的全文
+    static bool writeConfig(const QString &strIni);
+    static bool writeProtocol(const QString &strFileName, quint8 uServerAddr, const QList<TestSignal> &signalList,
+                              const QList<TestAlarm> &alarmList = QList<TestAlarm>());
+    //采集器设备表，每个端口一台127.0.0.1上的设备，都使用Protocol.json
+    static bool writeDevices(const QString &strFileName, quint8 uServerAddr, const QList<quint16> &portList);
+
+private:
+    static bool writeFile(const QString &strFileName, const QByteArray &content);
+};
+
+#endif // TESTCONFIG_H
@@ -0,0 +1,15 @@
+QT -= gui
+QT += testlib serialbus
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_derivedexpr
+INCLUDEPATH += $$PWD/../../src
+
+HEADERS += \
+        ../../src/derivedsignalengine.h
+
+SOURCES += \
+        tst_derivedexpr.cpp \
+        ../../src/derivedsignalengine.cpp
@@ -0,0 +1,257 @@
+﻿#include <QtTest>
+#include "derivedsignalengine.h"
+
+/* 派生信号表达式的编译和计算
+ * 输入信号A=6、B=3，派生信号追加在信号表末尾
+*/
+class TestDerivedExpr : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void precedence_data();
+    void precedence();
+    void parseError_data();
+    void parseError();
+    void topologicalOrder();
+    void circularReference();
+    void rate();
+    void untakenBranch();
+
+private:
+    //追加一个派生信号，返回其信号下标，编译失败返回-1
+    int addDerived(const QString &strKey, const QString &strExpr, QString &strError);
+    //输入信号读回一次
+    void sample(int iSignalIndex, double dValue, qint64 iAcqMonoNs);
+
+private:
+    DerivedSignalEngine m_engine;
+    QVector<SignalParameter> m_signalList;
+    QHash<QString, int> m_signalIndexHash;
+    quint64 m_uVersion;
+};
+
+static SignalParameter makeSignal(const QString &strKey, double dValue)
+{
+    SignalParameter signalParam;
+    signalParam.strKey = strKey;
+    signalParam.uValue = (quint64)dValue;
+    signalParam.dValue = dValue;
+    signalParam.uVersion = 0;
+    signalParam.uQuality = Quality_NoValue;
+    signalParam.uExceptionCode = 0;
+    signalParam.iAcqMonoNs = 0;
+    signalParam.iAcqTimeMs = 0;
+    return signalParam;
+}
+
+void TestDerivedExpr::init()
+{
+    m_engine.clear();
+    m_signalList.clear();
+    m_signalIndexHash.clear();
+    m_uVersion = 0;
+    m_signalList.append(makeSignal("A", 6));
+    m_signalList.append(makeSignal("B", 3));
+    m_signalIndexHash.insert("A", 0);
+    m_signalIndexHash.insert("B", 1);
+}
+
+int TestDerivedExpr::addDerived(const QString &strKey, const QString &strExpr, QString &strError)
+{
+    int iSignalIndex = m_signalList.size();
+    m_signalList.append(makeSignal(strKey, 0));
+    m_signalIndexHash.insert(strKey, iSignalIndex);
+    if(!m_engine.addSignal(iSignalIndex, strExpr, QString(), m_signalIndexHash, strError))
+        return -1;
+    return iSignalIndex;
+}
+
+void TestDerivedExpr::sample(int iSignalIndex, double dValue, qint64 iAcqMonoNs)
+{
+    SignalParameter &signalParam = m_signalList[iSignalIndex];
+    bool bChanged = signalParam.dValue != dValue || signalParam.uQuality != Quality_Good;
+    signalParam.dValue = dValue;
+    signalParam.uQuality = Quality_Good;
+    signalParam.iAcqMonoNs = iAcqMonoNs;
+    signalParam.iAcqTimeMs = iAcqMonoNs / 1000000;
+    m_engine.markInput(iSignalIndex, bChanged);
+    m_engine.evaluate(m_signalList, ++m_uVersion);
+}
+
+void TestDerivedExpr::precedence_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<double>("expected");
+    QTest::newRow("* before +") << "1 + 2 * 3" << 7.0;
+    QTest::newRow("parentheses") << "(1 + 2) * 3" << 9.0;
+    QTest::newRow("+ before <<") << "1 << 2 + 1" << 8.0;
+    QTest::newRow("& before ^ before |") << "1 | 2 ^ 3 & 1" << 3.0;
+    QTest::newRow("comparison before ==") << "1 < 2 == 1" << 1.0;
+    QTest::newRow("== before &&") << "A == 6 && B == 3" << 1.0;
+    QTest::newRow("&& before ||") << "1 || 0 && 0" << 1.0;
+    QTest::newRow("|| left to right") << "0 && 1 || 1" << 1.0;
+    QTest::newRow("&& gives 0 or 1") << "2 && 3" << 1.0;
+    QTest::newRow("|| gives 0 or 1") << "0 || 5" << 1.0;
+    QTest::newRow("- left to right") << "10 - 4 - 3" << 3.0;
+    QTest::newRow("unary minus") << "-2 * -3" << 6.0;
+    QTest::newRow("unary not") << "!0 + !A" << 1.0;
+    QTest::newRow("bitwise not") << "~0" << -1.0;
+    QTest::newRow("ternary") << "A > B ? A - B : B - A" << 3.0;
+    QTest::newRow("ternary right to left") << "0 ? 2 : 0 ? 3 : 4" << 4.0;
+    QTest::newRow("ternary in condition") << "(A < B ? 0 : 1) ? 5 : 6" << 5.0;
+    QTest::newRow("ternary below ||") << "0 || 0 ? 1 : 2" << 2.0;
+    QTest::newRow("functions") << "min(4, A, B) + max(1, 2) + bit(A, 1)" << 6.0;
+    QTest::newRow("rounding") << "floor(2.5) + ceil(2.5) + round(2.5) + abs(-1)" << 9.0;
+    QTest::newRow("modulo") << "7 % 4 == 3" << 1.0;
+    QTest::newRow("hex and exponent") << "0x10 + 1e1" << 26.0;
+    QTest::newRow("negative shift left") << "-1 << 1" << -2.0;
+    QTest::newRow("shift into sign bit") << "1 << 63" << -9223372036854775808.0;
+}
+
+void TestDerivedExpr::precedence()
+{
+    QFETCH(QString, expr);
+    QFETCH(double, expected);
+    //常量表达式没有输入不会被计算，补上A、B
+    QString strError;
+    int iSignalIndex = addDerived("D", QString("A - A + B - B + (%1)").arg(expr), strError);
+    QVERIFY2(iSignalIndex >= 0, qPrintable(strError));
+    QVERIFY(m_engine.finalize(m_signalList, strError));
+
+    sample(0, 6, 1000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).uQuality, (quint8)Quality_NoValue);
+    sample(1, 3, 1000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).uQuality, (quint8)Quality_Good);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, expected);
+}
+
+void TestDerivedExpr::parseError_data()
+{
+    QTest::addColumn<QString>("expr");
+    QTest::addColumn<QString>("error");
+    QTest::newRow("missing operand") << "1 +" << "unexpected end at column 4";
+    QTest::newRow("unclosed parenthesis") << "(1" << "expected ')'";
+    QTest::newRow("missing colon") << "A ? 1" << "expected ':'";
+    QTest::newRow("trailing token") << "1 2" << "unexpected '2' at column 3";
+    QTest::newRow("unknown signal") << "C + 1" << "unknown signal C";
+    QTest::newRow("unknown function") << "foo(1)" << "unknown function foo()";
+    QTest::newRow("argument count") << "min(1)" << "wrong number of arguments to min()";
+    QTest::newRow("rate of a constant") << "rate(1)" << "rate() takes a signal key";
+    QTest::newRow("too deep") << QString("1") + QString(" + (1").repeated(40) + QString(")").repeated(40) << "expression too deep";
+}
+
+void TestDerivedExpr::parseError()
+{
+    QFETCH(QString, expr);
+    QFETCH(QString, error);
+    QString strError;
+    QCOMPARE(addDerived("D", expr, strError), -1);
+    QVERIFY2(strError.contains(error), qPrintable(strError));
+
+    //失败的编译不留下代码，之后的信号照常编译
+    int iSignalIndex = addDerived("E", "A + B", strError);
+    QVERIFY(iSignalIndex >= 0);
+    QVERIFY(m_engine.finalize(m_signalList, strError));
+    QCOMPARE(m_engine.getSignalCount(), 1);
+    sample(0, 6, 1000000000LL);
+    sample(1, 3, 1000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 9.0);
+}
+
+void TestDerivedExpr::topologicalOrder()
+{
+    //D2在D1之前定义，finalize后D1先算，一次evaluate算到D2
+    QString strError;
+    int iD2 = m_signalList.size();
+    m_signalIndexHash.insert("D1", iD2 + 1);
+    QCOMPARE(addDerived("D2", "D1 * 2", strError), iD2);
+    int iD1 = addDerived("D1", "A + 1", strError);
+    QCOMPARE(iD1, iD2 + 1);
+    QVERIFY(m_engine.finalize(m_signalList, strError));
+
+    sample(0, 6, 1000000000LL);
+    QCOMPARE(m_signalList.at(iD1).dValue, 7.0);
+    QCOMPARE(m_signalList.at(iD2).dValue, 14.0);
+    QVERIFY(m_engine.getUpdatedList().indexOf(iD1) < m_engine.getUpdatedList().indexOf(iD2));
+
+    sample(0, 10, 2000000000LL);
+    QCOMPARE(m_signalList.at(iD2).dValue, 22.0);
+}
+
+void TestDerivedExpr::circularReference()
+{
+    //C1、C2互相引用，C3依赖环，D不受影响
+    QString strError;
+    int iFirst = m_signalList.size();
+    m_signalIndexHash.insert("C2", iFirst + 1);
+    int iC1 = addDerived("C1", "C2 + 1", strError);
+    int iC2 = addDerived("C2", "C1 + 1", strError);
+    int iC3 = addDerived("C3", "C1 + A", strError);
+    int iD = addDerived("D", "A + 1", strError);
+    QVERIFY(iC1 >= 0 && iC2 >= 0 && iC3 >= 0 && iD >= 0);
+    QVERIFY(!m_engine.finalize(m_signalList, strError));
+    QVERIFY2(strError.contains("C1") && strError.contains("C2") && strError.contains("C3"), qPrintable(strError));
+    QVERIFY2(!strError.contains("D"), qPrintable(strError));
+
+    sample(0, 6, 1000000000LL);
+    QCOMPARE(m_signalList.at(iD).dValue, 7.0);
+    QCOMPARE(m_signalList.at(iC3).uQuality, (quint8)Quality_NoValue);
+    QCOMPARE(m_engine.getUpdatedList(), QVector<int>() << iD);
+}
+
+void TestDerivedExpr::rate()
+{
+    QString strError;
+    int iSignalIndex = addDerived("D", "rate(A)", strError);
+    QVERIFY2(iSignalIndex >= 0, qPrintable(strError));
+    QVERIFY(m_engine.finalize(m_signalList, strError));
+
+    //第一个样本没有变化量
+    sample(0, 0, 1000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 0.0);
+    sample(0, 10, 2000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 10.0);
+    sample(0, 15, 2500000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 10.0);
+
+    //值不变也按新样本重算
+    sample(0, 15, 3000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 0.0);
+
+    //同一次读回重复计算时保持上次结果
+    sample(0, 20, 4000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 5.0);
+    m_engine.markInput(0, true);
+    m_engine.evaluate(m_signalList, ++m_uVersion);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 5.0);
+}
+
+void TestDerivedExpr::untakenBranch()
+{
+    //B非0时rate不在取到的分支上，不更新样本
+    QString strError;
+    int iSignalIndex = addDerived("D", "B != 0 ? -1 : rate(A)", strError);
+    int iAndIndex = addDerived("E", "B == 0 && rate(A) > 0", strError);
+    QVERIFY2(iSignalIndex >= 0 && iAndIndex >= 0, qPrintable(strError));
+    QVERIFY(m_engine.finalize(m_signalList, strError));
+
+    sample(1, 3, 1000000000LL);
+    sample(0, 0, 1000000000LL);
+    sample(0, 100, 2000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, -1.0);
+    QCOMPARE(m_signalList.at(iAndIndex).dValue, 0.0);
+
+    //切到rate分支后A=100@2s才作为第一个样本，之前算过的话这里会是100
+    sample(1, 0, 3000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 0.0);
+    QCOMPARE(m_signalList.at(iAndIndex).dValue, 0.0);
+    sample(0, 110, 3000000000LL);
+    QCOMPARE(m_signalList.at(iSignalIndex).dValue, 10.0);
+    QCOMPARE(m_signalList.at(iAndIndex).dValue, 1.0);
+}
+
+QTEST_GUILESS_MAIN(TestDerivedExpr)
+
+#include "tst_derivedexpr.moc"
@@ -0,0 +1,146 @@
+﻿#include <QtTest>
+#include "ptyslave.h"
+#include "testconfig.h"
+#include "modbusservice.h"
+
+/* 位域输出寄存器的周期写，被测服务经伪终端连到PtySlave
+ * 寄存器中Run、Mode两个位域归服务，其余位归PLC
+ * 首次读回前不写；屏蔽写开启时只用功能码22写自己的位，PLC之后改写的位不被改回
+*/
+class TestFieldRefresh : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void refresh_data();
+    void refresh();
+
+private:
+    //请求表中第一个对寄存器s_fieldAddr使用uFunctionCode的请求下标，没有时返回-1
+    int firstRequest(quint8 uFunctionCode) const;
+    int requestCount(quint8 uFunctionCode) const;
+
+private:
+    PtySlave m_slave;
+};
+
+static const quint16 s_fieldAddr = 300;
+static const quint16 s_ownMask = 0x00F1;    //Run为第0位，Mode为第4-7位
+
+void TestFieldRefresh::initTestCase()
+{
+    QVERIFY(m_slave.open());
+    QList<TestSignal> signalList;
+    TestSignal runSignal;
+    runSignal.strKey = "Run";
+    runSignal.uRegisterAddr = s_fieldAddr;
+    runSignal.uBitPos = 0;
+    runSignal.iLength = 1;
+    runSignal.strType = "DO";
+    signalList.append(runSignal);
+    TestSignal modeSignal;
+    modeSignal.strKey = "Mode";
+    modeSignal.uRegisterAddr = s_fieldAddr;
+    modeSignal.uBitPos = 4;
+    modeSignal.iLength = 4;
+    modeSignal.strType = "AO";
+    signalList.append(modeSignal);
+    QVERIFY(TestConfig::writeProtocol("Protocol.json", 1, signalList));
+}
+
+int TestFieldRefresh::firstRequest(quint8 uFunctionCode) const
+{
+    const QVector<PtyRequest> &requestList = m_slave.requests();
+    for(int i=0; i<requestList.size(); i++)
+    {
+        const QByteArray &adu = requestList.at(i).adu;
+        if(adu.size() >= 4 && (quint8)adu.at(1) == uFunctionCode
+           && (((quint8)adu.at(2) << 8) | (quint8)adu.at(3)) == s_fieldAddr)
+            return i;
+    }
+    return -1;
+}
+
+int TestFieldRefresh::requestCount(quint8 uFunctionCode) const
+{
+    int iCount = 0;
+    const QVector<PtyRequest> &requestList = m_slave.requests();
+    for(int i=0; i<requestList.size(); i++)
+    {
+        const QByteArray &adu = requestList.at(i).adu;
+        if(adu.size() >= 4 && (quint8)adu.at(1) == uFunctionCode
+           && (((quint8)adu.at(2) << 8) | (quint8)adu.at(3)) == s_fieldAddr)
+            iCount++;
+    }
+    return iCount;
+}
+
+void TestFieldRefresh::refresh_data()
+{
+    QTest::addColumn<int>("engine");
+    QTest::addColumn<int>("maskWrite");
+    QTest::newRow("QModbusRtuSerialMaster, mask write") << 0 << 1;
+    QTest::newRow("ModbusRtuEngine, mask write") << 1 << 1;
+    QTest::newRow("QModbusRtuSerialMaster, read-modify-write") << 0 << 0;
+    QTest::newRow("ModbusRtuEngine, read-modify-write") << 1 << 0;
+}
+
+void TestFieldRefresh::refresh()
+{
+    QFETCH(int, engine);
+    QFETCH(int, maskWrite);
+    QVERIFY(TestConfig::writeConfig(QString("ConnectType=0\n"
+                                            "Debug=0\n"
+                                            "[Serial]\n"
+                                            "PortName=%1\n"
+                                            "Parity=None\n"
+                                            "BaudRate=115200\n"
+                                            "DataBits=8\n"
+                                            "StopBits=1\n"
+                                            "Engine=%2\n"
+                                            "[Exception]\n"
+                                            "Timeout=500\n"
+                                            "NumberOfRetries=0\n"
+                                            "[Poll]\n"
+                                            "Period=50\n"
+                                            "[Scheduler]\n"
+                                            "MaskWrite=%3\n")
+                                    .arg(m_slave.portName())
+                                    .arg(engine)
+                                    .arg(maskWrite)));
+    quint16 uInitial = PtySlave::initialValue(1, QModbusDataUnit::HoldingRegisters, s_fieldAddr);
+    m_slave.setValue(1, QModbusDataUnit::HoldingRegisters, s_fieldAddr, uInitial);
+    m_slave.clearRequests();
+
+    quint8 uWriteCode = maskWrite ? 0x16 : 0x06;
+    ModBusService *pService = new ModBusService();
+    QTRY_VERIFY_WITH_TIMEOUT(requestCount(uWriteCode) >= 3, 5000);
+
+    //首次读回之前不写
+    QVERIFY(firstRequest(0x03) >= 0);
+    QVERIFY(firstRequest(uWriteCode) > firstRequest(0x03));
+    QCOMPARE(m_slave.value(1, QModbusDataUnit::HoldingRegisters, s_fieldAddr), uInitial);
+
+    if(maskWrite)
+    {
+        QCOMPARE(firstRequest(0x06), -1);
+        QCOMPARE(firstRequest(0x10), -1);
+
+        //PLC改写自己的位后，周期写不改回
+        quint16 uPlcValue = (uInitial & s_ownMask) | 0x3300;
+        m_slave.setValue(1, QModbusDataUnit::HoldingRegisters, s_fieldAddr, uPlcValue);
+        int iWrites = requestCount(uWriteCode);
+        QTRY_VERIFY_WITH_TIMEOUT(requestCount(uWriteCode) >= iWrites + 3, 5000);
+        QCOMPARE(m_slave.value(1, QModbusDataUnit::HoldingRegisters, s_fieldAddr), uPlcValue);
+    }
+    else
+    {
+        QCOMPARE(firstRequest(0x16), -1);
+    }
+    delete pService;
+}
+
+QTEST_GUILESS_MAIN(TestFieldRefresh)
+
+#include "tst_fieldrefresh.moc"
@@ -0,0 +1,11 @@
+QT -= gui
+QT += testlib serialbus
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_maskmerge
+INCLUDEPATH += $$PWD/../../src
+
+SOURCES += \
+        tst_maskmerge.cpp
@@ -0,0 +1,67 @@
+﻿#include <QtTest>
+#include "modbusframe.h"
+
+//合并后的一次屏蔽写应与依次执行两次屏蔽写结果相同
+class TestMaskMerge : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void internalMasks();
+    void overlappingOrMask();
+    void randomMasks();
+};
+
+static bool sameAsSequential(quint16 uRegValue, quint16 uAnd1, quint16 uOr1, quint16 uAnd2, quint16 uOr2)
+{
+    quint16 uExpected = applyMaskWrite(applyMaskWrite(uRegValue, uAnd1, uOr1), uAnd2, uOr2);
+    quint16 uAndMask = uAnd1;
+    quint16 uOrMask = uOr1;
+    mergeMaskWrite(uAndMask, uOrMask, uAnd2, uOr2);
+    return applyMaskWrite(uRegValue, uAndMask, uOrMask) == uExpected;
+}
+
+void TestMaskMerge::internalMasks()
+{
+    //服务生成的掩码OR只在字段内，字段外AND为1
+    QVERIFY(sameAsSequential(0x1234, 0xFF0F, 0x0050, 0xF0FF, 0x0A00));
+    QVERIFY(sameAsSequential(0xFFFF, 0xFF0F, 0x0000, 0xFF0F, 0x00A0));
+}
+
+void TestMaskMerge::overlappingOrMask()
+{
+    //代理转发的原始帧: 第二次OR在自己保留的位上也置位，这些位应取第一次的结果
+    QVERIFY(sameAsSequential(0x0000, 0xFF00, 0x00FF, 0x0FFF, 0xFFFF));
+    QVERIFY(sameAsSequential(0xAAAA, 0x00FF, 0x5555, 0xF0F0, 0xFFFF));
+
+    quint16 uAndMask = 0xFFF0;
+    quint16 uOrMask = 0x0005;
+    mergeMaskWrite(uAndMask, uOrMask, 0xFF0F, 0xFFFF);
+    QCOMPARE(uAndMask, (quint16)0xFF00);
+    QCOMPARE(applyMaskWrite(0x0000, uAndMask, uOrMask), (quint16)0x00F5);
+}
+
+void TestMaskMerge::randomMasks()
+{
+    quint32 uSeed = 12345;
+    for(int i=0; i<100000; i++)
+    {
+        quint16 uMaskList[5];
+        for(int j=0; j<5; j++)
+        {
+            uSeed = uSeed * 1103515245 + 12345;
+            uMaskList[j] = (quint16)(uSeed >> 16);
+        }
+        if(!sameAsSequential(uMaskList[0], uMaskList[1], uMaskList[2], uMaskList[3], uMaskList[4]))
+            QFAIL(qPrintable(QString("R=%1 A1=%2 O1=%3 A2=%4 O2=%5")
+                             .arg(uMaskList[0], 4, 16, QChar('0'))
+                             .arg(uMaskList[1], 4, 16, QChar('0'))
+                             .arg(uMaskList[2], 4, 16, QChar('0'))
+                             .arg(uMaskList[3], 4, 16, QChar('0'))
+                             .arg(uMaskList[4], 4, 16, QChar('0'))));
+    }
+}
+
+QTEST_APPLESS_MAIN(TestMaskMerge)
+
+#include "tst_maskmerge.moc"
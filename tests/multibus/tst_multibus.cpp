@@ -0,0 +1,110 @@
+﻿#include <QtTest>
+#include "ptyslave.h"
+#include "testconfig.h"
+#include "busmanager.h"
+
+/* 多串口并行，Bus/Groups的每个串口一个线程
+ * Bus1的从站延时应答，其请求未完成期间Bus2照常轮询，两条总线互不等待
+ * Bus1上按Units配置两个从站，都应被轮询到
+*/
+class TestMultiBus : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void parallelBuses();
+
+private:
+    QString busConfig(const QString &strGroup, const QString &strPortName, const QString &strUnits) const;
+
+private:
+    PtySlave m_slowSlave;
+    PtySlave m_fastSlave;
+};
+
+static const int s_slowDelayMs = 300;
+
+void TestMultiBus::initTestCase()
+{
+    QVERIFY(m_slowSlave.open());
+    QVERIFY(m_fastSlave.open());
+    m_slowSlave.setResponseDelayMs(s_slowDelayMs);
+
+    QList<TestSignal> signalList;
+    for(int i=0; i<2; i++)
+    {
+        TestSignal testSignal;
+        testSignal.strKey = QString("Value%1").arg(i);
+        testSignal.uRegisterAddr = (quint16)(100 + i);
+        testSignal.strType = "AI";
+        testSignal.iLength = 16;
+        signalList.append(testSignal);
+    }
+    QVERIFY(TestConfig::writeProtocol("Protocol.json", 1, signalList));
+}
+
+QString TestMultiBus::busConfig(const QString &strGroup, const QString &strPortName, const QString &strUnits) const
+{
+    return QString("[%1]\n"
+                   "PortName=%2\n"
+                   "Parity=None\n"
+                   "BaudRate=19200\n"
+                   "DataBits=8\n"
+                   "StopBits=1\n"
+                   "Units=%3\n")
+            .arg(strGroup)
+            .arg(strPortName)
+            .arg(strUnits);
+}
+
+void TestMultiBus::parallelBuses()
+{
+    QString strIni = QString("Debug=0\n"
+                             "[Bus]\n"
+                             "Groups=Bus1, Bus2\n"
+                             "[Exception]\n"
+                             "Timeout=1000\n"
+                             "NumberOfRetries=0\n"
+                             "[Poll]\n"
+                             "Period=100\n");
+    strIni += busConfig("Bus1", m_slowSlave.portName(), "1:Protocol.json:B1U1_, 2:Protocol.json:B1U2_");
+    strIni += busConfig("Bus2", m_fastSlave.portName(), QString());
+    QVERIFY(TestConfig::writeConfig(strIni));
+
+    //两个从站都在主线程，Bus2的请求到达时可直接查看Bus1是否有应答在等待
+    int iOverlapRequests = 0;
+    connect(&m_fastSlave, &PtySlave::sig_request, this, [this, &iOverlapRequests](quint8, quint8) {
+        if(m_slowSlave.isResponding())
+            iOverlapRequests++;
+    });
+
+    BusManager *pBusManager = new BusManager();
+    pBusManager->start();
+    QTRY_VERIFY_WITH_TIMEOUT(m_slowSlave.responseCount() >= 4, 5000);
+    delete pBusManager;
+    disconnect(&m_fastSlave, &PtySlave::sig_request, this, nullptr);
+
+    //Bus1每个请求占用300ms，其间Bus2按100ms周期至少完成两次轮询
+    QVERIFY2(iOverlapRequests >= 4,
+             qPrintable(QString("only %1 Bus2 requests while Bus1 was waiting").arg(iOverlapRequests)));
+    QVERIFY(m_fastSlave.responseCount() > m_slowSlave.responseCount());
+
+    bool bUnit1Polled = false;
+    bool bUnit2Polled = false;
+    const QVector<PtyRequest> &requestList = m_slowSlave.requests();
+    for(int i=0; i<requestList.size(); i++)
+    {
+        quint8 uServerAddr = (quint8)requestList.at(i).adu.at(0);
+        if(uServerAddr == 1)
+            bUnit1Polled = true;
+        else if(uServerAddr == 2)
+            bUnit2Polled = true;
+    }
+    QVERIFY(bUnit1Polled);
+    QVERIFY(bUnit2Polled);
+}
+
+QTEST_GUILESS_MAIN(TestMultiBus)
+
+#include "tst_multibus.moc"
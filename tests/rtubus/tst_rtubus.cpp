@@ -0,0 +1,161 @@
+﻿#include <QtTest>
+#include "ptyslave.h"
+#include "testconfig.h"
+#include "modbusservice.h"
+#include "rtutiming.h"
+
+/* RTU总线时间，被测服务经伪终端连到PtySlave
+ * 伪终端上字节立即到达，从站写出应答到收到下一个请求的间隔即为主站的帧间等待，不应短于t3.5
+ * 加载时按串口参数估算每周期总线时间，超出Poll/Period时告警
+*/
+class TestRtuBus : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void interFrameGap_data();
+    void interFrameGap();
+    void budgetWarning_data();
+    void budgetWarning();
+
+private:
+    QString buildConfig(int iEngine, int iPeriodMs) const;
+
+private:
+    PtySlave m_slave;
+};
+
+static const int s_baudRate = 4800;
+static const int s_blockCount = 4;
+static QStringList s_messageList;
+
+static void collectMessage(QtMsgType, const QMessageLogContext &, const QString &strMessage)
+{
+    s_messageList.append(strMessage);
+}
+
+void TestRtuBus::initTestCase()
+{
+    QVERIFY(m_slave.open());
+    //地址间隔大于MaxGap，每个信号一个读请求块
+    QList<TestSignal> signalList;
+    for(int i=0; i<s_blockCount; i++)
+    {
+        TestSignal testSignal;
+        testSignal.strKey = QString("Value%1").arg(i);
+        testSignal.uRegisterAddr = (quint16)(100 + i * 100);
+        testSignal.strType = "AI";
+        testSignal.iLength = 16;
+        signalList.append(testSignal);
+    }
+    QVERIFY(TestConfig::writeProtocol("Protocol.json", 1, signalList));
+}
+
+QString TestRtuBus::buildConfig(int iEngine, int iPeriodMs) const
+{
+    return QString("ConnectType=0\n"
+                   "Debug=0\n"
+                   "[Serial]\n"
+                   "PortName=%1\n"
+                   "Parity=None\n"
+                   "BaudRate=%2\n"
+                   "DataBits=8\n"
+                   "StopBits=1\n"
+                   "InterFrameDelayUs=0\n"
+                   "TurnaroundUs=1000\n"
+                   "Engine=%3\n"
+                   "[Exception]\n"
+                   "Timeout=1000\n"
+                   "NumberOfRetries=0\n"
+                   "[Poll]\n"
+                   "Period=%4\n"
+                   "MaxGap=0\n")
+            .arg(m_slave.portName())
+            .arg(s_baudRate)
+            .arg(iEngine)
+            .arg(iPeriodMs);
+}
+
+void TestRtuBus::interFrameGap_data()
+{
+    QTest::addColumn<int>("engine");
+    QTest::newRow("QModbusRtuSerialMaster") << 0;
+    QTest::newRow("ModbusRtuEngine") << 1;
+}
+
+void TestRtuBus::interFrameGap()
+{
+    QFETCH(int, engine);
+    QVERIFY(TestConfig::writeConfig(buildConfig(engine, 1000)));
+    m_slave.clearRequests();
+
+    RtuTiming rtuTiming;
+    rtuTiming.setSerialParameters(s_baudRate, 8, 0, 1);
+    qint64 iMinGapNs = rtuTiming.getInterFrameDelayUs() * 1000LL;
+
+    ModBusService *pService = new ModBusService();
+    QTRY_VERIFY_WITH_TIMEOUT(m_slave.requests().size() >= 2 * s_blockCount, 5000);
+    delete pService;
+
+    int iGaps = 0;
+    const QVector<PtyRequest> &requestList = m_slave.requests();
+    for(int i=0; i<requestList.size(); i++)
+    {
+        qint64 iGapNs = requestList.at(i).iGapNs;
+        if(iGapNs < 0)
+            continue;
+        iGaps++;
+        //定时器精度留200us
+        QVERIFY2(iGapNs >= iMinGapNs - 200000,
+                 qPrintable(QString("request %1 sent %2 us after the response, t3.5 is %3 us")
+                            .arg(i).arg(iGapNs / 1000).arg(iMinGapNs / 1000)));
+    }
+    QVERIFY(iGaps >= s_blockCount);
+}
+
+void TestRtuBus::budgetWarning_data()
+{
+    QTest::addColumn<int>("engine");
+    QTest::addColumn<int>("periodMs");
+    QTest::newRow("master, period too short") << 0 << 100;
+    QTest::newRow("master, period long enough") << 0 << 1000;
+    QTest::newRow("engine, period too short") << 1 << 100;
+    QTest::newRow("engine, period long enough") << 1 << 1000;
+}
+
+void TestRtuBus::budgetWarning()
+{
+    QFETCH(int, engine);
+    QFETCH(int, periodMs);
+    QVERIFY(TestConfig::writeConfig(buildConfig(engine, periodMs)));
+
+    RtuTiming rtuTiming;
+    rtuTiming.setSerialParameters(s_baudRate, 8, 0, 1);
+    rtuTiming.setTurnaroundUs(1000);
+    qint64 iPlanUs = s_blockCount * rtuTiming.transactionTimeUs(QModbusDataUnit(QModbusDataUnit::HoldingRegisters, 0, 1), false, false);
+    bool bExpectWarning = iPlanUs > periodMs * 1000LL;
+
+    s_messageList.clear();
+    QtMessageHandler oldHandler = qInstallMessageHandler(collectMessage);
+    ModBusService *pService = new ModBusService();
+    qInstallMessageHandler(oldHandler);
+    delete pService;
+
+    QString strPlan = QString("poll plan %1 us per %2 ms cycle").arg(iPlanUs).arg(periodMs);
+    bool bPlanFound = false;
+    bool bWarningFound = false;
+    for(int i=0; i<s_messageList.size(); i++)
+    {
+        if(s_messageList.at(i).contains(strPlan))
+            bPlanFound = true;
+        if(s_messageList.at(i).contains("Warning: RTU poll plan needs"))
+            bWarningFound = true;
+    }
+    QVERIFY2(bPlanFound, qPrintable("missing \"" + strPlan + "\" in: " + s_messageList.join(" | ")));
+    QCOMPARE(bWarningFound, bExpectWarning);
+}
+
+QTEST_GUILESS_MAIN(TestRtuBus)
+
+#include "tst_rtubus.moc"
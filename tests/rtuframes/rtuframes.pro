@@ -0,0 +1,13 @@
+QT -= gui
+QT += testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_rtuframes
+
+include(../../src/TFModbusService32.pri)
+include(../common/common.pri)
+
+SOURCES += \
+        tst_rtuframes.cpp
@@ -0,0 +1,224 @@
+﻿#include <QtTest>
+#include <QModbusRtuSerialMaster>
+#include <QSerialPort>
+#include "ptyslave.h"
+#include "modbusrtuengine.h"
+#include "rtutiming.h"
+
+/* ModbusRtuEngine与QModbusRtuSerialMaster对照，两者依次经伪终端访问同一PtySlave
+ * 每个功能码比较请求帧的全部字节、读回的值、成功与否和异常码
+ * 异常应答、分两次到达的应答和CRC错误的应答检验应答定界(getExpectedLength)和CRC校验
+*/
+class TestRtuFrames : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void compareFrames_data();
+    void compareFrames();
+
+private:
+    //一次请求的结果
+    struct FrameResult
+    {
+        QByteArray request;
+        bool bSuccess;
+        int iExceptionCode;
+        QVector<quint16> valueList;
+    };
+
+    void applyFault(int iFault, quint16 uAddr);
+    void runMaster(int iOperation, int iTable, quint16 uAddr, quint16 uCount, const QVector<quint16> &valueList, int iFault, FrameResult &result);
+    void runEngine(int iOperation, int iTable, quint16 uAddr, quint16 uCount, const QVector<quint16> &valueList, int iFault, FrameResult &result);
+
+private:
+    PtySlave m_slave;
+    RtuTiming m_rtuTiming;
+};
+
+enum FrameOperation
+{
+    Operation_Read = 0,
+    Operation_Write,
+    Operation_MaskWrite             //valueList为AND、OR屏蔽
+};
+
+enum FrameFault
+{
+    Fault_None = 0,
+    Fault_Exception,                //请求范围包含起始地址时应答异常02
+    Fault_Split,                    //应答分两次写出
+    Fault_CorruptCrc                //应答CRC取反
+};
+
+static const quint8 s_serverAddr = 1;
+static const int s_baudRate = 19200;
+static const int s_timeoutMs = 300;
+
+void TestRtuFrames::initTestCase()
+{
+    QVERIFY(m_slave.open());
+    m_rtuTiming.setSerialParameters(s_baudRate, 8, QSerialPort::NoParity, 1);
+}
+
+void TestRtuFrames::cleanup()
+{
+    m_slave.setExceptionAddress(0, 0);
+}
+
+void TestRtuFrames::applyFault(int iFault, quint16 uAddr)
+{
+    m_slave.clearRequests();
+    if(iFault == Fault_Exception)
+        m_slave.setExceptionAddress(uAddr, 0x02);
+    else if(iFault == Fault_Split)
+        m_slave.splitNextResponse();
+    else if(iFault == Fault_CorruptCrc)
+        m_slave.corruptNextResponse();
+}
+
+void TestRtuFrames::runMaster(int iOperation, int iTable, quint16 uAddr, quint16 uCount, const QVector<quint16> &valueList, int iFault, FrameResult &result)
+{
+    QModbusRtuSerialMaster master;
+    master.setConnectionParameter(QModbusDevice::SerialPortNameParameter, m_slave.portName());
+    master.setConnectionParameter(QModbusDevice::SerialParityParameter, QSerialPort::NoParity);
+    master.setConnectionParameter(QModbusDevice::SerialBaudRateParameter, s_baudRate);
+    master.setConnectionParameter(QModbusDevice::SerialDataBitsParameter, QSerialPort::Data8);
+    master.setConnectionParameter(QModbusDevice::SerialStopBitsParameter, QSerialPort::OneStop);
+    master.setInterFrameDelay(m_rtuTiming.getInterFrameDelayUs());
+    master.setTimeout(s_timeoutMs);
+    master.setNumberOfRetries(0);
+    QVERIFY(master.connectDevice());
+    QVERIFY(QTest::qWaitFor([&master]() { return master.state() == QModbusDevice::ConnectedState; }, 1000));
+
+    applyFault(iFault, uAddr);
+    QModbusDataUnit::RegisterType eRegTable = (QModbusDataUnit::RegisterType)iTable;
+    QModbusReply *pReply = nullptr;
+    if(iOperation == Operation_Read)
+        pReply = master.sendReadRequest(QModbusDataUnit(eRegTable, uAddr, uCount), s_serverAddr);
+    else if(iOperation == Operation_Write)
+        pReply = master.sendWriteRequest(QModbusDataUnit(eRegTable, uAddr, valueList), s_serverAddr);
+    else
+        pReply = master.sendRawRequest(QModbusRequest(QModbusRequest::MaskWriteRegister, uAddr, valueList.at(0), valueList.at(1)), s_serverAddr);
+    QVERIFY(pReply != nullptr);
+    QVERIFY(QTest::qWaitFor([pReply]() { return pReply->isFinished(); }, s_timeoutMs * 4));
+
+    result.bSuccess = pReply->error() == QModbusDevice::NoError;
+    result.iExceptionCode = pReply->error() == QModbusDevice::ProtocolError ? (int)pReply->rawResult().exceptionCode() : 0;
+    if(result.bSuccess && iOperation == Operation_Read)
+        result.valueList = pReply->result().values();
+    delete pReply;
+    master.disconnectDevice();
+
+    QCOMPARE(m_slave.requests().size(), 1);
+    result.request = m_slave.requests().first().adu;
+}
+
+void TestRtuFrames::runEngine(int iOperation, int iTable, quint16 uAddr, quint16 uCount, const QVector<quint16> &valueList, int iFault, FrameResult &result)
+{
+    ModbusRtuEngine engine;
+    engine.setSerialParameters(m_slave.portName(), s_baudRate, QSerialPort::Data8, QSerialPort::NoParity, QSerialPort::OneStop);
+    engine.setTiming(m_rtuTiming.getCharTimeNs(), m_rtuTiming.getInterFrameDelayUs(), m_rtuTiming.getInterCharTimeoutUs());
+    engine.setTimeout(s_timeoutMs);
+    engine.setMaxInFlight(1);
+    engine.connectDevice();
+    QVERIFY(engine.isConnected());
+
+    bool bFinished = false;
+    connect(&engine, &ModbusEngine::sig_commandRead, this,
+            [&result](int, quint8, QModbusDataUnit::RegisterType, quint16, const quint16 *pRegValue, int iCount) {
+        result.valueList.clear();
+        for(int i=0; i<iCount; i++)
+            result.valueList.append(pRegValue[i]);
+    }, Qt::DirectConnection);
+    connect(&engine, &ModbusEngine::sig_commandFinished, this,
+            [&result, &bFinished](int, int, bool, bool bSuccess, int iExceptionCode, qint64) {
+        result.bSuccess = bSuccess;
+        result.iExceptionCode = iExceptionCode;
+        bFinished = true;
+    });
+
+    //引擎在连接后等满t3.5才发送首帧
+    applyFault(iFault, uAddr);
+    QModbusDataUnit::RegisterType eRegTable = (QModbusDataUnit::RegisterType)iTable;
+    int iCommandId = -1;
+    if(iOperation == Operation_Read)
+        iCommandId = engine.enqueueReadCommand(s_serverAddr, eRegTable, uAddr, uCount, 0);
+    else if(iOperation == Operation_Write)
+        iCommandId = engine.enqueueCommand(QModbusDataUnit(eRegTable, uAddr, valueList), s_serverAddr, 0);
+    else
+        iCommandId = engine.enqueueMaskCommand(uAddr, valueList.at(0), valueList.at(1), s_serverAddr, 0);
+    QVERIFY(iCommandId >= 0);
+    QVERIFY(QTest::qWaitFor([&bFinished]() { return bFinished; }, s_timeoutMs * 4));
+    if(!result.bSuccess)
+        result.valueList.clear();
+    engine.disconnectDevice();
+
+    QCOMPARE(m_slave.requests().size(), 1);
+    result.request = m_slave.requests().first().adu;
+}
+
+void TestRtuFrames::compareFrames_data()
+{
+    QTest::addColumn<int>("operation");
+    QTest::addColumn<int>("table");
+    QTest::addColumn<quint16>("addr");
+    QTest::addColumn<quint16>("count");
+    QTest::addColumn<QVector<quint16> >("values");
+    QTest::addColumn<int>("fault");
+    QTest::addColumn<bool>("success");
+
+    const int iCoils = QModbusDataUnit::Coils;
+    const int iHolding = QModbusDataUnit::HoldingRegisters;
+    QTest::newRow("FC01 read coils") << (int)Operation_Read << iCoils << (quint16)10 << (quint16)13 << QVector<quint16>() << (int)Fault_None << true;
+    QTest::newRow("FC02 read discrete inputs") << (int)Operation_Read << (int)QModbusDataUnit::DiscreteInputs << (quint16)3 << (quint16)20 << QVector<quint16>() << (int)Fault_None << true;
+    QTest::newRow("FC03 read holding registers") << (int)Operation_Read << iHolding << (quint16)100 << (quint16)5 << QVector<quint16>() << (int)Fault_None << true;
+    QTest::newRow("FC04 read input registers") << (int)Operation_Read << (int)QModbusDataUnit::InputRegisters << (quint16)200 << (quint16)8 << QVector<quint16>() << (int)Fault_None << true;
+    QTest::newRow("FC05 write single coil") << (int)Operation_Write << iCoils << (quint16)7 << (quint16)1 << (QVector<quint16>() << 1) << (int)Fault_None << true;
+    QTest::newRow("FC0F write coils") << (int)Operation_Write << iCoils << (quint16)20 << (quint16)10 << (QVector<quint16>() << 1 << 0 << 1 << 1 << 0 << 0 << 1 << 0 << 1 << 1) << (int)Fault_None << true;
+    QTest::newRow("FC06 write single register") << (int)Operation_Write << iHolding << (quint16)300 << (quint16)1 << (QVector<quint16>() << 0x1234) << (int)Fault_None << true;
+    QTest::newRow("FC10 write registers") << (int)Operation_Write << iHolding << (quint16)310 << (quint16)4 << (QVector<quint16>() << 1 << 2 << 3 << 0xFFFF) << (int)Fault_None << true;
+    QTest::newRow("FC16 mask write register") << (int)Operation_MaskWrite << iHolding << (quint16)320 << (quint16)1 << (QVector<quint16>() << 0xF0F0 << 0x0A0A) << (int)Fault_None << true;
+    QTest::newRow("FC03 exception response") << (int)Operation_Read << iHolding << (quint16)100 << (quint16)5 << QVector<quint16>() << (int)Fault_Exception << false;
+    QTest::newRow("FC10 exception response") << (int)Operation_Write << iHolding << (quint16)310 << (quint16)2 << (QVector<quint16>() << 5 << 6) << (int)Fault_Exception << false;
+    QTest::newRow("FC16 exception response") << (int)Operation_MaskWrite << iHolding << (quint16)320 << (quint16)1 << (QVector<quint16>() << 0x00FF << 0x1100) << (int)Fault_Exception << false;
+    QTest::newRow("FC03 split response") << (int)Operation_Read << iHolding << (quint16)100 << (quint16)20 << QVector<quint16>() << (int)Fault_Split << true;
+    QTest::newRow("FC01 split response") << (int)Operation_Read << iCoils << (quint16)0 << (quint16)40 << QVector<quint16>() << (int)Fault_Split << true;
+    QTest::newRow("FC10 split response") << (int)Operation_Write << iHolding << (quint16)330 << (quint16)3 << (QVector<quint16>() << 7 << 8 << 9) << (int)Fault_Split << true;
+    QTest::newRow("FC03 corrupted CRC") << (int)Operation_Read << iHolding << (quint16)100 << (quint16)5 << QVector<quint16>() << (int)Fault_CorruptCrc << false;
+    QTest::newRow("FC06 corrupted CRC") << (int)Operation_Write << iHolding << (quint16)340 << (quint16)1 << (QVector<quint16>() << 0x5555) << (int)Fault_CorruptCrc << false;
+}
+
+void TestRtuFrames::compareFrames()
+{
+    QFETCH(int, operation);
+    QFETCH(int, table);
+    QFETCH(quint16, addr);
+    QFETCH(quint16, count);
+    QFETCH(QVector<quint16>, values);
+    QFETCH(int, fault);
+    QFETCH(bool, success);
+
+    FrameResult masterResult;
+    runMaster(operation, table, addr, count, values, fault, masterResult);
+    if(QTest::currentTestFailed())
+        return;
+    FrameResult engineResult;
+    runEngine(operation, table, addr, count, values, fault, engineResult);
+    if(QTest::currentTestFailed())
+        return;
+
+    QCOMPARE(engineResult.request.toHex(), masterResult.request.toHex());
+    QCOMPARE(masterResult.bSuccess, success);
+    QCOMPARE(engineResult.bSuccess, masterResult.bSuccess);
+    QCOMPARE(engineResult.iExceptionCode, masterResult.iExceptionCode);
+    QCOMPARE(engineResult.valueList, masterResult.valueList);
+    if(success && operation == Operation_Read)
+        QCOMPARE(engineResult.valueList.size(), (int)count);
+}
+
+QTEST_GUILESS_MAIN(TestRtuFrames)
+
+#include "tst_rtuframes.moc"
@@ -0,0 +1,15 @@
+QT -= gui
+QT += testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+# 替换malloc系列函数，按线程统计堆分配次数
+CONFIG += alloc_counter
+
+TARGET = tst_steadyalloc
+
+include(../../src/TFModbusService32.pri)
+include(../common/common.pri)
+
+SOURCES += \
+        tst_steadyalloc.cpp
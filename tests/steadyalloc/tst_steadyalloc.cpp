@@ -0,0 +1,131 @@
+﻿#include <QtTest>
+#include <QThread>
+#include "ptyslave.h"
+#include "testconfig.h"
+#include "modbusservice.h"
+#include "realtimemode.h"
+
+/* 稳态周期零分配，链路用RTU引擎，服务在单独的线程中运行，从站在主线程
+ * 从站的寄存器每次读回加1，位域信号每周期跳变，稳态周期内走到调试日志、告警事件、跳变记录的全部路径
+ * 服务在预热之后统计本线程每个周期的堆分配次数，应为0
+*/
+class TestSteadyAlloc : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void steadyStateCycles_data();
+    void steadyStateCycles();
+
+private:
+    PtySlave m_slave;
+};
+
+static const int s_counterAddr = 100;
+static const int s_setpointAddr = 200;
+static const int s_periodMs = 50;
+static const int s_steadyCycles = 40;
+
+void TestSteadyAlloc::initTestCase()
+{
+    if(!RealtimeMode::isAllocCounterEnabled())
+        QSKIP("heap allocation counter is only available with glibc");
+    QVERIFY(m_slave.open());
+    m_slave.setCounterAddress(s_counterAddr);
+
+    //Toggle每次读回翻转，Phase为其余位
+    QList<TestSignal> signalList;
+    TestSignal toggleSignal;
+    toggleSignal.strKey = "Toggle";
+    toggleSignal.uRegisterAddr = s_counterAddr;
+    toggleSignal.uBitPos = 0;
+    toggleSignal.iLength = 1;
+    toggleSignal.strType = "DI";
+    signalList.append(toggleSignal);
+    TestSignal phaseSignal;
+    phaseSignal.strKey = "Phase";
+    phaseSignal.uRegisterAddr = s_counterAddr;
+    phaseSignal.uBitPos = 1;
+    phaseSignal.iLength = 15;
+    phaseSignal.strType = "AI";
+    signalList.append(phaseSignal);
+    TestSignal setpointSignal;
+    setpointSignal.strKey = "Setpoint";
+    setpointSignal.uRegisterAddr = s_setpointAddr;
+    setpointSignal.strType = "AO";
+    signalList.append(setpointSignal);
+
+    QList<TestAlarm> alarmList;
+    TestAlarm toggleAlarm;
+    toggleAlarm.strKey = "ToggleOn";
+    toggleAlarm.strSignalKey = "Toggle";
+    toggleAlarm.strKind = "Equal";
+    toggleAlarm.dLimit = 1;
+    alarmList.append(toggleAlarm);
+    QVERIFY(TestConfig::writeProtocol("Protocol.json", 1, signalList, alarmList));
+}
+
+void TestSteadyAlloc::steadyStateCycles_data()
+{
+    QTest::addColumn<int>("debug");
+    QTest::newRow("Debug=0") << 0;
+    QTest::newRow("Debug=2, every signal logged") << 2;
+}
+
+void TestSteadyAlloc::steadyStateCycles()
+{
+    QFETCH(int, debug);
+    QVERIFY(TestConfig::writeConfig(QString("Debug=%1\n"
+                                            "[Link]\n"
+                                            "PortName=%2\n"
+                                            "Parity=None\n"
+                                            "BaudRate=115200\n"
+                                            "DataBits=8\n"
+                                            "StopBits=1\n"
+                                            "Engine=1\n"
+                                            "BurstSignals=Toggle\n"
+                                            "[Exception]\n"
+                                            "Timeout=500\n"
+                                            "NumberOfRetries=0\n"
+                                            "[Poll]\n"
+                                            "Period=%3\n"
+                                            "MaxGap=0\n")
+                                    .arg(debug)
+                                    .arg(m_slave.portName())
+                                    .arg(s_periodMs)));
+
+    //每周期写一次Setpoint，按写请求计周期
+    int iWriteRequests = 0;
+    QMetaObject::Connection requestConnection = connect(&m_slave, &PtySlave::sig_request, this, [&iWriteRequests](quint8, quint8 uFunctionCode) {
+        if(uFunctionCode == 0x06)
+            iWriteRequests++;
+    });
+
+    //与BusManager相同，服务在链路线程内创建和析构
+    QThread linkThread;
+    ModBusService *pService = nullptr;
+    connect(&linkThread, &QThread::started, [&pService, &linkThread]() {
+        pService = new ModBusService("Link");
+        QObject::connect(&linkThread, &QThread::finished, [&pService]() {
+            delete pService;
+            pService = nullptr;
+        });
+    });
+    linkThread.start();
+    QTRY_VERIFY_WITH_TIMEOUT(iWriteRequests >= ModBusService::AllocWarmupCycles + s_steadyCycles, 10000);
+
+    quint64 uSteadyAllocations = 0;
+    QVERIFY(QMetaObject::invokeMethod(pService, [pService, &uSteadyAllocations]() {
+        uSteadyAllocations = pService->getSteadyAllocations();
+    }, Qt::BlockingQueuedConnection));
+    linkThread.quit();
+    linkThread.wait();
+    disconnect(requestConnection);
+
+    QCOMPARE(uSteadyAllocations, (quint64)0);
+}
+
+QTEST_GUILESS_MAIN(TestSteadyAlloc)
+
+#include "tst_steadyalloc.moc"
@@ -0,0 +1,16 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    maskmerge \
+    derivedexpr
+
+# 伪终端从站，仅Linux
+linux {
+    SUBDIRS += \
+        rtubus \
+        rtuframes \
+        multibus \
+        steadyalloc \
+        fieldrefresh \
+        collectorbench
+}